@@ -0,0 +1,550 @@
+// Benchmarks for the operator's per-frame pipeline: every stage of
+// update_frame() timed on its own (micro) and chained (macro), on
+// synthetic frames and on recorded clips or sessions.
+//
+// For each stage it reports throughput, latency percentiles and heap
+// allocations per frame, and compares p50 latency and allocations against
+// a stored baseline; a regression makes the run exit with status 2, which
+// fails the `bench` build target.
+#include "detection.h"
+#include "motion_gate.h"
+#include "session.h"
+
+#include <QGuiApplication>
+#include <QImage>
+#include <QPixmap>
+
+#include <opencv2/opencv.hpp>
+
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#define BENCH_FRAMES      300     // timed iterations per stage
+#define BENCH_WARMUP      30      // untimed iterations before them
+#define BENCH_WIDTH       640     // synthetic frames, as the Pi camera sends
+#define BENCH_HEIGHT      480
+#define BENCH_CANDIDATES  8400    // columns of the YOLOv8 output at 640x640
+#define BENCH_TOLERANCE   0.10    // allowed p50 slowdown before failing
+
+
+// Every heap allocation in the process, OpenCV's and Qt's included, is
+// counted by interposing the glibc allocator entry points.
+extern "C" {
+void* __libc_malloc(size_t size);
+void* __libc_calloc(size_t count, size_t size);
+void* __libc_realloc(void* p, size_t size);
+void* __libc_memalign(size_t alignment, size_t size);
+void __libc_free(void* p);
+}
+
+static std::atomic<long> allocations{0};
+
+extern "C" {
+void* malloc(size_t size)
+{
+    allocations.fetch_add(1, std::memory_order_relaxed);
+    return __libc_malloc(size);
+}
+
+void* calloc(size_t count, size_t size)
+{
+    allocations.fetch_add(1, std::memory_order_relaxed);
+    return __libc_calloc(count, size);
+}
+
+void* realloc(void* p, size_t size)
+{
+    allocations.fetch_add(1, std::memory_order_relaxed);
+    return __libc_realloc(p, size);
+}
+
+void* memalign(size_t alignment, size_t size)
+{
+    allocations.fetch_add(1, std::memory_order_relaxed);
+    return __libc_memalign(alignment, size);
+}
+
+void* aligned_alloc(size_t alignment, size_t size)
+{
+    allocations.fetch_add(1, std::memory_order_relaxed);
+    return __libc_memalign(alignment, size);
+}
+
+int posix_memalign(void** result, size_t alignment, size_t size)
+{
+    allocations.fetch_add(1, std::memory_order_relaxed);
+    *result = __libc_memalign(alignment, size);
+    return *result ? 0 : ENOMEM;
+}
+
+void free(void* p)
+{
+    __libc_free(p);
+}
+}
+
+
+struct StageResult {
+    std::string name;
+    int frames = 0;
+    double seconds = 0;
+    double p50 = 0, p90 = 0, p99 = 0, max = 0;    // ms
+    double allocations = 0;                         // per frame
+};
+
+
+struct Options {
+    std::string model;
+    bool cuda = true;
+    int frames = BENCH_FRAMES;
+    int threads = -1;
+    double tolerance = BENCH_TOLERANCE;
+    std::string baseline;
+    bool update_baseline = false;
+    std::vector<std::string> clips;
+};
+
+
+void usage(const char* argv0)
+{
+    std::cerr <<
+        "Usage: " << argv0 << " [options]\n"
+        "  --model FILE        YOLOv8 ONNX model; without it the forward stage is skipped\n"
+        "  --cpu               run the model on the CPU instead of CUDA\n"
+        "  --frames N          timed frames per stage (default " << BENCH_FRAMES << ")\n"
+        "  --threads N         OpenCV worker threads (default: OpenCV's choice)\n"
+        "  --clip FILE         also decode and run a recorded clip (.avi) or session (.obsn); repeatable\n"
+        "  --baseline FILE     compare against FILE, or create it if it does not exist\n"
+        "  --update-baseline   overwrite the baseline with this run\n"
+        "  --tolerance F       allowed p50 slowdown, fraction (default " << BENCH_TOLERANCE << ")\n";
+}
+
+
+// Runs fn for warmup + frames iterations and times the last ones. fn
+// returns false when its input is exhausted (the end of a clip).
+StageResult measure(const std::string& name, int frames, const std::function<bool(int)>& fn)
+{
+    using clock = std::chrono::steady_clock;
+
+    StageResult result;
+    result.name = name;
+
+    for (int i = 0; i < BENCH_WARMUP; i++)
+        if (!fn(i)) break;
+
+    std::vector<double> latency;
+    latency.reserve(frames);
+
+    long allocations_before = allocations.load();
+    auto start = clock::now();
+
+    for (int i = 0; i < frames; i++) {
+        auto t0 = clock::now();
+        if (!fn(BENCH_WARMUP + i)) break;
+        latency.push_back(std::chrono::duration<double, std::milli>(clock::now() - t0).count());
+    }
+
+    result.seconds = std::chrono::duration<double>(clock::now() - start).count();
+    result.frames = latency.size();
+    if (result.frames == 0)
+        return result;
+
+    result.allocations = (double)(allocations.load() - allocations_before) / result.frames;
+
+    std::sort(latency.begin(), latency.end());
+    auto percentile = [&](double p) { return latency[std::min(latency.size() - 1, (size_t)(p * latency.size()))]; };
+    result.p50 = percentile(0.50);
+    result.p90 = percentile(0.90);
+    result.p99 = percentile(0.99);
+    result.max = latency.back();
+    return result;
+}
+
+
+// Moving shapes over noise: enough texture for JPEG and H.264 to work
+// on, and the same on every run.
+std::vector<cv::Mat> synthetic_frames(int count)
+{
+    cv::RNG rng(12345);
+    std::vector<cv::Mat> frames;
+
+    for (int i = 0; i < count; i++) {
+        cv::Mat frame(BENCH_HEIGHT, BENCH_WIDTH, CV_8UC3);
+        rng.fill(frame, cv::RNG::UNIFORM, 60, 120);
+
+        for (int k = 0; k < 6; k++) {
+            cv::Point center((k * 97 + i * (k + 2)) % BENCH_WIDTH, (k * 61 + i * (k + 1)) % BENCH_HEIGHT);
+            cv::rectangle(frame, cv::Rect(center.x, center.y, 40 + 10 * k, 80 + 5 * k),
+                          cv::Scalar(40 * k, 255 - 30 * k, 128), cv::FILLED);
+        }
+        frames.push_back(frame);
+    }
+    return frames;
+}
+
+
+// A 1x84xN output with a known number of candidates above the threshold,
+// clustered in groups so NMS has overlaps to merge.
+cv::Mat synthetic_output()
+{
+    cv::RNG rng(54321);
+    int sizes[] = {1, 84, BENCH_CANDIDATES};
+    cv::Mat output(3, sizes, CV_32F);
+    rng.fill(output, cv::RNG::UNIFORM, 0.0f, 0.3f);
+
+    for (int i = 0; i < BENCH_CANDIDATES; i += 40) {
+        int group = i / 400;
+        output.at<float>(0, 0, i) = 50 + (group % 5) * 120 + rng.uniform(-8.0f, 8.0f);
+        output.at<float>(0, 1, i) = 80 + (group / 5) * 110 + rng.uniform(-8.0f, 8.0f);
+        output.at<float>(0, 2, i) = 60 + rng.uniform(-5.0f, 5.0f);
+        output.at<float>(0, 3, i) = 140 + rng.uniform(-5.0f, 5.0f);
+        output.at<float>(0, 4, i) = rng.uniform(DETECTION_CONFIDENCE, 0.95f);
+    }
+    return output;
+}
+
+
+// Opens a clip for decoding: an .avi as recorded by the operator, or a
+// session through the same H.264 pipeline the replay mode uses.
+bool open_clip(const std::string& path, cv::VideoCapture& cap, std::string& temp_file)
+{
+    if (path.size() > 5 && path.compare(path.size() - 5, 5, ".obsn") == 0) {
+        SessionReader reader;
+        std::vector<int64_t> frame_times;
+        temp_file = "/tmp/omegabot_bench_" + std::to_string(getpid()) + ".rtp";
+        if (!reader.open(path) || !reader.export_video(reader.seek(0), temp_file, frame_times))
+            return false;
+
+        return cap.open(
+            "filesrc location=" + temp_file + " ! "
+            "application/x-rtp-stream,media=video,clock-rate=90000,encoding-name=H264,payload=96 ! "
+            "rtpstreamdepay ! rtph264depay ! h264parse ! avdec_h264 ! videoconvert ! "
+            "appsink sync=false max-buffers=2 drop=false",
+            cv::CAP_GSTREAMER);
+    }
+    return cap.open(path);
+}
+
+
+// Decoded frames of a clip, for the stages after decoding.
+std::vector<cv::Mat> read_clip(const std::string& path, int count)
+{
+    cv::VideoCapture cap;
+    std::string temp_file;
+    std::vector<cv::Mat> frames;
+
+    if (open_clip(path, cap, temp_file)) {
+        cv::Mat frame;
+        while ((int)frames.size() < count && cap.read(frame) && !frame.empty())
+            frames.push_back(frame.clone());
+    }
+    if (!temp_file.empty())
+        std::remove(temp_file.c_str());
+    return frames;
+}
+
+
+std::string clip_name(const std::string& path)
+{
+    size_t slash = path.find_last_of('/');
+    return slash == std::string::npos ? path : path.substr(slash + 1);
+}
+
+
+void print_result(const StageResult& r)
+{
+    if (r.frames == 0) {
+        std::printf("%-32s %8s\n", r.name.c_str(), "no data");
+        return;
+    }
+    std::printf("%-32s %6d %9.1f %8.3f %8.3f %8.3f %8.3f %10.1f\n",
+                r.name.c_str(), r.frames, r.frames / r.seconds, r.p50, r.p90, r.p99, r.max, r.allocations);
+}
+
+
+std::string host_name()
+{
+    char name[256] = {};
+    gethostname(name, sizeof(name) - 1);
+    return name;
+}
+
+
+// Baseline file: "# host NAME" then "stage p50_ms allocations" per line.
+bool load_baseline(const std::string& path, std::string& host, std::map<std::string, StageResult>& stages)
+{
+    std::ifstream in(path);
+    if (!in) return false;
+
+    std::string line;
+    while (std::getline(in, line)) {
+        std::istringstream fields(line);
+        std::string name;
+        fields >> name;
+        if (name == "#") {
+            std::string key;
+            fields >> key;
+            if (key == "host") fields >> host;
+            continue;
+        }
+
+        StageResult r;
+        r.name = name;
+        if (fields >> r.p50 >> r.allocations)
+            stages[name] = r;
+    }
+    return true;
+}
+
+
+void save_baseline(const std::string& path, const std::vector<StageResult>& results)
+{
+    std::ofstream out(path);
+    out << "# host " << host_name() << "\n";
+    out << "# stage p50_ms allocations_per_frame\n";
+    for (const StageResult& r : results)
+        if (r.frames > 0)
+            out << r.name << " " << r.p50 << " " << r.allocations << "\n";
+    std::cout << "Baseline written to " << path << std::endl;
+}
+
+
+// Latency is only comparable on the machine the baseline came from; on
+// another host only allocations are checked.
+int compare_baseline(const std::string& path, const std::vector<StageResult>& results, double tolerance)
+{
+    std::string host;
+    std::map<std::string, StageResult> baseline;
+    load_baseline(path, host, baseline);
+
+    bool same_host = host == host_name();
+    if (!same_host)
+        std::cout << "Baseline is from host " << host << ", comparing allocations only" << std::endl;
+
+    int regressions = 0;
+    for (const StageResult& r : results) {
+        auto it = baseline.find(r.name);
+        if (r.frames == 0 || it == baseline.end())
+            continue;
+
+        const StageResult& base = it->second;
+        if (same_host && r.p50 > base.p50 * (1 + tolerance)) {
+            std::printf("REGRESSION %s: p50 %.3f ms, baseline %.3f ms\n", r.name.c_str(), r.p50, base.p50);
+            regressions++;
+        }
+        // Allocation counts are nearly exact; allow one for run-to-run noise.
+        if (r.allocations > base.allocations * (1 + tolerance) + 1) {
+            std::printf("REGRESSION %s: %.1f allocations per frame, baseline %.1f\n",
+                        r.name.c_str(), r.allocations, base.allocations);
+            regressions++;
+        }
+    }
+
+    if (regressions == 0)
+        std::cout << "No regressions against " << path << std::endl;
+    return regressions;
+}
+
+
+int main(int argc, char* argv[])
+{
+    Options options;
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        bool has_value = i + 1 < argc;
+
+        if (arg == "--model" && has_value) options.model = argv[++i];
+        else if (arg == "--cpu") options.cuda = false;
+        else if (arg == "--frames" && has_value) options.frames = std::max(1, std::atoi(argv[++i]));
+        else if (arg == "--threads" && has_value) options.threads = std::atoi(argv[++i]);
+        else if (arg == "--clip" && has_value) options.clips.push_back(argv[++i]);
+        else if (arg == "--baseline" && has_value) options.baseline = argv[++i];
+        else if (arg == "--update-baseline") options.update_baseline = true;
+        else if (arg == "--tolerance" && has_value) options.tolerance = std::atof(argv[++i]);
+        else {
+            usage(argv[0]);
+            return arg == "--help" ? 0 : 1;
+        }
+    }
+
+    // QPixmap needs a GUI application, not a display.
+    if (qEnvironmentVariableIsEmpty("QT_QPA_PLATFORM"))
+        qputenv("QT_QPA_PLATFORM", "offscreen");
+    QGuiApplication app(argc, argv);
+
+    if (options.threads >= 0)
+        cv::setNumThreads(options.threads);
+    cv::setRNGSeed(12345);
+
+    cv::dnn::Net net;
+    bool have_model = false;
+    if (!options.model.empty() && access(options.model.c_str(), R_OK) == 0) {
+        net = load_detector(options.model, options.cuda);
+        have_model = !net.empty();
+    }
+    if (!have_model)
+        std::cout << "No model, skipping the forward stage" << std::endl;
+
+    const int frames = options.frames;
+    const int total = BENCH_WARMUP + frames;
+    std::vector<cv::Mat> synthetic = synthetic_frames(std::min(total, 120));
+    auto input = [&](const std::vector<cv::Mat>& set, int i) -> const cv::Mat& { return set[i % set.size()]; };
+
+    // A deterministic MJPG clip of the synthetic frames, for decoding.
+    std::string synthetic_clip = "/tmp/omegabot_bench_" + std::to_string(getpid()) + ".avi";
+    {
+        cv::VideoWriter writer(synthetic_clip, cv::VideoWriter::fourcc('M','J','P','G'), 30.0,
+                               cv::Size(BENCH_WIDTH, BENCH_HEIGHT));
+        for (int i = 0; i < total; i++)
+            writer.write(input(synthetic, i));
+    }
+
+    cv::Mat blob;
+    cv::Mat fake_output = synthetic_output();
+
+    Detections detections;
+    parse_detections(fake_output, detections);
+    suppress_detections(detections);
+    std::cout << "Synthetic output: " << detections.boxes.size() << " candidates, "
+              << detections.kept.size() << " after NMS" << std::endl;
+
+    std::string written_clip = "/tmp/omegabot_bench_out_" + std::to_string(getpid()) + ".avi";
+    cv::VideoWriter video_writer(written_clip, cv::VideoWriter::fourcc('M','J','P','G'), 30.0,
+                                 cv::Size(BENCH_WIDTH, BENCH_HEIGHT));
+    const QSize label_size(640, 480);
+
+    std::vector<StageResult> results;
+    cv::Mat frame;
+
+    // Micro benchmarks: one stage of update_frame() each.
+    {
+        cv::VideoCapture cap(synthetic_clip);
+        results.push_back(measure("decode.synthetic_mjpg", frames, [&](int) {
+            return cap.read(frame) && !frame.empty();
+        }));
+    }
+
+    // The synthetic frames all differ, so every call does the whole check.
+    MotionGate motion_gate;
+    results.push_back(measure("motion", frames, [&](int i) {
+        cv::Rect region;
+        motion_gate.update(input(synthetic, i), region);
+        return true;
+    }));
+
+    results.push_back(measure("blob", frames, [&](int i) {
+        detection_blob(input(synthetic, i), blob);
+        return true;
+    }));
+
+    if (have_model) {
+        results.push_back(measure("forward", frames, [&](int i) {
+            detection_blob(input(synthetic, i), blob);
+            run_detector(net, blob);
+            return true;
+        }));
+    }
+
+    results.push_back(measure("parse", frames, [&](int) {
+        parse_detections(fake_output, detections);
+        return true;
+    }));
+
+    results.push_back(measure("nms", frames, [&](int) {
+        suppress_detections(detections);
+        return true;
+    }));
+
+    results.push_back(measure("draw", frames, [&](int i) {
+        input(synthetic, i).copyTo(frame);
+        draw_detections(frame, detections);
+        return true;
+    }));
+
+    results.push_back(measure("pixmap_scale", frames, [&](int i) {
+        const cv::Mat& f = input(synthetic, i);
+        QImage img(f.data, f.cols, f.rows, f.step, QImage::Format_BGR888);
+        QPixmap pixmap = QPixmap::fromImage(img).scaled(label_size, Qt::KeepAspectRatio, Qt::SmoothTransformation);
+        return !pixmap.isNull();
+    }));
+
+    results.push_back(measure("video_write", frames, [&](int i) {
+        video_writer.write(input(synthetic, i));
+        return true;
+    }));
+
+    // Macro benchmarks: the whole of update_frame() after the capture,
+    // with the model's forward pass or, without a model, the synthetic output.
+    auto pipeline = [&](const cv::Mat& source) {
+        source.copyTo(frame);
+        detection_blob(frame, blob);
+        parse_detections(have_model ? run_detector(net, blob) : fake_output, detections);
+        suppress_detections(detections);
+        draw_detections(frame, detections);
+
+        QImage img(frame.data, frame.cols, frame.rows, frame.step, QImage::Format_BGR888);
+        QPixmap pixmap = QPixmap::fromImage(img).scaled(label_size, Qt::KeepAspectRatio, Qt::SmoothTransformation);
+        video_writer.write(frame);
+        return !pixmap.isNull();
+    };
+
+    results.push_back(measure("frame.synthetic", frames, [&](int i) {
+        return pipeline(input(synthetic, i));
+    }));
+
+    for (const std::string& path : options.clips) {
+        std::string name = clip_name(path);
+
+        cv::VideoCapture cap;
+        std::string temp_file;
+        if (!open_clip(path, cap, temp_file)) {
+            std::cerr << "Cannot open clip " << path << std::endl;
+            continue;
+        }
+        results.push_back(measure("decode." + name, frames, [&](int) {
+            return cap.read(frame) && !frame.empty();
+        }));
+        cap.release();
+        if (!temp_file.empty())
+            std::remove(temp_file.c_str());
+
+        std::vector<cv::Mat> clip = read_clip(path, std::min(total, 120));
+        if (clip.empty())
+            continue;
+        results.push_back(measure("frame." + name, frames, [&](int i) {
+            return pipeline(input(clip, i));
+        }));
+    }
+
+    video_writer.release();
+    std::remove(synthetic_clip.c_str());
+    std::remove(written_clip.c_str());
+
+    std::printf("\n%-32s %6s %9s %8s %8s %8s %8s %10s\n",
+                "stage", "frames", "fps", "p50 ms", "p90 ms", "p99 ms", "max ms", "allocs/fr");
+    for (const StageResult& r : results)
+        print_result(r);
+    std::printf("\n");
+
+    if (options.baseline.empty())
+        return 0;
+
+    if (options.update_baseline || access(options.baseline.c_str(), R_OK) != 0) {
+        save_baseline(options.baseline, results);
+        return 0;
+    }
+    return compare_baseline(options.baseline, results, options.tolerance) > 0 ? 2 : 0;
+}
@@ -0,0 +1,278 @@
+// Loopback test for the Raspberry Pi's video fan-out (video_fanout.h): one
+// encoder, the same pipeline tail the Pi runs, fed by videotestsrc instead
+// of the camera, with more and more subscribers on 127.0.0.1.
+//
+// For each subscriber count it reports the CPU used by the sending side
+// (the whole process minus the receiving thread) and what every subscriber
+// got. A subscriber that never reads and one nobody listens on are joined
+// throughout, to show a slow viewer does not hold the others back. The run
+// exits with status 2 if the sender's CPU grew by more than the tolerance
+// from one subscriber to the most, or a reading subscriber fell behind.
+#include "video_fanout.h"
+
+#include <gst/gst.h>
+
+#include <poll.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#define FANOUT_BASE_PORT   15000   // first subscriber port on loopback
+#define FANOUT_MAX         8       // most subscribers, doubling from 1
+#define FANOUT_SECONDS     5       // measured seconds per subscriber count
+#define FANOUT_WARMUP      1       // seconds after a join before measuring
+#define FANOUT_BITRATE     2000    // kbit/s, as on the Pi
+#define FANOUT_TOLERANCE   0.25    // allowed growth of the sender's CPU, fraction
+#define FANOUT_DELIVERY    0.95    // share of sent packets a reading subscriber must get
+
+
+struct Subscriber {
+    int port;
+    int sock = -1;
+    std::atomic<uint64_t> packets{0};
+    std::atomic<uint64_t> lost{0};
+    bool have_sequence = false;
+    uint16_t expected_sequence = 0;
+};
+
+static std::atomic<bool> receiving{true};
+static std::atomic<uint64_t> receiver_cpu_ns{0};
+
+
+static uint64_t process_cpu_ns()
+{
+    rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return (usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) * 1000000000ull +
+           (usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) * 1000ull;
+}
+
+
+static int open_socket(int port, int receive_buffer)
+{
+    int sock = socket(AF_INET, SOCK_DGRAM, 0);
+    if (sock < 0) return -1;
+
+    if (receive_buffer > 0)
+        setsockopt(sock, SOL_SOCKET, SO_RCVBUF, &receive_buffer, sizeof(receive_buffer));
+
+    sockaddr_in local{};
+    local.sin_family = AF_INET;
+    local.sin_port = htons(port);
+    local.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (bind(sock, (sockaddr*)&local, sizeof(local)) < 0) {
+        std::cerr << "Cannot bind port " << port << std::endl;
+        close(sock);
+        return -1;
+    }
+    return sock;
+}
+
+
+// One thread reads every subscriber, so its own CPU time can be taken out
+// of the process total.
+static void receive(std::vector<std::unique_ptr<Subscriber>>* subscribers)
+{
+    std::vector<pollfd> fds;
+    for (auto& s : *subscribers)
+        fds.push_back({s->sock, POLLIN, 0});
+
+    char packet[65536];
+    while (receiving) {
+        if (poll(fds.data(), fds.size(), 100) > 0) {
+            for (size_t i = 0; i < fds.size(); i++) {
+                if (!(fds[i].revents & POLLIN))
+                    continue;
+
+                Subscriber& s = *(*subscribers)[i];
+                int n;
+                while ((n = recv(s.sock, packet, sizeof(packet), MSG_DONTWAIT)) > 0) {
+                    s.packets.fetch_add(1, std::memory_order_relaxed);
+                    if (n < 12) continue;
+
+                    uint16_t sequence = ((uint8_t)packet[2] << 8) | (uint8_t)packet[3];
+                    uint16_t gap = sequence - s.expected_sequence;
+                    if (s.have_sequence && gap != 0 && gap < 0x8000)
+                        s.lost.fetch_add(gap, std::memory_order_relaxed);
+                    s.have_sequence = true;
+                    s.expected_sequence = sequence + 1;
+                }
+            }
+        }
+
+        timespec ts;
+        clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+        receiver_cpu_ns = (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+    }
+}
+
+
+static uint64_t sent_to(VideoFanout& fanout, int port)
+{
+    for (const VideoSubscriber& s : fanout.subscribers())
+        if (s.port == port)
+            return s.packets_sent;
+    return 0;
+}
+
+
+void usage(const char* argv0)
+{
+    std::cerr <<
+        "Usage: " << argv0 << " [options]\n"
+        "  --max N          most subscribers, doubling from 1 (default " << FANOUT_MAX << ")\n"
+        "  --seconds N      measured seconds per step (default " << FANOUT_SECONDS << ")\n"
+        "  --bitrate N      encoder bitrate, kbit/s (default " << FANOUT_BITRATE << ")\n"
+        "  --tolerance F    allowed growth of the sender's CPU, fraction (default " << FANOUT_TOLERANCE << ")\n";
+}
+
+
+int main(int argc, char* argv[])
+{
+    int max_subscribers = FANOUT_MAX;
+    int seconds = FANOUT_SECONDS;
+    int bitrate = FANOUT_BITRATE;
+    double tolerance = FANOUT_TOLERANCE;
+
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        bool has_value = i + 1 < argc;
+
+        if (arg == "--max" && has_value) max_subscribers = std::max(1, std::atoi(argv[++i]));
+        else if (arg == "--seconds" && has_value) seconds = std::max(1, std::atoi(argv[++i]));
+        else if (arg == "--bitrate" && has_value) bitrate = std::max(100, std::atoi(argv[++i]));
+        else if (arg == "--tolerance" && has_value) tolerance = std::atof(argv[++i]);
+        else {
+            usage(argv[0]);
+            return arg == "--help" ? 0 : 1;
+        }
+    }
+
+    gst_init(nullptr, nullptr);
+
+    // Reading subscribers, then one that never reads from a tiny buffer.
+    // The port after it has no socket at all.
+    std::vector<std::unique_ptr<Subscriber>> subscribers;
+    for (int i = 0; i < max_subscribers; i++) {
+        subscribers.emplace_back(new Subscriber{FANOUT_BASE_PORT + i});
+        subscribers.back()->sock = open_socket(FANOUT_BASE_PORT + i, 4 * 1024 * 1024);
+        if (subscribers.back()->sock < 0) return 1;
+    }
+    int stalled_port = FANOUT_BASE_PORT + max_subscribers;
+    int dead_port = stalled_port + 1;
+    int stalled_sock = open_socket(stalled_port, 1);
+    if (stalled_sock < 0) return 1;
+
+    std::string pipeline_str =
+        "videotestsrc is-live=true pattern=ball ! "
+        "video/x-raw, width=640, height=480, framerate=30/1 ! "
+        + video_fanout_pipeline(bitrate);
+
+    GError* error = nullptr;
+    GstElement* pipeline = gst_parse_launch(pipeline_str.c_str(), &error);
+    if (!pipeline) {
+        std::cerr << "Cannot create pipeline: " << (error ? error->message : "unknown error") << std::endl;
+        if (error) g_error_free(error);
+        return 1;
+    }
+
+    VideoFanout fanout;
+    if (!fanout.attach(pipeline))
+        return 1;
+    fanout.join("127.0.0.1", stalled_port, true);
+    fanout.join("127.0.0.1", dead_port, true);
+
+    std::thread receiver(receive, &subscribers);
+
+    if (gst_element_set_state(pipeline, GST_STATE_PLAYING) == GST_STATE_CHANGE_FAILURE) {
+        std::cerr << "Cannot start pipeline" << std::endl;
+        receiving = false;
+        receiver.join();
+        return 1;
+    }
+
+    std::printf("%-12s %10s %12s %12s %12s\n", "subscribers", "sender_cpu", "min_recv/s", "max_lost", "stalled_sent");
+
+    double first_cpu = -1;
+    double last_cpu = 0;
+    bool behind = false;
+    int joined = 0;
+
+    std::vector<int> steps;
+    for (int count = 1; count < max_subscribers; count *= 2)
+        steps.push_back(count);
+    steps.push_back(max_subscribers);
+
+    for (int count : steps) {
+        while (joined < count)
+            fanout.join("127.0.0.1", subscribers[joined++]->port, true);
+        std::this_thread::sleep_for(std::chrono::seconds(FANOUT_WARMUP));
+
+        std::vector<uint64_t> packets_before, lost_before, sent_before;
+        for (int i = 0; i < count; i++) {
+            packets_before.push_back(subscribers[i]->packets.load());
+            lost_before.push_back(subscribers[i]->lost.load());
+            sent_before.push_back(sent_to(fanout, subscribers[i]->port));
+        }
+        uint64_t stalled_before = sent_to(fanout, stalled_port);
+        uint64_t cpu_before = process_cpu_ns() - receiver_cpu_ns.load();
+        auto wall_before = std::chrono::steady_clock::now();
+
+        std::this_thread::sleep_for(std::chrono::seconds(seconds));
+
+        uint64_t cpu_after = process_cpu_ns() - receiver_cpu_ns.load();
+        double wall = std::chrono::duration<double>(std::chrono::steady_clock::now() - wall_before).count();
+        double cpu = (cpu_after - cpu_before) / 1e9 / wall * 100;
+
+        double min_rate = 1e18;
+        uint64_t max_lost = 0;
+        for (int i = 0; i < count; i++) {
+            uint64_t received = subscribers[i]->packets.load() - packets_before[i];
+            uint64_t sent = sent_to(fanout, subscribers[i]->port) - sent_before[i];
+            min_rate = std::min(min_rate, received / wall);
+            max_lost = std::max<uint64_t>(max_lost, subscribers[i]->lost.load() - lost_before[i]);
+            if (received < sent * FANOUT_DELIVERY) {
+                std::cerr << "Subscriber " << subscribers[i]->port << " got " << received << " of " << sent
+                          << " packets" << std::endl;
+                behind = true;
+            }
+        }
+
+        std::printf("%-12d %9.1f%% %12.0f %12llu %12llu\n", count, cpu, min_rate, (unsigned long long)max_lost,
+                    (unsigned long long)(sent_to(fanout, stalled_port) - stalled_before));
+
+        if (first_cpu < 0) first_cpu = cpu;
+        last_cpu = cpu;
+    }
+
+    gst_element_set_state(pipeline, GST_STATE_NULL);
+    fanout.detach();
+    gst_object_unref(pipeline);
+
+    receiving = false;
+    receiver.join();
+    for (auto& s : subscribers)
+        close(s->sock);
+    close(stalled_sock);
+
+    // One percentage point of slack keeps an almost idle sender from
+    // failing on noise.
+    bool grew = last_cpu > first_cpu * (1 + tolerance) + 1.0;
+    if (grew)
+        std::cerr << "Sender CPU grew from " << first_cpu << "% to " << last_cpu << "%" << std::endl;
+    if (!grew && !behind)
+        std::cout << "Sender CPU flat within " << tolerance * 100 << "%, every subscriber kept up" << std::endl;
+    return grew || behind ? 2 : 0;
+}
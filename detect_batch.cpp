@@ -0,0 +1,485 @@
+// Offline person detection over recorded videos: the operator's video_*.avi
+// files, or whole directories of them, through the same detection code the
+// operator runs live (detection.h). Writes <video>.det next to each video:
+//
+//   DetFileHeader
+//   per frame:  uint16_t count, then DetBox[count]
+//   index:      uint64_t offset of each frame's record, at index_offset
+//
+// so the boxes of any frame are two reads away. Videos are cut into chunks
+// of DETECT_CHUNK frames; every worker opens its own decoder, seeks to the
+// chunk it took and runs its own copy of the network, so decoding and
+// inference both spread over all cores. MJPG frames are all key frames, so
+// the seek is exact.
+#include "detection.h"
+#include "motion_gate.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <climits>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <dirent.h>
+#include <sys/stat.h>
+
+#define DETECT_CHUNK      300           // frames per job
+#define DETECT_BATCH      1             // frames per forward pass
+#define DET_MAGIC         0x5444424Fu   // "OBDT"
+#define DET_VERSION       1
+
+
+struct DetFileHeader {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t frames;
+    float fps;
+    uint16_t width;
+    uint16_t height;
+    uint32_t reserved;
+    uint64_t index_offset;
+};
+
+
+// Frame pixels; confidence scaled to 0..65535.
+struct DetBox {
+    int16_t x, y, w, h;
+    uint16_t confidence;
+};
+
+
+struct Options {
+    std::string model = "yolov8n.onnx";
+    int jobs = 0;
+    int batch = DETECT_BATCH;
+    bool motion = false;
+    bool cuda = false;
+    bool force = false;
+};
+
+
+struct Video {
+    std::string path;
+    int frames = 0;                             // as the container says
+    double fps = 0;
+    int width = 0, height = 0;
+
+    std::mutex mutex;
+    std::vector<std::vector<std::vector<DetBox>>> chunks;   // per chunk, per frame
+    int chunks_left = 0;
+};
+
+
+struct Job {
+    Video* video;
+    int chunk;
+};
+
+
+std::atomic<uint64_t> frames_done{0};
+std::atomic<uint64_t> inferences{0};
+std::atomic<bool> batching{true};              // cleared if the model will not take a batch
+
+
+void usage(const char* argv0)
+{
+    std::cerr <<
+        "Usage: " << argv0 << " [options] VIDEO_OR_DIR...\n"
+        "  --model FILE   YOLOv8 ONNX model (default yolov8n.onnx)\n"
+        "  --jobs N       workers, each with its own decoder and network (default: all cores)\n"
+        "  --batch N      frames per forward pass (default " << DETECT_BATCH << ")\n"
+        "  --motion       skip and crop unchanged frames as the operator does (motion_gate.h)\n"
+        "  --cuda         run the networks on CUDA\n"
+        "  --force        redo videos whose .det is newer than the video\n"
+        "  --show FILE    print the frames with detections from a .det file\n";
+}
+
+
+bool ends_with(const std::string& s, const std::string& suffix)
+{
+    return s.size() >= suffix.size() && s.compare(s.size() - suffix.size(), suffix.size(), suffix) == 0;
+}
+
+
+// Videos named on the command line, and the .avi files in named directories.
+void collect_videos(const std::string& path, std::vector<std::string>& paths)
+{
+    struct stat st;
+    if (stat(path.c_str(), &st) != 0) {
+        std::cerr << "Cannot open " << path << std::endl;
+        return;
+    }
+    if (!S_ISDIR(st.st_mode)) {
+        paths.push_back(path);
+        return;
+    }
+
+    DIR* d = opendir(path.c_str());
+    if (!d) return;
+    std::vector<std::string> found;
+    while (dirent* e = readdir(d)) {
+        std::string name = e->d_name;
+        if (ends_with(name, ".avi"))
+            found.push_back(path + "/" + name);
+    }
+    closedir(d);
+    std::sort(found.begin(), found.end());
+    paths.insert(paths.end(), found.begin(), found.end());
+}
+
+
+bool up_to_date(const std::string& video)
+{
+    struct stat v, d;
+    return stat(video.c_str(), &v) == 0 && stat((video + ".det").c_str(), &d) == 0 && d.st_mtime >= v.st_mtime;
+}
+
+
+void store(const Detections& detections, std::vector<DetBox>& boxes)
+{
+    boxes.clear();
+    for (int idx : detections.kept) {
+        const cv::Rect& r = detections.boxes[idx];
+        boxes.push_back({(int16_t)r.x, (int16_t)r.y, (int16_t)r.width, (int16_t)r.height,
+                         (uint16_t)std::min(65535.0f, detections.confidences[idx] * 65535.0f)});
+    }
+}
+
+
+bool write_detections(Video& video)
+{
+    std::string path = video.path + ".det";
+    std::string temp = path + ".tmp";
+    FILE* f = std::fopen(temp.c_str(), "wb");
+    if (!f) {
+        std::cerr << "Cannot write " << path << std::endl;
+        return false;
+    }
+
+    std::vector<uint64_t> index;
+    DetFileHeader header{DET_MAGIC, DET_VERSION, 0, (float)video.fps, (uint16_t)video.width,
+                         (uint16_t)video.height, 0, 0};
+    std::fwrite(&header, sizeof(header), 1, f);
+
+    uint64_t offset = sizeof(header);
+    for (const auto& chunk : video.chunks) {
+        for (const std::vector<DetBox>& boxes : chunk) {
+            index.push_back(offset);
+            uint16_t count = (uint16_t)boxes.size();
+            std::fwrite(&count, sizeof(count), 1, f);
+            std::fwrite(boxes.data(), sizeof(DetBox), count, f);
+            offset += sizeof(count) + count * sizeof(DetBox);
+        }
+    }
+
+    header.frames = (uint32_t)index.size();
+    header.index_offset = offset;
+    std::fwrite(index.data(), sizeof(uint64_t), index.size(), f);
+    std::fseek(f, 0, SEEK_SET);
+    std::fwrite(&header, sizeof(header), 1, f);
+
+    bool ok = std::ferror(f) == 0;
+    ok = std::fclose(f) == 0 && ok;
+    if (!ok || std::rename(temp.c_str(), path.c_str()) != 0) {
+        std::cerr << "Cannot write " << path << std::endl;
+        std::remove(temp.c_str());
+        return false;
+    }
+    return true;
+}
+
+
+class Worker {
+public:
+    explicit Worker(const Options& options) : options(options) {}
+
+    bool load() {
+        try {
+            net = load_detector(options.model, options.cuda);
+        } catch (const cv::Exception& e) {
+            std::cerr << "Cannot read model " << options.model << ": " << e.what() << std::endl;
+            return false;
+        }
+        return !net.empty();
+    }
+
+    void run(Job job) {
+        Video& video = *job.video;
+        int first = job.chunk * DETECT_CHUNK;
+        int last = job.chunk + 1 == (int)video.chunks.size() ? INT_MAX : first + DETECT_CHUNK;
+
+        cv::VideoCapture cap(video.path);
+        if (!cap.isOpened()) {
+            finish(job, {});
+            return;
+        }
+        // A container that cannot seek exactly is read up to the chunk.
+        cap.set(cv::CAP_PROP_POS_FRAMES, first);
+        if ((int)cap.get(cv::CAP_PROP_POS_FRAMES) != first) {
+            cap.open(video.path);
+            for (int i = 0; i < first && cap.grab(); i++) {}
+        }
+
+        std::vector<std::vector<DetBox>> results;
+        motion_gate.reset();
+        detections = Detections();
+
+        cv::Mat frame;
+        for (int n = first; n < last && cap.read(frame) && !frame.empty(); n++) {
+            cv::Rect region(0, 0, frame.cols, frame.rows);
+            MotionDecision decision = options.motion ? motion_gate.update(frame, region) : MOTION_FULL;
+
+            pending.push_back({decision, region, decision == MOTION_SKIP ? -1 : (int)inputs.size()});
+            if (decision != MOTION_SKIP)
+                inputs.push_back(decision == MOTION_REGION ? frame(region).clone() : frame.clone());
+            if ((int)inputs.size() >= options.batch)
+                flush(results);
+        }
+        flush(results);
+
+        finish(job, std::move(results));
+    }
+
+private:
+    struct Pending {
+        MotionDecision decision;
+        cv::Rect region;
+        int input;          // into inputs, -1 if skipped
+    };
+
+    // Runs the network on the frames gathered so far, then settles every
+    // pending frame in order: a skipped frame keeps what the one before it
+    // had, so it has to wait for that frame's pass.
+    void flush(std::vector<std::vector<DetBox>>& results) {
+        forward();
+
+        for (const Pending& p : pending) {
+            if (p.decision != MOTION_SKIP) {
+                if (p.decision == MOTION_REGION)
+                    keep_detections_outside(detections, p.region);
+                parse_detections(outputs[p.input], detections, p.region, p.decision == MOTION_REGION);
+                suppress_detections(detections);
+            }
+            results.emplace_back();
+            store(detections, results.back());
+        }
+        frames_done += pending.size();
+
+        pending.clear();
+        inputs.clear();
+    }
+
+    void forward() {
+        outputs.clear();
+        if (inputs.empty())
+            return;
+        inferences += inputs.size();
+
+        if (inputs.size() > 1 && batching) {
+            try {
+                detection_blobs(inputs, blob);
+                cv::Mat output = run_detector(net, blob);
+                if (output.dims == 3 && output.size[0] == (int)inputs.size()) {
+                    int sizes[] = {1, output.size[1], output.size[2]};
+                    for (size_t b = 0; b < inputs.size(); b++)
+                        outputs.push_back(cv::Mat(3, sizes, CV_32F, output.ptr<float>((int)b)).clone());
+                    return;
+                }
+            } catch (const cv::Exception&) {
+            }
+            if (batching.exchange(false))
+                std::cerr << "The model does not take a batch of " << inputs.size()
+                          << ", running frames one at a time" << std::endl;
+        }
+
+        for (const cv::Mat& input : inputs) {
+            detection_blob(input, blob);
+            outputs.push_back(run_detector(net, blob).clone());
+        }
+    }
+
+    void finish(const Job& job, std::vector<std::vector<DetBox>> results) {
+        Video& video = *job.video;
+        bool last;
+        {
+            std::lock_guard<std::mutex> lock(video.mutex);
+            video.chunks[job.chunk] = std::move(results);
+            last = --video.chunks_left == 0;
+        }
+        if (last && write_detections(video)) {
+            size_t frames = 0, with_person = 0;
+            for (const auto& chunk : video.chunks) {
+                frames += chunk.size();
+                for (const auto& boxes : chunk)
+                    with_person += !boxes.empty();
+            }
+            std::printf("%s: %zu frames, %zu with a person\n", video.path.c_str(), frames, with_person);
+            video.chunks.clear();
+            video.chunks.shrink_to_fit();
+        }
+    }
+
+    const Options& options;
+    cv::dnn::Net net;
+    MotionGate motion_gate;
+    Detections detections;
+    cv::Mat blob;
+    std::vector<Pending> pending;
+    std::vector<cv::Mat> inputs;
+    std::vector<cv::Mat> outputs;
+};
+
+
+int show(const std::string& path)
+{
+    FILE* f = std::fopen(path.c_str(), "rb");
+    DetFileHeader header;
+    if (!f || std::fread(&header, sizeof(header), 1, f) != 1 || header.magic != DET_MAGIC ||
+        header.version != DET_VERSION) {
+        std::cerr << "Not a detection file: " << path << std::endl;
+        if (f) std::fclose(f);
+        return 1;
+    }
+
+    std::printf("%u frames, %ux%u, %.1f fps\n", header.frames, header.width, header.height, header.fps);
+
+    std::vector<DetBox> boxes;
+    for (uint32_t n = 0; n < header.frames; n++) {
+        uint16_t count = 0;
+        if (std::fread(&count, sizeof(count), 1, f) != 1)
+            break;
+        boxes.resize(count);
+        if (std::fread(boxes.data(), sizeof(DetBox), count, f) != count)
+            break;
+        if (count == 0)
+            continue;
+
+        double seconds = header.fps > 0 ? n / header.fps : 0;
+        std::printf("%7u  %8.2f s ", n, seconds);
+        for (const DetBox& b : boxes)
+            std::printf(" [%d,%d %dx%d %.2f]", b.x, b.y, b.w, b.h, b.confidence / 65535.0);
+        std::printf("\n");
+    }
+    std::fclose(f);
+    return 0;
+}
+
+
+int main(int argc, char* argv[])
+{
+    Options options;
+    std::vector<std::string> paths;
+
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        bool has_value = i + 1 < argc;
+
+        if (arg == "--model" && has_value) options.model = argv[++i];
+        else if (arg == "--jobs" && has_value) options.jobs = std::max(1, std::atoi(argv[++i]));
+        else if (arg == "--batch" && has_value) options.batch = std::max(1, std::atoi(argv[++i]));
+        else if (arg == "--motion") options.motion = true;
+        else if (arg == "--cuda") options.cuda = true;
+        else if (arg == "--force") options.force = true;
+        else if (arg == "--show" && has_value) return show(argv[++i]);
+        else if (arg.size() > 1 && arg[0] == '-') {
+            usage(argv[0]);
+            return arg == "--help" ? 0 : 1;
+        } else {
+            collect_videos(arg, paths);
+        }
+    }
+    if (paths.empty()) {
+        usage(argv[0]);
+        return 1;
+    }
+    if (options.jobs == 0)
+        options.jobs = std::max(1u, std::thread::hardware_concurrency());
+
+    // Each worker is one core; OpenCV's own threads would only compete.
+    cv::setNumThreads(1);
+
+    std::vector<std::unique_ptr<Video>> videos;
+    std::vector<Job> jobs;
+    uint64_t total_frames = 0;
+    for (const std::string& path : paths) {
+        if (!options.force && up_to_date(path))
+            continue;
+
+        cv::VideoCapture cap(path);
+        if (!cap.isOpened()) {
+            std::cerr << "Cannot open " << path << std::endl;
+            continue;
+        }
+
+        std::unique_ptr<Video> video(new Video);
+        video->path = path;
+        video->frames = (int)cap.get(cv::CAP_PROP_FRAME_COUNT);
+        video->fps = cap.get(cv::CAP_PROP_FPS);
+        video->width = (int)cap.get(cv::CAP_PROP_FRAME_WIDTH);
+        video->height = (int)cap.get(cv::CAP_PROP_FRAME_HEIGHT);
+
+        int chunks = std::max(1, (video->frames + DETECT_CHUNK - 1) / DETECT_CHUNK);
+        video->chunks.resize(chunks);
+        video->chunks_left = chunks;
+        for (int c = 0; c < chunks; c++)
+            jobs.push_back({video.get(), c});
+        total_frames += std::max(video->frames, 0);
+        videos.push_back(std::move(video));
+    }
+    if (jobs.empty()) {
+        std::cout << "Every video is up to date" << std::endl;
+        return 0;
+    }
+
+    int workers = std::min<int>(options.jobs, jobs.size());
+    std::cout << videos.size() << " video(s), " << total_frames << " frames, " << jobs.size() << " chunks on "
+              << workers << " worker(s)" << std::endl;
+
+    std::atomic<size_t> next_job{0};
+    std::atomic<int> running{workers};
+    std::atomic<bool> failed{false};
+    auto started = std::chrono::steady_clock::now();
+
+    std::vector<std::thread> threads;
+    for (int w = 0; w < workers; w++) {
+        threads.emplace_back([&]() {
+            Worker worker(options);
+            if (!worker.load())
+                failed = true;
+            for (size_t j; !failed && (j = next_job++) < jobs.size();)
+                worker.run(jobs[j]);
+            running--;
+        });
+    }
+
+    // Progress every few seconds while the workers run.
+    auto reported = started;
+    while (running > 0) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+        auto now = std::chrono::steady_clock::now();
+        if (now - reported < std::chrono::seconds(5))
+            continue;
+        reported = now;
+        double seconds = std::chrono::duration<double>(now - started).count();
+        std::fprintf(stderr, "%llu / %llu frames, %.1f fps\n", (unsigned long long)frames_done.load(),
+                     (unsigned long long)total_frames, frames_done / seconds);
+    }
+    for (std::thread& t : threads)
+        t.join();
+    if (failed)
+        return 1;
+
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - started).count();
+    std::printf("%llu frames in %.1f s: %.1f fps, %.1f fps per worker, %llu forward passes\n",
+                (unsigned long long)frames_done.load(), seconds, frames_done / seconds,
+                frames_done / seconds / workers, (unsigned long long)inferences.load());
+    return 0;
+}
@@ -0,0 +1,202 @@
+#include "detection.h"
+
+#include <opencv2/core/cuda.hpp>
+
+#include <sys/stat.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <fstream>
+#include <iostream>
+
+
+cv::dnn::Net load_detector(const std::string& model_path, bool cuda)
+{
+    cv::dnn::Net net = cv::dnn::readNet(model_path);
+    if (cuda) {
+        net.setPreferableBackend(cv::dnn::DNN_BACKEND_CUDA);
+        net.setPreferableTarget(cv::dnn::DNN_TARGET_CUDA);
+    }
+    return net;
+}
+
+
+// "<model size> <model mtime> <OpenCV version> <CUDA devices>": the cached
+// backend is only trusted for the same model, build and GPUs.
+static std::string detector_cache_key(const std::string& model_path)
+{
+    struct stat st;
+    if (stat(model_path.c_str(), &st) != 0)
+        return "";
+    return std::to_string((long long)st.st_size) + " " + std::to_string((long long)st.st_mtime) + " " +
+           CV_VERSION + " " + std::to_string(cv::cuda::getCudaEnabledDeviceCount());
+}
+
+
+static double seconds_since(std::chrono::steady_clock::time_point start)
+{
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+
+cv::dnn::Net prepare_detector(const std::string& model_path, const std::string& cache_dir, DetectorLoad& load)
+{
+    std::string key = detector_cache_key(model_path);
+    std::string cache_path = cache_dir + "/detector_backend.txt";
+
+    // Cache file: the key on the first line, "cuda" or "cpu" on the second.
+    bool cuda = cv::cuda::getCudaEnabledDeviceCount() > 0;
+    {
+        std::ifstream in(cache_path);
+        std::string cached_key, backend;
+        if (!key.empty() && std::getline(in, cached_key) && std::getline(in, backend) && cached_key == key) {
+            cuda = cuda && backend == "cuda";
+            load.cached = true;
+        }
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    cv::dnn::Net net;
+    try {
+        net = load_detector(model_path, cuda);
+    } catch (const cv::Exception& e) {
+        std::cerr << "Cannot read model " << model_path << ": " << e.what() << std::endl;
+        return cv::dnn::Net();
+    }
+    load.read_seconds = seconds_since(start);
+    if (net.empty())
+        return net;
+
+    cv::Mat blank(DETECTION_INPUT_SIZE, DETECTION_INPUT_SIZE, CV_8UC3, cv::Scalar::all(0));
+    cv::Mat blob;
+    detection_blob(blank, blob);
+
+    start = std::chrono::steady_clock::now();
+    try {
+        run_detector(net, blob);
+    } catch (const cv::Exception& e) {
+        if (!cuda)
+            throw;
+        std::cerr << "CUDA backend failed, using the CPU: " << e.what() << std::endl;
+        cuda = false;
+        net.setPreferableBackend(cv::dnn::DNN_BACKEND_OPENCV);
+        net.setPreferableTarget(cv::dnn::DNN_TARGET_CPU);
+        run_detector(net, blob);
+    }
+    load.warmup_seconds = seconds_since(start);
+    load.cuda = cuda;
+
+    if (!key.empty()) {
+        mkdir(cache_dir.c_str(), 0755);
+        std::ofstream out(cache_path, std::ios::trunc);
+        out << key << "\n" << (cuda ? "cuda" : "cpu") << "\n";
+    }
+    return net;
+}
+
+
+void detection_blob(const cv::Mat& frame, cv::Mat& blob, int input_size)
+{
+    cv::dnn::blobFromImage(frame, blob, 1.0 / 255.0, cv::Size(input_size, input_size), cv::Scalar(), true);
+}
+
+
+void detection_blobs(const std::vector<cv::Mat>& frames, cv::Mat& blob)
+{
+    cv::dnn::blobFromImages(frames, blob, 1.0 / 255.0, cv::Size(DETECTION_INPUT_SIZE, DETECTION_INPUT_SIZE),
+                            cv::Scalar(), true);
+}
+
+
+cv::Mat run_detector(cv::dnn::Net& net, const cv::Mat& blob)
+{
+    net.setInput(blob);
+
+    std::vector<cv::Mat> out;
+    net.forward(out);
+    return out[0];
+}
+
+
+// YOLOv8 predicts on strides 8, 16 and 32, so an input of side s gives
+// s*s * (1/64 + 1/256 + 1/1024) candidates: 8400 at 640, 2100 at 320.
+static int detection_input_size(const cv::Mat& output)
+{
+    return (int)std::lround(std::sqrt(output.size[2] * 1024.0 / 21.0));
+}
+
+
+void parse_detections(const cv::Mat& output, Detections& result, const cv::Rect& region, bool append)
+{
+    if (!append) {
+        result.boxes.clear();
+        result.confidences.clear();
+    }
+
+    int input_size = detection_input_size(output);
+    float sx = (float)region.width / input_size;
+    float sy = (float)region.height / input_size;
+
+    // Rows are cx, cy, w, h and then one score per class; row 4 is "person".
+    for (int i = 0; i < output.size[2]; i++) {
+        float score = output.at<float>(0, 4, i);
+        if (score < DETECTION_CONFIDENCE)
+            continue;
+
+        float cx = output.at<float>(0, 0, i) * sx + region.x;
+        float cy = output.at<float>(0, 1, i) * sy + region.y;
+        float w = output.at<float>(0, 2, i) * sx;
+        float h = output.at<float>(0, 3, i) * sy;
+
+        result.boxes.push_back(cv::Rect(cx - w / 2, cy - h / 2, w, h));
+        result.confidences.push_back(score);
+    }
+}
+
+
+void keep_detections_outside(Detections& result, const cv::Rect& region)
+{
+    // Compacted in place, so the kept indices must ascend; NMS leaves them
+    // by score.
+    std::sort(result.kept.begin(), result.kept.end());
+
+    size_t n = 0;
+    for (int idx : result.kept) {
+        const cv::Rect box = result.boxes[idx];
+        if ((box & region).area() * 2 > box.area())
+            continue;
+        result.boxes[n] = box;
+        result.confidences[n] = result.confidences[idx];
+        n++;
+    }
+    result.boxes.resize(n);
+    result.confidences.resize(n);
+    result.kept.clear();
+}
+
+
+void suppress_detections(Detections& result)
+{
+    result.kept.clear();
+    cv::dnn::NMSBoxes(result.boxes, result.confidences, DETECTION_CONFIDENCE, DETECTION_NMS, result.kept);
+}
+
+
+void draw_detections(cv::Mat& frame, const Detections& result)
+{
+    for (int idx : result.kept) {
+        const cv::Rect& box = result.boxes[idx];
+
+        cv::rectangle(frame, box, cv::Scalar(0, 255, 0));
+        cv::putText(
+            frame,
+            "person",
+            cv::Point(box.x, box.y),
+            cv::FONT_HERSHEY_COMPLEX,
+            0.5,
+            cv::Scalar(0, 0, 0),
+            2
+        );
+    }
+}
@@ -0,0 +1,67 @@
+// YOLOv8 person detection as the operator runs it on every video frame,
+// split into its stages so the bench can time each one in isolation.
+#pragma once
+
+#include <opencv2/opencv.hpp>
+
+#include <string>
+#include <vector>
+
+#define DETECTION_INPUT_SIZE   640     // network input, pixels per side
+#define DETECTION_CONFIDENCE   0.4f    // minimum person score
+#define DETECTION_NMS          0.5f    // IoU above which overlapping boxes are merged
+
+
+// Kept between frames so the vectors stop reallocating once warmed up.
+struct Detections {
+    std::vector<cv::Rect> boxes;
+    std::vector<float> confidences;
+    std::vector<int> kept;              // indices into boxes after NMS
+};
+
+
+cv::dnn::Net load_detector(const std::string& model_path, bool cuda = true);
+
+
+// How prepare_detector() got the network ready, and how long each step took.
+struct DetectorLoad {
+    bool cuda = false;              // runs on the CUDA backend
+    bool cached = false;            // backend known from the cache, not probed
+    double read_seconds = 0;        // parsing the ONNX file
+    double warmup_seconds = 0;      // first forward pass, where layers are set up
+};
+
+// load_detector() followed by one forward pass on a blank frame, so the
+// first real frame does not pay for the lazy layer setup. Safe to call off
+// the GUI thread. Whether CUDA worked is remembered in cache_dir, keyed on
+// the model file and the OpenCV build, so a machine without a usable GPU
+// goes straight to the CPU next time instead of failing over again.
+// Returns an empty net if the model cannot be read.
+cv::dnn::Net prepare_detector(const std::string& model_path, const std::string& cache_dir, DetectorLoad& load);
+
+// Frame -> 1x3x640x640 float blob, RGB, scaled to [0, 1]. A model exported
+// for a smaller input (the Pi's) takes input_size instead.
+void detection_blob(const cv::Mat& frame, cv::Mat& blob, int input_size = DETECTION_INPUT_SIZE);
+
+// Several frames -> Bx3x640x640, for a batched forward pass.
+void detection_blobs(const std::vector<cv::Mat>& frames, cv::Mat& blob);
+
+// Runs the network; the result is the 1x84xN output (Bx84xN for a batch).
+cv::Mat run_detector(cv::dnn::Net& net, const cv::Mat& blob);
+
+// Boxes whose person score passes DETECTION_CONFIDENCE, mapped from the
+// network input (its size read off the output) onto the part of the frame
+// the blob was made from; by
+// default they stay in network input coordinates. With append, they are
+// added to what result already holds.
+void parse_detections(const cv::Mat& output, Detections& result,
+                      const cv::Rect& region = cv::Rect(0, 0, DETECTION_INPUT_SIZE, DETECTION_INPUT_SIZE),
+                      bool append = false);
+
+// Before detecting again in region only: keeps the boxes that survived the
+// last NMS and lie mostly outside it, as candidates for the next one.
+void keep_detections_outside(Detections& result, const cv::Rect& region);
+
+void suppress_detections(Detections& result);
+
+void draw_detections(cv::Mat& frame, const Detections& result);
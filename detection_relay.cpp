@@ -0,0 +1,630 @@
+// Headless detection relay: takes the robot's RTP H.264 video, runs the
+// operator's person detector (detection.h) on it and passes it on, for a
+// machine other than the operator's to do the detecting. It replaces
+// yolo_detection.py, which decoded, detected, drew and re-encoded every
+// frame one after the other in one thread.
+//
+// Every input stream gets three threads joined by one-slot mailboxes, so
+// a slow stage drops frames instead of queueing them:
+//
+//   decode     udpsrc -> avdec_h264 -> appsink, newest frame only
+//   inference  the detector; the boxes go out at once as TM_VISION_FRAME /
+//              TM_VISION_OBJECT records (onboard_vision.h), to the output
+//              host on the video port + RELAY_META_OFFSET
+//   encode     with --burn only: boxes drawn in, appsrc -> x264enc -> udpsink
+//
+// Without --burn the RTP packets are forwarded as they arrive, through a
+// tee in front of the decoder, so the video gains no latency at all and
+// the records are the only thing the relay adds. Relay latency is measured
+// per frame from the decoded frame leaving avdec_h264 to its records being
+// sent or, with --burn, to its encoded frame leaving x264enc.
+#include "detection.h"
+#include "metrics.h"
+#include "onboard_vision.h"
+#include "video_fanout.h"
+
+#include <gst/gst.h>
+
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <condition_variable>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#define SERVER_PORT        12345    // the Pi's command port, for "VJ"/"VL"
+#define RELAY_IN_PORT      12346    // default input, the Pi's video port
+#define RELAY_OUT_PORT     12349    // default output, as yolo_detection.py
+#define RELAY_META_OFFSET  1        // records go to the output port + this
+#define RELAY_MODEL        "yolov8n.onnx"
+#define RELAY_BITRATE      2000     // kbit/s of the --burn video, as on the Pi
+#define RELAY_KEY_INTERVAL 30       // frames between key frames of the --burn video
+#define RELAY_JOIN_PERIOD  2        // seconds between "VJ" renewals with --join
+#define RELAY_REPORT       10       // seconds between status lines
+#define RELAY_PENDING      64       // encoded frames whose start time is kept for the latency
+
+
+std::atomic<bool> running{true};
+std::atomic<bool> failed{false};
+
+MetricCounter relay_frames_in("relay_frames_in_total", "Decoded frames taken from the input streams");
+MetricCounter relay_frames_dropped("relay_frames_dropped_total", "Decoded frames replaced before inference or the encoder took them");
+MetricCounter relay_frames_out("relay_frames_out_total", "Frames whose detections were sent (and encoded, with --burn)");
+MetricCounter relay_objects("relay_objects_total", "Boxes sent as records");
+MetricHistogram relay_inference("relay_inference_seconds", "Detection time per frame",
+                                {0.005, 0.01, 0.02, 0.03, 0.05, 0.1, 0.2, 0.5});
+MetricHistogram relay_latency("relay_latency_seconds", "Decoded frame to records sent, or to encoded frame with --burn",
+                              {0.01, 0.02, 0.03, 0.05, 0.075, 0.1, 0.15, 0.2, 0.3, 0.5});
+MetricGauge relay_cpu_seconds("relay_cpu_seconds", "User and system CPU time of the process", process_cpu_seconds);
+
+
+static uint64_t monotonic_ns()
+{
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+
+struct Options {
+    std::string model = RELAY_MODEL;
+    bool cuda = false;
+    bool burn = false;          // draw the boxes into a re-encoded video
+    int bitrate = RELAY_BITRATE;
+    std::string join_host;      // Pi to subscribe each input at, if any
+    int report = RELAY_REPORT;
+    int metrics_port = 0;
+};
+
+
+// "IN=HOST:PORT": RTP arriving on UDP port IN goes to HOST:PORT.
+struct StreamSpec {
+    int in_port = RELAY_IN_PORT;
+    std::string out_host = "127.0.0.1";
+    int out_port = RELAY_OUT_PORT;
+};
+
+
+static bool parse_stream(const std::string& text, StreamSpec& spec)
+{
+    size_t eq = text.find('='), colon = text.rfind(':');
+    if (eq == std::string::npos || colon == std::string::npos || colon < eq)
+        return false;
+    spec.in_port = std::atoi(text.substr(0, eq).c_str());
+    spec.out_host = text.substr(eq + 1, colon - eq - 1);
+    spec.out_port = std::atoi(text.substr(colon + 1).c_str());
+    return spec.in_port > 0 && spec.out_port > 0 && !spec.out_host.empty();
+}
+
+
+struct Frame {
+    cv::Mat image;
+    uint64_t decoded_ns = 0;    // when it left the decoder
+    Detections detections;      // filled by the inference thread
+};
+
+
+// Hands the newest item from one thread to the next; an item that is
+// still there when the next one arrives is replaced, not queued.
+class Mailbox {
+public:
+    // false if an older item was dropped.
+    bool put(std::unique_ptr<Frame> frame) {
+        bool replaced;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            replaced = item != nullptr;
+            item = std::move(frame);
+        }
+        ready.notify_one();
+        return !replaced;
+    }
+
+    // Waits up to 100 ms; nullptr if nothing came.
+    std::unique_ptr<Frame> take() {
+        std::unique_lock<std::mutex> lock(mutex);
+        ready.wait_for(lock, std::chrono::milliseconds(100), [this] { return item != nullptr; });
+        return std::move(item);
+    }
+
+    void wake() { ready.notify_all(); }
+
+private:
+    std::mutex mutex;
+    std::condition_variable ready;
+    std::unique_ptr<Frame> item;
+};
+
+
+class Stream {
+public:
+    Stream(const StreamSpec& spec, const Options& options) : spec(spec), options(options) {}
+
+    ~Stream() { stop(); }
+
+    bool start() {
+        std::string pipeline_str =
+            "udpsrc port=" + std::to_string(spec.in_port) +
+            " caps=application/x-rtp,media=video,encoding-name=H264,payload=96 ! ";
+        if (!options.burn) {
+            pipeline_str += "tee name=split "
+                            "split. ! queue ! udpsink host=" + spec.out_host + " port=" + std::to_string(spec.out_port) +
+                            " sync=false async=false "
+                            "split. ! queue ! ";
+        }
+        pipeline_str +=
+            "rtph264depay ! h264parse ! avdec_h264 ! videoconvert ! video/x-raw, format=BGR ! "
+            "appsink name=frames max-buffers=1 drop=true sync=false";
+
+        GError* error = nullptr;
+        pipeline = gst_parse_launch(pipeline_str.c_str(), &error);
+        if (!pipeline) {
+            std::cerr << "Cannot create pipeline for port " << spec.in_port << ": "
+                      << (error ? error->message : "unknown error") << std::endl;
+            if (error) g_error_free(error);
+            return false;
+        }
+        appsink = gst_bin_get_by_name(GST_BIN(pipeline), "frames");
+        bus = gst_element_get_bus(pipeline);
+        if (gst_element_set_state(pipeline, GST_STATE_PLAYING) == GST_STATE_CHANGE_FAILURE) {
+            std::cerr << "Cannot start the pipeline for port " << spec.in_port << std::endl;
+            return false;
+        }
+
+        meta_sock = socket(AF_INET, SOCK_DGRAM, 0);
+        meta_addr.sin_family = AF_INET;
+        meta_addr.sin_port = htons(spec.out_port + RELAY_META_OFFSET);
+        if (inet_pton(AF_INET, spec.out_host.c_str(), &meta_addr.sin_addr) != 1) {
+            std::cerr << "Bad output host " << spec.out_host << std::endl;
+            return false;
+        }
+
+        decode_thread = std::thread(&Stream::decode, this);
+        inference_thread = std::thread(&Stream::infer, this);
+        if (options.burn)
+            encode_thread = std::thread(&Stream::encode, this);
+        return true;
+    }
+
+    void stop() {
+        to_inference.wake();
+        to_encoder.wake();
+        for (std::thread* t : {&decode_thread, &inference_thread, &encode_thread})
+            if (t->joinable())
+                t->join();
+
+        stop_encoder();
+        if (pipeline) {
+            gst_element_set_state(pipeline, GST_STATE_NULL);
+            if (appsink) gst_object_unref(appsink);
+            if (bus) gst_object_unref(bus);
+            gst_object_unref(pipeline);
+            pipeline = appsink = nullptr;
+            bus = nullptr;
+        }
+        if (meta_sock >= 0) {
+            close(meta_sock);
+            meta_sock = -1;
+        }
+    }
+
+    // One status line, for the period since the last one.
+    void report(double seconds) {
+        std::vector<double> latencies;
+        uint64_t inference_us;
+        {
+            std::lock_guard<std::mutex> lock(stats_mutex);
+            latencies.swap(period_latencies);
+            inference_us = period_inference_us;
+            period_inference_us = 0;
+        }
+        uint64_t in = frames_in.exchange(0), dropped = frames_dropped.exchange(0);
+        uint64_t inferred = frames_inferred.exchange(0);
+
+        std::printf("[%d -> %s:%d]  in %.1f fps  dropped %llu  inference %.1f fps, %.0f ms", spec.in_port,
+                    spec.out_host.c_str(), spec.out_port, in / seconds, (unsigned long long)dropped,
+                    inferred / seconds, inferred ? inference_us / 1000.0 / inferred : 0.0);
+        if (!latencies.empty()) {
+            std::sort(latencies.begin(), latencies.end());
+            auto at = [&](double q) { return latencies[std::min(latencies.size() - 1, (size_t)(q * latencies.size()))]; };
+            std::printf("  latency p50 %.0f  p95 %.0f  max %.0f ms", at(0.5) * 1000, at(0.95) * 1000,
+                        latencies.back() * 1000);
+        }
+        std::printf("\n");
+    }
+
+    const StreamSpec spec;
+
+private:
+    void decode() {
+        while (running) {
+            GstSample* sample = nullptr;
+            g_signal_emit_by_name(appsink, "try-pull-sample", (GstClockTime)(100 * GST_MSECOND), &sample);
+            if (!sample) {
+                check_bus();
+                continue;
+            }
+
+            std::unique_ptr<Frame> frame(new Frame);
+            frame->decoded_ns = monotonic_ns();
+            if (copy_frame(sample, frame->image)) {
+                frames_in++;
+                relay_frames_in.add();
+                if (!to_inference.put(std::move(frame))) {
+                    frames_dropped++;
+                    relay_frames_dropped.add();
+                }
+            }
+            gst_sample_unref(sample);
+        }
+    }
+
+    // Rows of a BGR frame are padded to 4 bytes by GStreamer.
+    static bool copy_frame(GstSample* sample, cv::Mat& image) {
+        GstCaps* caps = gst_sample_get_caps(sample);
+        GstStructure* structure = caps ? gst_caps_get_structure(caps, 0) : nullptr;
+        int width = 0, height = 0;
+        if (!structure || !gst_structure_get_int(structure, "width", &width) ||
+            !gst_structure_get_int(structure, "height", &height))
+            return false;
+
+        bool ok = false;
+        GstBuffer* buffer = gst_sample_get_buffer(sample);
+        GstMapInfo map;
+        size_t stride = ((size_t)width * 3 + 3) & ~(size_t)3;
+        if (buffer && gst_buffer_map(buffer, &map, GST_MAP_READ)) {
+            if (map.size >= stride * height) {
+                cv::Mat(height, width, CV_8UC3, map.data, stride).copyTo(image);
+                ok = true;
+            }
+            gst_buffer_unmap(buffer, &map);
+        }
+        return ok;
+    }
+
+    void check_bus() {
+        GstMessage* message = gst_bus_pop_filtered(bus, (GstMessageType)(GST_MESSAGE_EOS | GST_MESSAGE_ERROR));
+        if (!message)
+            return;
+        if (GST_MESSAGE_TYPE(message) == GST_MESSAGE_ERROR) {
+            GError* err = nullptr;
+            gst_message_parse_error(message, &err, nullptr);
+            std::cerr << "Port " << spec.in_port << ": " << (err ? err->message : "unknown error") << std::endl;
+            if (err) g_error_free(err);
+            failed = true;
+            running = false;
+        }
+        gst_message_unref(message);
+    }
+
+    void infer() {
+        cv::dnn::Net net;
+        try {
+            net = load_detector(options.model, options.cuda);
+        } catch (const cv::Exception& e) {
+            std::cerr << "Cannot read model " << options.model << ": " << e.what() << std::endl;
+        }
+        if (net.empty()) {
+            failed = true;
+            running = false;
+            return;
+        }
+
+        cv::Mat blob;
+        std::vector<uint8_t> datagram;
+        double last_cpu = process_cpu_seconds();
+        uint64_t last_ns = monotonic_ns();
+        while (running) {
+            std::unique_ptr<Frame> frame = to_inference.take();
+            if (!frame)
+                continue;
+
+            uint64_t started = monotonic_ns();
+            Detections& detections = frame->detections;
+            detection_blob(frame->image, blob);
+            cv::Mat output = run_detector(net, blob);
+            parse_detections(output, detections, cv::Rect(0, 0, frame->image.cols, frame->image.rows));
+            suppress_detections(detections);
+            uint64_t done = monotonic_ns();
+
+            double cpu = process_cpu_seconds();
+            int cpu_percent = done > last_ns ? (int)std::lround(100 * (cpu - last_cpu) / ((done - last_ns) / 1e9)) : 0;
+            last_cpu = cpu;
+            last_ns = done;
+
+            vision_records(detections, frame->image.size(), (uint32_t)(frame->decoded_ns / 1000000),
+                           (int)((done - started) / 1000000), cpu_percent, datagram);
+            sendto(meta_sock, datagram.data(), datagram.size(), 0, (const sockaddr*)&meta_addr, sizeof(meta_addr));
+
+            frames_inferred++;
+            relay_objects.add(detections.kept.size());
+            relay_inference.observe((done - started) / 1e9);
+            {
+                std::lock_guard<std::mutex> lock(stats_mutex);
+                period_inference_us += (done - started) / 1000;
+            }
+
+            if (options.burn) {
+                if (!to_encoder.put(std::move(frame))) {
+                    frames_dropped++;
+                    relay_frames_dropped.add();
+                }
+            } else
+                frame_done(frame->decoded_ns, monotonic_ns());
+        }
+    }
+
+    void frame_done(uint64_t decoded_ns, uint64_t now_ns) {
+        double latency = (now_ns - decoded_ns) / 1e9;
+        relay_frames_out.add();
+        relay_latency.observe(latency);
+        std::lock_guard<std::mutex> lock(stats_mutex);
+        period_latencies.push_back(latency);
+    }
+
+    void encode() {
+        while (running) {
+            std::unique_ptr<Frame> frame = to_encoder.take();
+            if (!frame)
+                continue;
+
+            cv::Mat& image = frame->image;
+            if (!encoder || image.cols != encoder_width || image.rows != encoder_height) {
+                stop_encoder();
+                if (!start_encoder(image.cols, image.rows)) {
+                    failed = true;
+                    running = false;
+                    break;
+                }
+            }
+            draw_detections(image, frame->detections);
+
+            size_t stride = ((size_t)image.cols * 3 + 3) & ~(size_t)3;
+            GstBuffer* buffer = gst_buffer_new_allocate(nullptr, stride * image.rows, nullptr);
+            GstMapInfo map;
+            if (gst_buffer_map(buffer, &map, GST_MAP_WRITE)) {
+                for (int y = 0; y < image.rows; y++)
+                    std::memcpy(map.data + y * stride, image.ptr<uint8_t>(y), (size_t)image.cols * 3);
+                gst_buffer_unmap(buffer, &map);
+            }
+
+            // The decode time doubles as the timestamp, so the probe on
+            // the encoder's output finds each frame's start again.
+            GstClockTime pts = frame->decoded_ns - encoder_base_ns;
+            GST_BUFFER_PTS(buffer) = pts;
+            {
+                std::lock_guard<std::mutex> lock(stats_mutex);
+                pending.push_back(pts);
+                if (pending.size() > RELAY_PENDING)
+                    pending.pop_front();
+            }
+
+            GstFlowReturn ret;
+            g_signal_emit_by_name(appsrc, "push-buffer", buffer, &ret);
+            gst_buffer_unref(buffer);
+        }
+    }
+
+    bool start_encoder(int width, int height) {
+        size_t frame_bytes = (((size_t)width * 3 + 3) & ~(size_t)3) * height;
+        std::string pipeline_str =
+            "appsrc name=src is-live=true format=time block=false max-bytes=" + std::to_string(2 * frame_bytes) +
+            " caps=video/x-raw,format=BGR,width=" + std::to_string(width) + ",height=" + std::to_string(height) +
+            ",framerate=0/1 ! " + video_encoder_pipeline(options.bitrate, RELAY_KEY_INTERVAL) +
+            " ! udpsink host=" + spec.out_host + " port=" + std::to_string(spec.out_port) + " sync=false async=false";
+
+        GError* error = nullptr;
+        encoder = gst_parse_launch(pipeline_str.c_str(), &error);
+        if (!encoder) {
+            std::cerr << "Cannot create the encoder for port " << spec.in_port << ": "
+                      << (error ? error->message : "unknown error") << std::endl;
+            if (error) g_error_free(error);
+            return false;
+        }
+        appsrc = gst_bin_get_by_name(GST_BIN(encoder), "src");
+
+        GstElement* x264 = gst_bin_get_by_name(GST_BIN(encoder), "encoder");
+        GstPad* src = gst_element_get_static_pad(x264, "src");
+        gst_pad_add_probe(src, GST_PAD_PROBE_TYPE_BUFFER, encoder_output, this, nullptr);
+        gst_object_unref(src);
+        gst_object_unref(x264);
+
+        encoder_width = width;
+        encoder_height = height;
+        encoder_base_ns = monotonic_ns() - GST_SECOND;
+        if (gst_element_set_state(encoder, GST_STATE_PLAYING) == GST_STATE_CHANGE_FAILURE) {
+            std::cerr << "Cannot start the encoder for port " << spec.in_port << std::endl;
+            return false;
+        }
+        return true;
+    }
+
+    void stop_encoder() {
+        if (!encoder)
+            return;
+        gst_element_set_state(encoder, GST_STATE_NULL);
+        if (appsrc) gst_object_unref(appsrc);
+        gst_object_unref(encoder);
+        encoder = appsrc = nullptr;
+        std::lock_guard<std::mutex> lock(stats_mutex);
+        pending.clear();
+    }
+
+    // x264enc with tune=zerolatency keeps the input timestamps and order.
+    static GstPadProbeReturn encoder_output(GstPad*, GstPadProbeInfo* info, gpointer data) {
+        Stream* stream = (Stream*)data;
+        GstBuffer* buffer = GST_PAD_PROBE_INFO_BUFFER(info);
+        if (!buffer)
+            return GST_PAD_PROBE_OK;
+
+        GstClockTime pts = GST_BUFFER_PTS(buffer);
+        bool found = false;
+        {
+            std::lock_guard<std::mutex> lock(stream->stats_mutex);
+            while (!stream->pending.empty() && stream->pending.front() <= pts) {
+                found = stream->pending.front() == pts;
+                stream->pending.pop_front();
+                if (found)
+                    break;
+            }
+        }
+        if (found)
+            stream->frame_done(pts + stream->encoder_base_ns, monotonic_ns());
+        return GST_PAD_PROBE_OK;
+    }
+
+    const Options& options;
+
+    GstElement* pipeline = nullptr;
+    GstElement* appsink = nullptr;
+    GstBus* bus = nullptr;
+    GstElement* encoder = nullptr;      // the --burn output, built for the first frame's size
+    GstElement* appsrc = nullptr;
+    int encoder_width = 0, encoder_height = 0;
+    uint64_t encoder_base_ns = 0;       // monotonic time of PTS 0
+
+    int meta_sock = -1;
+    sockaddr_in meta_addr{};
+
+    Mailbox to_inference;
+    Mailbox to_encoder;
+    std::thread decode_thread, inference_thread, encode_thread;
+
+    std::atomic<uint64_t> frames_in{0};
+    std::atomic<uint64_t> frames_dropped{0};
+    std::atomic<uint64_t> frames_inferred{0};
+    std::mutex stats_mutex;
+    std::vector<double> period_latencies;
+    uint64_t period_inference_us = 0;
+    std::deque<GstClockTime> pending;   // PTS of frames pushed but not yet out of the encoder
+};
+
+
+// Subscribes every input port at the Pi's VideoFanout, or leaves it.
+void send_join(int sock, const Options& options, const std::vector<std::unique_ptr<Stream>>& streams, const char* verb)
+{
+    sockaddr_in addr{};
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(SERVER_PORT);
+    if (inet_pton(AF_INET, options.join_host.c_str(), &addr.sin_addr) != 1)
+        return;
+
+    for (const auto& stream : streams) {
+        char msg[32];
+        int len = std::snprintf(msg, sizeof(msg), "%s %d", verb, stream->spec.in_port);
+        sendto(sock, msg, len, 0, (const sockaddr*)&addr, sizeof(addr));
+    }
+}
+
+
+void usage(const char* argv0)
+{
+    std::cerr <<
+        "Usage: " << argv0 << " [options]\n"
+        "  --stream IN=HOST:PORT  relay RTP from UDP port IN to HOST:PORT, records to PORT+" << RELAY_META_OFFSET << "\n"
+        "                         (repeatable; default " << RELAY_IN_PORT << "=127.0.0.1:" << RELAY_OUT_PORT << ")\n"
+        "  --burn                 draw the boxes into the video and re-encode it\n"
+        "  --bitrate N            --burn video bitrate, kbit/s (default " << RELAY_BITRATE << ")\n"
+        "  --model FILE           YOLOv8 ONNX model (default " RELAY_MODEL ")\n"
+        "  --cuda                 run the networks on CUDA\n"
+        "  --join IP              subscribe each input port at the Pi's video fan-out\n"
+        "  --report S             seconds between status lines (default " << RELAY_REPORT << ")\n"
+        "  --metrics PORT         serve Prometheus metrics on PORT\n";
+}
+
+
+int main(int argc, char* argv[])
+{
+    Options options;
+    std::vector<StreamSpec> specs;
+
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        bool has_value = i + 1 < argc;
+
+        StreamSpec spec;
+        if (arg == "--stream" && has_value && parse_stream(argv[i + 1], spec)) {
+            specs.push_back(spec);
+            i++;
+        }
+        else if (arg == "--burn") options.burn = true;
+        else if (arg == "--bitrate" && has_value) options.bitrate = std::max(100, std::atoi(argv[++i]));
+        else if (arg == "--model" && has_value) options.model = argv[++i];
+        else if (arg == "--cuda") options.cuda = true;
+        else if (arg == "--join" && has_value) options.join_host = argv[++i];
+        else if (arg == "--report" && has_value) options.report = std::max(1, std::atoi(argv[++i]));
+        else if (arg == "--metrics" && has_value) options.metrics_port = std::atoi(argv[++i]);
+        else {
+            usage(argv[0]);
+            return arg == "--help" ? 0 : 1;
+        }
+    }
+    if (specs.empty())
+        specs.push_back(StreamSpec());
+
+    signal(SIGINT, [](int) { running = false; });
+    signal(SIGTERM, [](int) { running = false; });
+
+    gst_init(nullptr, nullptr);
+
+    MetricsServer metrics;
+    if (options.metrics_port > 0 && !metrics.start(options.metrics_port))
+        std::cerr << "Metrics disabled" << std::endl;
+
+    std::vector<std::unique_ptr<Stream>> streams;
+    for (const StreamSpec& spec : specs) {
+        streams.emplace_back(new Stream(spec, options));
+        if (!streams.back()->start()) {
+            running = false;
+            return 1;
+        }
+        std::cout << "Relaying " << spec.in_port << " -> " << spec.out_host << ":" << spec.out_port
+                  << (options.burn ? " with boxes drawn in" : "") << ", records to port "
+                  << spec.out_port + RELAY_META_OFFSET << std::endl;
+    }
+
+    int join_sock = socket(AF_INET, SOCK_DGRAM, 0);
+    auto last_report = std::chrono::steady_clock::now();
+    auto next_join = last_report;
+    while (running) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(200));
+        auto now = std::chrono::steady_clock::now();
+
+        if (!options.join_host.empty() && now >= next_join) {
+            send_join(join_sock, options, streams, "VJ");
+            next_join = now + std::chrono::seconds(RELAY_JOIN_PERIOD);
+        }
+
+        double seconds = std::chrono::duration<double>(now - last_report).count();
+        if (seconds >= options.report) {
+            for (auto& stream : streams)
+                stream->report(seconds);
+            std::fflush(stdout);
+            last_report = now;
+        }
+    }
+
+    if (!options.join_host.empty())
+        send_join(join_sock, options, streams, "VL");
+    close(join_sock);
+
+    for (auto& stream : streams)
+        stream->stop();
+    metrics.stop();
+    return failed ? 1 : 0;
+}
@@ -0,0 +1,485 @@
+#include "log_index.h"
+#include "telemetry.h"
+
+#include <algorithm>
+#include <cctype>
+#include <cstring>
+#include <ctime>
+#include <iostream>
+#include <iterator>
+
+#include <fcntl.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define LOG_INDEX_MAGIC          0x584c424fu   // "OBLX"
+#define LOG_INDEX_SEGMENT_MAGIC  0x534c424fu   // "OBLS"
+#define LOG_INDEX_VERSION        1
+
+#define LOG_STAMP_SIZE           22            // "[YYYY-mm-dd HH:MM:SS] "
+
+
+struct LogEventText {
+    uint8_t code;
+    const char* name;
+    const char* prefix;         // how telemetry_format() starts the line
+};
+
+static const LogEventText log_events[] = {
+    {TM_BOOT,                "boot",                "Arduino started"},
+    {TM_ROTATION_STARTED,    "rotation_started",    "Rotation started"},
+    {TM_CONNECTION_LOST,     "connection_lost",     "Connection lost"},
+    {TM_INSPECTION_STARTED,  "inspection_started",  "Inspection started"},
+    {TM_FORWARD_BLOCKED,     "forward_blocked",     "Forward blocked by obstacle"},
+    {TM_OBSTACLE_DETECTED,   "obstacle_detected",   "Obstacle detected"},
+    {TM_OBSTACLE_STOP,       "obstacle_stop",       "Stopping forward motion due to obstacle"},
+    {TM_OBSTACLE_PRESENT,    "obstacle_present",    "Obstacle still present"},
+    {TM_OBSTACLE_CLEARED,    "obstacle_cleared",    "Obstacle cleared"},
+    {TM_ACTION_INTERRUPTED,  "action_interrupted",  "Action interrupted"},
+    {TM_SENSORS,             "sensors",             "Sensors ->"},
+    {TM_TX_OVERFLOW,         "tx_overflow",         "Telemetry overflow"},
+    {TM_POSE,                "pose",                "Pose ->"},
+    {TM_CALIBRATION_STARTED, "calibration_started", "Calibration started"},
+    {TM_CALIBRATION,         "calibration",         "Calibration done"},
+    {TM_CALIBRATION_FAILED,  "calibration_failed",  "Calibration failed"},
+};
+
+
+uint8_t log_event(const char* text, size_t size)
+{
+    for (const LogEventText& e : log_events) {
+        size_t n = std::strlen(e.prefix);
+        if (size >= n && std::memcmp(text, e.prefix, n) == 0)
+            return e.code;
+    }
+    return 0;
+}
+
+
+const char* log_event_name(uint8_t event)
+{
+    for (const LogEventText& e : log_events)
+        if (e.code == event)
+            return e.name;
+    return nullptr;
+}
+
+
+uint8_t log_event_parse(const std::string& name)
+{
+    for (const LogEventText& e : log_events)
+        if (name == e.name)
+            return e.code;
+    return 0;
+}
+
+
+void log_words(const char* text, size_t size, std::vector<std::string>& words)
+{
+    words.clear();
+    std::string word;
+    for (size_t i = 0; i <= size; i++) {
+        unsigned char c = i < size ? (unsigned char)text[i] : ' ';
+        if (std::isalnum(c) || c == '_' || c >= 0x80) {
+            word += (char)std::tolower(c);
+        } else if (!word.empty()) {
+            words.push_back(word);
+            word.clear();
+        }
+    }
+}
+
+
+// FNV-1a, top bit cleared for the event terms.
+uint32_t log_word_hash(const std::string& word)
+{
+    uint32_t hash = 2166136261u;
+    for (unsigned char c : word) {
+        hash ^= c;
+        hash *= 16777619u;
+    }
+    return hash & ~LOG_EVENT_TERM;
+}
+
+
+static size_t segment_size(const LogIndexSegmentHeader& h)
+{
+    size_t size = sizeof(LogIndexSegmentHeader) + h.lines * sizeof(LogIndexLine) +
+                  h.terms * sizeof(LogIndexTerm) + h.postings * sizeof(uint32_t);
+    return (size + 7) & ~(size_t)7;
+}
+
+
+// Size of the valid prefix of an index file: the header and every whole
+// segment. 0 if the file is not an index.
+static size_t valid_size(const uint8_t* data, size_t size, uint64_t* end_offset)
+{
+    const LogIndexFileHeader* header = (const LogIndexFileHeader*)data;
+    if (size < sizeof(LogIndexFileHeader) || header->magic != LOG_INDEX_MAGIC || header->version != LOG_INDEX_VERSION)
+        return 0;
+
+    size_t pos = sizeof(LogIndexFileHeader);
+    *end_offset = 0;
+    while (pos + sizeof(LogIndexSegmentHeader) <= size) {
+        const LogIndexSegmentHeader* h = (const LogIndexSegmentHeader*)(data + pos);
+        if (h->magic != LOG_INDEX_SEGMENT_MAGIC || pos + segment_size(*h) > size)
+            break;
+        *end_offset = h->end_offset;
+        pos += segment_size(*h);
+    }
+    return pos;
+}
+
+
+LogIndexWriter::~LogIndexWriter()
+{
+    close();
+}
+
+
+bool LogIndexWriter::open(const std::string& log_path, bool rebuild)
+{
+    std::string path = log_path + ".idx";
+
+    int fd = ::open(path.c_str(), O_RDWR | O_CREAT, 0644);
+    if (fd < 0) {
+        std::cerr << "Cannot open log index " << path << std::endl;
+        return false;
+    }
+
+    // One writer per index: LogSink holds the lock while the log is live.
+    if (flock(fd, LOCK_EX | LOCK_NB) < 0) {
+        ::close(fd);
+        return false;
+    }
+
+    struct stat st;
+    fstat(fd, &st);
+
+    std::vector<uint8_t> data(st.st_size);
+    if (st.st_size > 0 && pread(fd, data.data(), data.size(), 0) != (ssize_t)data.size())
+        data.clear();
+
+    end_offset = 0;
+    size_t valid = rebuild ? 0 : valid_size(data.data(), data.size(), &end_offset);
+    if (valid == 0) {
+        LogIndexFileHeader header{LOG_INDEX_MAGIC, LOG_INDEX_VERSION};
+        if (ftruncate(fd, 0) < 0 || pwrite(fd, &header, sizeof(header), 0) != sizeof(header)) {
+            ::close(fd);
+            return false;
+        }
+        valid = sizeof(header);
+    } else if (valid < data.size() && ftruncate(fd, valid) < 0) {
+        ::close(fd);
+        return false;
+    }
+
+    file = fdopen(fd, "ab");
+    begin_offset = end_offset;
+    bucket = INT64_MIN;
+    return file != nullptr;
+}
+
+
+void LogIndexWriter::close()
+{
+    if (!file) return;
+
+    flush();
+    std::fclose(file);      // drops the lock
+    file = nullptr;
+}
+
+
+void LogIndexWriter::add(uint64_t offset, uint64_t end, int64_t time, const char* text, size_t size)
+{
+    if (!file) return;
+
+    int64_t line_bucket = time / LOG_INDEX_BUCKET;
+    if (!lines.empty() && line_bucket != bucket)
+        flush();
+    bucket = line_bucket;
+
+    uint32_t line = lines.size();
+    lines.push_back({offset, time});
+    end_offset = end;
+
+    auto post = [&](uint32_t hash) {
+        std::vector<uint32_t>& list = postings[hash];
+        if (list.empty() || list.back() != line)
+            list.push_back(line);
+    };
+
+    log_words(text, size, words);
+    for (const std::string& word : words)
+        post(log_word_hash(word));
+
+    uint8_t event = log_event(text, size);
+    if (event)
+        post(LOG_EVENT_TERM | event);
+}
+
+
+void LogIndexWriter::flush()
+{
+    if (!file || lines.empty()) return;
+
+    std::vector<LogIndexTerm> terms;
+    terms.reserve(postings.size());
+    for (const auto& p : postings)
+        terms.push_back({p.first, 0, (uint32_t)p.second.size()});
+    std::sort(terms.begin(), terms.end(), [](const LogIndexTerm& a, const LogIndexTerm& b) { return a.hash < b.hash; });
+
+    std::vector<uint32_t> list;
+    for (LogIndexTerm& term : terms) {
+        term.first = list.size();
+        const std::vector<uint32_t>& p = postings[term.hash];
+        list.insert(list.end(), p.begin(), p.end());
+    }
+
+    LogIndexSegmentHeader header{};
+    header.magic = LOG_INDEX_SEGMENT_MAGIC;
+    header.lines = lines.size();
+    header.terms = terms.size();
+    header.postings = list.size();
+    header.first_time = INT64_MAX;
+    header.last_time = INT64_MIN;
+    for (const LogIndexLine& l : lines) {
+        header.first_time = std::min(header.first_time, l.time);
+        header.last_time = std::max(header.last_time, l.time);
+    }
+    header.begin_offset = begin_offset;
+    header.end_offset = end_offset;
+
+    // One write per segment, so a crash leaves at most one torn segment
+    // at the end of the file.
+    std::string segment;
+    segment.append((const char*)&header, sizeof(header));
+    segment.append((const char*)lines.data(), lines.size() * sizeof(LogIndexLine));
+    segment.append((const char*)terms.data(), terms.size() * sizeof(LogIndexTerm));
+    segment.append((const char*)list.data(), list.size() * sizeof(uint32_t));
+    segment.resize(segment_size(header), '\0');
+
+    if (std::fwrite(segment.data(), 1, segment.size(), file) != segment.size())
+        std::cerr << "Log index write failed" << std::endl;
+    std::fflush(file);
+
+    begin_offset = end_offset;
+    lines.clear();
+    postings.clear();
+}
+
+
+// "[YYYY-mm-dd HH:MM:SS] " as LogSink writes it; the stamp repeats for
+// every line in a second, so the conversion is cached.
+static bool parse_stamp(const char* line, size_t size, std::string& last_stamp, int64_t& time)
+{
+    if (size < LOG_STAMP_SIZE || line[0] != '[' || line[20] != ']')
+        return false;
+    if (last_stamp.compare(0, std::string::npos, line, LOG_STAMP_SIZE) == 0)
+        return true;
+
+    std::tm tm_buf{};
+    std::string stamp(line + 1, 19);
+    if (!strptime(stamp.c_str(), "%Y-%m-%d %H:%M:%S", &tm_buf))
+        return false;
+
+    tm_buf.tm_isdst = -1;
+    time = std::mktime(&tm_buf);
+    last_stamp.assign(line, LOG_STAMP_SIZE);
+    return true;
+}
+
+
+long log_index_update(const std::string& log_path, bool rebuild)
+{
+    LogIndexWriter writer;
+    if (!writer.open(log_path, rebuild))
+        return -1;
+
+    int fd = ::open(log_path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        std::cerr << "Cannot open log " << log_path << std::endl;
+        return -1;
+    }
+
+    struct stat st;
+    fstat(fd, &st);
+    size_t size = st.st_size;
+    uint64_t pos = writer.indexed_end();
+    if (pos >= size) {
+        ::close(fd);
+        return 0;
+    }
+
+    void* p = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if (p == MAP_FAILED) {
+        std::cerr << "Cannot map log " << log_path << std::endl;
+        return -1;
+    }
+    const char* data = (const char*)p;
+
+    long count = 0;
+    std::string last_stamp;
+    int64_t time = 0;
+
+    while (pos < size) {
+        const char* line = data + pos;
+        const char* newline = (const char*)std::memchr(line, '\n', size - pos);
+        if (!newline)
+            break;      // still being written
+
+        size_t length = newline - line;
+        uint64_t end = pos + length + 1;
+
+        // A line without a stamp keeps the time of the one before.
+        const char* text = line;
+        size_t text_size = length;
+        if (parse_stamp(line, length, last_stamp, time)) {
+            text += LOG_STAMP_SIZE;
+            text_size -= LOG_STAMP_SIZE;
+        }
+
+        writer.add(pos, end, time, text, text_size);
+        count++;
+        pos = end;
+    }
+
+    munmap(p, size);
+    writer.close();
+    return count;
+}
+
+
+LogIndexReader::~LogIndexReader()
+{
+    close();
+}
+
+
+bool LogIndexReader::open(const std::string& log_path)
+{
+    close();
+
+    std::string path = log_path + ".idx";
+    fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+        return false;
+
+    struct stat st;
+    fstat(fd, &st);
+    size = st.st_size;
+    if (size < sizeof(LogIndexFileHeader)) {
+        close();
+        return false;
+    }
+
+    void* p = mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+    if (p == MAP_FAILED) {
+        close();
+        return false;
+    }
+    data = (const uint8_t*)p;
+
+    uint64_t end_offset;
+    size_t valid = valid_size(data, size, &end_offset);
+    if (valid == 0) {
+        std::cerr << "Not a log index: " << path << std::endl;
+        close();
+        return false;
+    }
+
+    for (size_t pos = sizeof(LogIndexFileHeader); pos < valid;) {
+        Segment s;
+        s.header = (const LogIndexSegmentHeader*)(data + pos);
+        s.lines = (const LogIndexLine*)(s.header + 1);
+        s.terms = (const LogIndexTerm*)(s.lines + s.header->lines);
+        s.postings = (const uint32_t*)(s.terms + s.header->terms);
+        segment_list.push_back(s);
+        pos += segment_size(*s.header);
+    }
+    return true;
+}
+
+
+void LogIndexReader::close()
+{
+    if (data) munmap((void*)data, size);
+    if (fd >= 0) ::close(fd);
+    data = nullptr;
+    fd = -1;
+    size = 0;
+    segment_list.clear();
+}
+
+
+int64_t LogIndexReader::first_time() const
+{
+    return segment_list.empty() ? 0 : segment_list.front().header->first_time;
+}
+
+
+int64_t LogIndexReader::last_time() const
+{
+    return segment_list.empty() ? 0 : segment_list.back().header->last_time;
+}
+
+
+const LogIndexTerm* LogIndexReader::find(const Segment& segment, uint32_t hash) const
+{
+    const LogIndexTerm* begin = segment.terms;
+    const LogIndexTerm* end = segment.terms + segment.header->terms;
+    const LogIndexTerm* it = std::lower_bound(begin, end, hash,
+                                              [](const LogIndexTerm& t, uint32_t h) { return t.hash < h; });
+    return it != end && it->hash == hash ? it : nullptr;
+}
+
+
+void LogIndexReader::search(const std::vector<uint32_t>& terms, int64_t from, int64_t to,
+                            std::vector<LogIndexHit>& hits) const
+{
+    std::vector<const LogIndexTerm*> found;
+    std::vector<uint32_t> matches, next;
+
+    for (const Segment& segment : segment_list) {
+        const LogIndexSegmentHeader& h = *segment.header;
+        if (h.last_time < from || h.first_time > to)
+            continue;
+
+        if (terms.empty()) {
+            for (uint32_t i = 0; i < h.lines; i++)
+                if (segment.lines[i].time >= from && segment.lines[i].time <= to)
+                    hits.push_back({segment.lines[i].offset, segment.lines[i].time});
+            continue;
+        }
+
+        // Intersect the posting lists, shortest first.
+        found.clear();
+        for (uint32_t hash : terms) {
+            const LogIndexTerm* term = find(segment, hash);
+            if (!term) break;
+            found.push_back(term);
+        }
+        if (found.size() < terms.size())
+            continue;
+        std::sort(found.begin(), found.end(),
+                  [](const LogIndexTerm* a, const LogIndexTerm* b) { return a->count < b->count; });
+
+        const uint32_t* first = segment.postings + found[0]->first;
+        matches.assign(first, first + found[0]->count);
+        for (size_t t = 1; t < found.size() && !matches.empty(); t++) {
+            const uint32_t* list = segment.postings + found[t]->first;
+            next.clear();
+            std::set_intersection(matches.begin(), matches.end(), list, list + found[t]->count,
+                                  std::back_inserter(next));
+            matches.swap(next);
+        }
+
+        for (uint32_t i : matches)
+            if (segment.lines[i].time >= from && segment.lines[i].time <= to)
+                hits.push_back({segment.lines[i].offset, segment.lines[i].time});
+    }
+}
@@ -0,0 +1,149 @@
+// Inverted index over the operator's log files (logs_*.txt), kept next to
+// each as <log>.idx. LogSink adds lines as it writes them; log_search
+// indexes old files, or the tail a crash left unindexed, and answers word,
+// event and time queries across every session from the indexes alone.
+//
+//   file header    LogIndexFileHeader
+//   segments       one per LOG_INDEX_BUCKET seconds of log, appended:
+//     LogIndexSegmentHeader
+//     LogIndexLine   lines[lines]       where each line starts, and when
+//     LogIndexTerm   terms[terms]       sorted by hash
+//     uint32_t       postings[postings] line numbers in the segment, ascending
+//
+// Segments are only ever appended, so a file cut short by a crash is valid
+// up to its last whole segment; updating it truncates the rest and indexes
+// the log from where the last segment ends.
+//
+// Terms are 31-bit hashes of lowercased words, or LOG_EVENT_TERM | code for
+// the telemetry event a line reports. A hash can collide, so callers check
+// the words against the line itself.
+#pragma once
+
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#define LOG_INDEX_BUCKET  60            // seconds of log per segment
+#define LOG_EVENT_TERM    0x80000000u   // event terms; word hashes keep this bit clear
+
+
+struct LogIndexFileHeader {
+    uint32_t magic;
+    uint32_t version;
+};
+
+
+struct LogIndexSegmentHeader {
+    uint32_t magic;
+    uint32_t lines;
+    uint32_t terms;
+    uint32_t postings;
+    int64_t first_time;         // s since the Unix epoch
+    int64_t last_time;
+    uint64_t begin_offset;      // log bytes the segment covers, [begin, end)
+    uint64_t end_offset;
+};
+
+
+struct LogIndexLine {
+    uint64_t offset;            // of the '[' that starts the line
+    int64_t time;               // s since the Unix epoch
+};
+
+
+struct LogIndexTerm {
+    uint32_t hash;
+    uint32_t first;             // into postings
+    uint32_t count;
+};
+
+
+// The TelemetryCode a line reports, from its text (telemetry_format()
+// output, or the same line printed by older text-only firmware); 0 if none.
+uint8_t log_event(const char* text, size_t size);
+
+// "obstacle_detected" and back; nullptr / 0 if unknown.
+const char* log_event_name(uint8_t event);
+uint8_t log_event_parse(const std::string& name);
+
+// Lowercased runs of letters, digits and '_'; non-ASCII bytes count as
+// letters, so Russian words are tokens too.
+void log_words(const char* text, size_t size, std::vector<std::string>& words);
+uint32_t log_word_hash(const std::string& word);
+
+
+class LogIndexWriter {
+public:
+    ~LogIndexWriter();
+
+    // Opens <log_path>.idx for appending, dropping a torn last segment, or
+    // everything with rebuild. indexed_end() then tells where in the log
+    // indexing has to resume. Fails if another writer has the index.
+    bool open(const std::string& log_path, bool rebuild = false);
+    void close();
+
+    uint64_t indexed_end() const { return end_offset; }
+
+    // One line of the log: its offset, time and text without the stamp.
+    // Lines must come in file order; a new time bucket starts a segment.
+    void add(uint64_t offset, uint64_t end, int64_t time, const char* text, size_t size);
+
+    // Writes the lines added so far as a segment.
+    void flush();
+
+private:
+    FILE* file = nullptr;
+    uint64_t begin_offset = 0;
+    uint64_t end_offset = 0;
+    int64_t bucket = INT64_MIN;
+
+    std::vector<LogIndexLine> lines;
+    std::unordered_map<uint32_t, std::vector<uint32_t>> postings;
+    std::vector<std::string> words;
+};
+
+
+// Brings <log_path>.idx up to date with the log, indexing whatever it
+// does not cover yet; with rebuild, from scratch. Returns the number of
+// lines indexed, or -1 on error.
+long log_index_update(const std::string& log_path, bool rebuild = false);
+
+
+struct LogIndexHit {
+    uint64_t offset;
+    int64_t time;
+};
+
+
+class LogIndexReader {
+public:
+    ~LogIndexReader();
+
+    bool open(const std::string& log_path);
+    void close();
+
+    size_t segments() const { return segment_list.size(); }
+    int64_t first_time() const;
+    int64_t last_time() const;
+
+    // Lines carrying every term, between from and to (inclusive, s), in
+    // file order. With no terms, every line in the range.
+    void search(const std::vector<uint32_t>& terms, int64_t from, int64_t to, std::vector<LogIndexHit>& hits) const;
+
+private:
+    struct Segment {
+        const LogIndexSegmentHeader* header;
+        const LogIndexLine* lines;
+        const LogIndexTerm* terms;
+        const uint32_t* postings;
+    };
+
+    const LogIndexTerm* find(const Segment& segment, uint32_t hash) const;
+
+    int fd = -1;
+    const uint8_t* data = nullptr;
+    size_t size = 0;
+    std::vector<Segment> segment_list;
+};
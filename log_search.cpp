@@ -0,0 +1,384 @@
+// Search over every operator log (logs_*.txt) in a directory through their
+// log_index.h indexes: words, telemetry events and time ranges, across all
+// sessions at once. Missing or stale indexes are brought up to date first,
+// in parallel. Without a query on the command line it reads queries from
+// the terminal, and ":play N" replays hit N in the operator from the
+// session recorded alongside the log.
+#include "log_index.h"
+#include "session.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#define SEARCH_LIMIT        50     // hits printed per query
+#define SEARCH_LINE_MAX     1024   // longest log line read back
+#define SEARCH_PLAY_BEFORE  5      // seconds of replay before the hit
+
+
+void usage(const char* argv0)
+{
+    std::cerr <<
+        "Usage: " << argv0 << " [options] [QUERY...]\n"
+        "  --dir DIR         log directory (default ~/Desktop/omegabot-controller)\n"
+        "  --jobs N          threads for indexing (default: all cores)\n"
+        "  --rebuild         rebuild every index from its log\n"
+        "  --limit N         hits to print (default " << SEARCH_LIMIT << ")\n"
+        "  --operator PATH   operator binary for :play (default ./build/operator)\n"
+        "\n"
+        "A query is words, all of which a line must contain, plus any of\n"
+        "  event:NAME        telemetry event, e.g. event:obstacle_detected, event:connection_lost\n"
+        "  from:TIME to:TIME \"YYYY-MM-DD\" or \"YYYY-MM-DDTHH:MM:SS\"\n"
+        "Without a query, queries are read from the terminal; there \":play N\"\n"
+        "replays hit N from the session video and \":quit\" leaves.\n";
+}
+
+
+bool parse_time(std::string text, int64_t& time)
+{
+    std::replace(text.begin(), text.end(), 'T', ' ');
+
+    std::tm tm_buf{};
+    const char* rest = strptime(text.c_str(), "%Y-%m-%d %H:%M:%S", &tm_buf);
+    if (!rest) {
+        tm_buf = std::tm{};
+        rest = strptime(text.c_str(), "%Y-%m-%d", &tm_buf);
+    }
+    if (!rest || *rest != '\0')
+        return false;
+
+    tm_buf.tm_isdst = -1;
+    time = std::mktime(&tm_buf);
+    return true;
+}
+
+
+std::string format_time(int64_t time)
+{
+    std::time_t t = time;
+    std::tm tm_buf;
+    localtime_r(&t, &tm_buf);
+
+    char text[32];
+    std::strftime(text, sizeof(text), "%Y-%m-%d %H:%M:%S", &tm_buf);
+    return text;
+}
+
+
+// One log file with its index, and the session recorded in the same run
+// (same timestamp in the name), if there is one.
+struct LogFile {
+    std::string path;
+    std::string name;
+    std::string session;
+    int64_t session_start = -1;     // s since the epoch, -1 until read
+    int fd = -1;
+    LogIndexReader index;
+
+    ~LogFile() { if (fd >= 0) close(fd); }
+};
+
+
+std::vector<std::string> list_logs(const std::string& dir)
+{
+    std::vector<std::string> names;
+    DIR* d = opendir(dir.c_str());
+    if (!d) {
+        std::cerr << "Cannot open " << dir << std::endl;
+        return names;
+    }
+
+    while (dirent* e = readdir(d)) {
+        std::string name = e->d_name;
+        if (name.compare(0, 5, "logs_") == 0 && name.size() > 4 && name.compare(name.size() - 4, 4, ".txt") == 0)
+            names.push_back(name);
+    }
+    closedir(d);
+
+    std::sort(names.begin(), names.end());
+    return names;
+}
+
+
+// Indexes what each index is missing, one file per thread at a time.
+void update_indexes(const std::vector<std::string>& paths, int jobs, bool rebuild)
+{
+    auto start = std::chrono::steady_clock::now();
+    std::atomic<size_t> next{0};
+    std::atomic<long> lines{0};
+    std::atomic<int> updated{0};
+    std::atomic<int> busy{0};
+
+    auto work = [&] {
+        for (size_t i; (i = next++) < paths.size();) {
+            long n = log_index_update(paths[i], rebuild);
+            if (n < 0) {
+                busy++;
+            } else if (n > 0) {
+                lines += n;
+                updated++;
+            }
+        }
+    };
+
+    std::vector<std::thread> threads;
+    for (int i = 0; i < jobs; i++)
+        threads.emplace_back(work);
+    for (std::thread& t : threads)
+        t.join();
+
+    double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    if (updated > 0 || busy > 0)
+        std::fprintf(stderr, "Indexed %ld lines in %d files with %d threads, %.0f ms%s\n", lines.load(),
+                     updated.load(), jobs, ms, busy > 0 ? " (a log being written was left to its writer)" : "");
+}
+
+
+struct Query {
+    std::vector<std::string> words;
+    uint8_t event = 0;
+    int64_t from = INT64_MIN;
+    int64_t to = INT64_MAX;
+};
+
+
+bool parse_query(const std::string& text, Query& query)
+{
+    size_t pos = 0;
+    while (pos < text.size()) {
+        size_t end = text.find(' ', pos);
+        if (end == std::string::npos) end = text.size();
+        std::string part = text.substr(pos, end - pos);
+        pos = end + 1;
+        if (part.empty()) continue;
+
+        if (part.compare(0, 6, "event:") == 0) {
+            query.event = log_event_parse(part.substr(6));
+            if (!query.event) {
+                std::cerr << "Unknown event " << part.substr(6) << std::endl;
+                return false;
+            }
+        } else if (part.compare(0, 5, "from:") == 0) {
+            if (!parse_time(part.substr(5), query.from)) { std::cerr << "Bad time: " << part << std::endl; return false; }
+        } else if (part.compare(0, 3, "to:") == 0) {
+            if (!parse_time(part.substr(3), query.to)) { std::cerr << "Bad time: " << part << std::endl; return false; }
+            if (part.size() <= 13) query.to += 86399;   // a whole day
+        } else {
+            std::vector<std::string> words;
+            log_words(part.data(), part.size(), words);
+            query.words.insert(query.words.end(), words.begin(), words.end());
+        }
+    }
+    return true;
+}
+
+
+struct Hit {
+    LogFile* file;
+    int64_t time;
+    std::string text;
+};
+
+
+// The line at offset without its stamp.
+std::string read_line(const LogFile& file, uint64_t offset)
+{
+    char buffer[SEARCH_LINE_MAX];
+    ssize_t n = pread(file.fd, buffer, sizeof(buffer), offset);
+    if (n <= 0) return std::string();
+
+    const char* newline = (const char*)std::memchr(buffer, '\n', n);
+    size_t length = newline ? newline - buffer : n;
+    size_t skip = length > 22 && buffer[0] == '[' ? 22 : 0;
+    return std::string(buffer + skip, length - skip);
+}
+
+
+// Hashes can collide: keep a line only if it really has every word.
+bool line_matches(const std::string& text, const Query& query)
+{
+    if (query.event && log_event(text.data(), text.size()) != query.event)
+        return false;
+
+    std::vector<std::string> words;
+    log_words(text.data(), text.size(), words);
+    for (const std::string& w : query.words)
+        if (std::find(words.begin(), words.end(), w) == words.end())
+            return false;
+    return true;
+}
+
+
+void run_query(std::vector<std::unique_ptr<LogFile>>& files, const Query& query, size_t limit, std::vector<Hit>& hits)
+{
+    auto start = std::chrono::steady_clock::now();
+
+    std::vector<uint32_t> terms;
+    for (const std::string& w : query.words)
+        terms.push_back(log_word_hash(w));
+    if (query.event)
+        terms.push_back(LOG_EVENT_TERM | query.event);
+
+    hits.clear();
+    size_t total = 0;
+    std::vector<LogIndexHit> found;
+
+    for (auto& file : files) {
+        if (query.from != INT64_MIN && file->index.last_time() < query.from) continue;
+        if (query.to != INT64_MAX && file->index.first_time() > query.to) continue;
+
+        found.clear();
+        file->index.search(terms, query.from, query.to, found);
+        for (const LogIndexHit& h : found) {
+            std::string text = read_line(*file, h.offset);
+            if (!line_matches(text, query))
+                continue;
+            total++;
+            if (hits.size() < limit)
+                hits.push_back({file.get(), h.time, text});
+        }
+    }
+
+    double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    for (size_t i = 0; i < hits.size(); i++) {
+        const Hit& hit = hits[i];
+        std::printf("%3zu  %s  %-34s %s", i + 1, format_time(hit.time).c_str(), hit.file->name.c_str(), hit.text.c_str());
+        if (!hit.file->session.empty())
+            std::printf("  [video +%llds]", (long long)(hit.time - hit.file->session_start));
+        std::printf("\n");
+    }
+    std::fprintf(stderr, "%zu hits%s in %zu logs, %.2f ms\n", total,
+                 total > hits.size() ? (", first " + std::to_string(hits.size()) + " shown").c_str() : "",
+                 files.size(), ms);
+}
+
+
+// The session of the same run: logs_<stamp>[.N].txt and session_<stamp>.obsn.
+void find_session(const std::string& dir, LogFile& file)
+{
+    if (file.name.size() < 5 + 19) return;
+
+    std::string path = dir + "/session_" + file.name.substr(5, 19) + ".obsn";
+    if (access(path.c_str(), R_OK) != 0) return;
+
+    SessionReader reader;
+    if (!reader.open(path)) return;
+    file.session = path;
+    file.session_start = reader.start_time_ms() / 1000;
+}
+
+
+void play(const Hit& hit, const std::string& operator_path)
+{
+    if (hit.file->session.empty()) {
+        std::cerr << "No session recorded for " << hit.file->name << std::endl;
+        return;
+    }
+
+    int64_t at = std::max<int64_t>(0, hit.time - hit.file->session_start - SEARCH_PLAY_BEFORE);
+    std::string start = std::to_string(at);
+    std::cout << operator_path << " --replay " << hit.file->session << " --start " << start << std::endl;
+
+    if (fork() == 0) {
+        execlp(operator_path.c_str(), operator_path.c_str(), "--replay", hit.file->session.c_str(),
+               "--start", start.c_str(), (char*)nullptr);
+        std::perror(operator_path.c_str());
+        _exit(1);
+    }
+}
+
+
+int main(int argc, char* argv[])
+{
+    std::string dir = std::string(std::getenv("HOME") ? std::getenv("HOME") : ".") + "/Desktop/omegabot-controller";
+    int jobs = std::max(1u, std::thread::hardware_concurrency());
+    bool rebuild = false;
+    size_t limit = SEARCH_LIMIT;
+    std::string operator_path = "./build/operator";
+    std::string query_text;
+
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        bool has_value = i + 1 < argc;
+
+        if (arg == "--dir" && has_value) dir = argv[++i];
+        else if (arg == "--jobs" && has_value) jobs = std::max(1, std::atoi(argv[++i]));
+        else if (arg == "--rebuild") rebuild = true;
+        else if (arg == "--limit" && has_value) limit = std::max(1, std::atoi(argv[++i]));
+        else if (arg == "--operator" && has_value) operator_path = argv[++i];
+        else if (arg.size() > 1 && arg[0] == '-' && arg[1] == '-') {
+            usage(argv[0]);
+            return arg == "--help" ? 0 : 1;
+        } else {
+            query_text += (query_text.empty() ? "" : " ") + arg;
+        }
+    }
+
+    std::vector<std::string> paths;
+    for (const std::string& name : list_logs(dir))
+        paths.push_back(dir + "/" + name);
+    if (paths.empty()) {
+        std::cerr << "No logs in " << dir << std::endl;
+        return 1;
+    }
+
+    update_indexes(paths, std::min<int>(jobs, paths.size()), rebuild);
+
+    std::vector<std::unique_ptr<LogFile>> files;
+    for (const std::string& path : paths) {
+        std::unique_ptr<LogFile> file(new LogFile);
+        file->path = path;
+        file->name = path.substr(dir.size() + 1);
+        file->fd = open(path.c_str(), O_RDONLY);
+        if (file->fd < 0 || !file->index.open(path))
+            continue;
+        find_session(dir, *file);
+        files.push_back(std::move(file));
+    }
+
+    std::vector<Hit> hits;
+    if (!query_text.empty()) {
+        Query query;
+        if (!parse_query(query_text, query))
+            return 1;
+        run_query(files, query, limit, hits);
+        return 0;
+    }
+
+    std::signal(SIGCHLD, SIG_IGN);      // replays are not waited for
+    std::cerr << files.size() << " logs; type a query, \":play N\" or \":quit\"" << std::endl;
+
+    std::string line;
+    while (std::cout << "> " << std::flush, std::getline(std::cin, line)) {
+        if (line == ":quit" || line == ":q")
+            break;
+
+        if (line.compare(0, 6, ":play ") == 0) {
+            size_t n = std::atoi(line.c_str() + 6);
+            if (n >= 1 && n <= hits.size())
+                play(hits[n - 1], operator_path);
+            else
+                std::cerr << "No hit " << line.substr(6) << std::endl;
+            continue;
+        }
+
+        Query query;
+        if (parse_query(line, query))
+            run_query(files, query, limit, hits);
+    }
+    return 0;
+}
@@ -0,0 +1,221 @@
+#include "log_sink.h"
+
+#include <iostream>
+
+#define LOG_SINK_PERIOD   100   // ms the writer sleeps when the queue is empty
+#define LOG_ZSTD_LEVEL    3
+
+
+LogSink::LogSink(size_t queue_size)
+    : queue(queue_size)
+{
+}
+
+
+LogSink::~LogSink()
+{
+    close();
+}
+
+
+bool LogSink::open(const std::string& base, bool use_compression, size_t rotate, bool use_index)
+{
+    close();
+
+    path_base = base;
+    rotate_bytes = rotate;
+    index = use_index;
+    part = 0;
+
+#ifdef HAVE_ZSTD
+    compress = use_compression;
+#else
+    if (use_compression)
+        std::cerr << "Log compression requested, but built without zstd" << std::endl;
+    compress = false;
+#endif
+
+    if (!open_file())
+        return false;
+
+    running = true;
+    writer = std::thread(&LogSink::run, this);
+    return true;
+}
+
+
+void LogSink::close()
+{
+    running = false;
+    if (writer.joinable())
+        writer.join();
+    close_file();
+}
+
+
+void LogSink::write(std::string text)
+{
+    LogEntry entry{std::chrono::system_clock::now(), std::move(text)};
+    if (!queue.push(std::move(entry))) {
+        dropped++;
+        dropped_lines.fetch_add(1, std::memory_order_relaxed);
+    }
+}
+
+
+void LogSink::run()
+{
+    std::string batch;
+    LogEntry entry;
+
+    for (;;) {
+        // Read the flag before draining, so nothing queued before close()
+        // is left behind.
+        bool stopping = !running;
+
+        batch.clear();
+        while (queue.pop(entry))
+            append_line(batch, entry);
+
+        size_t lost = dropped.exchange(0);
+        if (lost > 0) {
+            LogEntry note{std::chrono::system_clock::now(),
+                          std::to_string(lost) + " log lines dropped, the writer fell behind"};
+            append_line(batch, note);
+        }
+
+        if (!batch.empty())
+            write_batch(batch);
+        else if (stopping)
+            break;
+        else
+            std::this_thread::sleep_for(std::chrono::milliseconds(LOG_SINK_PERIOD));
+    }
+}
+
+
+// Same "[YYYY-mm-dd HH:MM:SS] " prefix as before, but localtime() and the
+// formatting run once per second instead of once per line.
+void LogSink::append_line(std::string& batch, const LogEntry& entry)
+{
+    std::time_t t = std::chrono::system_clock::to_time_t(entry.time);
+    if (t != stamp_second) {
+        std::tm tm_buf;
+        localtime_r(&t, &tm_buf);
+
+        char text[32];
+        std::strftime(text, sizeof(text), "[%Y-%m-%d %H:%M:%S] ", &tm_buf);
+        stamp = text;
+        stamp_second = t;
+    }
+
+    // Compressed files have no byte offsets to index.
+    if (index && !compress) {
+        uint64_t offset = file_bytes + batch.size();
+        uint64_t end = offset + stamp.size() + entry.text.size() + 1;
+        index_writer.add(offset, end, t, entry.text.data(), entry.text.size());
+    }
+
+    batch += stamp;
+    batch += entry.text;
+    batch += '\n';
+}
+
+
+void LogSink::write_batch(const std::string& batch)
+{
+    if (!file) return;
+
+#ifdef HAVE_ZSTD
+    if (compress) {
+        // ZSTD_e_flush ends the batch on a block boundary: everything
+        // written so far can be decompressed even if the client dies.
+        ZSTD_inBuffer in{batch.data(), batch.size(), 0};
+        size_t remaining;
+        do {
+            ZSTD_outBuffer out{&zbuffer[0], zbuffer.size(), 0};
+            remaining = ZSTD_compressStream2(zstream, &out, &in, ZSTD_e_flush);
+            if (ZSTD_isError(remaining)) {
+                std::cerr << "zstd: " << ZSTD_getErrorName(remaining) << std::endl;
+                return;
+            }
+            write_file(out.dst, out.pos);
+        } while (remaining > 0);
+    } else
+#endif
+    {
+        write_file(batch.data(), batch.size());
+    }
+
+    std::fflush(file);
+
+    if (rotate_bytes > 0 && file_bytes >= rotate_bytes) {
+        close_file();
+        part++;
+        open_file();
+    }
+}
+
+
+void LogSink::write_file(const void* data, size_t size)
+{
+    if (size == 0) return;
+
+    if (std::fwrite(data, 1, size, file) != size)
+        std::cerr << "Log write failed" << std::endl;
+    file_bytes += size;
+}
+
+
+bool LogSink::open_file()
+{
+    std::string path = path_base;
+    if (part > 0)
+        path += "." + std::to_string(part);
+    path += compress ? ".txt.zst" : ".txt";
+
+    file = std::fopen(path.c_str(), "wb");
+    if (!file) {
+        std::cerr << "Cannot open log file " << path << std::endl;
+        return false;
+    }
+    file_bytes = 0;
+
+    if (index && !compress)
+        index_writer.open(path);
+
+#ifdef HAVE_ZSTD
+    if (compress) {
+        zstream = ZSTD_createCStream();
+        ZSTD_CCtx_setParameter(zstream, ZSTD_c_compressionLevel, LOG_ZSTD_LEVEL);
+        zbuffer.resize(ZSTD_CStreamOutSize());
+    }
+#endif
+    return true;
+}
+
+
+void LogSink::close_file()
+{
+    if (!file) return;
+
+#ifdef HAVE_ZSTD
+    if (zstream) {
+        ZSTD_inBuffer in{nullptr, 0, 0};
+        size_t remaining;
+        do {
+            ZSTD_outBuffer out{&zbuffer[0], zbuffer.size(), 0};
+            remaining = ZSTD_compressStream2(zstream, &out, &in, ZSTD_e_end);
+            if (ZSTD_isError(remaining)) break;
+            write_file(out.dst, out.pos);
+        } while (remaining > 0);
+
+        ZSTD_freeCStream(zstream);
+        zstream = nullptr;
+    }
+#endif
+
+    std::fclose(file);
+    file = nullptr;
+    index_writer.close();
+}
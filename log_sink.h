@@ -0,0 +1,165 @@
+// Asynchronous log file writer for the operator client. Producers push
+// lines into a bounded lock-free queue and return at once; a writer thread
+// drains it in batches, formats the timestamp once per second and writes
+// each batch with a single write and flush, optionally through a streaming
+// zstd compressor, starting a new file once the current one is big enough.
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <ctime>
+#include <memory>
+#include <string>
+#include <thread>
+
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#endif
+
+#include "log_index.h"
+
+
+// Bounded multi-producer/multi-consumer queue (Vyukov). Every cell carries a
+// sequence number telling whether it is free for the producer at a given
+// position or holds a value for the consumer, so push and pop each cost one
+// CAS and never block. A full queue makes push() fail instead of waiting.
+template <class T>
+class LogQueue {
+public:
+    explicit LogQueue(size_t capacity)
+    {
+        size_t size = 2;
+        while (size < capacity) size <<= 1;
+
+        mask = size - 1;
+        cells.reset(new Cell[size]);
+        for (size_t i = 0; i < size; i++)
+            cells[i].sequence.store(i, std::memory_order_relaxed);
+    }
+
+    bool push(T&& value)
+    {
+        size_t pos = enqueue_pos.load(std::memory_order_relaxed);
+        for (;;) {
+            Cell& cell = cells[pos & mask];
+            size_t seq = cell.sequence.load(std::memory_order_acquire);
+            intptr_t diff = (intptr_t)seq - (intptr_t)pos;
+
+            if (diff == 0) {
+                if (enqueue_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                    cell.value = std::move(value);
+                    cell.sequence.store(pos + 1, std::memory_order_release);
+                    return true;
+                }
+            } else if (diff < 0) {
+                return false;
+            } else {
+                pos = enqueue_pos.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+    bool pop(T& value)
+    {
+        size_t pos = dequeue_pos.load(std::memory_order_relaxed);
+        for (;;) {
+            Cell& cell = cells[pos & mask];
+            size_t seq = cell.sequence.load(std::memory_order_acquire);
+            intptr_t diff = (intptr_t)seq - (intptr_t)(pos + 1);
+
+            if (diff == 0) {
+                if (dequeue_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                    value = std::move(cell.value);
+                    cell.sequence.store(pos + mask + 1, std::memory_order_release);
+                    return true;
+                }
+            } else if (diff < 0) {
+                return false;
+            } else {
+                pos = dequeue_pos.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+    // Approximate while producers and the consumer are running.
+    size_t size() const
+    {
+        size_t in = enqueue_pos.load(std::memory_order_relaxed);
+        size_t out = dequeue_pos.load(std::memory_order_relaxed);
+        return in > out ? in - out : 0;
+    }
+
+private:
+    struct Cell {
+        std::atomic<size_t> sequence;
+        T value;
+    };
+
+    std::unique_ptr<Cell[]> cells;
+    size_t mask;
+
+    alignas(64) std::atomic<size_t> enqueue_pos{0};
+    alignas(64) std::atomic<size_t> dequeue_pos{0};
+};
+
+
+struct LogEntry {
+    std::chrono::system_clock::time_point time;
+    std::string text;
+};
+
+
+class LogSink {
+public:
+    explicit LogSink(size_t queue_size = 4096);
+    ~LogSink();
+
+    // Files are named <path_base>.txt, then <path_base>.1.txt, .2.txt, ...
+    // once rotate_bytes have been written to the current one (".txt.zst"
+    // with compression). Compression is ignored without HAVE_ZSTD. With
+    // index, each uncompressed file gets its log_index.h index as it grows.
+    bool open(const std::string& path_base, bool compress, size_t rotate_bytes, bool index = false);
+    void close();
+
+    // Any thread; stamps the line with the current time and never blocks.
+    // When the queue is full the line is dropped and counted.
+    void write(std::string text);
+
+    // For the metrics endpoint.
+    size_t queued() const { return queue.size(); }
+    uint64_t dropped_total() const { return dropped_lines.load(std::memory_order_relaxed); }
+
+private:
+    void run();
+
+    bool open_file();
+    void close_file();
+    void append_line(std::string& batch, const LogEntry& entry);
+    void write_batch(const std::string& batch);
+    void write_file(const void* data, size_t size);
+
+    LogQueue<LogEntry> queue;
+    std::atomic<bool> running{false};
+    std::atomic<size_t> dropped{0};             // since the last note in the log
+    std::atomic<uint64_t> dropped_lines{0};     // since start
+    std::thread writer;
+
+    std::string path_base;
+    bool compress = false;
+    size_t rotate_bytes = 0;
+    bool index = false;
+    LogIndexWriter index_writer;
+
+    FILE* file = nullptr;
+    int part = 0;
+    size_t file_bytes = 0;
+
+    std::time_t stamp_second = -1;
+    std::string stamp;
+
+#ifdef HAVE_ZSTD
+    ZSTD_CStream* zstream = nullptr;
+    std::string zbuffer;
+#endif
+};
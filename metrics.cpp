@@ -0,0 +1,216 @@
+#include "metrics.h"
+
+#include <algorithm>
+#include <cstdarg>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <mutex>
+
+#include <arpa/inet.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+
+// Metrics are globals; a function-local registry is constructed before the
+// first of them whatever the initialisation order of the files.
+static std::vector<const Metric*>& registry()
+{
+    static std::vector<const Metric*> metrics;
+    return metrics;
+}
+
+static std::mutex registry_mutex;
+
+
+Metric::Metric(const char* name, const char* help, const char* type)
+    : name(name), help(help), type(type)
+{
+    std::lock_guard<std::mutex> lock(registry_mutex);
+    registry().push_back(this);
+}
+
+
+static void append(std::string& out, const char* format, ...) __attribute__((format(printf, 2, 3)));
+
+static void append(std::string& out, const char* format, ...)
+{
+    char line[256];
+    va_list args;
+    va_start(args, format);
+    int n = std::vsnprintf(line, sizeof(line), format, args);
+    va_end(args);
+    if (n > 0) out.append(line, std::min<size_t>(n, sizeof(line) - 1));
+}
+
+
+void Metric::render(std::string& out) const
+{
+    append(out, "# HELP %s %s\n# TYPE %s %s\n", name, help, name, type);
+    render_values(out);
+}
+
+
+void MetricCounter::render_values(std::string& out) const
+{
+    append(out, "%s %llu\n", name, (unsigned long long)get());
+}
+
+
+void MetricGauge::render_values(std::string& out) const
+{
+    double v = reader ? reader() : value.load(std::memory_order_relaxed);
+    append(out, "%s %.9g\n", name, v);
+}
+
+
+MetricHistogram::MetricHistogram(const char* name, const char* help, std::initializer_list<double> list)
+    : Metric(name, help, "histogram")
+{
+    for (double bound : list)
+        if (bucket_count < METRICS_MAX_BUCKETS)
+            bounds[bucket_count++] = bound;
+}
+
+
+void MetricHistogram::observe(double value)
+{
+    int i = 0;
+    while (i < bucket_count && value > bounds[i])
+        i++;
+
+    buckets[i].fetch_add(1, std::memory_order_relaxed);
+    count.fetch_add(1, std::memory_order_relaxed);
+    if (value > 0)
+        sum_nano.fetch_add((uint64_t)(value * 1e9), std::memory_order_relaxed);
+}
+
+
+// Buckets are stored per range and rendered cumulative, as Prometheus
+// expects. A scrape racing observe() may see count and buckets a step
+// apart; the next scrape agrees again.
+void MetricHistogram::render_values(std::string& out) const
+{
+    uint64_t cumulative = 0;
+    for (int i = 0; i < bucket_count; i++) {
+        cumulative += buckets[i].load(std::memory_order_relaxed);
+        append(out, "%s_bucket{le=\"%.9g\"} %llu\n", name, bounds[i], (unsigned long long)cumulative);
+    }
+    cumulative += buckets[bucket_count].load(std::memory_order_relaxed);
+    append(out, "%s_bucket{le=\"+Inf\"} %llu\n", name, (unsigned long long)cumulative);
+    append(out, "%s_sum %.9g\n", name, sum_nano.load(std::memory_order_relaxed) / 1e9);
+    append(out, "%s_count %llu\n", name, (unsigned long long)count.load(std::memory_order_relaxed));
+}
+
+
+void MetricSet::render_values(std::string& out) const
+{
+    std::vector<MetricSample> samples;
+    reader(samples);
+    for (const MetricSample& sample : samples)
+        append(out, "%s{%s} %.9g\n", name, sample.labels.c_str(), sample.value);
+}
+
+
+void metrics_render(std::string& out)
+{
+    std::lock_guard<std::mutex> lock(registry_mutex);
+    for (const Metric* metric : registry())
+        metric->render(out);
+}
+
+
+MetricsServer::~MetricsServer()
+{
+    stop();
+}
+
+
+bool MetricsServer::start(int port)
+{
+    listen_sock = socket(AF_INET, SOCK_STREAM, 0);
+    if (listen_sock < 0) {
+        std::cerr << "Cannot create metrics socket" << std::endl;
+        return false;
+    }
+
+    int reuse = 1;
+    setsockopt(listen_sock, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+
+    sockaddr_in local{};
+    local.sin_family = AF_INET;
+    local.sin_port = htons(port);
+    local.sin_addr.s_addr = htonl(INADDR_ANY);
+
+    if (bind(listen_sock, (sockaddr*)&local, sizeof(local)) < 0 || listen(listen_sock, 8) < 0) {
+        std::cerr << "Cannot listen for metrics on port " << port << std::endl;
+        close(listen_sock);
+        listen_sock = -1;
+        return false;
+    }
+
+    running = true;
+    thread = std::thread(&MetricsServer::run, this);
+    return true;
+}
+
+
+void MetricsServer::stop()
+{
+    running = false;
+    if (thread.joinable())
+        thread.join();
+    if (listen_sock >= 0) {
+        close(listen_sock);
+        listen_sock = -1;
+    }
+}
+
+
+void MetricsServer::run()
+{
+    std::string body;
+    std::string response;
+    char request[1024];
+
+    while (running) {
+        // Wake up now and then to notice stop().
+        pollfd pfd{listen_sock, POLLIN, 0};
+        if (poll(&pfd, 1, 200) <= 0)
+            continue;
+
+        int client = accept(listen_sock, nullptr, nullptr);
+        if (client < 0)
+            continue;
+
+        timeval timeout{0, 200000};
+        setsockopt(client, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+        // The request line is all that matters; it arrives in the first read.
+        int n = recv(client, request, sizeof(request) - 1, 0);
+        request[n > 0 ? n : 0] = '\0';
+
+        body.clear();
+        const char* status = "200 OK";
+        if (std::strncmp(request, "GET /metrics ", 13) == 0 || std::strncmp(request, "GET / ", 6) == 0) {
+            metrics_render(body);
+        } else {
+            status = "404 Not Found";
+            body = "Try /metrics\n";
+        }
+
+        response.clear();
+        append(response, "HTTP/1.1 %s\r\nContent-Type: text/plain; version=0.0.4\r\n"
+                         "Content-Length: %zu\r\nConnection: close\r\n\r\n", status, body.size());
+        response += body;
+
+        size_t sent = 0;
+        while (sent < response.size()) {
+            ssize_t w = send(client, response.data() + sent, response.size() - sent, MSG_NOSIGNAL);
+            if (w <= 0) break;
+            sent += w;
+        }
+        close(client);
+    }
+}
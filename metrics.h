@@ -0,0 +1,134 @@
+// Process metrics for the operator client and the Raspberry Pi server,
+// served over HTTP in the Prometheus text format (GET /metrics).
+//
+// Metrics are globals that register themselves at startup. Updating one is
+// a relaxed atomic add or store, so they stay on all the time; the server
+// thread reads them when scraped and renders into a reused buffer.
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <initializer_list>
+#include <string>
+#include <thread>
+#include <vector>
+
+#define METRICS_MAX_BUCKETS  16
+
+
+class Metric {
+public:
+    Metric(const char* name, const char* help, const char* type);
+    virtual ~Metric() = default;
+
+    void render(std::string& out) const;
+
+protected:
+    virtual void render_values(std::string& out) const = 0;
+
+    const char* name;
+    const char* help;
+    const char* type;
+};
+
+
+// Either counted by the program or, with a reader, sampled when scraped
+// from a count kept elsewhere (in code that does not link the metrics).
+class MetricCounter : public Metric {
+public:
+    MetricCounter(const char* name, const char* help) : Metric(name, help, "counter") {}
+    MetricCounter(const char* name, const char* help, std::function<uint64_t()> reader)
+        : Metric(name, help, "counter"), reader(std::move(reader)) {}
+
+    void add(uint64_t n = 1) { value.fetch_add(n, std::memory_order_relaxed); }
+    uint64_t get() const { return reader ? reader() : value.load(std::memory_order_relaxed); }
+
+protected:
+    void render_values(std::string& out) const override;
+
+private:
+    std::atomic<uint64_t> value{0};
+    std::function<uint64_t()> reader;
+};
+
+
+// Either set by the program or, with a reader, sampled when scraped.
+class MetricGauge : public Metric {
+public:
+    MetricGauge(const char* name, const char* help) : Metric(name, help, "gauge") {}
+    MetricGauge(const char* name, const char* help, std::function<double()> reader)
+        : Metric(name, help, "gauge"), reader(std::move(reader)) {}
+
+    void set(double v) { value.store(v, std::memory_order_relaxed); }
+
+protected:
+    void render_values(std::string& out) const override;
+
+private:
+    std::atomic<double> value{0};
+    std::function<double()> reader;
+};
+
+
+// Fixed upper bounds, in seconds for durations. observe() finds the bucket
+// with a short linear scan and does three relaxed adds.
+class MetricHistogram : public Metric {
+public:
+    MetricHistogram(const char* name, const char* help, std::initializer_list<double> bounds);
+
+    void observe(double value);
+
+protected:
+    void render_values(std::string& out) const override;
+
+private:
+    double bounds[METRICS_MAX_BUCKETS];
+    int bucket_count = 0;
+    std::atomic<uint64_t> buckets[METRICS_MAX_BUCKETS + 1] = {};     // last one is +Inf
+    std::atomic<uint64_t> count{0};
+    std::atomic<uint64_t> sum_nano{0};                                // sum in units of 1e-9
+};
+
+
+// A family with one sample per label set, read when scraped; for things
+// that come and go, like video subscribers. Labels are given rendered,
+// e.g. subscriber="10.0.0.2:12346".
+struct MetricSample {
+    std::string labels;
+    double value;
+};
+
+class MetricSet : public Metric {
+public:
+    MetricSet(const char* name, const char* help, const char* type,
+              std::function<void(std::vector<MetricSample>&)> reader)
+        : Metric(name, help, type), reader(std::move(reader)) {}
+
+protected:
+    void render_values(std::string& out) const override;
+
+private:
+    std::function<void(std::vector<MetricSample>&)> reader;
+};
+
+
+// Renders every registered metric.
+void metrics_render(std::string& out);
+
+
+// One thread answering scrapes, one connection at a time.
+class MetricsServer {
+public:
+    ~MetricsServer();
+
+    bool start(int port);
+    void stop();
+
+private:
+    void run();
+
+    int listen_sock = -1;
+    std::atomic<bool> running{false};
+    std::thread thread;
+};
@@ -3,12 +3,25 @@
 #include <DHT.h>
 #include <math.h>
 
+#include "telemetry.h"
+
 #define DHT_PIN                9
 #define DHT_TYPE               DHT11
 
 #define TRIG_PIN               10
 #define ECHO_PIN               11
 #define CRITICAL_DISTANCE      10    // centimeters
+#define SONAR_PERIOD           30    // millis between pings
+#define SONAR_TIMEOUT          30000 // micros, a longer echo means nothing in range
+#define SONAR_HISTORY          6     // samples in the range-rate fit
+#define SONAR_JUMP             30    // centimeters, a larger step starts a new track
+#define SONAR_MAX_YAW_RATE     0.5   // rad/s, a faster turn sweeps the beam across surfaces
+
+#define BRAKE_TTC              500   // millis until CRITICAL_DISTANCE that triggers braking
+#define MIN_CLOSING_SPEED      3.0   // cm/s, slower approaches count as standing still
+#define OBSTACLE_CLEAR_TIME    300   // millis without danger before forward is released
+#define SLOWDOWN_DISTANCE      40    // centimeters past CRITICAL_DISTANCE where 'w' ramps down
+#define CRAWL_SPEED            80    // slowest PWM that still moves the robot
 
 #define MOTOR_LEFT             6
 #define MOTOR_RIGHT            5
@@ -16,21 +29,215 @@
 #define MOTOR_DIR_RIGHT        4
 
 #define SPEED                  150
-#define ROTATION_TIME          2000  // time to rotate 360 deg in millis
+#define ROTATION_TIME          2000  // time to rotate 360 deg in millis, turns give up after twice that
+
+#define WHEEL_SPEED            50.0  // cm/s at PWM 255 before calibration
+#define TRACK_WIDTH            14.0  // centimeters between the wheels
+#define MOTOR_TAU              0.12  // seconds, wheel speed lags the PWM like a first-order system
+#define POSE_PERIOD            200   // millis between pose reports while moving
 
 #define DISCONNECTION_DURATION 2000  // time to move backward when disconnected
+#define COMMAND_TIMEOUT        60    // millis without a command before the motors stop
+
+#define INSPECTION_DISTANCE    60    // centimeters to move forward in inspection
 
-#define INSPECTION_FORWARD     2000  // time to move forward in inspection
-#define INSPECTION_BACKWARD    2000  // time to move backward in inspection
+#define CALIBRATION_SETTLE     500   // millis for the wheels to stop before a range is taken
+#define CALIBRATION_DRIVE      1000  // millis backing away from the wall
+#define CALIBRATION_MIN_RANGE  30    // centimeters, the wall must be in this window
+#define CALIBRATION_MAX_RANGE  150
+#define CALIBRATION_TOLERANCE  0.15  // readings within this fraction of the wall range see the wall
+#define CALIBRATION_TURN_SPEED 100   // PWM while spinning past the wall
+#define CALIBRATION_TIMEOUT    15000
+
+#define TELEMETRY_RING         64    // bytes queued on top of the UART's own TX buffer
 
 DHT dht_sensor(DHT_PIN, DHT_TYPE);
 
 const unsigned long OBSTACLE_LOG_INTERVAL = 2000;
 
 
+// Diagnostics go out as fixed-size binary frames (telemetry.h) instead of
+// text, so no message strings occupy SRAM. Frames queue in a ring and drain
+// only as far as the UART's TX buffer has room, so a burst never stalls
+// loop(); a full ring drops the frame and reports the count later.
+class Telemetry {
+public:
+    void send(uint8_t code, int16_t v0 = 0, int16_t v1 = 0, int16_t v2 = 0);
+    void flush();
+
+private:
+    bool enqueue(uint8_t code, int16_t v0, int16_t v1, int16_t v2);
+
+    uint8_t ring[TELEMETRY_RING];
+    uint8_t head = 0;
+    uint8_t count = 0;
+    uint16_t dropped = 0;
+};
+
+
+void Telemetry::send(uint8_t code, int16_t v0, int16_t v1, int16_t v2)
+{
+    if (dropped > 0 && enqueue(TM_TX_OVERFLOW, dropped, 0, 0))
+        dropped = 0;
+
+    if (!enqueue(code, v0, v1, v2))
+        dropped++;
+
+    flush();
+}
+
+
+bool Telemetry::enqueue(uint8_t code, int16_t v0, int16_t v1, int16_t v2)
+{
+    if (TELEMETRY_RING - count < TELEMETRY_FRAME_SIZE)
+        return false;
+
+    uint8_t frame[TELEMETRY_FRAME_SIZE];
+    telemetry_pack(frame, code, millis(), v0, v1, v2);
+
+    for (uint8_t i = 0; i < TELEMETRY_FRAME_SIZE; i++)
+        ring[(head + count++) % TELEMETRY_RING] = frame[i];
+    return true;
+}
+
+
+void Telemetry::flush()
+{
+    int room = Serial.availableForWrite();
+    while (room-- > 0 && count > 0) {
+        Serial.write(ring[head]);
+        head = (head + 1) % TELEMETRY_RING;
+        count--;
+    }
+}
+
+
+Telemetry telemetry;
+
+
+// Compile-time pin access. With the pin number known at build time the port
+// and bit resolve to constants and each write is a single sbi/cbi instead of
+// the digitalWrite() table walk. Pins 0..7 are PORTD, 8..13 are PORTB.
+template <uint8_t PIN>
+struct FastPin {
+    static_assert(PIN < 14, "FastPin covers the digital pins of the ATmega328P");
+
+    static const uint8_t pin = PIN;
+    static const uint8_t mask = _BV(PIN < 8 ? PIN : PIN - 8);
+
+    static inline void output() { if (PIN < 8) DDRD |= mask;  else DDRB |= mask; }
+    static inline void input()  { if (PIN < 8) DDRD &= ~mask; else DDRB &= ~mask; }
+    static inline void high()   { if (PIN < 8) PORTD |= mask;  else PORTB |= mask; }
+    static inline void low()    { if (PIN < 8) PORTD &= ~mask; else PORTB &= ~mask; }
+    static inline void write(bool value) { if (value) high(); else low(); }
+    static inline bool read()   { return ((PIN < 8) ? PIND : PINB) & mask; }
+
+    static inline void enable_pin_change()
+    {
+        if (PIN < 8) { PCMSK2 |= mask; PCICR |= _BV(PCIE2); }
+        else         { PCMSK0 |= mask; PCICR |= _BV(PCIE0); }
+    }
+};
+
+
+// Output-compare unit behind each PWM-capable pin. The timers themselves are
+// configured by the Arduino core's init(), exactly as analogWrite() expects.
+template <uint8_t PIN> struct PwmTimer;
+
+template <> struct PwmTimer<6> {
+    static inline void duty(uint8_t d) { OCR0A = d; }
+    static inline void connect()       { TCCR0A |= _BV(COM0A1); }
+    static inline void disconnect()    { TCCR0A &= ~_BV(COM0A1); }
+};
+
+template <> struct PwmTimer<5> {
+    static inline void duty(uint8_t d) { OCR0B = d; }
+    static inline void connect()       { TCCR0A |= _BV(COM0B1); }
+    static inline void disconnect()    { TCCR0A &= ~_BV(COM0B1); }
+};
+
+template <> struct PwmTimer<9> {
+    static inline void duty(uint8_t d) { OCR1A = d; }
+    static inline void connect()       { TCCR1A |= _BV(COM1A1); }
+    static inline void disconnect()    { TCCR1A &= ~_BV(COM1A1); }
+};
+
+template <> struct PwmTimer<10> {
+    static inline void duty(uint8_t d) { OCR1B = d; }
+    static inline void connect()       { TCCR1A |= _BV(COM1B1); }
+    static inline void disconnect()    { TCCR1A &= ~_BV(COM1B1); }
+};
+
+template <> struct PwmTimer<11> {
+    static inline void duty(uint8_t d) { OCR2A = d; }
+    static inline void connect()       { TCCR2A |= _BV(COM2A1); }
+    static inline void disconnect()    { TCCR2A &= ~_BV(COM2A1); }
+};
+
+template <> struct PwmTimer<3> {
+    static inline void duty(uint8_t d) { OCR2B = d; }
+    static inline void connect()       { TCCR2A |= _BV(COM2B1); }
+    static inline void disconnect()    { TCCR2A &= ~_BV(COM2B1); }
+};
+
+
+template <uint8_t PIN>
+struct PwmPin : FastPin<PIN> {
+    // Same semantics as analogWrite(): 0 and 255 drive the pin statically,
+    // anything in between is handed to the timer.
+    static inline void write(uint8_t duty)
+    {
+        if (duty == 0 || duty == 255) {
+            PwmTimer<PIN>::disconnect();
+            FastPin<PIN>::write(duty == 255);
+        } else {
+            PwmTimer<PIN>::duty(duty);
+            PwmTimer<PIN>::connect();
+        }
+    }
+};
+
+
+struct WheelPins {
+    typedef PwmPin<MOTOR_LEFT>        motor_left;
+    typedef PwmPin<MOTOR_RIGHT>       motor_right;
+    typedef FastPin<MOTOR_DIR_LEFT>   dir_left;
+    typedef FastPin<MOTOR_DIR_RIGHT>  dir_right;
+    typedef FastPin<TRIG_PIN>         trig;
+    typedef FastPin<ECHO_PIN>         echo;
+};
+
+
+// Echo timing is captured by the pin-change interrupt, so loop() never sits
+// in pulseIn(); check_obstacle() only fires pings and collects the results.
+volatile bool echo_high = false;
+volatile bool echo_ready = false;
+volatile unsigned long echo_rise_time = 0;
+volatile unsigned long echo_width = 0;
+
+#if ECHO_PIN < 8
+ISR(PCINT2_vect)
+#else
+ISR(PCINT0_vect)
+#endif
+{
+    unsigned long now = micros();
+    bool level = FastPin<ECHO_PIN>::read();
+
+    if (level && !echo_high) {
+        echo_rise_time = now;
+    } else if (!level && echo_high) {
+        echo_width = now - echo_rise_time;
+        echo_ready = true;
+    }
+    echo_high = level;
+}
+
+
+template <class Pins>
 class Driver {
 public:
-    Driver(int left_pin, int right_pin, int left_dir_pin, int right_dir_pin, int motor_speed, int trig_pin, int echo_pin, int rotation_time); 
+    Driver(int motor_speed, int rotation_time);
     ~Driver();
     
     void set_motors(const int velo_left, const int velo_right);
@@ -50,11 +257,34 @@ public:
     void check_flags();
     void interrupt_actions();
 
+    void update_odometry();
+    void calibrate();
+    void reset_pose();
+
     char last_command = '0';
     unsigned long last_command_time = 0;
+    unsigned long last_receive_time = 0;
 
     bool obstacle = false;
     unsigned long last_obstacle_log_time = 0;
+    unsigned long last_danger_time = 0;
+
+    float range = -1;          // centimeters, latest sonar reading, -1 when nothing in range
+    float closing_speed = 0;   // cm/s, positive while the gap ahead shrinks
+
+    // Dead-reckoned pose from the commanded wheel speeds. heading is not
+    // wrapped, so closed-loop turns can compare against it directly.
+    float pose_x = 0;          // centimeters
+    float pose_y = 0;
+    float heading = 0;         // radians, counter-clockwise
+    float odometer = 0;        // centimeters driven, negative backward
+    float velocity = 0;        // cm/s
+    float yaw_rate = 0;        // rad/s
+
+    float wheel_speed = WHEEL_SPEED;   // cm/s at PWM 255, refined by calibrate()
+    float turn_gain = 1.0;             // measured / modelled yaw rate
+
+    bool calibrating = false;
 
     bool rotating = false;
     unsigned int current_rotation_duration; 
@@ -68,14 +298,47 @@ public:
     int inspection_state = 0;
 
 private:
-    int pin_motor_left;
-    int pin_motor_right;
-    int pin_motor_dir_left;
-    int pin_motor_dir_right;
+    void start_ping();
+    void update_sonar();
+    void add_range_sample(unsigned long time, float distance);
+    int forward_speed();
+
     int speed;
 
-    int pin_trig;
-    int pin_echo;
+    bool pinging = false;
+    unsigned long ping_time = 0;
+    unsigned long last_ping_millis = 0;
+
+    unsigned long sample_time[SONAR_HISTORY];
+    float sample_range[SONAR_HISTORY];
+    uint8_t sample_count = 0;
+    uint8_t sample_next = 0;
+    uint8_t range_samples = 0;          // bumped by every reading, wraps
+
+    float wheel_left = 0;               // cm/s, modelled
+    float wheel_right = 0;
+    unsigned long odometry_time = 0;
+    unsigned long last_pose_time = 0;
+    bool pose_reported_moving = false;
+
+    float turn_target = 0;              // heading where the current turn ends
+    float turn_direction = 1;
+
+    void calibration_failed(int reason);
+
+    uint8_t calibration_state = 0;
+    unsigned long calibration_start_time = 0;
+    unsigned long calibration_time = 0;
+    float calibration_range = 0;
+    float calibration_mark = 0;
+    float calibration_return = 0;
+    uint8_t calibration_seen = 0;
+
+    // Last setpoint written to the motor pins; set_motors() skips the I/O
+    // when nothing changes. 0x7FFF is outside the PWM range, forcing the
+    // first write.
+    int motor_left_setpoint = 0x7FFF;
+    int motor_right_setpoint = 0x7FFF;
 
     unsigned long rotation_start_time = 0;
     unsigned long disconnect_start_time = 0;
@@ -85,46 +348,50 @@ private:
     int rotation_speed;
     unsigned int rotation_duration; 
     
-    unsigned long inspection_forward_duration = INSPECTION_FORWARD;
-    unsigned long inspection_backward_duration = INSPECTION_BACKWARD;
+    float inspection_leg_start = 0;
+    float inspection_backward_distance = INSPECTION_DISTANCE;
 };
 
 
-Driver::Driver(int left_pin, int right_pin, int left_dir_pin, int right_dir_pin, int motor_speed, int trig_pin, int echo_pin, int rotation_time) 
-    : pin_motor_left(left_pin), pin_motor_right(right_pin), 
-      pin_motor_dir_left(left_dir_pin), pin_motor_dir_right(right_dir_pin), 
-      speed(motor_speed), pin_trig(trig_pin), pin_echo(echo_pin), rotation_duration(rotation_time)
+template <class Pins>
+Driver<Pins>::Driver(int motor_speed, int rotation_time) 
+    : speed(motor_speed), rotation_duration(rotation_time)
 {
-    pinMode(pin_motor_left, OUTPUT);
-    pinMode(pin_motor_right, OUTPUT);
-    pinMode(pin_motor_dir_left, OUTPUT);
-    pinMode(pin_motor_dir_right, OUTPUT);
+    Pins::motor_left::output();
+    Pins::motor_right::output();
+    Pins::dir_left::output();
+    Pins::dir_right::output();
     dht_sensor.begin();
 
-    pinMode(pin_trig, OUTPUT);
-    pinMode(pin_echo, INPUT);
+    Pins::trig::output();
+    Pins::echo::input();
+    Pins::echo::enable_pin_change();
     rotation_speed = 0.5 * speed;
 
     set_motors(0, 0);
 }
 
 
-Driver::~Driver()
+template <class Pins>
+Driver<Pins>::~Driver()
 {
     set_motors(0, 0);
 }
 
 
-char Driver::read_command()
+template <class Pins>
+char Driver<Pins>::read_command()
 {
     if (Serial.available() > 0) {
         char command = Serial.read();
-        int current_time = millis();
+        unsigned long current_time = millis();
 
         if (command == '\n' || command == '\r') {
             return '0';
         }
 
+        last_receive_time = current_time;
+
         if (last_command != command) {
             last_command = command;
             last_command_time = current_time;
@@ -136,20 +403,25 @@ char Driver::read_command()
 }
 
 
-void Driver::set_motors(const int velo_left, const int velo_right)
+template <class Pins>
+void Driver<Pins>::set_motors(const int velo_left, const int velo_right)
 {
-    int motor_dir_left  = (velo_left  >= 0) ? HIGH : LOW;
-    int motor_dir_right = (velo_right >= 0) ? HIGH : LOW;
+    if (velo_left == motor_left_setpoint && velo_right == motor_right_setpoint)
+        return;
+
+    motor_left_setpoint = velo_left;
+    motor_right_setpoint = velo_right;
 
-    digitalWrite(pin_motor_dir_left, motor_dir_left);
-    digitalWrite(pin_motor_dir_right, motor_dir_right);
+    Pins::dir_left::write(velo_left >= 0);
+    Pins::dir_right::write(velo_right >= 0);
 
-    analogWrite(pin_motor_left,  constrain(abs(velo_left),  0, 255));
-    analogWrite(pin_motor_right, constrain(abs(velo_right), 0, 255));
+    Pins::motor_left::write(constrain(abs(velo_left),  0, 255));
+    Pins::motor_right::write(constrain(abs(velo_right), 0, 255));
 }
 
 
-double Driver::get_temperature()
+template <class Pins>
+double Driver<Pins>::get_temperature()
 {
     float temp = dht_sensor.readTemperature();
     if (isnan(temp)) return -1.0;
@@ -157,7 +429,8 @@ double Driver::get_temperature()
 }
 
 
-double Driver::get_humidity()
+template <class Pins>
+double Driver<Pins>::get_humidity()
 {
     float hum = dht_sensor.readHumidity();
     if (isnan(hum)) return -1.0;
@@ -165,30 +438,300 @@ double Driver::get_humidity()
 }
 
 
-long Driver::get_distance() {
-    digitalWrite(pin_trig, LOW);
+template <class Pins>
+long Driver<Pins>::get_distance() {
+    return range < 0 ? -1 : (long)range;
+}
+
+
+template <class Pins>
+void Driver<Pins>::start_ping()
+{
+    noInterrupts();
+    echo_ready = false;
+    interrupts();
+
+    Pins::trig::low();
     delayMicroseconds(2);
-    digitalWrite(pin_trig, HIGH);
+    Pins::trig::high();
     delayMicroseconds(10);
-    digitalWrite(pin_trig, LOW);
+    Pins::trig::low();
 
-    long duration = pulseIn(pin_echo, HIGH, 30000);
-    
-    if (duration == 0) {
-        return -1;
-    } else {
-        return duration * 0.034 / 2;
+    pinging = true;
+    ping_time = micros();
+    last_ping_millis = millis();
+}
+
+
+template <class Pins>
+void Driver<Pins>::update_sonar()
+{
+    if (pinging) {
+        noInterrupts();
+        bool ready = echo_ready;
+        unsigned long rise = echo_rise_time;
+        unsigned long width = echo_width;
+        echo_ready = false;
+        interrupts();
+
+        if (ready) {
+            pinging = false;
+            add_range_sample(rise, width < SONAR_TIMEOUT ? width * 0.034 / 2 : -1);
+        } else if (micros() - ping_time >= SONAR_TIMEOUT) {
+            pinging = false;
+            add_range_sample(micros(), -1);
+        }
     }
+
+    // Without a target the module holds ECHO high for ~38 ms and ignores
+    // triggers until it drops.
+    if (!pinging && millis() - last_ping_millis >= SONAR_PERIOD && !Pins::echo::read())
+        start_ping();
 }
 
 
-void Driver::turn_on_degree(const int degree)
+template <class Pins>
+void Driver<Pins>::add_range_sample(unsigned long time, float distance)
+{
+    float previous = range;
+    range = distance;
+    range_samples++;
+
+    // While turning, consecutive readings come from different surfaces and
+    // their slope is not an approach speed.
+    if (distance < 0 || fabs(yaw_rate) > SONAR_MAX_YAW_RATE ||
+        (previous >= 0 && fabs(distance - previous) > SONAR_JUMP)) {
+        sample_count = 0;
+        closing_speed = 0;
+        if (distance < 0) return;
+    }
+
+    sample_time[sample_next] = time;
+    sample_range[sample_next] = distance;
+    sample_next = (sample_next + 1) % SONAR_HISTORY;
+    if (sample_count < SONAR_HISTORY) sample_count++;
+
+    if (sample_count < 3) {
+        closing_speed = 0;
+        return;
+    }
+
+    // Least-squares slope of range over the history, relative to the newest
+    // sample so the micros() wrap-around cancels out.
+    float st = 0, sr = 0, stt = 0, str = 0;
+    for (uint8_t i = 0; i < sample_count; i++) {
+        float t = (long)(sample_time[i] - time) / 1e6;
+        st  += t;
+        sr  += sample_range[i];
+        stt += t * t;
+        str += t * sample_range[i];
+    }
+
+    float denom = sample_count * stt - st * st;
+    if (denom > 0)
+        closing_speed = -(sample_count * str - st * sr) / denom;
+}
+
+
+// Full speed while the way is clear. Inside SLOWDOWN_DISTANCE the speed
+// ramps down with the gap, so the robot reaches CRITICAL_DISTANCE slowly
+// enough to stop on it.
+template <class Pins>
+int Driver<Pins>::forward_speed()
+{
+    if (range < 0 || range >= CRITICAL_DISTANCE + SLOWDOWN_DISTANCE)
+        return speed;
+
+    long v = CRAWL_SPEED + (long)((speed - CRAWL_SPEED) * (range - CRITICAL_DISTANCE) / SLOWDOWN_DISTANCE);
+    return constrain(v, CRAWL_SPEED, speed);
+}
+
+
+template <class Pins>
+void Driver<Pins>::update_odometry()
+{
+    unsigned long now = micros();
+    float dt = (now - odometry_time) / 1e6;
+    odometry_time = now;
+    if (dt > 0.1) dt = 0.1;     // first call, or loop() was held up
+
+    // Same first-order lag the wheels show on the floor, so the estimate
+    // keeps moving after set_motors(0, 0) the way the robot does.
+    float alpha = 1.0 - exp(-dt / MOTOR_TAU);
+    wheel_left  += (motor_left_setpoint  * wheel_speed / 255.0 - wheel_left)  * alpha;
+    wheel_right += (motor_right_setpoint * wheel_speed / 255.0 - wheel_right) * alpha;
+
+    velocity = 0.5 * (wheel_left + wheel_right);
+    yaw_rate = (wheel_right - wheel_left) / TRACK_WIDTH * turn_gain;
+
+    float mid_heading = heading + 0.5 * yaw_rate * dt;
+    pose_x += velocity * cos(mid_heading) * dt;
+    pose_y += velocity * sin(mid_heading) * dt;
+    heading += yaw_rate * dt;
+    odometer += velocity * dt;
+
+    // Report while moving, plus once more to deliver the resting pose.
+    bool moving = fabs(velocity) > 0.5 || fabs(yaw_rate) > 0.01;
+    if ((moving || pose_reported_moving) && millis() - last_pose_time >= POSE_PERIOD) {
+        // Wrapped to -180..180 deg for the report; avr-libc has no remainder().
+        float wrapped = atan2(sin(heading), cos(heading));
+        telemetry.send(TM_POSE, pose_x * 10, pose_y * 10, wrapped * 1800 / M_PI);
+        last_pose_time = millis();
+        pose_reported_moving = moving;
+    }
+}
+
+
+template <class Pins>
+void Driver<Pins>::reset_pose()
+{
+    pose_x = 0;
+    pose_y = 0;
+    heading = 0;
+    telemetry.send(TM_POSE, 0, 0, 0);
+}
+
+
+// Self-calibration against a wall 30..150 cm straight ahead. Backing away
+// and comparing the sonar range change with the odometer gives the wheel
+// speed per PWM; spinning in place and timing two passes of the sonar over
+// the same wall gives the true yaw rate. Both drift with battery voltage
+// and floor surface, so run it at the start of a session.
+template <class Pins>
+void Driver<Pins>::calibrate()
+{
+    unsigned long now = millis();
+
+    if (!calibrating) {
+        telemetry.send(TM_CALIBRATION_STARTED);
+        calibrating = true;
+        calibration_state = 0;
+        calibration_start_time = now;
+        calibration_time = now;
+        set_motors(0, 0);
+        return;
+    }
+
+    if (now - calibration_start_time >= CALIBRATION_TIMEOUT) {
+        calibration_failed(3);
+        return;
+    }
+
+    bool new_sample = range_samples != calibration_seen;
+    calibration_seen = range_samples;
+    bool wall_in_view = range > 0 && fabs(range - calibration_range) < calibration_range * CALIBRATION_TOLERANCE;
+
+    switch (calibration_state) {
+        case 0:     // standing still, take the starting range
+            if (now - calibration_time < CALIBRATION_SETTLE) break;
+
+            if (range < CALIBRATION_MIN_RANGE || range > CALIBRATION_MAX_RANGE) {
+                calibration_failed(1);
+                break;
+            }
+            calibration_range = range;
+            calibration_mark = odometer;
+            calibration_time = now;
+            set_motors(-speed, -speed);
+            calibration_state = 1;
+            break;
+
+        case 1:     // backing away from the wall
+            if (now - calibration_time < CALIBRATION_DRIVE) break;
+
+            set_motors(0, 0);
+            calibration_time = now;
+            calibration_state = 2;
+            break;
+
+        case 2:     // stopped again, compare the sonar with the odometer
+            if (now - calibration_time < CALIBRATION_SETTLE) break;
+            {
+                float measured = range - calibration_range;
+                float modelled = calibration_mark - odometer;
+                float ratio = (range > 0 && modelled > 5) ? measured / modelled : 0;
+
+                if (ratio < 0.5 || ratio > 2.0) {
+                    calibration_failed(2);
+                    break;
+                }
+
+                wheel_speed *= ratio;
+                calibration_return = measured;
+            }
+            calibration_mark = odometer;
+            set_motors(speed, speed);
+            calibration_state = 3;
+            break;
+
+        case 3:     // driving back to the starting spot
+            if (odometer - calibration_mark + fabs(velocity) * MOTOR_TAU < calibration_return) break;
+
+            set_motors(0, 0);
+            calibration_time = now;
+            calibration_state = 4;
+            break;
+
+        case 4:     // stopped facing the wall, start spinning
+            if (now - calibration_time < CALIBRATION_SETTLE) break;
+
+            if (range > 0) calibration_range = range;
+            calibration_mark = heading;
+            set_motors(-CALIBRATION_TURN_SPEED, CALIBRATION_TURN_SPEED);
+            calibration_state = 5;
+            break;
+
+        // Time the spin between two entries of the wall into the sonar beam,
+        // not from the start: the robot is still accelerating there. A pass
+        // only counts after half a modelled turn, so nearby clutter seen at
+        // the edge of the beam does not end the lap early.
+        case 5:     // wall leaves the beam
+            if (new_sample && !wall_in_view) calibration_state = 6;
+            break;
+
+        case 6:     // first pass: mark the heading
+            if (new_sample && wall_in_view && heading - calibration_mark > M_PI) {
+                calibration_mark = heading;
+                calibration_state = 7;
+            }
+            break;
+
+        case 7:
+            if (new_sample && !wall_in_view) calibration_state = 8;
+            break;
+
+        case 8:     // second pass: one full turn since the mark
+            if (new_sample && wall_in_view && heading - calibration_mark > M_PI) {
+                turn_gain *= 2 * M_PI / (heading - calibration_mark);
+                set_motors(0, 0);
+                calibrating = false;
+                telemetry.send(TM_CALIBRATION, wheel_speed * 10, turn_gain * 1000);
+            }
+            break;
+    }
+}
+
+
+template <class Pins>
+void Driver<Pins>::calibration_failed(int reason)
+{
+    set_motors(0, 0);
+    calibrating = false;
+    telemetry.send(TM_CALIBRATION_FAILED, reason);
+}
+
+
+template <class Pins>
+void Driver<Pins>::turn_on_degree(const int degree)
 {
     if (!rotating)
     {
-        Serial.println("Rotation started");
+        telemetry.send(TM_ROTATION_STARTED);
         rotation_start_time = millis();
-        current_rotation_duration = (ROTATION_TIME / 360.0) * abs(degree);
+        current_rotation_duration = 2 * (ROTATION_TIME / 360.0) * abs(degree);
+
+        turn_direction = (degree >= 0) ? 1 : -1;
+        turn_target = heading + degree * M_PI / 180.0;
 
         int rotation_left_speed  = (degree >= 0) ? -speed : speed;
         int rotation_right_speed = (degree >= 0) ?  speed : -speed;
@@ -198,7 +741,13 @@ void Driver::turn_on_degree(const int degree)
         return;
     }
 
-    if (millis() - rotation_start_time >= current_rotation_duration)
+    // Cut the motors early by the angle the wheels still coast through
+    // (yaw_rate * MOTOR_TAU for a first-order lag), so the robot comes to
+    // rest on the target. The time limit only catches a stalled robot.
+    float remaining = (turn_target - heading) * turn_direction;
+    float coast = fabs(yaw_rate) * MOTOR_TAU;
+
+    if (remaining <= coast || millis() - rotation_start_time >= current_rotation_duration)
     {
         set_motors(0, 0);
         rotating = false;
@@ -207,11 +756,12 @@ void Driver::turn_on_degree(const int degree)
 }
 
 
-void Driver::connection_lost_case()
+template <class Pins>
+void Driver<Pins>::connection_lost_case()
 {
     if (connection)
     {
-        Serial.println("Connection lost. Moving backward");
+        telemetry.send(TM_CONNECTION_LOST);
         connection = false;
         disconnect_start_time = millis();
         set_motors(-speed, -speed);
@@ -226,18 +776,22 @@ void Driver::connection_lost_case()
 }
 
 
-void Driver::inspection()
+template <class Pins>
+void Driver<Pins>::inspection()
 {
     if (!inspecting)
     {
-        Serial.println("Inspection started");
+        telemetry.send(TM_INSPECTION_STARTED);
         inspecting = true;
         inspection_state = 0;
         inspection_start_time = millis();
+        inspection_leg_start = odometer;
         return;
     }
 
     unsigned long now = millis();
+    float travelled = fabs(odometer - inspection_leg_start);
+    float coast = fabs(velocity) * MOTOR_TAU;
 
     switch (inspection_state)
     {
@@ -246,18 +800,18 @@ void Driver::inspection()
             {
                 set_motors(0, 0);
                 inspection_pause_time = now;
-                inspection_backward_duration = now - inspection_start_time;
+                inspection_backward_distance = travelled + coast;
                 inspection_state = 1;
                 break;
             }
 
             set_motors(speed, speed);
 
-            if (now - inspection_start_time >= inspection_forward_duration)
+            if (travelled + coast >= INSPECTION_DISTANCE)
             {
                 set_motors(0, 0);
                 inspection_pause_time = now;
-                inspection_backward_duration = inspection_forward_duration;
+                inspection_backward_distance = INSPECTION_DISTANCE;
                 inspection_state = 1;
             }
             break;
@@ -274,6 +828,7 @@ void Driver::inspection()
             if (!rotating)
             {
                 inspection_start_time = millis();
+                inspection_leg_start = odometer;
                 inspection_state = 3;
             }
             break;
@@ -281,7 +836,7 @@ void Driver::inspection()
         case 3:
             set_motors(-speed, -speed);
 
-            if (now - inspection_start_time >= inspection_backward_duration)
+            if (travelled + coast >= inspection_backward_distance)
             {
                 set_motors(0, 0);
                 inspecting = false;
@@ -292,11 +847,12 @@ void Driver::inspection()
 }
 
 
-void Driver::get_command_wheels(char command)
+template <class Pins>
+void Driver<Pins>::get_command_wheels(char command)
 {
     if ((command == 'w' || command == 'a' || command == 's' ||
         command == 'd' || command == 'x' || command == 'q' || command == 'e') &&
-        (rotating || inspecting || !connection)) {
+        (rotating || inspecting || calibrating || !connection)) {
         interrupt_actions();
     }
     
@@ -304,9 +860,10 @@ void Driver::get_command_wheels(char command)
         case 'w':
             if (obstacle) {
                 set_motors(0, 0);
-                Serial.println("Forward blocked by obstacle");
+                telemetry.send(TM_FORWARD_BLOCKED);
             } else {
-                set_motors(speed, speed);
+                int forward = forward_speed();
+                set_motors(forward, forward);
             }
             break;
         case 's': 
@@ -331,7 +888,8 @@ void Driver::get_command_wheels(char command)
 }
 
 
-void Driver::get_command_other(char command)
+template <class Pins>
+void Driver<Pins>::get_command_other(char command)
 {
     switch (command) {
         case 'o':
@@ -340,68 +898,92 @@ void Driver::get_command_other(char command)
         case 'c':
             inspection();
             break;
+        case 'k':
+            calibrate();
+            break;
+        case 'z':
+            reset_pose();
+            break;
         case 'f':
             {
                 double temp = get_temperature();
                 double hum = get_humidity();
                 long dist = get_distance();
                 
-                Serial.print("Sensors -> Temp: ");
-                Serial.print(temp);
-                Serial.print(" C, Hum: ");
-                Serial.print(hum);
-                Serial.print(" %, Dist: ");
-                Serial.print(dist);
-                Serial.println(" cm");
+                telemetry.send(TM_SENSORS, temp * 100, hum * 100, dist);
             }
             break;
     }
 }
 
 
-void Driver::check_obstacle()
+template <class Pins>
+void Driver<Pins>::check_obstacle()
 {
-    long distance = get_distance();
+    update_sonar();
     unsigned long current_time = millis();
 
-    if (distance > 0 && distance < CRITICAL_DISTANCE) {
+    // Brake on time-to-collision: how long until the gap shrinks to
+    // CRITICAL_DISTANCE at the measured closing speed. The faster the
+    // approach, the earlier the robot stops.
+    //
+    // A stopped robot has no closing speed, so TTC alone would release the
+    // latch right in front of the obstacle and let 'w' creep into it. The
+    // range alone keeps it while there is no room to stop from CRAWL_SPEED:
+    // one sonar period to see the limit, then the wheels coast v * MOTOR_TAU.
+    float crawl_stop = CRAWL_SPEED * wheel_speed / 255.0 * (SONAR_PERIOD / 1000.0 + MOTOR_TAU);
+    bool danger = false;
+    if (range > 0) {
+        if (range < CRITICAL_DISTANCE + crawl_stop) {
+            danger = true;
+        } else if (closing_speed > MIN_CLOSING_SPEED) {
+            float ttc = (range - CRITICAL_DISTANCE) / closing_speed * 1000.0;
+            danger = ttc < BRAKE_TTC;
+        }
+    }
+
+    if (danger) {
+        last_danger_time = current_time;
+
         if (!obstacle) {
             obstacle = true;
             last_obstacle_log_time = current_time;
-            Serial.println("Obstacle detected! Forward blocked");
+            telemetry.send(TM_OBSTACLE_DETECTED, range * 10, constrain(closing_speed * 10, -32767, 32767));
             
             if (last_command == 'w') {
                 set_motors(0, 0);
-                Serial.println("Stopping forward motion due to obstacle");
+                telemetry.send(TM_OBSTACLE_STOP);
             }
         } 
         else if (current_time - last_obstacle_log_time >= OBSTACLE_LOG_INTERVAL) {
-            Serial.println("Obstacle still present");
+            telemetry.send(TM_OBSTACLE_PRESENT, range * 10);
             last_obstacle_log_time = current_time;
         }
-    } else {
-        if (obstacle) {
-            obstacle = false;
-            Serial.println("Obstacle cleared");
-        }
+    } else if (obstacle && current_time - last_danger_time >= OBSTACLE_CLEAR_TIME) {
+        obstacle = false;
+        telemetry.send(TM_OBSTACLE_CLEARED);
     }
 }
 
 
-void Driver::check_flags()
+template <class Pins>
+void Driver<Pins>::check_flags()
 {
     if (!connection) connection_lost_case();
     if (rotating) turn_on_degree(0);
     if (inspecting) inspection(); 
+    if (calibrating) calibrate();
 }
 
 
-void Driver::interrupt_actions()
+template <class Pins>
+void Driver<Pins>::interrupt_actions()
 {
-    Serial.println("Action interrupted");
+    telemetry.send(TM_ACTION_INTERRUPTED);
 
     rotating = false;
     inspecting = false;
+    calibrating = false;
     connection = true;
 
     inspection_state = 0;
@@ -410,28 +992,20 @@ void Driver::interrupt_actions()
 }
 
 
-Driver Wheels(
-    MOTOR_LEFT,
-    MOTOR_RIGHT,
-    MOTOR_DIR_LEFT,
-    MOTOR_DIR_RIGHT,
-    SPEED,
-    TRIG_PIN,
-    ECHO_PIN,
-    ROTATION_TIME
-);
+Driver<WheelPins> Wheels(SPEED, ROTATION_TIME);
 
 
 void setup()
 {
     Serial.begin(115200); 
     delay(1000);
-    Serial.println("Arduino started");
+    telemetry.send(TM_BOOT);
 }
 
 
 void loop()
 {    
+    Wheels.update_odometry();
     Wheels.check_obstacle();
     Wheels.check_flags();
     
@@ -440,11 +1014,15 @@ void loop()
         Wheels.get_command_wheels(command);
         Wheels.get_command_other(command);
     } else {
-        if (!Wheels.rotating && !Wheels.inspecting && Wheels.connection)
+        // The operator repeats held keys every 20 ms; stop once they stop
+        // arriving, not on the first iteration that happens to see no byte.
+        if (!Wheels.rotating && !Wheels.inspecting && !Wheels.calibrating && Wheels.connection &&
+            millis() - Wheels.last_receive_time >= COMMAND_TIMEOUT)
         {
             Wheels.set_motors(0, 0);
         }
     }
 
+    telemetry.flush();
     delay(10);
 }
\ No newline at end of file
@@ -0,0 +1,78 @@
+#include "motion_gate.h"
+
+#include <algorithm>
+
+
+MotionDecision MotionGate::full(const cv::Mat& frame, cv::Rect& region)
+{
+    small.copyTo(reference);
+    since_full = 0;
+    region = cv::Rect(0, 0, frame.cols, frame.rows);
+    return MOTION_FULL;
+}
+
+
+MotionDecision MotionGate::update(const cv::Mat& frame, cv::Rect& region)
+{
+    // Bilinear at a 4x reduction averages 2x2 of every 4x4 pixels: enough
+    // to calm the encoder's noise, at a fifth of the cost of INTER_AREA.
+    cv::resize(frame, small_color, cv::Size(MOTION_WIDTH, MOTION_HEIGHT), 0, 0, cv::INTER_LINEAR);
+    cv::cvtColor(small_color, small, cv::COLOR_BGR2GRAY);
+
+    if (reference.empty() || ++since_full >= MOTION_REFRESH)
+        return full(frame, region);
+
+    // Changed pixels, then the share of them per block: INTER_AREA by a
+    // whole factor averages each block exactly.
+    const int grid_w = MOTION_WIDTH / MOTION_BLOCK;
+    const int grid_h = MOTION_HEIGHT / MOTION_BLOCK;
+    cv::absdiff(small, reference, diff);
+    cv::threshold(diff, diff, MOTION_PIXEL_DELTA, 255, cv::THRESH_BINARY);
+    cv::resize(diff, blocks, cv::Size(grid_w, grid_h), 0, 0, cv::INTER_AREA);
+    cv::threshold(blocks, blocks, 255 * MOTION_BLOCK_CHANGED, 255, cv::THRESH_BINARY);
+
+    cv::findNonZero(blocks, changed);
+    if (changed.empty())
+        return MOTION_SKIP;
+    if (changed.size() > MOTION_FULL_FRACTION * grid_w * grid_h)
+        return full(frame, region);
+
+    cv::Rect area = cv::boundingRect(changed);
+    area.x -= MOTION_CROP_MARGIN;
+    area.y -= MOTION_CROP_MARGIN;
+    area.width += 2 * MOTION_CROP_MARGIN;
+    area.height += 2 * MOTION_CROP_MARGIN;
+    area &= cv::Rect(0, 0, grid_w, grid_h);
+
+    // A square in frame pixels, so the network sees the crop undistorted,
+    // and not so small that a person in it lacks context.
+    double sx = (double)frame.cols / grid_w;
+    double sy = (double)frame.rows / grid_h;
+    int side = std::max({(int)(area.width * sx), (int)(area.height * sy), MOTION_CROP_MIN});
+    side = std::min({side, frame.cols, frame.rows});
+    if ((double)side * side > MOTION_FULL_FRACTION * frame.cols * frame.rows)
+        return full(frame, region);
+
+    int cx = (int)((area.x + area.width / 2.0) * sx);
+    int cy = (int)((area.y + area.height / 2.0) * sy);
+    region.x = std::min(std::max(cx - side / 2, 0), frame.cols - side);
+    region.y = std::min(std::max(cy - side / 2, 0), frame.rows - side);
+    region.width = side;
+    region.height = side;
+
+    // The detections are current inside the crop from now on.
+    int x0 = region.x * MOTION_WIDTH / frame.cols;
+    int y0 = region.y * MOTION_HEIGHT / frame.rows;
+    int x1 = ((region.x + side) * MOTION_WIDTH + frame.cols - 1) / frame.cols;
+    int y1 = ((region.y + side) * MOTION_HEIGHT + frame.rows - 1) / frame.rows;
+    cv::Rect taken = cv::Rect(x0, y0, x1 - x0, y1 - y0) & cv::Rect(0, 0, MOTION_WIDTH, MOTION_HEIGHT);
+    small(taken).copyTo(reference(taken));
+    return MOTION_REGION;
+}
+
+
+void MotionGate::reset()
+{
+    reference.release();
+    since_full = 0;
+}
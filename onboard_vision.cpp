@@ -0,0 +1,153 @@
+#include "onboard_vision.h"
+#include "telemetry.h"
+
+#include <sys/resource.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <iostream>
+
+
+bool parse_onboard_video(const std::string& name, OnboardVideo& video)
+{
+    if (name == "full") video = ONBOARD_VIDEO_FULL;
+    else if (name == "thumbnail") video = ONBOARD_VIDEO_THUMBNAIL;
+    else if (name == "off") video = ONBOARD_VIDEO_OFF;
+    else return false;
+    return true;
+}
+
+
+std::string onboard_vision_pipeline(OnboardVideo video, int bitrate_kbps,
+                                    const std::function<std::string(int bitrate_kbps, int key_interval)>& video_tail)
+{
+    // The detector takes the newest frame whenever it is free; frames that
+    // arrive while it works are dropped in front of the appsink, never
+    // queued, so a slow network lowers the rate instead of adding latency.
+    std::string pipeline =
+        "tee name=split "
+        "split. ! queue leaky=downstream max-size-buffers=1 ! "
+        "videorate drop-only=true ! videoscale ! videoconvert ! "
+        "video/x-raw, format=BGR, width=" + std::to_string(ONBOARD_WIDTH) +
+        ", height=" + std::to_string(ONBOARD_HEIGHT) + ", framerate=" + std::to_string(ONBOARD_FPS) + "/1 ! "
+        "appsink name=vision max-buffers=1 drop=true sync=false";
+
+    if (video == ONBOARD_VIDEO_FULL) {
+        pipeline += " split. ! queue leaky=downstream max-size-buffers=2 ! " + video_tail(bitrate_kbps, 0);
+    } else if (video == ONBOARD_VIDEO_THUMBNAIL) {
+        // A key frame every two seconds, so a viewer joining the slow
+        // stream does not wait for x264enc's default 250 frames.
+        pipeline += " split. ! queue leaky=downstream max-size-buffers=2 ! "
+                    "videorate drop-only=true ! videoscale ! "
+                    "video/x-raw, width=" + std::to_string(ONBOARD_THUMB_WIDTH) +
+                    ", height=" + std::to_string(ONBOARD_THUMB_HEIGHT) +
+                    ", framerate=" + std::to_string(ONBOARD_THUMB_FPS) + "/1 ! " +
+                    video_tail(ONBOARD_THUMB_BITRATE, 2 * ONBOARD_THUMB_FPS);
+    }
+    return pipeline;
+}
+
+
+bool onboard_pull_frame(GstElement* appsink, cv::Mat& frame, GstClockTime timeout)
+{
+    GstSample* sample = nullptr;
+    g_signal_emit_by_name(appsink, "try-pull-sample", timeout, &sample);
+    if (!sample)
+        return false;
+
+    bool ok = false;
+    GstBuffer* buffer = gst_sample_get_buffer(sample);
+    GstMapInfo map;
+    if (buffer && gst_buffer_map(buffer, &map, GST_MAP_READ)) {
+        if (map.size >= (size_t)ONBOARD_WIDTH * ONBOARD_HEIGHT * 3) {
+            cv::Mat(ONBOARD_HEIGHT, ONBOARD_WIDTH, CV_8UC3, map.data).copyTo(frame);
+            ok = true;
+        }
+        gst_buffer_unmap(buffer, &map);
+    }
+    gst_sample_unref(sample);
+    return ok;
+}
+
+
+double process_cpu_seconds()
+{
+    rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_utime.tv_sec + usage.ru_utime.tv_usec / 1e6 +
+           usage.ru_stime.tv_sec + usage.ru_stime.tv_usec / 1e6;
+}
+
+
+static double wall_seconds()
+{
+    return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+
+bool OnboardVision::load(const std::string& model_path)
+{
+    try {
+        net = load_detector(model_path, false);
+    } catch (const cv::Exception& e) {
+        std::cerr << "Cannot read model " << model_path << ": " << e.what() << std::endl;
+        return false;
+    }
+    if (net.empty()) {
+        std::cerr << "Cannot read model " << model_path << std::endl;
+        return false;
+    }
+
+    last_cpu = process_cpu_seconds();
+    last_wall = wall_seconds();
+    return true;
+}
+
+
+// A fraction of the frame in 1/256 steps, as TM_VISION_OBJECT carries it.
+static int fraction(int value, int size)
+{
+    return std::min(255, std::max(0, value * 256 / size));
+}
+
+
+void vision_records(const Detections& detections, cv::Size frame_size, uint32_t time_ms,
+                    int inference_ms, int cpu_percent, std::vector<uint8_t>& datagram)
+{
+    datagram.resize((1 + detections.kept.size()) * TELEMETRY_FRAME_SIZE);
+    uint8_t* record = datagram.data();
+    telemetry_pack(record, TM_VISION_FRAME, time_ms, (int16_t)detections.kept.size(),
+                   (int16_t)inference_ms, (int16_t)cpu_percent);
+
+    // parse_detections() only keeps people: COCO class 0.
+    for (int idx : detections.kept) {
+        const cv::Rect& box = detections.boxes[idx];
+        int score = std::min(255, (int)std::lround(detections.confidences[idx] * 255));
+        int x = fraction(box.x, frame_size.width), y = fraction(box.y, frame_size.height);
+        int w = fraction(box.width, frame_size.width), h = fraction(box.height, frame_size.height);
+        record += TELEMETRY_FRAME_SIZE;
+        telemetry_pack(record, TM_VISION_OBJECT, time_ms, (int16_t)(0 << 8 | score), (int16_t)(x << 8 | y),
+                       (int16_t)(w << 8 | h));
+    }
+}
+
+
+void OnboardVision::detect(const cv::Mat& frame, uint32_t time_ms, std::vector<uint8_t>& datagram)
+{
+    auto started = std::chrono::steady_clock::now();
+    detection_blob(frame, blob, ONBOARD_INPUT_SIZE);
+    cv::Mat output = run_detector(net, blob);
+    parse_detections(output, detections, cv::Rect(0, 0, frame.cols, frame.rows));
+    suppress_detections(detections);
+    inference_seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - started).count();
+
+    double cpu = process_cpu_seconds(), wall = wall_seconds();
+    if (wall > last_wall)
+        cpu_percent = (int)std::lround(100 * (cpu - last_cpu) / (wall - last_wall));
+    last_cpu = cpu;
+    last_wall = wall;
+
+    vision_records(detections, frame.size(), time_ms, (int)std::lround(inference_seconds * 1000), cpu_percent,
+                   datagram);
+}
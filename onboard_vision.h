@@ -0,0 +1,79 @@
+// Person detection on the Raspberry Pi itself, for links too weak for the
+// 2 Mbit/s video. The camera frames are split: a small CPU network runs on
+// downscaled frames and its boxes go to the operator as telemetry records
+// (TM_VISION_FRAME, TM_VISION_OBJECT) on the log port, a few hundred bytes
+// a second, while the video drops to a thumbnail or stops.
+//
+// Used by raspberry.cpp and, over videotestsrc, by robot_standin.cpp.
+#pragma once
+
+#include "detection.h"
+
+#include <gst/gst.h>
+
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <vector>
+
+#define ONBOARD_MODEL          "yolov8n_320.onnx"  // YOLOv8 exported for a 320 input, int8 if it can be
+#define ONBOARD_INPUT_SIZE     320     // network input, pixels per side
+#define ONBOARD_WIDTH          320     // frames detected on
+#define ONBOARD_HEIGHT         240
+#define ONBOARD_FPS            5       // frames per second detected at most
+#define ONBOARD_THUMB_WIDTH    160     // thumbnail video
+#define ONBOARD_THUMB_HEIGHT   120
+#define ONBOARD_THUMB_FPS      2
+#define ONBOARD_THUMB_BITRATE  48      // kbit/s
+#define ONBOARD_REPORT         10      // seconds between bandwidth and CPU lines
+
+
+enum OnboardVideo {
+    ONBOARD_VIDEO_FULL,         // the usual video, detection on top
+    ONBOARD_VIDEO_THUMBNAIL,    // ONBOARD_THUMB_* instead
+    ONBOARD_VIDEO_OFF,          // detections only
+};
+
+// "full", "thumbnail" or "off"; false for anything else.
+bool parse_onboard_video(const std::string& name, OnboardVideo& video);
+
+// Everything after the decoded camera frames: a tee into an appsink named
+// "vision" (BGR, ONBOARD_WIDTH x ONBOARD_HEIGHT, newest frame only) and,
+// unless the video is off, the scaled video handed to video_tail with the
+// bitrate and key frame interval to encode it at; on the Pi video_tail is
+// video_fanout_pipeline.
+std::string onboard_vision_pipeline(OnboardVideo video, int bitrate_kbps,
+                                    const std::function<std::string(int bitrate_kbps, int key_interval)>& video_tail);
+
+// Waits up to timeout for the next frame from the "vision" appsink.
+bool onboard_pull_frame(GstElement* appsink, cv::Mat& frame, GstClockTime timeout);
+
+// User and system CPU time of this process.
+double process_cpu_seconds();
+
+// Replaces datagram with the records of one detected frame, stamped time_ms:
+// one TM_VISION_FRAME and a TM_VISION_OBJECT per box kept by NMS, boxes in
+// pixels of frame_size. Also used by detection_relay.cpp.
+void vision_records(const Detections& detections, cv::Size frame_size, uint32_t time_ms,
+                    int inference_ms, int cpu_percent, std::vector<uint8_t>& datagram);
+
+
+class OnboardVision {
+public:
+    // CPU backend; false if the model cannot be read.
+    bool load(const std::string& model_path);
+
+    // Detects in one frame and replaces datagram with its records, stamped
+    // time_ms: one TM_VISION_FRAME and a TM_VISION_OBJECT per box.
+    void detect(const cv::Mat& frame, uint32_t time_ms, std::vector<uint8_t>& datagram);
+
+    double inference_seconds = 0;   // of the last frame
+    int cpu_percent = 0;            // of one core, since the frame before
+
+private:
+    cv::dnn::Net net;
+    cv::Mat blob;
+    Detections detections;
+    double last_cpu = 0;
+    double last_wall = 0;
+};
@@ -2,7 +2,8 @@
 #include <QApplication>
 #include <QWidget>
 #include <QLabel>
-#include <QTextEdit>
+#include <QPlainTextEdit>
+#include <QStringList>
 #include <QVBoxLayout>
 #include <QKeyEvent>
 #include <QTimer>
@@ -29,6 +30,19 @@
 #include <iomanip>
 #include <fstream>
 #include <mutex>
+#include <condition_variable>
+#include <deque>
+#include <algorithm>
+
+#include "detection.h"
+#include "log_sink.h"
+#include "metrics.h"
+#include "motion_gate.h"
+#include "safety.h"
+#include "session.h"
+#include "telemetry_store.h"
+#include "telemetry_decoder.h"
+#include "trace.h"
 
 
 // #define SERVER_IP       "192.168.0.105"  // IP raspberry 
@@ -37,14 +51,168 @@
 #define VIDEO_PORT      12346
 #define LOGS_PORT       12347
 #define HEARTBEAT_PORT  12348
+#define VIDEO_RELAY_PORT 12356  // loopback port the decoder reads the recorded video from
+
+#define SESSION_RECORD  true    // record video, logs, commands and heartbeats into a session file
+#define KEYFRAME_RETRY  500     // ms between key frame requests while waiting for one after a join or loss
+#define VIDEO_TIMING_SHOWN 5000 // ms the join and recovery times stay on the video
+
+#define LOG_COMPRESS    false               // zstd-compress log files (needs a build with zstd)
+#define LOG_ROTATE_SIZE (64 * 1024 * 1024)  // bytes per log file before starting the next one
+#define LOG_INDEX       true                // keep a search index next to each log file (log_search)
+#define LOG_VIEW_LINES  2000                // lines kept in the log pane
+#define LOG_VIEW_PERIOD 100                 // ms between log pane updates
+
+#define TRACE_PID       1       // process id of the operator in exported traces; the Pi is 2
+#define CLOCK_SAMPLES   8       // heartbeat round trips the Pi clock offset is estimated from
+#define METRICS_PORT    12350   // GET /metrics on this port; the Pi serves on 12351
+
+#define DETECTOR_MODEL  "/home/greisersem/Desktop/omegabot-controller/yolov8n.onnx"
+#define DETECTOR_CACHE  "/.cache/omegabot-controller"  // under $HOME; which DNN backend worked last time
+#define MOTION_GATE     true    // detect only where the picture changed (motion_gate.h)
+#define PI_VISION_FRESH 1000    // ms the Pi's own detections are shown for and ours held off
+#define SAFETY_STOP     true    // send 's' when a detection breaks a safety rule (safety.h)
+#define SAFETY_CLEAR    1000    // ms without a broken rule before a fresh 'w' press releases the stop
+#define SAFETY_BUDGET   100     // ms from frame capture to stop sent; slower stops are counted and logged
+
+#define POSE_TRAIL      300     // points kept for the track on the video overlay
+#define POSE_MAP_SIZE   160     // pixels, side of the overlay map
+#define POSE_MAP_SCALE  0.5     // pixels per centimeter
 
 std::atomic<bool> running(true);
 std::atomic<bool> running_logs(true);
-std::ofstream log_file;
-std::mutex log_mutex;
+LogSink log_sink;
+LogQueue<std::string> log_view_queue(4096);    // lines waiting for the next pane update
+TelemetryStore telemetry_store;
+SessionWriter session;
+
+// Replay (--replay): records come from a session file instead of the network.
+// The replay position is session time; the video and the log thread both
+// follow it, so detections and log lines line up as they did live.
+bool replaying = false;
+double replay_speed = 1.0;                      // 0: as fast as frames decode
+SessionReader replay_reader;
+uint64_t replay_offset = 0;                     // first record to replay
+std::vector<int64_t> replay_frame_times;        // session time of each decoded frame
+std::chrono::steady_clock::time_point replay_started;
+int64_t replay_begin = 0;                       // session time replay starts at, us
+std::atomic<int64_t> replay_position{0};        // last frame shown, as-fast-as-possible mode
+std::atomic<bool> replay_logs_done{false};
+
+// Dead-reckoned pose reported by the Arduino (TM_POSE), drawn over the video.
+struct RobotPose {
+    bool valid = false;
+    float x = 0;            // centimeters
+    float y = 0;
+    float heading = 0;      // degrees, counter-clockwise
+    std::deque<cv::Point2f> trail;
+};
+
+RobotPose robot_pose;
+std::mutex pose_mutex;
+
+// The last frame the Pi's onboard detector reported (raspberry --detect,
+// TM_VISION_*). While it keeps coming it is drawn instead of our own
+// detections, which a thumbnail or absent video could not feed anyway.
+struct PiVision {
+    std::chrono::steady_clock::time_point received;
+    uint32_t time_ms = 0;                   // Pi CLOCK_MONOTONIC
+    int inference_ms = 0;
+    int cpu_percent = 0;
+    std::vector<std::pair<cv::Rect2f, float>> objects;     // box as fractions of the frame, score
+};
+
+PiVision pi_vision;
+std::mutex pi_vision_mutex;
+bool pi_person = false;                     // as last announced in the log pane
 
 int command_sock = -1;
 
+// The robot to talk to, and a shift applied to every port above on both
+// sides, so several operators and robot stand-ins can share one host
+// (--robot, --port-offset).
+std::string robot_ip = SERVER_IP;
+int port_offset = 0;
+
+// Pi CLOCK_MONOTONIC minus ours, from the heartbeat echo; sent back to the
+// Pi so its trace lands on our clock.
+std::atomic<int64_t> pi_clock_offset{0};
+
+// Served on METRICS_PORT; scrape with curl or Prometheus.
+MetricsServer metrics_server;
+MetricCounter commands_sent("operator_commands_sent_total", "Commands sent to the robot");
+MetricCounter heartbeats_sent("operator_heartbeats_sent_total", "Heartbeats sent to the Pi");
+MetricCounter heartbeats_answered("operator_heartbeats_answered_total", "Heartbeats the Pi echoed in time");
+MetricHistogram heartbeat_rtt("operator_heartbeat_rtt_seconds", "Heartbeat round trip to the Pi",
+                              {0.001, 0.002, 0.005, 0.01, 0.02, 0.05, 0.1, 0.2});
+MetricGauge pi_clock_offset_gauge("operator_pi_clock_offset_seconds", "Pi monotonic clock minus ours",
+                                  [] { return pi_clock_offset.load() / 1e9; });
+MetricCounter log_datagrams("operator_log_datagrams_total", "Log datagrams received from the Pi");
+MetricCounter log_bytes("operator_log_bytes_total", "Log bytes received from the Pi");
+MetricGauge log_queue_depth("operator_log_queue_depth", "Lines waiting for the log writer",
+                            [] { return (double)log_sink.queued(); });
+MetricGauge log_lines_dropped("operator_log_lines_dropped", "Log lines dropped because the writer fell behind",
+                              [] { return (double)log_sink.dropped_total(); });
+MetricCounter video_packets("operator_video_packets_total", "RTP packets received (relay only)");
+MetricCounter video_packets_lost("operator_video_packets_lost_total", "RTP sequence numbers skipped (relay only)");
+MetricCounter video_frames_received("operator_video_frames_received_total", "Frames completed by an RTP marker (relay only)");
+MetricCounter keyframe_requests("operator_keyframe_requests_total", "Key frames asked of the Pi on join and after packet loss");
+MetricGauge video_first_frame_seconds("operator_video_first_frame_seconds", "Video opened to the first frame shown");
+MetricHistogram video_recover_seconds("operator_video_recover_seconds", "Packet loss to the end of the next key frame (relay only)",
+                                      {0.05, 0.1, 0.2, 0.3, 0.5, 1, 2, 5, 10});
+MetricCounter frames_displayed("operator_frames_displayed_total", "Frames decoded, run through detection and shown");
+MetricHistogram inference_seconds("operator_inference_seconds", "Detection time per frame, blob to NMS",
+                                  {0.005, 0.01, 0.02, 0.03, 0.05, 0.075, 0.1, 0.2, 0.5});
+MetricCounter inferences_full("operator_inferences_full_total", "Detection passes over the whole frame");
+MetricCounter inferences_region("operator_inferences_region_total", "Detection passes over the changed part of the frame");
+MetricCounter inferences_skipped("operator_inferences_skipped_total", "Frames that kept the previous detections, nothing changed");
+MetricCounter safety_stops("operator_safety_stops_total", "Safety stops: a detection broke a safety rule");
+MetricHistogram safety_stop_seconds("operator_safety_stop_seconds", "Frame captured to stop command sent",
+                                    {0.01, 0.02, 0.03, 0.05, 0.075, 0.1, 0.15, 0.2, 0.5});
+MetricHistogram safety_decision_seconds("operator_safety_decision_seconds", "Detections ready to stop command sent",
+                                        {0.00001, 0.00002, 0.00005, 0.0001, 0.0002, 0.0005, 0.001});
+MetricCounter safety_over_budget("operator_safety_over_budget_total", "Safety stops sent later than SAFETY_BUDGET");
+MetricCounter safety_suppressed("operator_safety_suppressed_total", "Forward commands dropped while stopped for safety");
+MetricHistogram frame_seconds("operator_frame_seconds", "Whole update_frame time per shown frame",
+                              {0.005, 0.01, 0.02, 0.03, 0.05, 0.075, 0.1, 0.2, 0.5});
+MetricGauge display_fps("operator_display_fps", "Frames shown per second over the last second");
+MetricGauge resident_bytes("operator_resident_bytes", "Resident memory of the process, for soak runs",
+                           [] {
+                               long pages = 0, resident = 0;
+                               std::ifstream statm("/proc/self/statm");
+                               statm >> pages >> resident;
+                               return (double)resident * sysconf(_SC_PAGESIZE);
+                           });
+
+// Startup phases, each reported once when it finishes: printed, and served
+// as operator_startup_seconds{phase="..."}, seconds since main() began.
+uint64_t startup_begin = 0;
+std::mutex startup_mutex;
+std::vector<MetricSample> startup_phases;
+MetricSet startup_seconds("operator_startup_seconds", "Seconds from start until each startup phase finished", "gauge",
+                          [](std::vector<MetricSample>& samples) {
+                              std::lock_guard<std::mutex> lock(startup_mutex);
+                              samples.insert(samples.end(), startup_phases.begin(), startup_phases.end());
+                          });
+
+void startup_phase(const char* phase) {
+    double seconds = (trace_now() - startup_begin) / 1e9;
+    {
+        std::lock_guard<std::mutex> lock(startup_mutex);
+        startup_phases.push_back({std::string("phase=\"") + phase + "\"", seconds});
+    }
+    std::ostringstream line;
+    line << "Startup: " << phase << " at " << std::fixed << std::setprecision(3) << seconds << " s";
+    std::cout << line.str() << std::endl;
+}
+
+
+// The recorded video track, rewritten for GStreamer's filesrc.
+std::string replay_video_path() {
+    return "/tmp/omegabot_replay_" + std::to_string(getpid()) + ".rtp";
+}
+
+
 std::vector<std::string> classNames = {
         "person","bicycle","car","motorcycle","airplane","bus","train","truck","boat","traffic light",
         "fire hydrant","stop sign","parking meter","bench","bird","cat","dog","horse","sheep","cow",
@@ -56,18 +224,151 @@ std::vector<std::string> classNames = {
         "toaster","sink","refrigerator","book","clock","vase","scissors","teddy bear","hair drier","toothbrush"
     };
 
+// Joins the Pi's video fan-out, or renews the lease, with what the relay
+// has seen so far; the Pi shows it per viewer in its metrics.
+void join_video() {
+    sockaddr_in server{};
+    server.sin_family = AF_INET;
+    server.sin_port = htons(SERVER_PORT + port_offset);
+    inet_pton(AF_INET, robot_ip.c_str(), &server.sin_addr);
+
+    char msg[64];
+    int len = std::snprintf(msg, sizeof(msg), "VJ %d %llu %llu", VIDEO_PORT + port_offset,
+                            (unsigned long long)video_packets.get(), (unsigned long long)video_packets_lost.get());
+    sendto(command_sock, msg, len, 0, (sockaddr*)&server, sizeof(server));
+}
+
+
+void leave_video() {
+    sockaddr_in server{};
+    server.sin_family = AF_INET;
+    server.sin_port = htons(SERVER_PORT + port_offset);
+    inet_pton(AF_INET, robot_ip.c_str(), &server.sin_addr);
+
+    char msg[32];
+    int len = std::snprintf(msg, sizeof(msg), "VL %d", VIDEO_PORT + port_offset);
+    sendto(command_sock, msg, len, 0, (sockaddr*)&server, sizeof(server));
+}
+
+
+// Asks the Pi for a key frame now instead of at the encoder's next key
+// frame interval; the Pi rate-limits these (VIDEO_KEYFRAME_GAP).
+void request_keyframe() {
+    sockaddr_in server{};
+    server.sin_family = AF_INET;
+    server.sin_port = htons(SERVER_PORT + port_offset);
+    inet_pton(AF_INET, robot_ip.c_str(), &server.sin_addr);
+
+    char msg[32];
+    int len = std::snprintf(msg, sizeof(msg), "VK %d", VIDEO_PORT + port_offset);
+    sendto(command_sock, msg, len, 0, (sockaddr*)&server, sizeof(server));
+    keyframe_requests.add();
+}
+
+
+// Join and recovery times, for the metrics, the log and the overlay.
+std::atomic<uint64_t> video_open_ns{0};         // video open started
+std::atomic<uint64_t> video_first_frame_ns{0};  // first frame shown
+std::atomic<uint64_t> video_recovered_ns{0};    // last recovery from packet loss
+std::atomic<int> video_recover_ms{0};
+
+
+// Whether an RTP packet of H.264 starts a key frame: an IDR slice, or the
+// SPS that rtph264pay config-interval=1 sends ahead of each one. The NAL
+// type is read through STAP-A aggregates and FU-A fragments.
+bool rtp_starts_keyframe(const uint8_t* rtp, int size) {
+    int offset = 12 + (rtp[0] & 0x0f) * 4;
+    if (rtp[0] & 0x10) {
+        if (size < offset + 4)
+            return false;
+        offset += 4 + ((rtp[offset + 2] << 8) | rtp[offset + 3]) * 4;
+    }
+    if (size < offset + 2)
+        return false;
+
+    int type = rtp[offset] & 0x1f;
+    if (type == 24 && size > offset + 3) {
+        type = rtp[offset + 3] & 0x1f;
+    } else if (type == 28) {
+        if (!(rtp[offset + 1] & 0x80))
+            return false;
+        type = rtp[offset + 1] & 0x1f;
+    }
+    return type == 5 || type == 7;
+}
+
+
+// The last join and recovery times over the bottom of the frame for a few
+// seconds after each.
+void draw_video_timing(cv::Mat& frame) {
+    uint64_t now = trace_now(), shown = VIDEO_TIMING_SHOWN * 1000000ull;
+    uint64_t first = video_first_frame_ns, recovered = video_recovered_ns;
+
+    char text[96];
+    if (recovered && now - recovered < shown)
+        std::snprintf(text, sizeof(text), "Video recovered in %d ms", video_recover_ms.load());
+    else if (first && now - first < shown)
+        std::snprintf(text, sizeof(text), "First frame %d ms after join", (int)((first - video_open_ns) / 1000000));
+    else
+        return;
+    cv::putText(frame, text, cv::Point(5, frame.rows - 22), cv::FONT_HERSHEY_SIMPLEX, 0.4, cv::Scalar(255, 255, 255), 1);
+}
+
+
+// The heartbeat also carries our clock, the current Pi clock offset and
+// whether tracing is on: "1 <ns> <offset ns> <0|1>". The Pi echoes
+// "2 <our ns> <its ns>"; the offset is taken from the fastest of the last
+// CLOCK_SAMPLES round trips, assuming the two directions take equally long.
 void send_heartbeat() {
+    trace_thread_name("send_heartbeat");
+
     int sock = socket(AF_INET, SOCK_DGRAM, 0);
     if (sock < 0) return;
 
     sockaddr_in addr{};
     addr.sin_family = AF_INET;
-    addr.sin_port = htons(HEARTBEAT_PORT);
-    inet_pton(AF_INET, SERVER_IP, &addr.sin_addr);
+    addr.sin_port = htons(HEARTBEAT_PORT + port_offset);
+    inet_pton(AF_INET, robot_ip.c_str(), &addr.sin_addr);
+
+    timeval timeout{0, 200000};
+    setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+    std::deque<std::pair<uint64_t, int64_t>> samples;     // round trip, offset
 
     while (running) {
-        const char* msg = "1";
-        sendto(sock, msg, std::strlen(msg), 0, (sockaddr*)&addr, sizeof(addr));
+        {
+            TRACE_SCOPE("heartbeat");
+
+            uint64_t sent = trace_now();
+            char msg[64];
+            int len = std::snprintf(msg, sizeof(msg), "1 %llu %lld %d", (unsigned long long)sent,
+                                    (long long)pi_clock_offset.load(), trace_enabled ? 1 : 0);
+            sendto(sock, msg, len, 0, (sockaddr*)&addr, sizeof(addr));
+            session.append(SESSION_HEARTBEAT, msg, len);
+            heartbeats_sent.add();
+            join_video();
+
+            char reply[64];
+            int n = recv(sock, reply, sizeof(reply) - 1, 0);
+            uint64_t received = trace_now();
+
+            unsigned long long echoed = 0, pi_time = 0;
+            if (n > 0) {
+                reply[n] = '\0';
+                if (std::sscanf(reply, "2 %llu %llu", &echoed, &pi_time) == 2 && echoed == sent) {
+                    heartbeats_answered.add();
+                    heartbeat_rtt.observe((received - sent) / 1e9);
+
+                    samples.push_back({received - sent, (int64_t)(pi_time - (sent + received) / 2)});
+                    if (samples.size() > CLOCK_SAMPLES)
+                        samples.pop_front();
+
+                    auto best = std::min_element(samples.begin(), samples.end());
+                    pi_clock_offset = best->second;
+                }
+            }
+        }
+
         std::this_thread::sleep_for(std::chrono::seconds(2));
     }
 
@@ -75,28 +376,340 @@ void send_heartbeat() {
 }
 
 
+// Tracing on, or off with the trace written out next to the logs. The Pi
+// follows with the next heartbeat.
+void set_tracing(bool on) {
+    if (on == trace_enabled)
+        return;
+    trace_enabled = on;
+    if (on) {
+        std::cout << "Tracing on" << std::endl;
+        return;
+    }
+
+    std::time_t t = std::time(nullptr);
+    std::ostringstream filename;
+    filename << std::getenv("HOME")
+             << "/Desktop/omegabot-controller/trace_operator_"
+             << std::put_time(std::localtime(&t), "%Y-%m-%d_%H-%M-%S")
+             << ".json";
+    trace_export(filename.str(), TRACE_PID, "operator");
+}
+
+
 void write_log_to_file(const std::string& text) {
-    if (!log_file.is_open())
+    if (replaying) return;      // the session already has these lines
+    log_sink.write(text);
+}
+
+
+int64_t now_ms() {
+    return std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::system_clock::now().time_since_epoch()).count();
+}
+
+
+// Sensor readings and events go into the telemetry store as rows; columns
+// a record does not carry stay STORE_NONE.
+void store_record(const TelemetryRecord& record) {
+    TelemetryRow row{now_ms(), STORE_NONE, STORE_NONE, STORE_NONE, 0, record.code};
+
+    switch (record.code) {
+        case TM_SENSORS:
+            // A failed DHT read comes as -1.0 (-100 here); a real reading
+            // of exactly -1.00 C is not one the DHT11 can make (0..50 C).
+            if (record.value[0] != -100) row.temperature = record.value[0];
+            if (record.value[1] >= 0) row.humidity = record.value[1];
+            if (record.value[2] >= 0) row.distance = record.value[2] * 10;
+            break;
+        case TM_OBSTACLE_DETECTED:
+        case TM_OBSTACLE_PRESENT:
+            row.distance = record.value[0];
+            break;
+        case TM_POSE:
+        case TM_VISION_FRAME:
+        case TM_VISION_OBJECT:
+            return;     // kept in the log file only
+    }
+
+    telemetry_store.append(row);
+}
+
+
+void store_command(char cmd) {
+    telemetry_store.append({now_ms(), STORE_NONE, STORE_NONE, STORE_NONE, (uint8_t)cmd, 0});
+}
+
+
+void update_pose(const TelemetryRecord& record) {
+    std::lock_guard<std::mutex> lock(pose_mutex);
+
+    robot_pose.valid = true;
+    robot_pose.x = record.value[0] / 10.0f;
+    robot_pose.y = record.value[1] / 10.0f;
+    robot_pose.heading = record.value[2] / 10.0f;
+
+    // A pose reset ('z') jumps back to the origin: start a new track.
+    if (robot_pose.x == 0 && robot_pose.y == 0 && robot_pose.heading == 0)
+        robot_pose.trail.clear();
+
+    robot_pose.trail.push_back(cv::Point2f(robot_pose.x, robot_pose.y));
+    if (robot_pose.trail.size() > POSE_TRAIL)
+        robot_pose.trail.pop_front();
+}
+
+
+// Map in the top-right corner, centered on the robot, with north up being
+// the heading the pose was last zeroed at.
+void draw_pose_overlay(cv::Mat& frame) {
+    std::lock_guard<std::mutex> lock(pose_mutex);
+    if (!robot_pose.valid || frame.cols < POSE_MAP_SIZE || frame.rows < POSE_MAP_SIZE)
         return;
 
-    auto now = std::chrono::system_clock::now();
-    std::time_t t = std::chrono::system_clock::to_time_t(now);
-    std::tm* tm_ptr = std::localtime(&t);
+    cv::Rect area(frame.cols - POSE_MAP_SIZE - 10, 10, POSE_MAP_SIZE, POSE_MAP_SIZE);
+    cv::Mat map = frame(area);
+    map *= 0.4;
+
+    cv::Point2f center(POSE_MAP_SIZE / 2.0f, POSE_MAP_SIZE / 2.0f);
+    auto to_map = [&](const cv::Point2f& p) {
+        return cv::Point(center.x - (p.y - robot_pose.y) * POSE_MAP_SCALE,
+                         center.y - (p.x - robot_pose.x) * POSE_MAP_SCALE);
+    };
+
+    for (size_t i = 1; i < robot_pose.trail.size(); i++)
+        cv::line(map, to_map(robot_pose.trail[i - 1]), to_map(robot_pose.trail[i]), cv::Scalar(0, 200, 255), 1);
+
+    float a = robot_pose.heading * CV_PI / 180.0;
+    cv::Point nose(center.x - 12 * std::sin(a), center.y - 12 * std::cos(a));
+    cv::circle(map, center, 5, cv::Scalar(255, 255, 255), 1);
+    cv::line(map, center, nose, cv::Scalar(255, 255, 255), 2);
+
+    char text[64];
+    std::snprintf(text, sizeof(text), "%.0f, %.0f cm  %.0f deg", robot_pose.x, robot_pose.y, robot_pose.heading);
+    cv::putText(map, text, cv::Point(5, POSE_MAP_SIZE - 6), cv::FONT_HERSHEY_SIMPLEX, 0.4, cv::Scalar(255, 255, 255), 1);
+}
+
+
+// The pane is refreshed by a timer in the GUI thread; if it falls that
+// far behind, dropping lines from the view is fine, the file has them.
+void show_line(const std::string& line) {
+    write_log_to_file(line);
+    log_view_queue.push(std::string(line));
+}
+
+
+// Straight onto the command socket, from whichever thread calls it.
+void send_robot_command(char cmd) {
+    session.append(SESSION_COMMAND, &cmd, 1);
+    commands_sent.add();
+
+    sockaddr_in server{};
+    server.sin_family = AF_INET;
+    server.sin_port = htons(SERVER_PORT + port_offset);
+    inet_pton(AF_INET, robot_ip.c_str(), &server.sin_addr);
+
+    sendto(command_sock, &cmd, 1, 0, (sockaddr*)&server, sizeof(server));
+}
+
+
+// Vision safety stop. The rules are checked where detections come out, on
+// the detector thread for ours and on the log thread for the Pi's, and 's'
+// is sent from there, without a round through the Qt event loop. While any
+// rule keeps firing the stop is latched and every command that can take
+// the robot forward is dropped; it is released by a fresh press of one of
+// them once no rule has fired for SAFETY_CLEAR, so a key held through the
+// stop does not drive on.
+std::vector<SafetyRule> safety_rules;           // --safety-rule, SAFETY_RULE by default
+std::mutex safety_mutex;
+bool safety_latched = false;
+uint64_t safety_last_fired = 0;                 // trace_now()
+bool safety_fresh_press = false;                // forward key pressed since the stop
+
+// captured: when the frame the boxes came from was taken (trace_now());
+// ready: when the boxes were.
+void check_safety_stop(const std::vector<SafetyBox>& boxes, uint64_t captured, uint64_t ready, const char* source) {
+    if (!SAFETY_STOP || replaying || safety_rules.empty())
+        return;
+
+    float area = 0;
+    int rule = check_safety(safety_rules, boxes, area);
+    if (rule < 0)
+        return;
+
+    // Repeated on every frame that fires, in case a datagram is lost.
+    send_robot_command('s');
+    uint64_t sent = trace_now();
+
+    bool first;
+    {
+        std::lock_guard<std::mutex> lock(safety_mutex);
+        first = !safety_latched;
+        safety_latched = true;
+        safety_last_fired = sent;
+        safety_fresh_press = false;
+    }
+    if (!first)
+        return;
+
+    double latency = (sent - captured) / 1e9;
+    safety_stops.add();
+    safety_stop_seconds.observe(latency);
+    safety_decision_seconds.observe((sent - ready) / 1e9);
+    store_command('s');
+
+    char line[200];
+    std::snprintf(line, sizeof(line), "Safety stop (%s): rule \"%s\", %.0f %% of the frame, sent %.1f ms after capture%s",
+                  source, safety_rules[rule].text.c_str(), area * 100, latency * 1000,
+                  latency * 1000 > SAFETY_BUDGET ? ", over budget" : "");
+    if (latency * 1000 > SAFETY_BUDGET)
+        safety_over_budget.add();
+    show_line(line);
+}
+
+
+// Commands that can take the robot toward what stopped it: forward, the
+// inspection's forward legs, the 180-degree turns that end in a drive
+// and the calibration's drive to the wall. Back, a/d and the rest pass.
+bool safety_blocks(char cmd) {
+    return cmd == 'w' || cmd == 'c' || cmd == 'q' || cmd == 'e' || cmd == 'k';
+}
+
 
-    log_file << "[" << std::put_time(tm_ptr, "%Y-%m-%d %H:%M:%S") << "] "
-             << text << std::endl;
+// Whether a command may go to the robot while the stop is latched.
+bool safety_allows(char cmd) {
+    if (!safety_blocks(cmd))
+        return true;
+
+    std::lock_guard<std::mutex> lock(safety_mutex);
+    if (!safety_latched)
+        return true;
+    if (safety_fresh_press && trace_now() - safety_last_fired >= SAFETY_CLEAR * 1000000ull) {
+        safety_latched = false;
+        show_line("Safety stop released");
+        return true;
+    }
+    safety_suppressed.add();
+    return false;
+}
+
+
+void safety_key_pressed() {
+    std::lock_guard<std::mutex> lock(safety_mutex);
+    safety_fresh_press = true;
 }
 
 
-void receive_logs(QTextEdit* log_widget) {
-    if (!log_widget) return;
+bool safety_stopped() {
+    std::lock_guard<std::mutex> lock(safety_mutex);
+    return safety_latched;
+}
+
+
+// One frame of the Pi's onboard detection; the log pane only hears when a
+// person appears or goes.
+void update_pi_vision(const char* data, size_t size) {
+    PiVision vision;
+    vision.received = std::chrono::steady_clock::now();
+
+    for (size_t at = 0; at + TELEMETRY_FRAME_SIZE <= size; at += TELEMETRY_FRAME_SIZE) {
+        TelemetryRecord record = TelemetryDecoder::unpack((const uint8_t*)data + at);
+        write_log_to_file(telemetry_format(record));
+
+        uint16_t v0 = (uint16_t)record.value[0], v1 = (uint16_t)record.value[1], v2 = (uint16_t)record.value[2];
+        if (record.code == TM_VISION_FRAME) {
+            vision.time_ms = record.time_ms;
+            vision.inference_ms = record.value[1];
+            vision.cpu_percent = record.value[2];
+        } else if (record.code == TM_VISION_OBJECT) {
+            cv::Rect2f box((v1 >> 8) / 256.0f, (v1 & 0xFF) / 256.0f, (v2 >> 8) / 256.0f, (v2 & 0xFF) / 256.0f);
+            vision.objects.push_back({box, (v0 & 0xFF) / 255.0f});
+        }
+    }
+
+    // The Pi's frame time moved onto our clock with the heartbeat offset.
+    uint64_t now = trace_now();
+    int32_t age_ms = (int32_t)((uint32_t)((now + pi_clock_offset.load()) / 1000000) - vision.time_ms);
+    std::vector<SafetyBox> boxes;
+    for (const auto& object : vision.objects)
+        boxes.push_back({object.first, object.second});
+    check_safety_stop(boxes, now - (uint64_t)std::max(age_ms, 0) * 1000000, now, "Pi");
+
+    bool person = !vision.objects.empty();
+    {
+        std::lock_guard<std::mutex> lock(pi_vision_mutex);
+        pi_vision = std::move(vision);
+    }
+    if (person != pi_person) {
+        pi_person = person;
+        show_line(person ? "Pi vision: person ahead" : "Pi vision: clear");
+    }
+}
+
+
+bool pi_vision_fresh() {
+    std::lock_guard<std::mutex> lock(pi_vision_mutex);
+    return std::chrono::steady_clock::now() - pi_vision.received < std::chrono::milliseconds(PI_VISION_FRESH);
+}
+
+
+// The Pi's boxes over the frame, whatever size the video arrives at, with
+// how old the detection was when it got here.
+void draw_pi_vision(cv::Mat& frame) {
+    std::lock_guard<std::mutex> lock(pi_vision_mutex);
+
+    for (const auto& object : pi_vision.objects) {
+        cv::Rect box(object.first.x * frame.cols, object.first.y * frame.rows,
+                     object.first.width * frame.cols, object.first.height * frame.rows);
+        cv::rectangle(frame, box, cv::Scalar(0, 165, 255), 2);
+        char label[32];
+        std::snprintf(label, sizeof(label), "Pi %.2f", object.second);
+        cv::putText(frame, label, cv::Point(box.x, std::max(box.y - 4, 10)), cv::FONT_HERSHEY_SIMPLEX, 0.4,
+                    cv::Scalar(0, 165, 255), 1);
+    }
+
+    // Pi time of the frame moved onto our clock with the heartbeat offset.
+    uint32_t now_ms = (uint32_t)(trace_now() / 1000000);
+    uint32_t pi_now_ms = now_ms + (uint32_t)(pi_clock_offset.load() / 1000000);
+    char text[96];
+    std::snprintf(text, sizeof(text), "Pi vision: %zu, %d ms, CPU %d %%, age %d ms", pi_vision.objects.size(),
+                  pi_vision.inference_ms, pi_vision.cpu_percent, (int32_t)(pi_now_ms - pi_vision.time_ms));
+    cv::putText(frame, text, cv::Point(5, frame.rows - 6), cv::FONT_HERSHEY_SIMPLEX, 0.4, cv::Scalar(0, 165, 255), 1);
+}
+
+
+// One datagram from the Raspberry Pi, live or replayed.
+void handle_log_datagram(TelemetryDecoder& decoder, const char* data, size_t size) {
+    if (telemetry_vision_datagram(data, size)) {
+        update_pi_vision(data, size);
+        return;
+    }
+
+    decoder.feed(data, size,
+                 [](const TelemetryRecord& record) {
+                     store_record(record);
+
+                     // Poses stream every 200 ms while moving: keep them
+                     // in the file and on the video, not in the log view.
+                     if (record.code == TM_POSE) {
+                         update_pose(record);
+                         write_log_to_file(telemetry_format(record));
+                     } else {
+                         show_line(telemetry_format(record));
+                     }
+                 },
+                 show_line);
+}
+
+
+void receive_logs() {
+    trace_thread_name("receive_logs");
 
     int sock = socket(AF_INET, SOCK_DGRAM, 0);
     if (sock < 0) return;
 
     sockaddr_in local{};
     local.sin_family = AF_INET;
-    local.sin_port = htons(LOGS_PORT);
+    local.sin_port = htons(LOGS_PORT + port_offset);
     local.sin_addr.s_addr = htonl(INADDR_ANY);
 
     if (bind(sock, (sockaddr*)&local, sizeof(local)) < 0) {
@@ -104,53 +717,201 @@ void receive_logs(QTextEdit* log_widget) {
         return;
     }
 
-    int flags = fcntl(sock, F_GETFL, 0);
-    fcntl(sock, F_SETFL, flags | O_NONBLOCK);
+    // Block in recvfrom() instead of polling every 50 ms; the timeout only
+    // bounds how long shutdown waits for this thread.
+    timeval timeout{0, 200000};
+    setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
 
     char buffer[512];
     sockaddr_in client{};
     socklen_t client_len = sizeof(client);
 
+    TelemetryDecoder decoder;
+
     while (running_logs) {
-        int n = recvfrom(sock, buffer, sizeof(buffer) - 1, 0,
+        int n = recvfrom(sock, buffer, sizeof(buffer), 0,
                         (sockaddr*)&client, &client_len);
 
         if (n > 0) {
-            buffer[n] = '\0';
+            TRACE_SCOPE("log_datagram");
+            log_datagrams.add();
+            log_bytes.add(n);
+            session.append(SESSION_LOG, buffer, n);
+            handle_log_datagram(decoder, buffer, n);
+        }
+    }
 
-            std::string msg_str(buffer);
-            QString msg = QString::fromUtf8(buffer);
+    close(sock);
+}
 
-            write_log_to_file(msg_str);
 
-            QMetaObject::invokeMethod(
-                log_widget,
-                [log_widget, msg]() { log_widget->append(msg); },
-                Qt::QueuedConnection
-            );
+// With session recording on, the video comes here first: every RTP packet
+// is recorded as received and passed on to the decoder on loopback.
+void relay_video() {
+    trace_thread_name("relay_video");
+
+    int sock = socket(AF_INET, SOCK_DGRAM, 0);
+    if (sock < 0) return;
+
+    sockaddr_in local{};
+    local.sin_family = AF_INET;
+    local.sin_port = htons(VIDEO_PORT + port_offset);
+    local.sin_addr.s_addr = htonl(INADDR_ANY);
+
+    if (bind(sock, (sockaddr*)&local, sizeof(local)) < 0) {
+        std::cerr << "Cannot bind video port " << VIDEO_PORT + port_offset << std::endl;
+        close(sock);
+        return;
+    }
+
+    int buffer_size = 4 * 1024 * 1024;
+    setsockopt(sock, SOL_SOCKET, SO_RCVBUF, &buffer_size, sizeof(buffer_size));
+
+    timeval timeout{0, 200000};
+    setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+    sockaddr_in decoder{};
+    decoder.sin_family = AF_INET;
+    decoder.sin_port = htons(VIDEO_RELAY_PORT + port_offset);
+    decoder.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+    std::vector<char> packet(65536);
+    bool have_sequence = false;
+    uint16_t expected_sequence = 0;
+
+    // Until a whole key frame has come through after the join or a loss,
+    // the decoder has nothing to decode from and a key frame is asked for
+    // every KEYFRAME_RETRY ms.
+    uint64_t waiting_since = trace_now(), last_request = 0;
+    bool after_loss = false, keyframe_started = false;
+
+    while (running) {
+        uint64_t now = trace_now();
+        if (waiting_since && now - last_request >= KEYFRAME_RETRY * 1000000ull) {
+            request_keyframe();
+            last_request = now;
         }
 
-        std::this_thread::sleep_for(std::chrono::milliseconds(50));
+        int n = recv(sock, packet.data(), packet.size(), 0);
+        if (n <= 0) continue;
+
+        TRACE_SCOPE("video_packet");
+
+        // RTP header: marker bit ends a frame, sequence numbers count losses.
+        video_packets.add();
+        if (n >= 12) {
+            const uint8_t* rtp = (const uint8_t*)packet.data();
+            uint16_t sequence = (rtp[2] << 8) | rtp[3];
+            uint16_t gap = sequence - expected_sequence;
+            if (!have_sequence || gap < 0x8000) {       // a late packet is not a loss
+                if (have_sequence && gap != 0) {
+                    video_packets_lost.add(gap);
+                    if (!waiting_since) {
+                        waiting_since = trace_now();
+                        after_loss = true;
+                    }
+                    keyframe_started = false;
+                }
+                have_sequence = true;
+                expected_sequence = sequence + 1;
+            }
+
+            if (waiting_since && rtp_starts_keyframe(rtp, n))
+                keyframe_started = true;
+            if (rtp[1] & 0x80) {
+                video_frames_received.add();
+                if (waiting_since && keyframe_started) {
+                    if (after_loss) {
+                        uint64_t recovered = trace_now();
+                        video_recover_seconds.observe((recovered - waiting_since) / 1e9);
+                        video_recover_ms = (int)((recovered - waiting_since) / 1000000);
+                        video_recovered_ns = recovered;
+                        std::cout << "Video recovered from packet loss in " << video_recover_ms << " ms" << std::endl;
+                    }
+                    waiting_since = 0;
+                    after_loss = keyframe_started = false;
+                }
+            }
+        }
+
+        session.append(SESSION_VIDEO, packet.data(), n);
+        sendto(sock, packet.data(), n, 0, (sockaddr*)&decoder, sizeof(decoder));
     }
 
     close(sock);
 }
 
 
+// Session time the replay has reached: the wall clock scaled by the speed,
+// or in as-fast-as-possible mode the last frame the video has shown.
+int64_t replay_clock() {
+    if (replay_speed <= 0)
+        return replay_position.load();
+
+    double elapsed = std::chrono::duration<double, std::micro>(
+        std::chrono::steady_clock::now() - replay_started).count();
+    return replay_begin + (int64_t)(elapsed * replay_speed);
+}
+
+
+// Feeds the recorded log datagrams to the same handler the live receiver
+// uses, each once the replay position reaches its time. Commands show in
+// the log view; the video track is replayed by the decoder.
+void replay_session() {
+    trace_thread_name("replay_session");
+
+    TelemetryDecoder decoder;
+    uint64_t offset = replay_offset;
+    SessionRecord record;
+    char last_command = 0;
+    int64_t last_command_time = 0;
+
+    while (running_logs && replay_reader.next(offset, record)) {
+        if (record.type == SESSION_VIDEO || record.type == SESSION_HEARTBEAT)
+            continue;
+
+        while (running_logs) {
+            int64_t ahead = record.time_us - replay_clock();
+            if (ahead <= 0) break;
+
+            int64_t wait_us = replay_speed > 0 ? (int64_t)(ahead / replay_speed) : 1000;
+            std::this_thread::sleep_for(std::chrono::microseconds(std::min<int64_t>(wait_us, 50000)));
+        }
+
+        if (record.type == SESSION_LOG) {
+            TRACE_SCOPE("log_datagram");
+            handle_log_datagram(decoder, (const char*)record.data, record.size);
+        } else if (record.type == SESSION_COMMAND && record.size == 1) {
+            // Held keys repeat every 20 ms; show each press once.
+            char cmd = record.data[0];
+            if (cmd != last_command || record.time_us - last_command_time > 100000)
+                log_view_queue.push(std::string("Command: ") + cmd);
+            last_command = cmd;
+            last_command_time = record.time_us;
+        }
+    }
+
+    replay_logs_done = true;
+}
+
+
 class ControllerWindow : public QWidget {
     Q_OBJECT
 public:
     explicit ControllerWindow(QWidget* parent = nullptr)
         : QWidget(parent)
     {
+        trace_thread_name("qt_main");
+
         setFixedSize(800, 600);
 
         video_label = new QLabel(this);
         video_label->setFixedSize(640, 480);
         video_label->setText("Waiting for video...");
 
-        log_widget = new QTextEdit(this);
+        log_widget = new QPlainTextEdit(this);
         log_widget->setReadOnly(true);
+        log_widget->setMaximumBlockCount(LOG_VIEW_LINES);
 
         QVBoxLayout* layout = new QVBoxLayout(this);
         layout->addWidget(video_label);
@@ -160,7 +921,8 @@ public:
         video_timer = new QTimer(this);
         connect(video_timer, &QTimer::timeout,
                 this, &ControllerWindow::update_frame);
-        video_timer->start(33);
+        // As fast as possible: decode the next frame on every event loop pass.
+        video_timer->start(replaying && replay_speed <= 0 ? 0 : 33);
 
         command_timer = new QTimer(this);
         connect(command_timer, &QTimer::timeout, this, [this]() {
@@ -171,36 +933,50 @@ public:
         });
         command_timer->start(20);
 
+        log_timer = new QTimer(this);
+        connect(log_timer, &QTimer::timeout,
+                this, &ControllerWindow::update_logs);
+        log_timer->start(LOG_VIEW_PERIOD);
+
         start_video_open_thread();
-        init_yolo();
+        start_detector_thread();
     }
 
     ~ControllerWindow() override {
         video_ready = false;
         if (video_open_thread.joinable())
             video_open_thread.join();
+        {
+            std::lock_guard<std::mutex> lock(detector_mutex);
+            detector_stopping = true;
+        }
+        detector_wake.notify_one();
+        if (detector_thread.joinable())
+            detector_thread.join();
         if (video_writer.isOpened())
             video_writer.release();
     }
 
-    QTextEdit* logs() const { return log_widget; }
-
 protected:
     void keyPressEvent(QKeyEvent* event) override {
         if (event->isAutoRepeat())
             return;
 
         switch (event->key()) {
-            case Qt::Key_W: current_command = 'w'; break;
+            case Qt::Key_W: current_command = 'w'; safety_key_pressed(); break;
             case Qt::Key_S: current_command = 's'; break;
             case Qt::Key_D: current_command = 'd'; break;
             case Qt::Key_A: current_command = 'a'; break;
             case Qt::Key_X: current_command = 'x'; break;
 
-            case Qt::Key_E: send_command('e'); break;
-            case Qt::Key_Q: send_command('q'); break;
-            case Qt::Key_C: send_command('c'); break;
+            case Qt::Key_E: safety_key_pressed(); send_command('e'); break;
+            case Qt::Key_Q: safety_key_pressed(); send_command('q'); break;
+            case Qt::Key_C: safety_key_pressed(); send_command('c'); break;
             case Qt::Key_F: send_command('f'); break;
+            case Qt::Key_K: safety_key_pressed(); send_command('k'); break;
+            case Qt::Key_Z: send_command('z'); break;
+
+            case Qt::Key_T: set_tracing(!trace_enabled); break;
 
             default: break;
         }
@@ -224,10 +1000,11 @@ protected:
 
 private:
     QLabel* video_label = nullptr;
-    QTextEdit* log_widget = nullptr;
+    QPlainTextEdit* log_widget = nullptr;
 
     QTimer* video_timer = nullptr;
     QTimer* command_timer = nullptr;
+    QTimer* log_timer = nullptr;
 
     cv::VideoCapture cap;
     std::atomic<bool> video_ready{false};
@@ -236,25 +1013,80 @@ private:
     std::atomic<bool> recording{false};
 
     int frame_count = 0;
+    std::chrono::steady_clock::time_point frames_started;     // first frame captured
+    uint64_t fps_since = 0;             // trace_now() the display fps window began
+    int fps_frames = 0;
+    size_t replay_frame = 0;            // next frame of replay_frame_times
+    bool replay_video_done = false;
+    bool replay_reported = false;
     cv::Mat last_annotated_frame;
-    cv::dnn::Net yolo_net;
+    std::atomic<bool> detector_ready{false};
+    std::atomic<bool> detector_done{false};   // ready, or failed to load
+    std::thread detector_thread;
+    bool first_frame_shown = false;
+    bool first_detection_shown = false;
+
+    // Frames go to the detector thread and boxes come back through here.
+    // Only the newest frame waits; one arriving while the detector is busy
+    // replaces it.
+    std::mutex detector_mutex;
+    std::condition_variable detector_wake;
+    cv::Mat detector_frame;
+    uint64_t detector_captured = 0;     // trace_now() detector_frame was taken
+    bool detector_pending = false;      // detector_frame not taken yet
+    bool detector_working = false;
+    bool detector_stopping = false;
+    Detections shown_detections;        // latest result, drawn by update_frame()
+    uint64_t detector_results = 0;
 
     std::atomic<char> current_command{0};
+    char last_stored_command = 0;
 
     void start_video_open_thread() {
-        const std::string gst_pipeline =
-            "udpsrc port=" + std::to_string(VIDEO_PORT) + " caps=application/x-rtp,media=video,encoding-name=H264,payload=96 ! "
+        std::string gst_pipeline =
+            "udpsrc port=" + std::to_string((SESSION_RECORD ? VIDEO_RELAY_PORT : VIDEO_PORT) + port_offset) +
+            " caps=application/x-rtp,media=video,encoding-name=H264,payload=96 ! "
             "rtph264depay ! "
             "h264parse ! "
             "avdec_h264 ! "
             "videoconvert ! "
             "appsink sync=false max-buffers=2 drop=true";
 
+        // Replay decodes the recorded packets with the same depayloader and
+        // decoder; appsink must not drop, frames are matched to their times.
+        if (replaying) {
+            gst_pipeline =
+                "filesrc location=" + replay_video_path() + " ! "
+                "application/x-rtp-stream,media=video,clock-rate=90000,encoding-name=H264,payload=96 ! "
+                "rtpstreamdepay ! "
+                "rtph264depay ! "
+                "h264parse ! "
+                "avdec_h264 ! "
+                "videoconvert ! "
+                "appsink sync=false max-buffers=2 drop=false";
+        }
+
+        if (replaying && replay_frame_times.empty()) {
+            replay_video_done = true;
+            video_label->setText("No video in this session");
+            return;
+        }
+
+        // With the relay running, it asks for the key frame until one comes.
+        video_open_ns = trace_now();
+        if (!replaying && !SESSION_RECORD)
+            request_keyframe();
+
         video_open_thread = std::thread([this, gst_pipeline]() {
+            trace_thread_name("video_open");
+            TRACE_SCOPE("video_open");
+
             bool ok = cap.open(gst_pipeline, cv::CAP_GSTREAMER);
             video_ready = ok;
+            if (ok)
+                startup_phase("video_open");
 
-            if (ok) {
+            if (ok && !replaying) {
                 cv::Mat first_frame;
                 cap >> first_frame;
 
@@ -303,138 +1135,475 @@ private:
         });
     }
 
-    void init_yolo()
-    {
-        yolo_net = cv::dnn::readNet("/home/greisersem/Desktop/omegabot-controller/yolov8n.onnx");
-        yolo_net.setPreferableBackend(cv::dnn::DNN_BACKEND_CUDA);
-        yolo_net.setPreferableTarget(cv::dnn::DNN_TARGET_CUDA);
-    }
+    // Reading the model and the first forward pass take long enough to hold
+    // up the window, so they run here while the video opens; frames are
+    // shown without boxes until the detector is ready. The thread then
+    // stays on to detect.
+    void start_detector_thread() {
+        detector_thread = std::thread([this]() {
+            trace_thread_name("detector");
+
+            DetectorLoad load;
+            cv::dnn::Net net;
+            try {
+                TRACE_SCOPE("detector_load");
+                net = prepare_detector(DETECTOR_MODEL, std::string(std::getenv("HOME")) + DETECTOR_CACHE, load);
+            } catch (const cv::Exception& e) {
+                std::cerr << "Detector warm-up failed: " << e.what() << std::endl;
+            }
+            if (net.empty()) {
+                log_view_queue.push("Detector not available, showing video without detection");
+                detector_done = true;
+                return;
+            }
 
-   void update_frame() {
-        if (!video_ready.load() || !cap.isOpened())
-            return;
+            startup_phase("detector_ready");
+            std::ostringstream line;
+            line << "Detector ready on " << (load.cuda ? "CUDA" : "CPU") << (load.cached ? " (cached)" : "")
+                 << ": read " << std::fixed << std::setprecision(3) << load.read_seconds
+                 << " s, warm-up " << load.warmup_seconds << " s";
+            std::cout << line.str() << std::endl;
+            log_view_queue.push(line.str());
+
+            detector_ready.store(true, std::memory_order_release);
+            detector_done = true;
+            detect_frames(net);
+        });
+    }
 
+    // Detection and the safety rules run here, off the GUI thread, so a
+    // stop does not wait behind painting and key handling in the Qt event
+    // loop. update_frame() hands over frames and draws what comes back.
+    void detect_frames(cv::dnn::Net& net) {
         cv::Mat frame;
-        cap >> frame;
-        if (frame.empty())
+        cv::Mat blob;
+        Detections detections;
+        std::vector<SafetyBox> boxes;
+        MotionGate motion_gate;
+
+        while (true) {
+            uint64_t captured;
+            {
+                std::unique_lock<std::mutex> lock(detector_mutex);
+                detector_wake.wait(lock, [this]() { return detector_pending || detector_stopping; });
+                if (detector_stopping)
+                    return;
+                std::swap(frame, detector_frame);
+                captured = detector_captured;
+                detector_pending = false;
+                detector_working = true;
+            }
+
+            uint64_t inference_start = trace_now();
+            MotionDecision decision = MOTION_FULL;
+            cv::Rect region(0, 0, frame.cols, frame.rows);
+            if (MOTION_GATE) {
+                TRACE_SCOPE("motion");
+                decision = motion_gate.update(frame, region);
+            }
+
+            // A skipped frame keeps the previous boxes, for the rules as much
+            // as for drawing: a person standing still in front of the robot
+            // must keep the stop latched.
+            if (decision == MOTION_SKIP) {
+                TRACE_SCOPE("safety");
+                safety_boxes(detections, frame.size(), boxes);
+                check_safety_stop(boxes, captured, trace_now(), "operator");
+                inferences_skipped.add();
+            } else {
+                {
+                    TRACE_SCOPE("blob");
+                    detection_blob(decision == MOTION_REGION ? frame(region) : frame, blob);
+                }
+                cv::Mat output;
+                {
+                    TRACE_SCOPE("forward");
+                    output = run_detector(net, blob);
+                }
+                {
+                    TRACE_SCOPE("parse");
+                    if (decision == MOTION_REGION)
+                        keep_detections_outside(detections, region);
+                    parse_detections(output, detections, region, decision == MOTION_REGION);
+                }
+                {
+                    TRACE_SCOPE("nms");
+                    suppress_detections(detections);
+                }
+                {
+                    TRACE_SCOPE("safety");
+                    safety_boxes(detections, frame.size(), boxes);
+                    check_safety_stop(boxes, captured, trace_now(), "operator");
+                }
+                (decision == MOTION_REGION ? inferences_region : inferences_full).add();
+                inference_seconds.observe((trace_now() - inference_start) / 1e9);
+            }
+
+            std::lock_guard<std::mutex> lock(detector_mutex);
+            shown_detections = detections;
+            detector_results++;
+            detector_working = false;
+        }
+    }
+
+    void submit_frame(const cv::Mat& frame, uint64_t captured) {
+        {
+            std::lock_guard<std::mutex> lock(detector_mutex);
+            frame.copyTo(detector_frame);
+            detector_captured = captured;
+            detector_pending = true;
+        }
+        detector_wake.notify_one();
+    }
+
+    bool detector_idle() {
+        std::lock_guard<std::mutex> lock(detector_mutex);
+        return !detector_pending && !detector_working;
+    }
+
+    // Boxes from the latest frame detected, which may be a frame or two
+    // behind the one they are drawn on. True once there are any.
+    bool draw_latest_detections(cv::Mat& frame) {
+        std::lock_guard<std::mutex> lock(detector_mutex);
+        draw_detections(frame, shown_detections);
+        return detector_results > 0;
+    }
+
+    // Next frame to show while replaying, or false if none is due yet.
+    bool next_replay_frame(cv::Mat& frame) {
+        if (replay_video_done || !video_ready.load() || !cap.isOpened())
+            return false;
+
+        // As fast as possible: every frame, and the log replay follows it.
+        // Otherwise: decode all frames due by now and show the latest, as
+        // the live appsink would when processing falls behind.
+        int64_t position = replay_clock();
+        bool got = false;
+        cv::Mat decoded;
+        while (replay_frame < replay_frame_times.size() &&
+               (replay_speed <= 0 ? !got : replay_frame_times[replay_frame] <= position)) {
+            if (!cap.read(decoded) || decoded.empty()) {
+                replay_frame = replay_frame_times.size();   // the decoder ran out early
+                break;
+            }
+            std::swap(frame, decoded);
+            if (replay_speed <= 0)
+                replay_position = replay_frame_times[replay_frame];
+            replay_frame++;
+            got = true;
+        }
+
+        if (replay_frame == replay_frame_times.size()) {
+            replay_video_done = true;
+            replay_position = INT64_MAX;
+        }
+        return got;
+    }
+
+    void report_replay() {
+        if (replay_reported || !replay_video_done || !replay_logs_done)
             return;
+        replay_reported = true;
 
-        frame_count++;
-        cv::Mat yolo_frame = frame.clone();
+        // From the first frame, so waiting for the detector is not counted.
+        auto since = frame_count > 0 ? frames_started : replay_started;
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - since).count();
+        std::cout << "Replay finished: " << frame_count << " frames in " << std::fixed << std::setprecision(2)
+                  << seconds << " s (" << frame_count / std::max(seconds, 1e-6) << " fps)" << std::endl;
 
-        cv::Mat blob = cv::dnn::blobFromImage(yolo_frame, 1.0 / 255.0, cv::Size(640, 640), cv::Scalar(), true);
-        yolo_net.setInput(blob);
-        
-        std::vector<cv::Mat> out;
-        yolo_net.forward(out);
-        cv::Mat output = out[0];
+        // An as-fast-as-possible run is a measurement; end it with the data.
+        if (replay_speed <= 0)
+            QApplication::quit();
+    }
 
-        std::vector<cv::Rect> boxes;
-        std::vector<float> confidences;
-        float conf = 0.4;
+    void update_frame() {
+        TRACE_SCOPE("update_frame");
+        uint64_t frame_start = trace_now();
 
-        for (int i = 0; i < output.size[2]; i++) {
-            if (output.at<float>(0, 4, i) < conf) {
-                continue;
-            } else {
-                float cx = output.at<float>(0, 0, i);
-                float cy = output.at<float>(0, 1, i);
-                float w = output.at<float>(0, 2, i);
-                float h = output.at<float>(0, 3, i);
-
-                float x = cx - w / 2;
-                float y = cy - h / 2;
-                boxes.push_back(cv::Rect(x, y, w, h));
-                confidences.push_back(output.at<float>(0, 4, i));
+        // An as-fast-as-possible replay measures detection, so it waits for
+        // the detector rather than showing frames without it, and hands it
+        // every frame.
+        bool detect = detector_ready.load(std::memory_order_acquire);
+        if (replaying && replay_speed <= 0 && (!detector_done.load() || (detect && !detector_idle())))
+            return;
+
+        cv::Mat frame;
+        if (replaying) {
+            TRACE_SCOPE("capture");
+            bool got = next_replay_frame(frame);
+            report_replay();
+            if (!got)
+                return;
+        } else {
+            if (!video_ready.load() || !cap.isOpened())
+                return;
+
+            TRACE_SCOPE("capture");
+            cap >> frame;
+            if (frame.empty())
+                return;
+        }
+        uint64_t captured = trace_now();
+
+        if (frame_count++ == 0)
+            frames_started = std::chrono::steady_clock::now();
+
+        // The Pi detecting for us leaves the GPU alone.
+        bool pi_detects = pi_vision_fresh();
+        if (detect && !pi_detects)
+            submit_frame(frame, captured);
+        bool detected = false;
+        {
+            TRACE_SCOPE("draw");
+            if (pi_detects) {
+                draw_pi_vision(frame);
+                detected = detect;
+            } else if (detect) {
+                detected = draw_latest_detections(frame);
             }
+            if (safety_stopped())
+                cv::putText(frame, "SAFETY STOP", cv::Point(10, 30), cv::FONT_HERSHEY_SIMPLEX, 0.9,
+                            cv::Scalar(0, 0, 255), 2);
+            draw_pose_overlay(frame);
+            if (!replaying)
+                draw_video_timing(frame);
         }
 
-        std::vector<int> indices;
-        cv::dnn::NMSBoxes(boxes, confidences, 0.4, 0.5, indices);
-
-        for (int idx : indices) {
-            cv::Rect box = boxes[idx];
-
-            cv::rectangle(frame, box, cv::Scalar(0, 255, 0));
-            cv::putText(
-                frame,
-                "person", 
-                cv::Point(box.x, box.y),
-                cv::FONT_HERSHEY_COMPLEX,
-                0.5, 
-                cv::Scalar(0, 0, 0),
-                2
+        {
+            TRACE_SCOPE("display");
+            QImage img(frame.data,
+                    frame.cols,
+                    frame.rows,
+                    frame.step,
+                    QImage::Format_BGR888);
+
+            video_label->setPixmap(
+                QPixmap::fromImage(img).scaled(
+                    video_label->size(),
+                    Qt::KeepAspectRatio,
+                    Qt::SmoothTransformation
+                )
             );
         }
-        
-        QImage img(frame.data,
-                frame.cols,
-                frame.rows,
-                frame.step,
-                QImage::Format_BGR888);
-
-        video_label->setPixmap(
-            QPixmap::fromImage(img).scaled(
-                video_label->size(),
-                Qt::KeepAspectRatio,
-                Qt::SmoothTransformation
-            )
-        );
-
-        if (recording && video_writer.isOpened())
+
+        if (recording && video_writer.isOpened()) {
+            TRACE_SCOPE("video_write");
             video_writer.write(frame);
+        }
+
+        if (!first_frame_shown) {
+            first_frame_shown = true;
+            startup_phase("first_frame");
+            if (!replaying) {
+                video_first_frame_ns = trace_now();
+                double seconds = (video_first_frame_ns - video_open_ns) / 1e9;
+                video_first_frame_seconds.set(seconds);
+                std::cout << "Video: first frame " << (int)(seconds * 1000) << " ms after join" << std::endl;
+            }
+        }
+        if (detected && !first_detection_shown) {
+            first_detection_shown = true;
+            startup_phase("first_detection");
+        }
+
+        uint64_t frame_end = trace_now();
+        frame_seconds.observe((frame_end - frame_start) / 1e9);
+        frames_displayed.add();
+
+        fps_frames++;
+        if (frame_end - fps_since >= 1000000000ull) {
+            display_fps.set(fps_frames * 1e9 / (frame_end - fps_since));
+            fps_since = frame_end;
+            fps_frames = 0;
+        }
+    }
+
+
+    // One append per tick for everything that arrived since the last one.
+    void update_logs() {
+        TRACE_SCOPE("update_logs");
+
+        QStringList lines;
+        std::string line;
+        while (log_view_queue.pop(line)) {
+            lines.append(QString::fromStdString(line));
+            if (lines.size() > LOG_VIEW_LINES)
+                lines.removeFirst();
+        }
+
+        if (!lines.isEmpty())
+            log_widget->appendPlainText(lines.join('\n'));
     }
 
 
     void send_command(char cmd) {
-        sockaddr_in server{};
-        server.sin_family = AF_INET;
-        server.sin_port = htons(SERVER_PORT);
-        inet_pton(AF_INET, SERVER_IP, &server.sin_addr);
-
-        sendto(command_sock,
-               &cmd,
-               1,
-               0,
-               (sockaddr*)&server,
-               sizeof(server));
+        if (replaying || !safety_allows(cmd))
+            return;
+
+        TRACE_SCOPE("send_command");
+
+        // Held keys repeat every 20 ms; store only when the command changes.
+        bool held = cmd == current_command.load();
+        if (!held || cmd != last_stored_command)
+            store_command(cmd);
+        last_stored_command = held ? cmd : 0;
+
+        send_robot_command(cmd);
     }
 };
 
 
+// Opens the session for --replay and prepares its video track; start is
+// where to begin, in seconds into the session.
+bool open_replay(const std::string& path, double start) {
+    if (!replay_reader.open(path))
+        return false;
+
+    replay_begin = (int64_t)(start * 1e6);
+    replay_offset = replay_reader.seek(replay_begin);
+    if (!replay_reader.export_video(replay_offset, replay_video_path(), replay_frame_times))
+        return false;
+
+    std::cout << "Replaying " << path << ": " << replay_reader.duration_us() / 1000000.0 << " s, "
+              << replay_frame_times.size() << " frames, speed ";
+    if (replay_speed > 0)
+        std::cout << replay_speed << "x" << std::endl;
+    else
+        std::cout << "max" << std::endl;
+
+    replaying = true;
+    replay_position = replay_frame_times.empty() ? INT64_MAX : replay_begin;
+    return true;
+}
+
+
 int main(int argc, char* argv[]) {
+    startup_begin = trace_now();
     signal(SIGINT, [](int){ running = false; running_logs = false; });
 
     command_sock = socket(AF_INET, SOCK_DGRAM, 0);
     if (command_sock < 0) { perror("command socket"); return -1; }
 
     QApplication app(argc, argv);
+    startup_phase("qt");
+
+    // Qt has taken its own options out of argv by now.
+    std::string replay_path;
+    double replay_start = 0;
+    bool no_safety = false;
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "--replay" && i + 1 < argc) {
+            replay_path = argv[++i];
+        } else if (arg == "--speed" && i + 1 < argc) {
+            replay_speed = std::atof(argv[++i]);
+        } else if (arg == "--start" && i + 1 < argc) {
+            replay_start = std::atof(argv[++i]);
+        } else if (arg == "--trace") {
+            trace_enabled = true;
+        } else if (arg == "--robot" && i + 1 < argc) {
+            robot_ip = argv[++i];
+        } else if (arg == "--port-offset" && i + 1 < argc) {
+            port_offset = std::atoi(argv[++i]);
+        } else if (arg == "--safety-rule" && i + 1 < argc) {
+            SafetyRule rule;
+            if (!parse_safety_rule(argv[++i], rule))
+                return 1;
+            safety_rules.push_back(rule);
+        } else if (arg == "--no-safety") {
+            no_safety = true;
+        } else {
+            std::cerr << "Usage: " << argv[0] << " [--trace] [--robot IP] [--port-offset N]"
+                         " [--safety-rule RULE]... [--no-safety]"
+                         " [--replay SESSION [--speed N] [--start SECONDS]]\n"
+                         "  --trace          start with tracing on (T toggles it)\n"
+                         "  --robot IP       Raspberry Pi or robot_standin address (default " SERVER_IP ")\n"
+                         "  --port-offset N  added to every port, to match a robot_standin instance\n"
+                         "  --safety-rule R  stop the robot when a person meets R, e.g. \"area=8% zone=lower\"\n"
+                         "                   (safety.h); repeat for several, default \"" SAFETY_RULE "\"\n"
+                         "  --no-safety      no vision safety stop\n"
+                         "  --speed N        replay speed, 1 real time (default), 0 as fast as possible" << std::endl;
+            return 1;
+        }
+    }
+
+    if (!replay_path.empty() && !open_replay(replay_path, replay_start))
+        return 1;
+
+    if (no_safety) {
+        safety_rules.clear();
+    } else if (safety_rules.empty()) {
+        SafetyRule rule;
+        parse_safety_rule(SAFETY_RULE, rule);
+        safety_rules.push_back(rule);
+    }
 
     ControllerWindow window;
     window.show();
+    startup_phase("window");
 
     auto now = std::chrono::system_clock::now();
     std::time_t t = std::chrono::system_clock::to_time_t(now);
     std::tm* tm_ptr = std::localtime(&t);
 
-    std::ostringstream filename;
-    filename << std::getenv("HOME")
-            << "/Desktop/omegabot-controller/logs_"
-            << std::put_time(tm_ptr, "%Y-%m-%d_%H-%M-%S")
-            << ".txt";
+    std::thread heartbeat_thread;
+    std::thread log_thread;
+    std::thread video_thread;
+
+    if (replaying) {
+        replay_started = std::chrono::steady_clock::now();
+        log_thread = std::thread(replay_session);
+    } else {
+        std::ostringstream filename;
+        filename << std::getenv("HOME")
+                << "/Desktop/omegabot-controller/logs_"
+                << std::put_time(tm_ptr, "%Y-%m-%d_%H-%M-%S");
+
+        log_sink.open(filename.str(), LOG_COMPRESS, LOG_ROTATE_SIZE, LOG_INDEX);
+
+        std::ostringstream store_name;
+        store_name << std::getenv("HOME")
+                   << "/Desktop/omegabot-controller/telemetry_"
+                   << std::put_time(tm_ptr, "%Y-%m-%d_%H-%M-%S")
+                   << ".obts";
+        telemetry_store.open_write(store_name.str());
+
+        if (SESSION_RECORD) {
+            std::ostringstream session_name;
+            session_name << std::getenv("HOME")
+                         << "/Desktop/omegabot-controller/session_"
+                         << std::put_time(tm_ptr, "%Y-%m-%d_%H-%M-%S")
+                         << ".obsn";
+            session.open(session_name.str());
+            video_thread = std::thread(relay_video);
+        }
 
-    log_file.open(filename.str());
+        heartbeat_thread = std::thread(send_heartbeat);
+        log_thread = std::thread(receive_logs);
+    }
 
-    std::thread heartbeat_thread(send_heartbeat);
-    std::thread log_thread(receive_logs, window.logs());
+    metrics_server.start(METRICS_PORT + port_offset);
+    startup_phase("network");
 
     int ret = app.exec();
 
     running = false;
     running_logs = false;
 
-    if (heartbeat_thread.joinable()) heartbeat_thread.join();
+    if (heartbeat_thread.joinable()) {
+        heartbeat_thread.join();
+        leave_video();
+    }
     if (log_thread.joinable()) log_thread.join();
+    if (video_thread.joinable()) video_thread.join();
+    metrics_server.stop();
+    log_sink.close();
+    telemetry_store.close();
+    session.close();
+    set_tracing(false);
+
+    if (replaying)
+        std::remove(replay_video_path().c_str());
 
     close(command_sock);
     return ret;
@@ -1,17 +1,30 @@
+#include <algorithm>
+#include <cstdio>
 #include <iostream>
 #include <thread>
+#include <atomic>
 #include <cstring>
+#include <ctime>
 #include <fcntl.h>
 #include <arpa/inet.h>
 #include <unistd.h>
 #include <pigpio.h>
 #include <gst/gst.h>
 
+#include "metrics.h"
+#include "onboard_vision.h"
+#include "telemetry.h"
+#include "trace.h"
+#include "video_fanout.h"
+
 #define SERVER_PORT     12345  // Порт для приёма команд
 #define VIDEO_PORT      12346  // Порт для отправки видеопотока
 #define LOGS_PORT       12347  // Порт для отправки логов
 #define HEARTBEAT_PORT  12348  // Порт для отслеживания соединения
 
+#define TRACE_PID       2      // Номер процесса Raspberry Pi в трассировке (оператор — 1)
+#define METRICS_PORT    12351  // Порт HTTP для GET /metrics (у оператора 12350)
+
 #define UART_DEVICE "/dev/ttyUSB0"   // UART устройство
 #define SERVER_IP   "192.168.0.103"  // IP адрес ноутбука дома
 // #define SERVER_IP "192.168.31.152"    // IP вдрес ноутбука в аудитории
@@ -23,8 +36,90 @@ volatile bool connection_restored = false;
 
 auto CRITICAL_TIMEOUT = std::chrono::seconds(30);
 
+// Onboard detection for weak links (--detect, onboard_vision.h): boxes go
+// to the operator on the log port and the video shrinks or stops.
+bool onboard_detection = false;
+OnboardVideo onboard_video = ONBOARD_VIDEO_THUMBNAIL;
+std::string onboard_model = ONBOARD_MODEL;
+std::atomic<bool> vision_running(false);
+std::atomic<uint64_t> vision_inference_us(0);   // summed, for the report line
+
+// Our CLOCK_MONOTONIC minus the operator's, as the operator measured it
+// from the heartbeat echo; exported traces are shifted onto its clock.
+std::atomic<long long> clock_offset(0);
+
+MetricsServer metrics_server;
+MetricCounter commands_received("raspberry_commands_received_total", "Commands received from the operator");
+MetricCounter commands_forwarded("raspberry_commands_forwarded_total", "Commands written to the Arduino");
+MetricCounter uart_bytes_in("raspberry_uart_bytes_in_total", "Bytes read from the Arduino");
+MetricCounter uart_bytes_out("raspberry_uart_bytes_out_total", "Bytes written to the Arduino");
+MetricCounter log_datagrams("raspberry_log_datagrams_total", "Log datagrams sent to the operator");
+MetricCounter heartbeats_received("raspberry_heartbeats_received_total", "Heartbeats received from the operator");
+MetricHistogram heartbeat_gap("raspberry_heartbeat_gap_seconds", "Time between consecutive heartbeats",
+                              {1, 1.5, 2, 2.5, 3, 5, 10, 30});
+MetricCounter connection_losses("raspberry_connection_lost_total", "Times the operator went silent for CRITICAL_TIMEOUT");
+MetricCounter camera_frames("raspberry_camera_frames_total", "Frames captured by the camera");
+MetricCounter camera_drops("raspberry_camera_dropped_total", "Frames the camera driver skipped (buffer offset gaps)");
+MetricCounter encoder_frames("raspberry_encoder_frames_total", "Frames out of the H.264 encoder");
+VideoFanout video_fanout;
+MetricGauge video_subscribers("raspberry_video_subscribers", "Viewers the video is sent to",
+                              [] { return (double)video_fanout.subscribers().size(); });
+MetricSet subscriber_packets_sent("raspberry_video_subscriber_packets_sent", "RTP packets sent to each viewer", "counter",
+                                  [](std::vector<MetricSample>& samples) {
+                                      for (const VideoSubscriber& s : video_fanout.subscribers())
+                                          samples.push_back({"subscriber=\"" + s.host + ":" + std::to_string(s.port) + "\"",
+                                                             (double)s.packets_sent});
+                                  });
+MetricSet subscriber_packets_lost("raspberry_video_subscriber_packets_lost", "RTP packets each viewer reported lost", "counter",
+                                  [](std::vector<MetricSample>& samples) {
+                                      for (const VideoSubscriber& s : video_fanout.subscribers())
+                                          samples.push_back({"subscriber=\"" + s.host + ":" + std::to_string(s.port) + "\"",
+                                                             (double)s.packets_lost});
+                                  });
+MetricHistogram encode_seconds("raspberry_encode_seconds", "H.264 encode time per frame",
+                               {0.002, 0.005, 0.01, 0.015, 0.02, 0.03, 0.05, 0.1});
+MetricGauge video_bytes_sent("raspberry_video_bytes_sent", "RTP bytes sent to all current viewers", [] {
+    double bytes = 0;
+    for (const VideoSubscriber& s : video_fanout.subscribers())
+        bytes += s.bytes_sent;
+    return bytes;
+});
+MetricCounter keyframe_requests("raspberry_keyframe_requests_total", "Key frames asked for by viewers, joins included",
+                                [] { return video_fanout.keyframes.requests.load(); });
+MetricCounter keyframes_forced("raspberry_keyframes_forced_total", "Key frames forced in the encoder, at most one per VIDEO_KEYFRAME_GAP",
+                               [] { return video_fanout.keyframes.forced.load(); });
+MetricGauge cpu_seconds("raspberry_cpu_seconds", "User and system CPU time of the process", process_cpu_seconds);
+MetricCounter vision_frames("raspberry_vision_frames_total", "Frames the onboard detector ran on");
+MetricCounter vision_objects("raspberry_vision_objects_total", "Boxes the onboard detector sent");
+MetricCounter vision_bytes("raspberry_vision_bytes_total", "Detection record bytes sent to the operator");
+MetricHistogram vision_inference("raspberry_vision_inference_seconds", "Onboard detection time per frame",
+                                 {0.02, 0.05, 0.1, 0.15, 0.2, 0.3, 0.5, 1});
+
+
+void export_trace()
+{
+    std::time_t t = std::time(nullptr);
+    char name[64];
+    std::strftime(name, sizeof(name), "trace_raspberry_%Y-%m-%d_%H-%M-%S.json", std::localtime(&t));
+    trace_export(name, TRACE_PID, "raspberry", clock_offset);
+}
+
+
+// The operator switches tracing with its heartbeat; switching off, or
+// losing the operator, writes the trace out.
+void set_tracing(bool on)
+{
+    if (on == trace_enabled)
+        return;
+    trace_enabled = on;
+    if (!on)
+        export_trace();
+}
+
 void monitor_heartbeat()
 {
+    trace_thread_name("monitor_heartbeat");
+
     int heartbeat_sock = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
 
     if (heartbeat_sock < 0) {
@@ -43,21 +138,17 @@ void monitor_heartbeat()
         return;
     }
 
-    int flags = fcntl(heartbeat_sock, F_GETFL, 0);
-
-    if (flags < 0) {
-        std::cerr << "Error getting socket flags." << std::endl;
+    // Wait in recvfrom() rather than polling every 100 ms, so the echo
+    // below leaves as soon as the heartbeat arrives and the operator's
+    // clock estimate is not off by up to the polling period.
+    timeval timeout{0, 100000};
+    if (setsockopt(heartbeat_sock, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout)) < 0) {
+        std::cerr << "Error setting heartbeat socket timeout." << std::endl;
         close(heartbeat_sock);
         return;
     }
 
-    if (fcntl(heartbeat_sock, F_SETFL, flags | O_NONBLOCK) < 0) {
-        std::cerr << "Error setting socket to non-blocking mode." << std::endl;
-        close(heartbeat_sock);
-        return;
-    }
-
-    char buffer[2] = {0};
+    char buffer[64] = {0};
     sockaddr_in client_addr{};
     socklen_t client_addr_len = sizeof(client_addr);
 
@@ -69,9 +160,29 @@ void monitor_heartbeat()
     while (heartbeat_running) {
         int received = recvfrom(heartbeat_sock, buffer, sizeof(buffer) - 1, 0, (sockaddr*)&client_addr, &client_addr_len);
         if (received > 0) {
+            TRACE_SCOPE("heartbeat");
+            uint64_t now_ns = trace_now();
+            heartbeats_received.add();
+
             buffer[received] = '\0';
             if (buffer[0] == '1') {
+                // "1 <operator ns> <offset ns> <trace>": echo the operator's
+                // time with ours. A bare "1" is an operator without tracing.
+                unsigned long long sent = 0;
+                long long offset = 0;
+                int trace = 0;
+                if (sscanf(buffer, "1 %llu %lld %d", &sent, &offset, &trace) == 3) {
+                    char reply[64];
+                    int len = snprintf(reply, sizeof(reply), "2 %llu %llu", sent, (unsigned long long)now_ns);
+                    sendto(heartbeat_sock, reply, len, 0, (sockaddr*)&client_addr, client_addr_len);
+
+                    clock_offset = offset;
+                    set_tracing(trace != 0);
+                }
+
+                auto previous = last_heartbeat;
                 last_heartbeat = std::chrono::steady_clock::now();
+                heartbeat_gap.observe(std::chrono::duration<double>(last_heartbeat - previous).count());
                 if (was_connection_lost) {
                     std::cout << "Connection restored." << std::endl;
                     was_connection_lost = false;
@@ -93,9 +204,10 @@ void monitor_heartbeat()
                 std::cout << "Connection lost detected." << std::endl;
                 was_connection_lost = true;
                 connection_lost = true;
+                connection_losses.add();
+                set_tracing(false);
             }
         }
-        std::this_thread::sleep_for(std::chrono::milliseconds(100));
     }
 
     std::cout << "Exiting heartbeat loop and closing socket." << std::endl;
@@ -103,17 +215,144 @@ void monitor_heartbeat()
 }
 
 
+// x264enc with tune=zerolatency emits each frame before taking the next,
+// so the time a buffer enters the encoder pairs with the next one out.
+// The metrics time every frame; the trace span is recorded while tracing.
+std::atomic<uint64_t> encode_started(0);        // trace_ticks(), tracing only
+std::atomic<uint64_t> encode_started_ns(0);     // trace_now()
+
+GstPadProbeReturn encoder_input(GstPad*, GstPadProbeInfo*, gpointer)
+{
+    encode_started_ns = trace_now();
+    if (trace_enabled.load(std::memory_order_relaxed))
+        encode_started = trace_ticks();
+    return GST_PAD_PROBE_OK;
+}
+
+GstPadProbeReturn encoder_output(GstPad*, GstPadProbeInfo*, gpointer)
+{
+    encoder_frames.add();
+    uint64_t started_ns = encode_started_ns.exchange(0);
+    if (started_ns)
+        encode_seconds.observe((trace_now() - started_ns) / 1e9);
+
+    uint64_t started = encode_started.exchange(0);
+    if (started)
+        trace_record("encode", started, trace_ticks());
+    return GST_PAD_PROBE_OK;
+}
+
+
+// v4l2src numbers its buffers by the driver's frame sequence, so a jump in
+// the offset is frames the driver dropped before we saw them.
+GstPadProbeReturn camera_output(GstPad*, GstPadProbeInfo* info, gpointer)
+{
+    static guint64 expected = GST_BUFFER_OFFSET_NONE;
+
+    GstBuffer* buffer = GST_PAD_PROBE_INFO_BUFFER(info);
+    guint64 offset = GST_BUFFER_OFFSET(buffer);
+    camera_frames.add();
+    if (offset != GST_BUFFER_OFFSET_NONE) {
+        if (expected != GST_BUFFER_OFFSET_NONE && offset > expected)
+            camera_drops.add(offset - expected);
+        expected = offset + 1;
+    }
+    return GST_PAD_PROBE_OK;
+}
+
+
+// Runs the onboard detector on the newest frame from the "vision" appsink
+// and sends each frame's records to the operator as one datagram on the
+// log port, next to what send_logs() forwards from the Arduino.
+void onboard_detection_loop(GstElement* pipeline, const std::string& server_ip) {
+    trace_thread_name("onboard_detection");
+
+    OnboardVision vision;
+    if (!vision.load(onboard_model))
+        return;
+
+    GstElement* appsink = gst_bin_get_by_name(GST_BIN(pipeline), "vision");
+    int sock = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+    if (!appsink || sock < 0) {
+        std::cerr << "Error starting onboard detection." << std::endl;
+        if (appsink) gst_object_unref(appsink);
+        if (sock >= 0) close(sock);
+        return;
+    }
+
+    sockaddr_in log_addr{};
+    log_addr.sin_family = AF_INET;
+    log_addr.sin_port = htons(LOGS_PORT);
+    inet_pton(AF_INET, server_ip.c_str(), &log_addr.sin_addr);
+
+    std::cout << "Onboard detection with " << onboard_model << std::endl;
+
+    cv::Mat frame;
+    std::vector<uint8_t> datagram;
+    while (vision_running) {
+        if (!onboard_pull_frame(appsink, frame, 100 * GST_MSECOND))
+            continue;
+
+        TRACE_SCOPE("onboard_detect");
+        vision.detect(frame, (uint32_t)(trace_now() / 1000000), datagram);
+        sendto(sock, datagram.data(), datagram.size(), 0, (sockaddr*)&log_addr, sizeof(log_addr));
+
+        vision_frames.add();
+        vision_objects.add(datagram.size() / TELEMETRY_FRAME_SIZE - 1);
+        vision_bytes.add(datagram.size());
+        vision_inference.observe(vision.inference_seconds);
+        vision_inference_us += (uint64_t)(vision.inference_seconds * 1e6);
+    }
+
+    close(sock);
+    gst_object_unref(appsink);
+}
+
+
+// What leaves the Pi and what it costs, every ONBOARD_REPORT seconds, so a
+// run with --detect can be set against one without.
+void report_bandwidth(double seconds) {
+    static double last_cpu = process_cpu_seconds();
+    static uint64_t last_frames = 0, last_vision_bytes = 0, last_inference_us = 0;
+    static double last_video_bytes = 0;
+
+    double cpu = process_cpu_seconds();
+    double video_bytes = 0;
+    for (const VideoSubscriber& s : video_fanout.subscribers())
+        video_bytes += s.bytes_sent;
+    uint64_t frames = vision_frames.get(), bytes = vision_bytes.get(), inference_us = vision_inference_us;
+
+    std::printf("Video %.1f kB/s, CPU %.0f %%", std::max(0.0, video_bytes - last_video_bytes) / seconds / 1000,
+                100 * (cpu - last_cpu) / seconds);
+    if (onboard_detection) {
+        uint64_t n = frames - last_frames;
+        std::printf(", detection %.1f fps, %.0f ms per frame, %.0f B/s", n / seconds,
+                    n ? (inference_us - last_inference_us) / 1000.0 / n : 0.0, (bytes - last_vision_bytes) / seconds);
+    }
+    std::printf("\n");
+    std::fflush(stdout);
+
+    last_cpu = cpu;
+    last_video_bytes = video_bytes;
+    last_frames = frames;
+    last_vision_bytes = bytes;
+    last_inference_us = inference_us;
+}
+
+
 void video_stream_sender() {
     gst_init(nullptr, nullptr);
 
-    std::string pipeline_str = 
-        "v4l2src device=/dev/video0 ! "
+    std::string camera_str =
+        "v4l2src name=camera device=/dev/video0 ! "
         "image/jpeg, width=640, height=480, "
-        "framerate=30/1 ! jpegparse ! avdec_mjpeg ! "
-        "videoconvert ! x264enc tune=zerolatency bitrate=2000 "
-        "speed-preset=ultrafast ! "
-        "rtph264pay config-interval=1 pt=96 !" 
-        "udpsink host=" + std::string(SERVER_IP) + " port=" + std::to_string(VIDEO_PORT);
+        "framerate=30/1 ! jpegparse ! avdec_mjpeg ! ";
+    std::string pipeline_str = camera_str + video_fanout_pipeline(2000);
+    if (onboard_detection) {
+        pipeline_str = camera_str + onboard_vision_pipeline(onboard_video, 2000, [](int bitrate, int key_interval) {
+                           return video_fanout_pipeline(bitrate, key_interval);
+                       });
+    }
     GError* error = nullptr;
     GstElement* pipeline = gst_parse_launch(pipeline_str.c_str(), &error);
 
@@ -123,24 +362,77 @@ void video_stream_sender() {
         return;
     }
 
+    // Camera drops and encoder time per frame for the metrics and the trace.
+    GstElement* camera = gst_bin_get_by_name(GST_BIN(pipeline), "camera");
+    if (camera) {
+        GstPad* src = gst_element_get_static_pad(camera, "src");
+        gst_pad_add_probe(src, GST_PAD_PROBE_TYPE_BUFFER, camera_output, nullptr, nullptr);
+        gst_object_unref(src);
+        gst_object_unref(camera);
+    }
+
+    GstElement* encoder = gst_bin_get_by_name(GST_BIN(pipeline), "encoder");
+    if (encoder) {
+        GstPad* sink = gst_element_get_static_pad(encoder, "sink");
+        GstPad* src = gst_element_get_static_pad(encoder, "src");
+        gst_pad_add_probe(sink, GST_PAD_PROBE_TYPE_BUFFER, encoder_input, nullptr, nullptr);
+        gst_pad_add_probe(src, GST_PAD_PROBE_TYPE_BUFFER, encoder_output, nullptr, nullptr);
+        gst_object_unref(sink);
+        gst_object_unref(src);
+        gst_object_unref(encoder);
+    }
+
+    // With the video off there is no fanout sink to attach.
+    bool video = !onboard_detection || onboard_video != ONBOARD_VIDEO_OFF;
+    if (video)
+        video_fanout.attach(pipeline);
+
     GstStateChangeReturn ret = gst_element_set_state(pipeline, GST_STATE_PLAYING);
     if (ret == GST_STATE_CHANGE_FAILURE) {
         std::cerr << "Error opening pipline with GStreamer!" << std::endl;
+        if (video) video_fanout.detach();
         gst_object_unref(pipeline);
         return;
     }
 
+    std::thread vision_thread;
+    if (onboard_detection) {
+        vision_running = true;
+        vision_thread = std::thread(onboard_detection_loop, pipeline, std::string(SERVER_IP));
+    }
+
     std::cout << "Video stream is sending. Press Ctrl+C to exit." << std::endl;
     GstBus* bus = gst_element_get_bus(pipeline);
-    gst_bus_timed_pop_filtered(bus, GST_CLOCK_TIME_NONE, static_cast<GstMessageType>(GST_MESSAGE_ERROR | GST_MESSAGE_EOS));
+    auto last_report = std::chrono::steady_clock::now();
+    while (true) {
+        GstMessage* message = gst_bus_timed_pop_filtered(bus, GST_SECOND,
+                                                         static_cast<GstMessageType>(GST_MESSAGE_ERROR | GST_MESSAGE_EOS));
+        if (message) {
+            gst_message_unref(message);
+            break;
+        }
+
+        auto now = std::chrono::steady_clock::now();
+        if (now - last_report >= std::chrono::seconds(ONBOARD_REPORT)) {
+            report_bandwidth(std::chrono::duration<double>(now - last_report).count());
+            last_report = now;
+        }
+    }
+
+    vision_running = false;
+    if (vision_thread.joinable())
+        vision_thread.join();
 
     gst_element_set_state(pipeline, GST_STATE_NULL);
+    if (video) video_fanout.detach();
     gst_object_unref(bus);
     gst_object_unref(pipeline);
 }
 
 
 void send_logs(int uart, const std::string& server_ip) {
+    trace_thread_name("send_logs");
+
     int log_sock = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
     if (log_sock < 0) {
         std::cerr << "Error binding log socket." << std::endl;
@@ -153,11 +445,17 @@ void send_logs(int uart, const std::string& server_ip) {
     inet_pton(AF_INET, server_ip.c_str(), &log_addr.sin_addr);
 
     while (logs_running) {
-        char uart_buffer[256] = {0};
-        int bytes_read = serRead(uart, uart_buffer, sizeof(uart_buffer) - 1);
-        if (bytes_read > 0) {
-            uart_buffer[bytes_read] = '\0';
-            sendto(log_sock, uart_buffer, strlen(uart_buffer), 0, (sockaddr*)&log_addr, sizeof(log_addr));
+        // The Arduino sends binary telemetry frames (telemetry.h), so forward
+        // exactly what was read: the payload may contain zero bytes.
+        char uart_buffer[256];
+        {
+            TRACE_SCOPE("forward_logs");
+            int bytes_read = serRead(uart, uart_buffer, sizeof(uart_buffer));
+            if (bytes_read > 0) {
+                uart_bytes_in.add(bytes_read);
+                sendto(log_sock, uart_buffer, bytes_read, 0, (sockaddr*)&log_addr, sizeof(log_addr));
+                log_datagrams.add();
+            }
         }
 
         std::this_thread::sleep_for(std::chrono::milliseconds(100));
@@ -166,7 +464,23 @@ void send_logs(int uart, const std::string& server_ip) {
     close(log_sock);
 }
 
-int main() {
+int main(int argc, char* argv[]) {
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        bool has_value = i + 1 < argc;
+
+        if (arg == "--detect") {
+            onboard_detection = true;
+        } else if (arg == "--video" && has_value && parse_onboard_video(argv[i + 1], onboard_video)) {
+            i++;
+        } else if (arg == "--model" && has_value) {
+            onboard_model = argv[++i];
+        } else {
+            std::cerr << "Usage: " << argv[0] << " [--detect [--video full|thumbnail|off] [--model FILE]]" << std::endl;
+            return arg == "--help" ? 0 : -1;
+        }
+    }
+
     if (gpioInitialise() < 0) {
         std::cerr << "Pigpio init error." << std::endl;
         return -1;
@@ -216,17 +530,24 @@ int main() {
         return -1;
     }
 
+    // The configured operator always gets the video, so an operator that
+    // does not join still works; others join over the command port.
+    video_fanout.join(SERVER_IP, VIDEO_PORT, true);
+
     std::thread logThread(send_logs, uart, SERVER_IP);
     std::thread videoThread(video_stream_sender);
     std::thread heartbeatThread(monitor_heartbeat);
+    metrics_server.start(METRICS_PORT);
 
+    trace_thread_name("main");
     bool e_sent = false;
 
     while (true) {
         if (connection_lost) {
             if (!e_sent) {
                 std::cout << "Connection is lost" << std::endl;
-                serWriteByte(uart, 'o');
+                if (serWriteByte(uart, 'o') == 0)
+                    uart_bytes_out.add();
                 e_sent = true;
             }
             std::this_thread::sleep_for(std::chrono::milliseconds(100));
@@ -240,14 +561,26 @@ int main() {
             continue;
         }
 
-        char buffer[1];
+        video_fanout.expire();
+
+        // Commands are one byte; longer datagrams are video join/leave and
+        // key frame requests.
+        char buffer[64];
         sockaddr_in client_addr;
         socklen_t addr_len = sizeof(client_addr);
 
         int received = recvfrom(sock, buffer, sizeof(buffer), 0, (sockaddr*)&client_addr, &addr_len);
-        if (received > 0) {
+        if (received > 1) {
+            if (!video_fanout.control(buffer, received, client_addr))
+                std::cerr << "Invalid control message." << std::endl;
+        } else if (received == 1) {
+            TRACE_SCOPE("forward_command");
+            commands_received.add();
             std::cout << "Received command: " << buffer[0] << std::endl;
-            serWriteByte(uart, buffer[0]);
+            if (serWriteByte(uart, buffer[0]) == 0) {
+                commands_forwarded.add();
+                uart_bytes_out.add();
+            }
         }
     }
 
@@ -256,6 +589,7 @@ int main() {
     heartbeatThread.join();
     logThread.join();
     videoThread.join();
+    metrics_server.stop();
 
     close(sock);
     serClose(uart);
@@ -0,0 +1,883 @@
+// Headless stand-in for the Raspberry Pi and the robot behind it, so the
+// operator can be run, load-tested and soaked without hardware. Each
+// instance speaks what raspberry.cpp speaks, on the same ports:
+//
+//   12345  commands in; "VJ"/"VL" video join and leave, "VK" key frame
+//          requests, as VideoFanout
+//   12346  RTP H.264 out, to the operator and every viewer that joined
+//   12347  telemetry frames out (telemetry.h), batched every 100 ms
+//   12348  heartbeats in, "2 <operator ns> <our ns>" echoed back
+//
+// The robot is a toy that takes the firmware's commands: held w/x/a/d
+// drive a dead-reckoned pose forward, back or round, 's' stops, 'q'/'e'
+// turn it by 180 degrees, 'c' and 'k' only report that an inspection or
+// calibration started. The pose is
+// reported in TM_POSE frames, with sensor readings and obstacle events
+// mixed in at the configured log rate. Going 30 s without a heartbeat
+// reports TM_CONNECTION_LOST, as the firmware does after the Pi's 'o'.
+//
+// Everything an instance sends goes through its Link, which drops, delays
+// and jitters datagrams; incoming datagrams are dropped at the same rate.
+// One encoder feeds every instance, so many of them fit on one machine:
+// instance k adds port_offset + k * port_stride to every port, and an
+// operator started with the same --port-offset talks to it.
+//
+// With --detect the stand-in runs the Pi's onboard detection
+// (onboard_vision.h) on the test pattern or file and sends its records on
+// the log port, with the video at full size, a thumbnail or off; the status
+// lines show bytes per second and CPU for either mode.
+#include "onboard_vision.h"
+#include "telemetry.h"
+#include "video_fanout.h"
+
+#include <gst/gst.h>
+
+#include <arpa/inet.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <condition_variable>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <queue>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#define SERVER_PORT     12345
+#define VIDEO_PORT      12346
+#define LOGS_PORT       12347
+#define HEARTBEAT_PORT  12348
+
+#define STANDIN_LOG_PERIOD    100     // ms between log datagrams, as send_logs() on the Pi
+#define STANDIN_LOG_DATAGRAM  256     // bytes per log datagram at most, the Pi's UART read
+#define STANDIN_PORT_STRIDE   100     // port offset between instances
+#define STANDIN_BITRATE       2000    // kbit/s, as on the Pi
+#define STANDIN_LOG_RATE      10      // telemetry frames per second per instance
+#define STANDIN_REPORT        10      // seconds between status lines
+#define STANDIN_TIMEOUT       30      // seconds without a heartbeat before the connection is lost
+
+#define ROBOT_SPEED           250     // mm/s driving
+#define ROBOT_TURN_RATE       90      // deg/s turning
+#define ROBOT_HOLD            200     // ms a motion command lasts without a repeat
+#define ROOM_SIZE             4000    // mm, side of the square room the sonar sees
+
+
+std::atomic<bool> running{true};
+std::atomic<bool> video_failed{false};
+
+// Key frames asked for by any instance's viewers, rate-limited together
+// since they share the encoder.
+KeyframeForcer keyframes;
+
+// Onboard detection, shared by every instance like the encoder.
+std::atomic<uint64_t> vision_frames{0};
+std::atomic<uint64_t> vision_inference_us{0};
+
+using Clock = std::chrono::steady_clock;
+
+
+static uint64_t monotonic_ns()
+{
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+
+struct Options {
+    int instances = 1;
+    std::string operator_ip = "127.0.0.1";
+    int port_offset = 0;
+    int port_stride = STANDIN_PORT_STRIDE;
+    std::string video_file;
+    int bitrate = STANDIN_BITRATE;
+    double log_rate = STANDIN_LOG_RATE;
+    double loss = 0;            // fraction of datagrams dropped, each way
+    int delay_ms = 0;           // added to everything sent
+    int jitter_ms = 0;          // uniform +-jitter on top of the delay
+    int duration = 0;           // seconds, 0 until Ctrl+C
+    int report = STANDIN_REPORT;
+    unsigned seed = 1;
+    bool detect = false;        // onboard detection, as raspberry --detect
+    OnboardVideo detect_video = ONBOARD_VIDEO_THUMBNAIL;
+    std::string model = ONBOARD_MODEL;
+};
+
+
+// Outgoing datagrams with loss, delay and jitter. Without delay or jitter
+// they go out from the caller's thread; otherwise a sender thread sends
+// each when it is due, so jitter larger than the packet gap reorders them
+// as a real network would.
+class Link {
+public:
+    Link(const Options& options, unsigned seed)
+        : loss(options.loss), delay_ms(options.delay_ms), jitter_ms(options.jitter_ms), rng(seed) {}
+
+    ~Link() { stop(); }
+
+    void start() {
+        if (delay_ms > 0 || jitter_ms > 0)
+            thread = std::thread(&Link::run, this);
+    }
+
+    void stop() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        wake.notify_all();
+        if (thread.joinable())
+            thread.join();
+    }
+
+    // For incoming datagrams: whether this one is lost on the way in.
+    bool lost() {
+        std::lock_guard<std::mutex> lock(mutex);
+        return loss > 0 && uniform(rng) < loss;
+    }
+
+    void send(int sock, const sockaddr_in& to, const void* data, size_t size) {
+        std::unique_lock<std::mutex> lock(mutex);
+        if (loss > 0 && uniform(rng) < loss) {
+            dropped++;
+            return;
+        }
+
+        if (!thread.joinable()) {
+            lock.unlock();
+            sendto(sock, data, size, 0, (const sockaddr*)&to, sizeof(to));
+            sent++;
+            return;
+        }
+
+        double ms = delay_ms + (jitter_ms > 0 ? (uniform(rng) * 2 - 1) * jitter_ms : 0);
+        Datagram datagram;
+        datagram.due = Clock::now() + std::chrono::microseconds((int64_t)(std::max(ms, 0.0) * 1000));
+        datagram.order = next_order++;
+        datagram.sock = sock;
+        datagram.to = to;
+        datagram.data.assign((const char*)data, (const char*)data + size);
+        pending.push(std::move(datagram));
+        lock.unlock();
+        wake.notify_one();
+    }
+
+    std::atomic<uint64_t> sent{0};
+    std::atomic<uint64_t> dropped{0};
+
+private:
+    struct Datagram {
+        Clock::time_point due;
+        uint64_t order;
+        int sock;
+        sockaddr_in to;
+        std::vector<char> data;
+    };
+
+    struct Later {
+        bool operator()(const Datagram& a, const Datagram& b) const {
+            return a.due != b.due ? a.due > b.due : a.order > b.order;
+        }
+    };
+
+    void run() {
+        std::unique_lock<std::mutex> lock(mutex);
+        while (!stopping) {
+            if (pending.empty()) {
+                wake.wait(lock);
+                continue;
+            }
+            if (pending.top().due > Clock::now()) {
+                wake.wait_until(lock, pending.top().due);
+                continue;
+            }
+
+            Datagram datagram = std::move(const_cast<Datagram&>(pending.top()));
+            pending.pop();
+            lock.unlock();
+            sendto(datagram.sock, datagram.data.data(), datagram.data.size(), 0,
+                   (const sockaddr*)&datagram.to, sizeof(datagram.to));
+            sent++;
+            lock.lock();
+        }
+    }
+
+    double loss;
+    int delay_ms;
+    int jitter_ms;
+
+    std::mutex mutex;
+    std::condition_variable wake;
+    std::mt19937 rng;
+    std::uniform_real_distribution<double> uniform{0.0, 1.0};
+    std::priority_queue<Datagram, std::vector<Datagram>, Later> pending;
+    uint64_t next_order = 0;
+    bool stopping = false;
+    std::thread thread;
+};
+
+
+static int open_socket(int port)
+{
+    int sock = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+    if (sock < 0 || port == 0)
+        return sock;
+
+    sockaddr_in local{};
+    local.sin_family = AF_INET;
+    local.sin_port = htons(port);
+    local.sin_addr.s_addr = htonl(INADDR_ANY);
+    if (bind(sock, (sockaddr*)&local, sizeof(local)) < 0) {
+        std::cerr << "Cannot bind port " << port << std::endl;
+        close(sock);
+        return -1;
+    }
+    return sock;
+}
+
+
+class Robot {
+public:
+    Robot(int index, const Options& options)
+        : index(index), options(options), offset(options.port_offset + index * options.port_stride),
+          link(options, options.seed * 1000003u + index), rng(options.seed + index) {}
+
+    ~Robot() {
+        stop();
+        for (int sock : {command_sock, heartbeat_sock, video_sock, log_sock})
+            if (sock >= 0) close(sock);
+    }
+
+    bool start() {
+        command_sock = open_socket(SERVER_PORT + offset);
+        heartbeat_sock = open_socket(HEARTBEAT_PORT + offset);
+        video_sock = open_socket(0);
+        log_sock = open_socket(0);
+        if (command_sock < 0 || heartbeat_sock < 0 || video_sock < 0 || log_sock < 0)
+            return false;
+
+        int buffer_size = VIDEO_SEND_BUFFER;
+        setsockopt(video_sock, SOL_SOCKET, SO_SNDBUF, &buffer_size, sizeof(buffer_size));
+
+        log_addr.sin_family = AF_INET;
+        log_addr.sin_port = htons(LOGS_PORT + offset);
+        if (inet_pton(AF_INET, options.operator_ip.c_str(), &log_addr.sin_addr) != 1) {
+            std::cerr << "Bad operator address " << options.operator_ip << std::endl;
+            return false;
+        }
+
+        // The configured operator always gets the video, as on the Pi.
+        Viewer viewer{log_addr, true, Clock::now()};
+        viewer.addr.sin_port = htons(VIDEO_PORT + offset);
+        viewers.push_back(viewer);
+
+        started = Clock::now();
+        last_heartbeat = started;
+        link.start();
+        thread = std::thread(&Robot::run, this);
+        return true;
+    }
+
+    void stop() {
+        stopping = true;
+        if (thread.joinable())
+            thread.join();
+        link.stop();
+    }
+
+    // One RTP packet from the shared encoder, to every viewer.
+    void video(const void* packet, size_t size) {
+        std::lock_guard<std::mutex> lock(viewers_mutex);
+        for (Viewer& viewer : viewers) {
+            link.send(video_sock, viewer.addr, packet, size);
+            viewer.packets++;
+            video_bytes += size;
+        }
+        video_packets++;
+    }
+
+    // One frame's detection records, in a datagram of their own as the Pi
+    // sends them.
+    void vision(const std::vector<uint8_t>& datagram) {
+        link.send(log_sock, log_addr, datagram.data(), datagram.size());
+        vision_bytes += datagram.size();
+    }
+
+    // Bytes handed to the link so far: video to all viewers, telemetry and
+    // detection records.
+    uint64_t sent_video_bytes() const { return video_bytes; }
+    uint64_t sent_log_bytes() const { return log_frames * TELEMETRY_FRAME_SIZE; }
+    uint64_t sent_vision_bytes() const { return vision_bytes; }
+
+    void report(double seconds) {
+        size_t viewer_count;
+        {
+            std::lock_guard<std::mutex> lock(viewers_mutex);
+            viewer_count = viewers.size();
+        }
+        std::printf("[%d] %7.0f s  ports +%-5d commands %-7llu heartbeats %-6llu video %-9llu logs %-8llu "
+                    "viewers %zu  sent %llu dropped %llu%s\n",
+                    index, seconds, offset, (unsigned long long)commands.load(),
+                    (unsigned long long)heartbeats.load(), (unsigned long long)video_packets.load(),
+                    (unsigned long long)log_frames.load(), viewer_count, (unsigned long long)link.sent.load(),
+                    (unsigned long long)link.dropped.load(), connection_lost ? "  connection lost" : "");
+    }
+
+private:
+    struct Viewer {
+        sockaddr_in addr;
+        bool permanent;
+        Clock::time_point seen;
+        uint64_t packets = 0;
+    };
+
+    void run() {
+        pollfd fds[2] = {{command_sock, POLLIN, 0}, {heartbeat_sock, POLLIN, 0}};
+        auto next_log = Clock::now();
+
+        frame(TM_BOOT, 0, 0, 0);
+
+        while (!stopping && running) {
+            auto now = Clock::now();
+            int wait = (int)std::chrono::duration_cast<std::chrono::milliseconds>(next_log - now).count();
+            if (poll(fds, 2, std::max(wait, 0)) > 0) {
+                if (fds[0].revents & POLLIN) receive_command();
+                if (fds[1].revents & POLLIN) receive_heartbeat();
+            }
+
+            now = Clock::now();
+            if (now < next_log)
+                continue;
+            next_log += std::chrono::milliseconds(STANDIN_LOG_PERIOD);
+            if (next_log < now)
+                next_log = now + std::chrono::milliseconds(STANDIN_LOG_PERIOD);
+
+            move(now);
+            check_connection(now);
+            expire_viewers(now);
+            generate_logs();
+            send_logs();
+        }
+    }
+
+    void receive_command() {
+        char buffer[64];
+        sockaddr_in from{};
+        socklen_t from_len = sizeof(from);
+        int n = recvfrom(command_sock, buffer, sizeof(buffer) - 1, 0, (sockaddr*)&from, &from_len);
+        if (n <= 0 || link.lost())
+            return;
+
+        if (n == 1) {
+            commands++;
+            command(buffer[0]);
+            return;
+        }
+
+        // "VJ <port> [<received> <lost>]", "VL <port>" or "VK <port>", host
+        // from the sender.
+        buffer[n] = '\0';
+        int port = 0;
+        if (std::sscanf(buffer, "VK %d", &port) == 1) {
+            keyframes.request();
+            return;
+        }
+        bool join = std::sscanf(buffer, "VJ %d", &port) == 1;
+        if (!join && std::sscanf(buffer, "VL %d", &port) != 1)
+            return;
+
+        sockaddr_in addr = from;
+        addr.sin_port = htons(port);
+
+        std::lock_guard<std::mutex> lock(viewers_mutex);
+        auto it = std::find_if(viewers.begin(), viewers.end(), [&](const Viewer& v) {
+            return v.addr.sin_addr.s_addr == addr.sin_addr.s_addr && v.addr.sin_port == addr.sin_port;
+        });
+        if (join) {
+            if (it == viewers.end()) {
+                viewers.push_back({addr, false, Clock::now()});
+                keyframes.request();
+            } else {
+                it->seen = Clock::now();
+            }
+        } else if (it != viewers.end() && !it->permanent) {
+            viewers.erase(it);
+        }
+    }
+
+    void receive_heartbeat() {
+        char buffer[64];
+        sockaddr_in from{};
+        socklen_t from_len = sizeof(from);
+        int n = recvfrom(heartbeat_sock, buffer, sizeof(buffer) - 1, 0, (sockaddr*)&from, &from_len);
+        uint64_t now_ns = monotonic_ns();
+        if (n <= 0 || link.lost())
+            return;
+
+        buffer[n] = '\0';
+        if (buffer[0] != '1')
+            return;
+
+        unsigned long long sent = 0;
+        long long offset_ns = 0;
+        int trace = 0;
+        if (std::sscanf(buffer, "1 %llu %lld %d", &sent, &offset_ns, &trace) == 3) {
+            char reply[64];
+            int len = std::snprintf(reply, sizeof(reply), "2 %llu %llu", sent, (unsigned long long)now_ns);
+            link.send(heartbeat_sock, from, reply, len);
+        }
+
+        heartbeats++;
+        last_heartbeat = Clock::now();
+        if (connection_lost) {
+            connection_lost = false;
+            std::cout << "[" << index << "] Connection restored." << std::endl;
+        }
+    }
+
+    // The firmware's commands (get_command_wheels/get_command_other):
+    // w/x/a/d held to drive forward, back or turn, s stops, q/e turn by
+    // -180/+180 degrees, c inspects, k calibrates, z zeroes the pose.
+    void command(char cmd) {
+        switch (cmd) {
+            case 'w': case 'x': case 'a': case 'd':
+                motion = cmd;
+                motion_until = Clock::now() + std::chrono::milliseconds(ROBOT_HOLD);
+                turn_left = 0;
+                break;
+            case 's':
+                motion = 0;
+                turn_left = 0;
+                break;
+            case 'q': case 'e':
+                if (turn_left == 0) {
+                    motion = 0;
+                    turn_left = cmd == 'e' ? 180 : -180;
+                    frame(TM_ROTATION_STARTED, 0, 0, 0);
+                }
+                break;
+            case 'c':
+                frame(TM_INSPECTION_STARTED, 0, 0, 0);
+                break;
+            case 'k':
+                frame(TM_CALIBRATION_STARTED, 0, 0, 0);
+                break;
+            case 'z':
+                x = y = heading = 0;
+                frame(TM_POSE, 0, 0, 0);
+                break;
+            default:
+                break;
+        }
+    }
+
+    void move(Clock::time_point now) {
+        double dt = std::chrono::duration<double>(now - last_move).count();
+        last_move = now;
+        if (dt > 1)
+            return;
+
+        // A q/e turn runs to its end without the key held, as turn_on_degree().
+        if (turn_left != 0) {
+            double step = std::min(std::fabs(turn_left), ROBOT_TURN_RATE * dt);
+            if (turn_left < 0)
+                step = -step;
+            heading = std::fmod(heading + step + 360, 360);
+            turn_left -= step;
+            return;
+        }
+        if (motion == 0 || now > motion_until)
+            return;
+
+        double a = heading * M_PI / 180;
+        switch (motion) {
+            case 'w': x += std::cos(a) * ROBOT_SPEED * dt; y += std::sin(a) * ROBOT_SPEED * dt; break;
+            case 'x': x -= std::cos(a) * ROBOT_SPEED * dt; y -= std::sin(a) * ROBOT_SPEED * dt; break;
+            case 'a': heading = std::fmod(heading + ROBOT_TURN_RATE * dt + 360, 360); break;
+            case 'd': heading = std::fmod(heading - ROBOT_TURN_RATE * dt + 360, 360); break;
+        }
+        x = std::max(-ROOM_SIZE / 2.0, std::min(ROOM_SIZE / 2.0, x));
+        y = std::max(-ROOM_SIZE / 2.0, std::min(ROOM_SIZE / 2.0, y));
+    }
+
+    void check_connection(Clock::time_point now) {
+        if (!connection_lost && now - last_heartbeat >= std::chrono::seconds(STANDIN_TIMEOUT)) {
+            connection_lost = true;
+            motion = 0;
+            turn_left = 0;
+            std::cout << "[" << index << "] Connection lost detected." << std::endl;
+            frame(TM_CONNECTION_LOST, 0, 0, 0);
+        }
+    }
+
+    void expire_viewers(Clock::time_point now) {
+        std::lock_guard<std::mutex> lock(viewers_mutex);
+        viewers.erase(std::remove_if(viewers.begin(), viewers.end(), [&](const Viewer& v) {
+                          return !v.permanent && now - v.seen > std::chrono::seconds(VIDEO_LEASE);
+                      }),
+                      viewers.end());
+    }
+
+    // Distance to the wall ahead in the square room, in cm.
+    int sonar_cm() const {
+        double a = heading * M_PI / 180;
+        double dx = std::cos(a), dy = std::sin(a);
+        double tx = dx > 1e-9 ? (ROOM_SIZE / 2.0 - x) / dx : dx < -1e-9 ? (-ROOM_SIZE / 2.0 - x) / dx : 1e9;
+        double ty = dy > 1e-9 ? (ROOM_SIZE / 2.0 - y) / dy : dy < -1e-9 ? (-ROOM_SIZE / 2.0 - y) / dy : 1e9;
+        return (int)(std::min(tx, ty) / 10);
+    }
+
+    // The configured rate as a repeating mix: mostly poses, every fifth a
+    // sensor reading, every tenth an obstacle event.
+    void generate_logs() {
+        frames_due += options.log_rate * STANDIN_LOG_PERIOD / 1000.0;
+        std::normal_distribution<double> noise(0, 20);
+
+        while (frames_due >= 1) {
+            frames_due -= 1;
+            uint64_t i = generated++;
+            int distance = sonar_cm();
+
+            if (i % 10 == 9) {
+                switch ((i / 10) % 3) {
+                    case 0: frame(TM_OBSTACLE_DETECTED, distance * 10, 600, 0); break;
+                    case 1: frame(TM_OBSTACLE_PRESENT, distance * 10, 0, 0); break;
+                    case 2: frame(TM_OBSTACLE_CLEARED, 0, 0, 0); break;
+                }
+            } else if (i % 5 == 0) {
+                frame(TM_SENSORS, (int16_t)(2350 + noise(rng)), (int16_t)(4100 + noise(rng) * 5), distance);
+            } else {
+                frame(TM_POSE, (int16_t)x, (int16_t)y, (int16_t)(heading * 10));
+            }
+        }
+    }
+
+    void frame(uint8_t code, int16_t v0, int16_t v1, int16_t v2) {
+        uint32_t millis = (uint32_t)std::chrono::duration_cast<std::chrono::milliseconds>(
+            Clock::now() - started).count();
+
+        std::lock_guard<std::mutex> lock(log_mutex);
+        size_t at = log_buffer.size();
+        log_buffer.resize(at + TELEMETRY_FRAME_SIZE);
+        telemetry_pack((uint8_t*)log_buffer.data() + at, code, millis, v0, v1, v2);
+        log_frames++;
+    }
+
+    // Whole frames per datagram, as the Pi forwards what one UART read got.
+    void send_logs() {
+        std::lock_guard<std::mutex> lock(log_mutex);
+        const size_t per_datagram = STANDIN_LOG_DATAGRAM / TELEMETRY_FRAME_SIZE * TELEMETRY_FRAME_SIZE;
+        for (size_t at = 0; at < log_buffer.size(); at += per_datagram)
+            link.send(log_sock, log_addr, log_buffer.data() + at, std::min(per_datagram, log_buffer.size() - at));
+        log_buffer.clear();
+    }
+
+    int index;
+    const Options& options;
+    int offset;
+    Link link;
+    std::mt19937 rng;
+
+    int command_sock = -1;
+    int heartbeat_sock = -1;
+    int video_sock = -1;
+    int log_sock = -1;
+    sockaddr_in log_addr{};
+
+    std::mutex viewers_mutex;
+    std::vector<Viewer> viewers;
+
+    std::mutex log_mutex;
+    std::vector<char> log_buffer;
+    double frames_due = 0;
+    uint64_t generated = 0;
+
+    Clock::time_point started;
+    Clock::time_point last_heartbeat;
+    Clock::time_point last_move;
+    Clock::time_point motion_until;
+    bool connection_lost = false;
+    char motion = 0;
+    double turn_left = 0;           // degrees of a q/e turn still to go, + to the left
+    double x = 0, y = 0, heading = 0;       // mm, mm, degrees counter-clockwise
+
+    std::atomic<uint64_t> commands{0};
+    std::atomic<uint64_t> heartbeats{0};
+    std::atomic<uint64_t> video_packets{0};
+    std::atomic<uint64_t> log_frames{0};
+    std::atomic<uint64_t> video_bytes{0};
+    std::atomic<uint64_t> vision_bytes{0};
+
+    std::atomic<bool> stopping{false};
+    std::thread thread;
+};
+
+
+// The onboard detector on the "vision" appsink; each frame's records go
+// to every robot.
+void detect_video(const Options& options, GstElement* pipeline, std::vector<std::unique_ptr<Robot>>* robots)
+{
+    OnboardVision vision;
+    GstElement* appsink = gst_bin_get_by_name(GST_BIN(pipeline), "vision");
+    if (!appsink || !vision.load(options.model)) {
+        if (appsink) gst_object_unref(appsink);
+        video_failed = true;
+        running = false;
+        return;
+    }
+
+    cv::Mat frame;
+    std::vector<uint8_t> datagram;
+    while (running) {
+        if (!onboard_pull_frame(appsink, frame, 100 * GST_MSECOND))
+            continue;
+
+        vision.detect(frame, (uint32_t)(monotonic_ns() / 1000000), datagram);
+        for (auto& robot : *robots)
+            robot->vision(datagram);
+        vision_frames++;
+        vision_inference_us += (uint64_t)(vision.inference_seconds * 1e6);
+    }
+    gst_object_unref(appsink);
+}
+
+
+// One encoder for every instance: RTP packets are pulled from an appsink
+// and handed to each robot's link. A recorded file loops.
+void stream_video(const Options& options, std::vector<std::unique_ptr<Robot>>* robots)
+{
+    std::string source =
+        "videotestsrc is-live=true pattern=ball ! "
+        "video/x-raw, width=640, height=480, framerate=30/1 ! ";
+    if (!options.video_file.empty()) {
+        source =
+            "filesrc location=\"" + options.video_file + "\" ! decodebin ! videoconvert ! videoscale ! videorate ! "
+            "video/x-raw, width=640, height=480, framerate=30/1 ! ";
+    }
+
+    // A file has to be paced by its timestamps; the test source is live.
+    std::string sync = options.video_file.empty() ? "false" : "true";
+    auto video_tail = [&](int bitrate, int key_interval) {
+        return video_encoder_pipeline(bitrate, key_interval) + " ! appsink name=rtp max-buffers=64 sync=" + sync;
+    };
+    std::string pipeline_str = source + video_tail(options.bitrate, 0);
+    if (options.detect)
+        pipeline_str = source + onboard_vision_pipeline(options.detect_video, options.bitrate, video_tail);
+
+    GError* error = nullptr;
+    GstElement* pipeline = gst_parse_launch(pipeline_str.c_str(), &error);
+    if (!pipeline) {
+        std::cerr << "Cannot create pipeline: " << (error ? error->message : "unknown error") << std::endl;
+        if (error) g_error_free(error);
+        video_failed = true;
+        running = false;
+        return;
+    }
+
+    // No "rtp" appsink when detection runs with the video off.
+    GstElement* appsink = gst_bin_get_by_name(GST_BIN(pipeline), "rtp");
+    GstBus* bus = gst_element_get_bus(pipeline);
+    if (gst_element_set_state(pipeline, GST_STATE_PLAYING) == GST_STATE_CHANGE_FAILURE) {
+        std::cerr << "Cannot start the video pipeline" << std::endl;
+        video_failed = true;
+        running = false;
+    }
+
+    if (appsink)
+        keyframes.attach(pipeline);
+
+    std::thread vision_thread;
+    if (options.detect)
+        vision_thread = std::thread(detect_video, std::cref(options), pipeline, robots);
+
+    while (running) {
+        keyframes.poll();
+
+        GstSample* sample = nullptr;
+        if (appsink)
+            g_signal_emit_by_name(appsink, "try-pull-sample", (GstClockTime)(100 * GST_MSECOND), &sample);
+        else
+            std::this_thread::sleep_for(std::chrono::milliseconds(100));
+        if (sample) {
+            GstBuffer* buffer = gst_sample_get_buffer(sample);
+            GstMapInfo map;
+            if (buffer && gst_buffer_map(buffer, &map, GST_MAP_READ)) {
+                for (auto& robot : *robots)
+                    robot->video(map.data, map.size);
+                gst_buffer_unmap(buffer, &map);
+            }
+            gst_sample_unref(sample);
+            continue;
+        }
+
+        GstMessage* message = gst_bus_pop_filtered(bus, (GstMessageType)(GST_MESSAGE_EOS | GST_MESSAGE_ERROR));
+        if (!message)
+            continue;
+        if (GST_MESSAGE_TYPE(message) == GST_MESSAGE_ERROR) {
+            GError* err = nullptr;
+            gst_message_parse_error(message, &err, nullptr);
+            std::cerr << "Video pipeline error: " << (err ? err->message : "unknown") << std::endl;
+            if (err) g_error_free(err);
+            gst_message_unref(message);
+            video_failed = true;
+            running = false;
+            break;
+        }
+        gst_message_unref(message);
+        gst_element_seek_simple(pipeline, GST_FORMAT_TIME,
+                                (GstSeekFlags)(GST_SEEK_FLAG_FLUSH | GST_SEEK_FLAG_KEY_UNIT), 0);
+    }
+
+    running = false;
+    if (vision_thread.joinable())
+        vision_thread.join();
+
+    keyframes.detach();
+    gst_element_set_state(pipeline, GST_STATE_NULL);
+    gst_object_unref(bus);
+    if (appsink) gst_object_unref(appsink);
+    gst_object_unref(pipeline);
+}
+
+
+// Bytes per second leaving all robots and the CPU the process used since
+// the last call, to compare --detect with full streaming.
+void report_bandwidth(const Options& options, const std::vector<std::unique_ptr<Robot>>& robots, double seconds)
+{
+    static uint64_t last_video = 0, last_logs = 0, last_vision = 0, last_frames = 0, last_inference_us = 0;
+    static double last_cpu = 0;
+
+    uint64_t video = 0, logs = 0, vision = 0;
+    for (const auto& robot : robots) {
+        video += robot->sent_video_bytes();
+        logs += robot->sent_log_bytes();
+        vision += robot->sent_vision_bytes();
+    }
+    uint64_t frames = vision_frames, inference_us = vision_inference_us;
+    double cpu = process_cpu_seconds();
+
+    std::printf("    video %.1f kB/s  telemetry %.0f B/s  CPU %.0f %%", (video - last_video) / seconds / 1000,
+                (logs - last_logs) / seconds, 100 * (cpu - last_cpu) / seconds);
+    if (options.detect) {
+        uint64_t n = frames - last_frames;
+        std::printf("  detection %.1f fps, %.0f ms per frame, %.0f B/s", n / seconds,
+                    n ? (inference_us - last_inference_us) / 1000.0 / n : 0.0, (vision - last_vision) / seconds);
+    }
+    std::printf("\n");
+
+    last_video = video;
+    last_logs = logs;
+    last_vision = vision;
+    last_frames = frames;
+    last_inference_us = inference_us;
+    last_cpu = cpu;
+}
+
+
+void usage(const char* argv0)
+{
+    std::cerr <<
+        "Usage: " << argv0 << " [options]\n"
+        "  --instances N    robots to run, each on its own ports (default 1)\n"
+        "  --operator IP    where video and logs go (default 127.0.0.1)\n"
+        "  --port-offset N  added to every port of the first robot (default 0)\n"
+        "  --port-stride N  further offset per robot (default " << STANDIN_PORT_STRIDE << ")\n"
+        "  --video FILE     loop a recorded video instead of a test pattern\n"
+        "  --bitrate N      encoder bitrate, kbit/s (default " << STANDIN_BITRATE << ")\n"
+        "  --log-rate N     telemetry frames per second per robot (default " << STANDIN_LOG_RATE << ")\n"
+        "  --loss F         fraction of datagrams lost, each way (default 0)\n"
+        "  --delay MS       delay of everything sent (default 0)\n"
+        "  --jitter MS      uniform +-jitter on top of the delay (default 0)\n"
+        "  --duration S     stop after S seconds (default: until Ctrl+C)\n"
+        "  --report S       seconds between status lines (default " << STANDIN_REPORT << ")\n"
+        "  --seed N         random seed for loss, jitter and sensor noise (default 1)\n"
+        "  --detect         run the Pi's onboard detection and send its records\n"
+        "  --detect-video M with --detect: full, thumbnail or off (default thumbnail)\n"
+        "  --model FILE     onboard detection model (default " ONBOARD_MODEL ")\n";
+}
+
+
+int main(int argc, char* argv[])
+{
+    Options options;
+
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        bool has_value = i + 1 < argc;
+
+        if (arg == "--instances" && has_value) options.instances = std::max(1, std::atoi(argv[++i]));
+        else if (arg == "--operator" && has_value) options.operator_ip = argv[++i];
+        else if (arg == "--port-offset" && has_value) options.port_offset = std::atoi(argv[++i]);
+        else if (arg == "--port-stride" && has_value) options.port_stride = std::max(10, std::atoi(argv[++i]));
+        else if (arg == "--video" && has_value) options.video_file = argv[++i];
+        else if (arg == "--bitrate" && has_value) options.bitrate = std::max(100, std::atoi(argv[++i]));
+        else if (arg == "--log-rate" && has_value) options.log_rate = std::max(0.0, std::atof(argv[++i]));
+        else if (arg == "--loss" && has_value) options.loss = std::min(1.0, std::max(0.0, std::atof(argv[++i])));
+        else if (arg == "--delay" && has_value) options.delay_ms = std::max(0, std::atoi(argv[++i]));
+        else if (arg == "--jitter" && has_value) options.jitter_ms = std::max(0, std::atoi(argv[++i]));
+        else if (arg == "--duration" && has_value) options.duration = std::max(0, std::atoi(argv[++i]));
+        else if (arg == "--report" && has_value) options.report = std::max(1, std::atoi(argv[++i]));
+        else if (arg == "--seed" && has_value) options.seed = (unsigned)std::atoi(argv[++i]);
+        else if (arg == "--detect") options.detect = true;
+        else if (arg == "--detect-video" && has_value && parse_onboard_video(argv[i + 1], options.detect_video)) i++;
+        else if (arg == "--model" && has_value) options.model = argv[++i];
+        else {
+            usage(argv[0]);
+            return arg == "--help" ? 0 : 1;
+        }
+    }
+
+    signal(SIGINT, [](int) { running = false; });
+    signal(SIGTERM, [](int) { running = false; });
+
+    gst_init(nullptr, nullptr);
+
+    std::vector<std::unique_ptr<Robot>> robots;
+    for (int i = 0; i < options.instances; i++) {
+        robots.emplace_back(new Robot(i, options));
+        if (!robots.back()->start())
+            return 1;
+    }
+    std::cout << options.instances << " robot(s) sending to " << options.operator_ip << ", ports +"
+              << options.port_offset << " step " << options.port_stride << std::endl;
+
+    std::thread video_thread(stream_video, std::cref(options), &robots);
+
+    auto begin = Clock::now();
+    auto next_report = begin + std::chrono::seconds(options.report);
+    auto last_report = begin;
+    while (running) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(200));
+        auto now = Clock::now();
+        double seconds = std::chrono::duration<double>(now - begin).count();
+
+        if (options.duration > 0 && seconds >= options.duration)
+            running = false;
+        if (now >= next_report || !running) {
+            next_report += std::chrono::seconds(options.report);
+            for (auto& robot : robots)
+                robot->report(seconds);
+            report_bandwidth(options, robots, std::chrono::duration<double>(now - last_report).count());
+            last_report = now;
+            std::fflush(stdout);
+        }
+    }
+
+    video_thread.join();
+    for (auto& robot : robots)
+        robot->stop();
+    return video_failed ? 1 : 0;
+}
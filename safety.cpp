@@ -0,0 +1,104 @@
+#include "safety.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <sstream>
+
+
+// "8%" or "0.08".
+static bool parse_fraction(const std::string& value, float& out)
+{
+    char* end = nullptr;
+    double v = std::strtod(value.c_str(), &end);
+    if (end == value.c_str())
+        return false;
+    if (*end == '%') {
+        v /= 100;
+        end++;
+    }
+    out = (float)v;
+    return *end == '\0' && v >= 0 && v <= 1;
+}
+
+
+static bool parse_zone(const std::string& value, cv::Rect2f& zone)
+{
+    if (value == "full") zone = cv::Rect2f(0, 0, 1, 1);
+    else if (value == "lower") zone = cv::Rect2f(0, 0.5f, 1, 0.5f);
+    else if (value == "upper") zone = cv::Rect2f(0, 0, 1, 0.5f);
+    else if (value == "left") zone = cv::Rect2f(0, 0, 0.5f, 1);
+    else if (value == "right") zone = cv::Rect2f(0.5f, 0, 0.5f, 1);
+    else if (value == "center") zone = cv::Rect2f(0.25f, 0.25f, 0.5f, 0.5f);
+    else {
+        float x, y, w, h;
+        char tail;
+        if (std::sscanf(value.c_str(), "%f,%f,%f,%f%c", &x, &y, &w, &h, &tail) != 4)
+            return false;
+        zone = cv::Rect2f(x, y, w, h);
+        return w > 0 && h > 0;
+    }
+    return true;
+}
+
+
+bool parse_safety_rule(const std::string& text, SafetyRule& rule)
+{
+    rule = SafetyRule();
+    rule.text = text;
+
+    std::istringstream in(text);
+    std::string token;
+    bool any = false;
+    while (in >> token) {
+        size_t eq = token.find('=');
+        std::string key = token.substr(0, eq);
+        std::string value = eq == std::string::npos ? "" : token.substr(eq + 1);
+
+        bool ok = false;
+        if (key == "area") ok = parse_fraction(value, rule.area);
+        else if (key == "height") ok = parse_fraction(value, rule.height);
+        else if (key == "score") ok = parse_fraction(value, rule.score);
+        else if (key == "zone") ok = parse_zone(value, rule.zone);
+
+        if (!ok) {
+            std::cerr << "Bad safety rule \"" << text << "\" at " << token << std::endl;
+            return false;
+        }
+        any = true;
+    }
+
+    if (!any)
+        std::cerr << "Empty safety rule" << std::endl;
+    return any;
+}
+
+
+int check_safety(const std::vector<SafetyRule>& rules, const std::vector<SafetyBox>& boxes, float& area)
+{
+    for (size_t r = 0; r < rules.size(); r++) {
+        const SafetyRule& rule = rules[r];
+        for (const SafetyBox& b : boxes) {
+            if (b.score < rule.score || b.box.height < rule.height)
+                continue;
+            float inside = (b.box & rule.zone).area();
+            if (inside > rule.area) {
+                area = inside;
+                return (int)r;
+            }
+        }
+    }
+    return -1;
+}
+
+
+void safety_boxes(const Detections& detections, cv::Size frame, std::vector<SafetyBox>& boxes)
+{
+    boxes.clear();
+    for (int idx : detections.kept) {
+        const cv::Rect& r = detections.boxes[idx];
+        boxes.push_back({cv::Rect2f((float)r.x / frame.width, (float)r.y / frame.height,
+                                    (float)r.width / frame.width, (float)r.height / frame.height),
+                         detections.confidences[idx]});
+    }
+}
@@ -0,0 +1,50 @@
+// Vision safety rules: when a detected person is close enough in front of
+// the robot that it has to stop, whoever is at the keyboard. A rule is a
+// line of key=value conditions, all of which one box has to meet:
+//
+//   area=8%            more than this share of the frame covered by the box
+//                      inside the zone
+//   zone=lower         lower, upper, left, right, center, full or x,y,w,h
+//   height=0.4         box height, share of the frame height
+//   score=0.5          detection confidence
+//
+// e.g. "area=8% zone=lower": a person covering more than 8 % of the frame
+// in its lower half. Boxes are given as fractions of the frame, so the
+// same rules apply to our detections and to the Pi's (onboard_vision.h).
+#pragma once
+
+#include <opencv2/opencv.hpp>
+
+#include <string>
+#include <vector>
+
+#include "detection.h"
+
+#define SAFETY_RULE  "area=8% zone=lower"   // used when no --safety-rule is given
+
+
+struct SafetyRule {
+    std::string text;                       // as given, for the log
+    float area = 0;
+    cv::Rect2f zone{0, 0, 1, 1};
+    float height = 0;
+    float score = 0;
+};
+
+
+struct SafetyBox {
+    cv::Rect2f box;                         // fractions of the frame
+    float score;
+};
+
+
+// false, with a message on std::cerr, if the rule does not parse.
+bool parse_safety_rule(const std::string& text, SafetyRule& rule);
+
+// Index of the first rule a box meets, -1 if none; area gets the part of
+// that box inside the rule's zone.
+int check_safety(const std::vector<SafetyRule>& rules, const std::vector<SafetyBox>& boxes, float& area);
+
+// The boxes kept by the last NMS, in pixels of a frame this size, as
+// fractions of it for check_safety().
+void safety_boxes(const Detections& detections, cv::Size frame, std::vector<SafetyBox>& boxes);
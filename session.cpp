@@ -0,0 +1,267 @@
+#include "session.h"
+
+#include <algorithm>
+#include <iostream>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define SESSION_MAGIC          0x4e53424fu   // "OBSN"
+#define SESSION_FOOTER_MAGIC   0x5853424fu   // "OBSX"
+#define SESSION_VERSION        1
+#define SESSION_INDEX_PERIOD   1000000       // us between index entries, also the flush period
+#define SESSION_WRITE_BUFFER   (1 << 20)
+
+
+SessionWriter::~SessionWriter()
+{
+    close();
+}
+
+
+bool SessionWriter::open(const std::string& path)
+{
+    close();
+
+    file = std::fopen(path.c_str(), "wb");
+    if (!file) {
+        std::cerr << "Cannot open session file " << path << std::endl;
+        return false;
+    }
+    setvbuf(file, nullptr, _IOFBF, SESSION_WRITE_BUFFER);
+
+    start = std::chrono::steady_clock::now();
+    int64_t wall_ms = std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::system_clock::now().time_since_epoch()).count();
+
+    SessionFileHeader header{SESSION_MAGIC, SESSION_VERSION, wall_ms};
+    std::fwrite(&header, sizeof(header), 1, file);
+    offset = sizeof(header);
+    index.clear();
+    return true;
+}
+
+
+void SessionWriter::close()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    if (!file) return;
+
+    uint64_t index_offset = offset;
+    int64_t now_us = std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::steady_clock::now() - start).count();
+
+    SessionRecordHeader h{SESSION_INDEX, {0, 0, 0},
+                          (uint32_t)(index.size() * sizeof(SessionIndexEntry)), now_us};
+    std::fwrite(&h, sizeof(h), 1, file);
+    std::fwrite(index.data(), sizeof(SessionIndexEntry), index.size(), file);
+
+    SessionFooter footer{SESSION_FOOTER_MAGIC, 0, index_offset};
+    std::fwrite(&footer, sizeof(footer), 1, file);
+
+    std::fclose(file);
+    file = nullptr;
+}
+
+
+void SessionWriter::append(SessionRecordType type, const void* payload, size_t payload_size)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    if (!file) return;
+
+    // Stamped under the lock so records from different threads stay in
+    // time order in the file.
+    int64_t now_us = std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::steady_clock::now() - start).count();
+
+    // A new index entry every second; flushing there bounds what a crash
+    // can lose without a write() per record.
+    if (index.empty() || now_us - index.back().time_us >= SESSION_INDEX_PERIOD) {
+        index.push_back({now_us, offset});
+        std::fflush(file);
+    }
+
+    SessionRecordHeader h{(uint8_t)type, {0, 0, 0}, (uint32_t)payload_size, now_us};
+    std::fwrite(&h, sizeof(h), 1, file);
+    if (payload_size > 0)
+        std::fwrite(payload, 1, payload_size, file);
+    offset += sizeof(h) + payload_size;
+}
+
+
+SessionReader::~SessionReader()
+{
+    close();
+}
+
+
+bool SessionReader::open(const std::string& path)
+{
+    close();
+
+    fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        std::cerr << "Cannot open session file " << path << std::endl;
+        return false;
+    }
+
+    struct stat st;
+    fstat(fd, &st);
+    size = st.st_size;
+
+    if (size < sizeof(SessionFileHeader)) {
+        std::cerr << "Not a session file: " << path << std::endl;
+        close();
+        return false;
+    }
+
+    void* p = mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+    if (p == MAP_FAILED) {
+        std::cerr << "Cannot map session file " << path << std::endl;
+        close();
+        return false;
+    }
+    data = (const uint8_t*)p;
+
+    header = *(const SessionFileHeader*)data;
+    if (header.magic != SESSION_MAGIC || header.version != SESSION_VERSION) {
+        std::cerr << "Not a session file or incompatible version: " << path << std::endl;
+        close();
+        return false;
+    }
+
+    // Closed cleanly: take the index from the footer.
+    if (size >= sizeof(SessionFileHeader) + sizeof(SessionRecordHeader) + sizeof(SessionFooter)) {
+        const SessionFooter* footer = (const SessionFooter*)(data + size - sizeof(SessionFooter));
+        if (footer->magic == SESSION_FOOTER_MAGIC &&
+            footer->index_offset + sizeof(SessionRecordHeader) <= size - sizeof(SessionFooter)) {
+            const SessionRecordHeader* h = (const SessionRecordHeader*)(data + footer->index_offset);
+            const SessionIndexEntry* entries = (const SessionIndexEntry*)(h + 1);
+
+            if (h->type == SESSION_INDEX &&
+                footer->index_offset + sizeof(*h) + h->size <= size - sizeof(SessionFooter)) {
+                index.assign(entries, entries + h->size / sizeof(SessionIndexEntry));
+                records_end = footer->index_offset;
+                end_time_us = h->time_us;
+                return true;
+            }
+        }
+    }
+
+    // Crashed: walk the records, stopping at the first incomplete one.
+    std::cerr << "Session " << path << " was not closed cleanly, rebuilding its index" << std::endl;
+    uint64_t offset = sizeof(SessionFileHeader);
+    while (offset + sizeof(SessionRecordHeader) <= size) {
+        const SessionRecordHeader* h = (const SessionRecordHeader*)(data + offset);
+        if (h->type < SESSION_VIDEO || h->type > SESSION_HEARTBEAT ||
+            offset + sizeof(*h) + h->size > size)
+            break;
+
+        if (index.empty() || h->time_us - index.back().time_us >= SESSION_INDEX_PERIOD)
+            index.push_back({h->time_us, offset});
+        end_time_us = h->time_us;
+        offset += sizeof(*h) + h->size;
+    }
+    records_end = offset;
+    return true;
+}
+
+
+void SessionReader::close()
+{
+    if (data) munmap((void*)data, size);
+    if (fd >= 0) ::close(fd);
+    data = nullptr;
+    fd = -1;
+    size = 0;
+    records_end = 0;
+    end_time_us = 0;
+    index.clear();
+}
+
+
+uint64_t SessionReader::seek(int64_t time_us) const
+{
+    auto it = std::upper_bound(index.begin(), index.end(), time_us,
+                               [](int64_t t, const SessionIndexEntry& e) { return t < e.time_us; });
+    uint64_t offset = (it == index.begin()) ? sizeof(SessionFileHeader) : (it - 1)->offset;
+
+    // Entries are a second apart; step to the exact record.
+    uint64_t probe = offset;
+    SessionRecord record;
+    while (next(probe, record) && record.time_us < time_us)
+        offset = probe;
+    return offset;
+}
+
+
+bool SessionReader::next(uint64_t& offset, SessionRecord& record) const
+{
+    if (offset + sizeof(SessionRecordHeader) > records_end)
+        return false;
+
+    const SessionRecordHeader* h = (const SessionRecordHeader*)(data + offset);
+    record.type = h->type;
+    record.time_us = h->time_us;
+    record.data = (const uint8_t*)(h + 1);
+    record.size = h->size;
+
+    offset += sizeof(*h) + h->size;
+    return true;
+}
+
+
+// RTP payload carries an SPS: a plain NAL of type 7 or a STAP-A whose
+// first NAL is one (x264 with config-interval=1 sends SPS+PPS before IDRs).
+static bool rtp_has_sps(const uint8_t* packet, uint32_t size)
+{
+    if (size < 13) return false;
+
+    uint32_t header = 12 + 4 * (packet[0] & 0x0f);
+    if (packet[0] & 0x10) {
+        if (size < header + 4) return false;
+        header += 4 + 4 * ((packet[header + 2] << 8) | packet[header + 3]);
+    }
+    if (size <= header) return false;
+
+    uint8_t nal = packet[header] & 0x1f;
+    if (nal == 24 && size > header + 3)
+        nal = packet[header + 3] & 0x1f;
+    return nal == 7;
+}
+
+
+bool SessionReader::export_video(uint64_t offset, const std::string& path, std::vector<int64_t>& frame_times) const
+{
+    FILE* out = std::fopen(path.c_str(), "wb");
+    if (!out) {
+        std::cerr << "Cannot write " << path << std::endl;
+        return false;
+    }
+    setvbuf(out, nullptr, _IOFBF, SESSION_WRITE_BUFFER);
+
+    frame_times.clear();
+    bool started = false;
+    SessionRecord record;
+
+    while (next(offset, record)) {
+        if (record.type != SESSION_VIDEO || record.size < 12 || record.size > 0xffff)
+            continue;
+
+        if (!started && !rtp_has_sps(record.data, record.size))
+            continue;
+        started = true;
+
+        uint8_t length[2] = {(uint8_t)(record.size >> 8), (uint8_t)record.size};
+        std::fwrite(length, 1, 2, out);
+        std::fwrite(record.data, 1, record.size, out);
+
+        if (record.data[1] & 0x80)
+            frame_times.push_back(record.time_us);
+    }
+
+    std::fclose(out);
+    return true;
+}
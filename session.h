@@ -0,0 +1,118 @@
+// Session container: one file per operator run holding the encoded video
+// (the robot's RTP/H.264 packets as received), the raw log datagrams, the
+// commands sent and the heartbeats, each stamped against one monotonic
+// clock. Replay reads it back and feeds the same decode and log pipeline.
+//
+//   file header   SessionFileHeader
+//   records       SessionRecordHeader + payload, in time order
+//   index         SESSION_INDEX record: (time, offset) once per second
+//   footer        SessionFooter pointing at the index
+//
+// The index and footer are written on close. After a crash they are
+// missing and the reader rebuilds the index by walking the records.
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <mutex>
+#include <string>
+#include <vector>
+
+
+enum SessionRecordType : uint8_t {
+    SESSION_VIDEO      = 1,   // one RTP packet
+    SESSION_LOG        = 2,   // one log datagram from the Raspberry Pi
+    SESSION_COMMAND    = 3,   // one command byte sent to the robot
+    SESSION_HEARTBEAT  = 4,   // a watchdog heartbeat was sent
+    SESSION_INDEX      = 5,
+};
+
+
+struct SessionFileHeader {
+    uint32_t magic;
+    uint32_t version;
+    int64_t start_time_ms;    // wall clock at time 0, ms since the Unix epoch
+};
+
+
+struct SessionRecordHeader {
+    uint8_t type;
+    uint8_t reserved[3];
+    uint32_t size;            // payload bytes
+    int64_t time_us;          // monotonic, since the session started
+};
+
+
+struct SessionIndexEntry {
+    int64_t time_us;
+    uint64_t offset;
+};
+
+
+struct SessionFooter {
+    uint32_t magic;
+    uint32_t reserved;
+    uint64_t index_offset;
+};
+
+
+struct SessionRecord {
+    uint8_t type;
+    int64_t time_us;
+    const uint8_t* data;
+    uint32_t size;
+};
+
+
+class SessionWriter {
+public:
+    ~SessionWriter();
+
+    bool open(const std::string& path);
+    void close();
+
+    // Thread-safe; stamps the record with the session clock.
+    void append(SessionRecordType type, const void* data, size_t size);
+
+private:
+    std::mutex mutex;
+    FILE* file = nullptr;
+    std::chrono::steady_clock::time_point start;
+    uint64_t offset = 0;
+    std::vector<SessionIndexEntry> index;
+};
+
+
+class SessionReader {
+public:
+    ~SessionReader();
+
+    bool open(const std::string& path);
+    void close();
+
+    int64_t start_time_ms() const { return header.start_time_ms; }
+    int64_t duration_us() const { return end_time_us; }
+
+    // Offset of the first record at or after time_us, for next().
+    uint64_t seek(int64_t time_us) const;
+
+    // Reads the record at offset and advances it; false at the end.
+    bool next(uint64_t& offset, SessionRecord& record) const;
+
+    // Writes the video records from offset on as an RFC 4571 stream
+    // (2-byte length + RTP packet) that GStreamer's rtpstreamdepay reads,
+    // starting at the first SPS so the decoder can start cleanly. Returns
+    // the session time of every frame in decode order (the packets with
+    // the RTP marker bit set).
+    bool export_video(uint64_t offset, const std::string& path, std::vector<int64_t>& frame_times) const;
+
+private:
+    int fd = -1;
+    const uint8_t* data = nullptr;
+    size_t size = 0;
+    size_t records_end = 0;
+    int64_t end_time_us = 0;
+    SessionFileHeader header{};
+    std::vector<SessionIndexEntry> index;
+};
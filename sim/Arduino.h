@@ -0,0 +1,78 @@
+// Host-side stand-in for the Arduino core used by the firmware simulator.
+// Only the subset that microcontroller.cpp touches is provided; timing and
+// pin behaviour are driven by the virtual clock in hal.cpp.
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <math.h>
+#include <string.h>
+
+#include <avr/io.h>
+
+#define HIGH 0x1
+#define LOW  0x0
+
+#define INPUT        0x0
+#define OUTPUT       0x1
+#define INPUT_PULLUP 0x2
+
+#define DEC 10
+#define HEX 16
+
+#define interrupts()   sei()
+#define noInterrupts() cli()
+
+#define constrain(amt, low, high) ((amt) < (low) ? (low) : ((amt) > (high) ? (high) : (amt)))
+
+typedef bool    boolean;
+typedef uint8_t byte;
+
+unsigned long millis();
+unsigned long micros();
+void delay(unsigned long ms);
+void delayMicroseconds(unsigned int us);
+
+void pinMode(uint8_t pin, uint8_t mode);
+void digitalWrite(uint8_t pin, uint8_t val);
+int  digitalRead(uint8_t pin);
+void analogWrite(uint8_t pin, int val);
+unsigned long pulseIn(uint8_t pin, uint8_t state, unsigned long timeout = 1000000L);
+
+
+class HardwareSerial {
+public:
+    void begin(unsigned long baud);
+    void end() {}
+
+    int available();
+    int read();
+    int peek();
+    int availableForWrite();
+    void flush();
+
+    size_t write(uint8_t c);
+    size_t write(const uint8_t* buffer, size_t size);
+
+    size_t print(const char* str);
+    size_t print(char c);
+    size_t print(int n, int base = DEC);
+    size_t print(unsigned int n, int base = DEC);
+    size_t print(long n, int base = DEC);
+    size_t print(unsigned long n, int base = DEC);
+    size_t print(double n, int digits = 2);
+
+    size_t println();
+    size_t println(const char* str);
+    size_t println(char c);
+    size_t println(int n, int base = DEC);
+    size_t println(unsigned int n, int base = DEC);
+    size_t println(long n, int base = DEC);
+    size_t println(unsigned long n, int base = DEC);
+    size_t println(double n, int digits = 2);
+
+    explicit operator bool() const { return true; }
+};
+
+extern HardwareSerial Serial;
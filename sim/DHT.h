@@ -0,0 +1,28 @@
+// Host-side stand-in for the Adafruit DHT library. Readings come from the
+// simulated environment and a real read blocks for ~23 ms at most once
+// every two seconds, as the library caches between conversions.
+#pragma once
+
+#include <Arduino.h>
+
+#define DHT11 11
+#define DHT22 22
+
+class DHT {
+public:
+    DHT(uint8_t pin, uint8_t type, uint8_t count = 6) : pin(pin), type(type) { (void)count; }
+
+    void begin(uint8_t usec = 55) { (void)usec; }
+    float readTemperature(bool S = false, bool force = false);
+    float readHumidity(bool force = false);
+
+private:
+    bool read(bool force);
+
+    uint8_t pin;
+    uint8_t type;
+    unsigned long last_read_time = 0;
+    bool has_read = false;
+    float temperature = NAN;
+    float humidity = NAN;
+};
@@ -0,0 +1,17 @@
+// Host-side stand-in for the Arduino Servo library (not driven by the firmware yet).
+#pragma once
+
+#include <Arduino.h>
+
+class Servo {
+public:
+    uint8_t attach(int pin) { attached_pin = pin; return 0; }
+    void detach() { attached_pin = -1; }
+    void write(int value) { angle = value; }
+    int read() const { return angle; }
+    bool attached() const { return attached_pin >= 0; }
+
+private:
+    int attached_pin = -1;
+    int angle = 90;
+};
@@ -0,0 +1,63 @@
+// Host-side stand-in for <avr/io.h>: the ATmega328P (Uno/Nano) registers the
+// firmware may touch directly. Every access goes through hal.cpp, so port
+// writes move the simulated pins and are charged their AVR cycle cost.
+#pragma once
+
+#include <stdint.h>
+
+#define _BV(bit) (1 << (bit))
+
+#define COM0A1 7
+#define COM0B1 5
+#define COM1A1 7
+#define COM1B1 5
+#define COM2A1 7
+#define COM2B1 5
+
+#define PCIE0  0
+#define PCIE2  2
+
+// Interrupt vectors are plain functions on the host; hal.cpp calls them when
+// an enabled pin-change edge happens on the virtual clock.
+#define ISR(vector) extern "C" void vector(void)
+
+#define cli()
+#define sei()
+
+namespace sim {
+
+enum RegisterId : uint8_t {
+    REG_PORTB, REG_DDRB, REG_PINB,
+    REG_PORTD, REG_DDRD, REG_PIND,
+    REG_TCCR0A, REG_TCCR1A, REG_TCCR2A,
+    REG_OCR0A, REG_OCR0B, REG_OCR1A, REG_OCR1B, REG_OCR2A, REG_OCR2B,
+    REG_PCICR, REG_PCMSK0, REG_PCMSK2,
+    REG_COUNT
+};
+
+uint8_t register_read(RegisterId id);
+uint8_t register_peek(RegisterId id);
+void register_write(RegisterId id, uint8_t value);
+void register_modify(RegisterId id, uint8_t value);
+
+class Register {
+public:
+    explicit constexpr Register(RegisterId id) : id(id) {}
+
+    operator uint8_t() const { return register_read(id); }
+    Register& operator=(int value) { register_write(id, value); return *this; }
+    Register& operator|=(int mask) { register_modify(id, register_peek(id) | mask); return *this; }
+    Register& operator&=(int mask) { register_modify(id, register_peek(id) & mask); return *this; }
+    Register& operator^=(int mask) { register_modify(id, register_peek(id) ^ mask); return *this; }
+
+private:
+    RegisterId id;
+};
+
+}
+
+extern sim::Register PORTB, DDRB, PINB;
+extern sim::Register PORTD, DDRD, PIND;
+extern sim::Register TCCR0A, TCCR1A, TCCR2A;
+extern sim::Register OCR0A, OCR0B, OCR1A, OCR1B, OCR2A, OCR2B;
+extern sim::Register PCICR, PCMSK0, PCMSK2;
@@ -0,0 +1,23 @@
+// Compiles the unmodified firmware against the mock Arduino headers in this
+// directory and exports its wiring to the simulator.
+#include "hal.h"
+
+#include <math.h>
+
+// The host math.h has glibc functions avr-libc does not; refuse them so the
+// firmware cannot pick one up here and then fail to build for the board.
+#pragma GCC poison remainder remainderf remquo remquof nearbyint nearbyintf rint rintf
+#pragma GCC poison expm1 expm1f log1p log1pf log2 log2f exp2 exp2f
+#pragma GCC poison acosh acoshf asinh asinhf atanh atanhf erf erff erfc erfcf
+#pragma GCC poison tgamma tgammaf lgamma lgammaf nextafter nextafterf
+
+#include "../microcontroller.cpp"
+
+const sim::FirmwareWiring sim::firmware_wiring = {
+    MOTOR_LEFT,
+    MOTOR_RIGHT,
+    MOTOR_DIR_LEFT,
+    MOTOR_DIR_RIGHT,
+    TRIG_PIN,
+    ECHO_PIN
+};
@@ -0,0 +1,830 @@
+#include "hal.h"
+
+#include "../telemetry_decoder.h"
+
+#include <Arduino.h>
+#include <DHT.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <iostream>
+#include <map>
+#include <thread>
+
+#include <fcntl.h>
+#include <termios.h>
+#include <unistd.h>
+
+#define NUM_PINS            20
+#define SERIAL_TX_BUFFER    63     // usable bytes of the AVR core's 64-byte ring
+#define SERIAL_RX_BUFFER    63
+
+#define SONAR_ECHO_DELAY    460    // us from trigger to echo rising edge (HC-SR04)
+#define SONAR_NO_ECHO       38000  // us, echo pulse width when nothing is in range
+#define SONAR_MAX_RANGE     400.0  // cm
+#define SONAR_MIN_RANGE     2.0    // cm
+
+#define DHT_READ_TIME       23000  // us the DHT11 handshake blocks the CPU
+#define DHT_MIN_INTERVAL    2000   // ms between real conversions
+
+#define PHYSICS_STEP        1000   // us
+
+// Approximate ATmega328P cycle cost of pin I/O. The Arduino core calls walk
+// the pin -> port/bit/timer tables in flash and toggle interrupts; direct
+// register access on a constant address is a single sbi/cbi/out/sts.
+#define CYCLES_PIN_MODE       48
+#define CYCLES_DIGITAL_WRITE  56
+#define CYCLES_DIGITAL_READ   52
+#define CYCLES_ANALOG_WRITE   80    // includes its internal pinMode()
+#define CYCLES_REG_ACCESS     2     // sbi/cbi, out, sts
+#define CYCLES_REG_MODIFY_EXT 5     // lds/ori/sts on extended I/O (TCCR1A, TCCR2A)
+
+
+HardwareSerial Serial;
+
+sim::Register PORTB(sim::REG_PORTB), DDRB(sim::REG_DDRB), PINB(sim::REG_PINB);
+sim::Register PORTD(sim::REG_PORTD), DDRD(sim::REG_DDRD), PIND(sim::REG_PIND);
+sim::Register TCCR0A(sim::REG_TCCR0A), TCCR1A(sim::REG_TCCR1A), TCCR2A(sim::REG_TCCR2A);
+sim::Register OCR0A(sim::REG_OCR0A), OCR0B(sim::REG_OCR0B), OCR1A(sim::REG_OCR1A);
+sim::Register OCR1B(sim::REG_OCR1B), OCR2A(sim::REG_OCR2A), OCR2B(sim::REG_OCR2B);
+sim::Register PCICR(sim::REG_PCICR), PCMSK0(sim::REG_PCMSK0), PCMSK2(sim::REG_PCMSK2);
+
+// Pin-change vectors the firmware may define.
+extern "C" void PCINT0_vect(void) __attribute__((weak));
+extern "C" void PCINT2_vect(void) __attribute__((weak));
+
+namespace sim {
+
+void register_store(RegisterId id, uint8_t value);
+
+namespace {
+
+struct State {
+    uint64_t now = 0;
+    std::multimap<uint64_t, std::function<void()>> events;
+
+    bool realtime = false;
+    std::chrono::steady_clock::time_point wall_origin;
+
+    Pin pins[NUM_PINS];
+    uint8_t registers[REG_COUNT] = {};
+    World world;
+    Stats stats;
+
+    int motor_left = 0;
+    int motor_right = 0;
+    std::vector<MotorSample> trace;
+
+    uint64_t trig_high_since = 0;
+    bool trig_high = false;
+    uint64_t echo_rise = 0;
+    uint64_t echo_fall = 0;
+
+    unsigned long baud = 115200;
+    std::deque<uint8_t> rx;
+    std::deque<uint64_t> tx_drain;   // completion time of every byte still in the TX buffer
+    double tx_line_free = 0.0;       // us when the UART shift register becomes idle
+    TelemetryDecoder decoder;
+    std::vector<SerialLine> lines;
+    bool echo = true;
+    int pty_fd = -1;
+};
+
+
+State& state()
+{
+    static State s;
+    return s;
+}
+
+
+// Timer output-compare channels wired to PWM-capable pins.
+struct PwmChannel {
+    int pin;
+    RegisterId control;
+    uint8_t com_bit;
+    RegisterId compare;
+};
+
+const PwmChannel pwm_channels[] = {
+    { 6, REG_TCCR0A, COM0A1, REG_OCR0A},
+    { 5, REG_TCCR0A, COM0B1, REG_OCR0B},
+    { 9, REG_TCCR1A, COM1A1, REG_OCR1A},
+    {10, REG_TCCR1A, COM1B1, REG_OCR1B},
+    {11, REG_TCCR2A, COM2A1, REG_OCR2A},
+    { 3, REG_TCCR2A, COM2B1, REG_OCR2B},
+};
+
+
+const PwmChannel* pwm_channel(int pin)
+{
+    for (const PwmChannel& c : pwm_channels)
+        if (c.pin == pin) return &c;
+    return nullptr;
+}
+
+
+int pin_output(int n)
+{
+    const Pin& p = state().pins[n];
+    if (p.pwm >= 0) return p.pwm;
+    return p.level ? 255 : 0;
+}
+
+
+void update_motor_trace()
+{
+    State& s = state();
+    const FirmwareWiring& w = firmware_wiring;
+
+    int left  = pin_output(w.motor_left)  * (s.pins[w.motor_dir_left].level  ? 1 : -1);
+    int right = pin_output(w.motor_right) * (s.pins[w.motor_dir_right].level ? 1 : -1);
+
+    if (left == s.motor_left && right == s.motor_right && !s.trace.empty())
+        return;
+
+    s.motor_left = left;
+    s.motor_right = right;
+
+    // set_motors() writes four pins back to back; keep only the final state.
+    if (!s.trace.empty() && s.trace.back().t_us == s.now) {
+        s.trace.back().left = left;
+        s.trace.back().right = right;
+        if (s.trace.size() > 1 && s.trace[s.trace.size() - 2].left == left &&
+            s.trace[s.trace.size() - 2].right == right)
+            s.trace.pop_back();
+        return;
+    }
+    s.trace.push_back({s.now, left, right});
+}
+
+
+uint8_t pin_level(int n)
+{
+    State& s = state();
+    if (n == firmware_wiring.echo)
+        return (s.now >= s.echo_rise && s.now < s.echo_fall) ? HIGH : LOW;
+    return s.pins[n].level;
+}
+
+
+// Deliver a pin-change interrupt if the firmware enabled one for this pin.
+void pin_changed(int n)
+{
+    const uint8_t* regs = state().registers;
+    bool port_b = n >= 8;
+
+    if (!(regs[REG_PCICR] & _BV(port_b ? PCIE0 : PCIE2)))
+        return;
+    if (!(regs[port_b ? REG_PCMSK0 : REG_PCMSK2] & _BV(port_b ? n - 8 : n)))
+        return;
+
+    void (*vector)(void) = port_b ? PCINT0_vect : PCINT2_vect;
+    if (vector) vector();
+}
+
+
+void set_level(int n, uint8_t level)
+{
+    State& s = state();
+    Pin& p = s.pins[n];
+
+    if (n == firmware_wiring.trig) {
+        if (level && !p.level) {
+            s.trig_high_since = s.now;
+            s.trig_high = true;
+        } else if (!level && s.trig_high) {
+            s.trig_high = false;
+            // The module ignores triggers while a previous echo is still high.
+            if (s.now - s.trig_high_since >= 10 && s.now >= s.echo_fall) {
+                double d = sonar_distance_cm();
+                s.echo_rise = s.now + SONAR_ECHO_DELAY;
+                s.echo_fall = s.echo_rise + (d >= 0.0 ? (uint64_t)(d * 2.0 / 0.0343) : SONAR_NO_ECHO);
+
+                int echo = firmware_wiring.echo;
+                schedule(s.echo_rise, [echo]() { pin_changed(echo); });
+                schedule(s.echo_fall, [echo]() { pin_changed(echo); });
+            }
+        }
+    }
+
+    p.level = level ? HIGH : LOW;
+    update_motor_trace();
+}
+
+
+void refresh_pwm()
+{
+    State& s = state();
+    for (const PwmChannel& c : pwm_channels) {
+        bool connected = s.registers[c.control] & _BV(c.com_bit);
+        s.pins[c.pin].pwm = connected ? s.registers[c.compare] : -1;
+    }
+    update_motor_trace();
+}
+
+
+void disconnect_pwm(int n)
+{
+    const PwmChannel* c = pwm_channel(n);
+    if (!c) return;
+    state().registers[c->control] &= ~_BV(c->com_bit);
+    refresh_pwm();
+}
+
+
+// Port B carries pins 8..13, port D pins 0..7.
+int port_base(RegisterId id)
+{
+    return (id == REG_PORTB || id == REG_DDRB || id == REG_PINB) ? 8 : 0;
+}
+
+
+int port_width(RegisterId id)
+{
+    return port_base(id) == 8 ? 6 : 8;
+}
+
+
+void step_physics(double dt)
+{
+    World& w = state().world;
+
+    double target_left  = state().motor_left  / 255.0 * w.max_wheel_speed;
+    double target_right = state().motor_right / 255.0 * w.max_wheel_speed;
+    double alpha = 1.0 - std::exp(-dt / w.motor_tau);
+
+    w.room_max_x -= w.wall_speed * dt;
+    if (w.room_max_x <= w.x) {
+        w.room_max_x = w.x;     // the approaching obstacle stops on contact
+        w.wall_speed = 0.0;
+    }
+
+    w.v_left  += (target_left  - w.v_left)  * alpha;
+    w.v_right += (target_right - w.v_right) * alpha;
+
+    double v = 0.5 * (w.v_left + w.v_right);
+    double omega = (w.v_right - w.v_left) / w.track * w.turn_efficiency;
+
+    w.x += v * std::cos(w.theta) * dt;
+    w.y += v * std::sin(w.theta) * dt;
+    w.theta = std::remainder(w.theta + omega * dt, 2.0 * M_PI);
+    w.distance_travelled += std::fabs(v) * dt;
+
+    w.x = std::clamp(w.x, w.room_min_x, w.room_max_x);
+    w.y = std::clamp(w.y, w.room_min_y, w.room_max_y);
+
+    double wall = std::min({w.room_max_x - w.x, w.x - w.room_min_x,
+                            w.room_max_y - w.y, w.y - w.room_min_y});
+    w.min_wall_distance = std::min(w.min_wall_distance, wall);
+}
+
+
+void serial_poll_pty()
+{
+    State& s = state();
+    if (s.pty_fd < 0) return;
+
+    uint8_t buffer[64];
+    ssize_t n = ::read(s.pty_fd, buffer, sizeof(buffer));
+    for (ssize_t i = 0; i < n; i++)
+        serial_inject(buffer[i]);
+}
+
+
+void serial_emit(uint8_t c)
+{
+    State& s = state();
+
+    while (!s.tx_drain.empty() && s.tx_drain.front() <= s.now)
+        s.tx_drain.pop_front();
+
+    if (s.tx_drain.size() >= SERIAL_TX_BUFFER) {
+        uint64_t wait = s.tx_drain.front() - s.now;
+        s.stats.tx_stalls++;
+        s.stats.tx_stall_us += wait;
+        advance_us(wait);
+        s.tx_drain.pop_front();
+    }
+
+    double byte_time = 10.0 * 1e6 / s.baud;
+    s.tx_line_free = std::max(s.tx_line_free, (double)s.now) + byte_time;
+    s.tx_drain.push_back((uint64_t)std::ceil(s.tx_line_free));
+    s.stats.tx_bytes++;
+
+    if (s.pty_fd >= 0)
+        (void)::write(s.pty_fd, &c, 1);
+
+    auto add_line = [&s](const std::string& text) {
+        if (s.echo)
+            std::printf("[%10.3f] %s\n", s.now / 1000.0, text.c_str());
+        s.lines.push_back({s.now, text});
+    };
+
+    char byte = (char)c;
+    s.decoder.feed(&byte, 1,
+                   [&](const TelemetryRecord& r) { add_line(telemetry_format(r)); },
+                   add_line);
+}
+
+
+size_t serial_emit(const char* str)
+{
+    size_t n = 0;
+    for (; str[n]; n++)
+        serial_emit((uint8_t)str[n]);
+    return n;
+}
+
+}
+
+
+uint64_t now_us()
+{
+    return state().now;
+}
+
+
+void advance_us(uint64_t us)
+{
+    State& s = state();
+    uint64_t target = s.now + us;
+
+    while (s.now < target) {
+        uint64_t next = target;
+        if (!s.events.empty() && s.events.begin()->first < next)
+            next = std::max(s.events.begin()->first, s.now);
+
+        while (s.now < next) {
+            uint64_t step = std::min<uint64_t>(PHYSICS_STEP, next - s.now);
+            step_physics(step / 1e6);
+            s.now += step;
+        }
+
+        while (!s.events.empty() && s.events.begin()->first <= s.now) {
+            auto fn = std::move(s.events.begin()->second);
+            s.events.erase(s.events.begin());
+            fn();
+        }
+    }
+
+    if (s.realtime)
+        std::this_thread::sleep_until(s.wall_origin + std::chrono::microseconds(s.now));
+}
+
+
+void schedule(uint64_t t_us, std::function<void()> fn)
+{
+    state().events.emplace(t_us, std::move(fn));
+}
+
+
+void set_realtime(bool realtime)
+{
+    State& s = state();
+    s.realtime = realtime;
+    s.wall_origin = std::chrono::steady_clock::now() - std::chrono::microseconds(s.now);
+}
+
+
+Pin& pin(int n)
+{
+    return state().pins[n];
+}
+
+
+World& world()
+{
+    return state().world;
+}
+
+
+Stats& stats()
+{
+    return state().stats;
+}
+
+
+int motor_left_output()
+{
+    return state().motor_left;
+}
+
+
+int motor_right_output()
+{
+    return state().motor_right;
+}
+
+
+const std::vector<MotorSample>& motor_trace()
+{
+    return state().trace;
+}
+
+
+void serial_inject(uint8_t c)
+{
+    State& s = state();
+    if (s.rx.size() < SERIAL_RX_BUFFER)
+        s.rx.push_back(c);
+}
+
+
+void serial_inject(const std::string& str)
+{
+    for (char c : str)
+        serial_inject((uint8_t)c);
+}
+
+
+void serial_set_baud(unsigned long baud)
+{
+    state().baud = baud;
+}
+
+
+const std::vector<SerialLine>& serial_lines()
+{
+    return state().lines;
+}
+
+
+void serial_set_echo(bool echo)
+{
+    state().echo = echo;
+}
+
+
+std::string serial_open_pty()
+{
+    int fd = posix_openpt(O_RDWR | O_NOCTTY);
+    if (fd < 0) return "";
+
+    if (grantpt(fd) < 0 || unlockpt(fd) < 0) {
+        ::close(fd);
+        return "";
+    }
+
+    termios tio{};
+    if (tcgetattr(fd, &tio) == 0) {
+        cfmakeraw(&tio);
+        tcsetattr(fd, TCSANOW, &tio);
+    }
+
+    int flags = fcntl(fd, F_GETFL, 0);
+    fcntl(fd, F_SETFL, flags | O_NONBLOCK);
+
+    state().pty_fd = fd;
+    return ptsname(fd);
+}
+
+
+double sonar_distance_cm()
+{
+    const World& w = state().world;
+    if (w.scripted_distance >= 0.0)
+        return w.scripted_distance;
+
+    double c = std::cos(w.theta);
+    double s = std::sin(w.theta);
+
+    double best = 1e9;
+    double incidence = 0.0;
+
+    auto consider = [&](double t, double cos_to_normal) {
+        if (t > 0.0 && t < best) {
+            best = t;
+            incidence = std::acos(std::min(1.0, std::fabs(cos_to_normal)));
+        }
+    };
+
+    if (c > 1e-9)  consider((w.room_max_x - w.x) / c, c);
+    if (c < -1e-9) consider((w.room_min_x - w.x) / c, c);
+    if (s > 1e-9)  consider((w.room_max_y - w.y) / s, s);
+    if (s < -1e-9) consider((w.room_min_y - w.y) / s, s);
+
+    if (best > SONAR_MAX_RANGE || incidence > w.sonar_cone)
+        return -1.0;
+    return std::max(best, SONAR_MIN_RANGE);
+}
+
+}
+
+
+using sim::state;
+
+
+unsigned long millis()
+{
+    return (unsigned long)(state().now / 1000);
+}
+
+
+unsigned long micros()
+{
+    return (unsigned long)state().now;
+}
+
+
+void delay(unsigned long ms)
+{
+    sim::advance_us((uint64_t)ms * 1000);
+}
+
+
+void delayMicroseconds(unsigned int us)
+{
+    sim::advance_us(us);
+}
+
+
+void pinMode(uint8_t pin, uint8_t mode)
+{
+    if (pin >= NUM_PINS) return;
+    sim::stats().io_cycles += CYCLES_PIN_MODE;
+    state().pins[pin].mode = mode;
+}
+
+
+void digitalWrite(uint8_t pin, uint8_t val)
+{
+    if (pin >= NUM_PINS) return;
+    sim::stats().io_cycles += CYCLES_DIGITAL_WRITE;
+
+    sim::disconnect_pwm(pin);
+    sim::set_level(pin, val);
+}
+
+
+int digitalRead(uint8_t pin)
+{
+    if (pin >= NUM_PINS) return LOW;
+    sim::stats().io_cycles += CYCLES_DIGITAL_READ;
+
+    sim::disconnect_pwm(pin);
+    return sim::pin_level(pin);
+}
+
+
+void analogWrite(uint8_t pin, int val)
+{
+    if (pin >= NUM_PINS) return;
+
+    pinMode(pin, OUTPUT);
+    sim::stats().io_cycles += CYCLES_ANALOG_WRITE - CYCLES_PIN_MODE;
+
+    const sim::PwmChannel* c = sim::pwm_channel(pin);
+    if (!c || val <= 0 || val >= 255) {
+        sim::disconnect_pwm(pin);
+        sim::set_level(pin, val >= 128 ? HIGH : LOW);
+        return;
+    }
+
+    auto& regs = state().registers;
+    regs[c->compare] = (uint8_t)val;
+    regs[c->control] |= _BV(c->com_bit);
+    sim::refresh_pwm();
+}
+
+
+uint8_t sim::register_read(RegisterId id)
+{
+    stats().io_cycles += CYCLES_REG_ACCESS / 2;
+    return register_peek(id);
+}
+
+
+uint8_t sim::register_peek(RegisterId id)
+{
+    auto& s = state();
+    if (id >= REG_TCCR0A)
+        return s.registers[id];
+
+    uint8_t value = 0;
+    for (int bit = 0; bit < port_width(id); bit++) {
+        int n = port_base(id) + bit;
+        bool set = (id == REG_PINB || id == REG_PIND) ? pin_level(n)
+                 : (id == REG_DDRB || id == REG_DDRD) ? s.pins[n].mode == OUTPUT
+                 : s.pins[n].level;
+        if (set) value |= _BV(bit);
+    }
+    return value;
+}
+
+
+void sim::register_write(RegisterId id, uint8_t value)
+{
+    stats().io_cycles += CYCLES_REG_ACCESS;
+    register_store(id, value);
+}
+
+
+void sim::register_modify(RegisterId id, uint8_t value)
+{
+    // sbi/cbi for the I/O-space registers, lds/ori/sts for the extended ones.
+    bool extended = id == REG_TCCR1A || id == REG_TCCR2A;
+    stats().io_cycles += extended ? CYCLES_REG_MODIFY_EXT : CYCLES_REG_ACCESS;
+    register_store(id, value);
+}
+
+
+void sim::register_store(RegisterId id, uint8_t value)
+{
+    auto& s = state();
+    if (id >= REG_TCCR0A) {
+        s.registers[id] = value;
+        refresh_pwm();
+        return;
+    }
+
+    for (int bit = 0; bit < port_width(id); bit++) {
+        int n = port_base(id) + bit;
+        bool set = value & _BV(bit);
+
+        if (id == REG_DDRB || id == REG_DDRD) {
+            s.pins[n].mode = set ? OUTPUT : INPUT;
+        } else if (id == REG_PINB || id == REG_PIND) {
+            if (set) set_level(n, !s.pins[n].level);    // writing 1 to PINx toggles
+        } else if (s.pins[n].level != (set ? HIGH : LOW)) {
+            set_level(n, set);
+        }
+    }
+}
+
+
+unsigned long pulseIn(uint8_t pin, uint8_t pulse_state, unsigned long timeout)
+{
+    auto& s = state();
+    uint64_t start = s.now;
+    uint64_t deadline = start + timeout;
+
+    auto give_up = [&]() -> unsigned long {
+        sim::advance_us(deadline - s.now);
+        s.stats.pulse_in_us += s.now - start;
+        return 0;
+    };
+
+    if (pin != sim::firmware_wiring.echo || pulse_state != HIGH)
+        return give_up();
+
+    // Like the AVR core, wait out a pulse that is already in progress first.
+    if (s.now >= s.echo_rise && s.now < s.echo_fall)
+        return give_up();
+    if (s.now >= s.echo_fall)
+        return give_up();
+
+    if (s.echo_rise >= deadline) return give_up();
+    sim::advance_us(s.echo_rise - s.now);
+
+    if (s.echo_fall >= deadline) return give_up();
+    sim::advance_us(s.echo_fall - s.now);
+
+    s.stats.pulse_in_us += s.now - start;
+    return (unsigned long)(s.echo_fall - s.echo_rise);
+}
+
+
+void HardwareSerial::begin(unsigned long baud)
+{
+    sim::serial_set_baud(baud);
+}
+
+
+int HardwareSerial::available()
+{
+    sim::serial_poll_pty();
+    return (int)state().rx.size();
+}
+
+
+int HardwareSerial::read()
+{
+    sim::serial_poll_pty();
+    auto& rx = state().rx;
+    if (rx.empty()) return -1;
+
+    int c = rx.front();
+    rx.pop_front();
+    return c;
+}
+
+
+int HardwareSerial::peek()
+{
+    sim::serial_poll_pty();
+    auto& rx = state().rx;
+    return rx.empty() ? -1 : rx.front();
+}
+
+
+int HardwareSerial::availableForWrite()
+{
+    auto& s = state();
+    while (!s.tx_drain.empty() && s.tx_drain.front() <= s.now)
+        s.tx_drain.pop_front();
+    return SERIAL_TX_BUFFER - (int)s.tx_drain.size();
+}
+
+
+void HardwareSerial::flush()
+{
+    auto& s = state();
+    if (!s.tx_drain.empty() && s.tx_drain.back() > s.now)
+        sim::advance_us(s.tx_drain.back() - s.now);
+    s.tx_drain.clear();
+}
+
+
+size_t HardwareSerial::write(uint8_t c)
+{
+    sim::serial_emit(c);
+    return 1;
+}
+
+
+size_t HardwareSerial::write(const uint8_t* buffer, size_t size)
+{
+    for (size_t i = 0; i < size; i++)
+        sim::serial_emit(buffer[i]);
+    return size;
+}
+
+
+size_t HardwareSerial::print(const char* str) { return sim::serial_emit(str); }
+size_t HardwareSerial::print(char c) { sim::serial_emit((uint8_t)c); return 1; }
+size_t HardwareSerial::print(int n, int base) { return print((long)n, base); }
+size_t HardwareSerial::print(unsigned int n, int base) { return print((unsigned long)n, base); }
+
+
+size_t HardwareSerial::print(long n, int base)
+{
+    char buffer[24];
+    if (base == HEX) std::snprintf(buffer, sizeof(buffer), "%lX", (unsigned long)n);
+    else             std::snprintf(buffer, sizeof(buffer), "%ld", n);
+    return sim::serial_emit(buffer);
+}
+
+
+size_t HardwareSerial::print(unsigned long n, int base)
+{
+    char buffer[24];
+    std::snprintf(buffer, sizeof(buffer), base == HEX ? "%lX" : "%lu", n);
+    return sim::serial_emit(buffer);
+}
+
+
+size_t HardwareSerial::print(double n, int digits)
+{
+    char buffer[48];
+    if (std::isnan(n))      std::snprintf(buffer, sizeof(buffer), "nan");
+    else if (std::isinf(n)) std::snprintf(buffer, sizeof(buffer), "inf");
+    else                    std::snprintf(buffer, sizeof(buffer), "%.*f", digits, n);
+    return sim::serial_emit(buffer);
+}
+
+
+size_t HardwareSerial::println() { return sim::serial_emit("\r\n"); }
+size_t HardwareSerial::println(const char* str) { return print(str) + println(); }
+size_t HardwareSerial::println(char c) { return print(c) + println(); }
+size_t HardwareSerial::println(int n, int base) { return print(n, base) + println(); }
+size_t HardwareSerial::println(unsigned int n, int base) { return print(n, base) + println(); }
+size_t HardwareSerial::println(long n, int base) { return print(n, base) + println(); }
+size_t HardwareSerial::println(unsigned long n, int base) { return print(n, base) + println(); }
+size_t HardwareSerial::println(double n, int digits) { return print(n, digits) + println(); }
+
+
+bool DHT::read(bool force)
+{
+    unsigned long now = millis();
+    if (!force && has_read && now - last_read_time < DHT_MIN_INTERVAL)
+        return !isnan(temperature);
+
+    sim::advance_us(DHT_READ_TIME);
+    sim::stats().dht_read_us += DHT_READ_TIME;
+
+    const sim::World& w = sim::world();
+    // DHT11 reports whole degrees and whole percent.
+    temperature = type == DHT11 ? std::round(w.temperature) : w.temperature;
+    humidity    = type == DHT11 ? std::round(w.humidity)    : w.humidity;
+
+    last_read_time = now;
+    has_read = true;
+    return true;
+}
+
+
+float DHT::readTemperature(bool S, bool force)
+{
+    if (!read(force)) return NAN;
+    return S ? temperature * 1.8f + 32.0f : temperature;
+}
+
+
+float DHT::readHumidity(bool force)
+{
+    if (!read(force)) return NAN;
+    return humidity;
+}
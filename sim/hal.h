@@ -0,0 +1,104 @@
+// Control side of the mock Arduino HAL: virtual clock, pin state, the
+// simulated robot (motors + HC-SR04 in a rectangular room) and the Serial
+// port. The firmware only ever sees Arduino.h; the simulator drives this.
+#pragma once
+
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <string>
+#include <vector>
+
+namespace sim {
+
+// Pin numbers exported by firmware.cpp from the macros in microcontroller.cpp.
+struct FirmwareWiring {
+    int motor_left;
+    int motor_right;
+    int motor_dir_left;
+    int motor_dir_right;
+    int trig;
+    int echo;
+};
+
+extern const FirmwareWiring firmware_wiring;
+
+struct Pin {
+    uint8_t mode = 0;
+    uint8_t level = 0;
+    int pwm = -1;           // duty 0..255 while analogWrite drives the pin
+};
+
+// Robot and environment model. Wheel speeds follow the commanded PWM with a
+// first-order lag, so braking has a realistic stopping distance.
+struct World {
+    double room_min_x = -300.0, room_max_x = 100.0;    // cm
+    double wall_speed = 0.0;                           // cm/s, the wall ahead moving toward the robot
+    double room_min_y = -300.0, room_max_y = 300.0;
+    double x = 0.0, y = 0.0, theta = 0.0;              // cm, cm, rad
+    double v_left = 0.0, v_right = 0.0;                // cm/s
+
+    double max_wheel_speed = 50.0;   // cm/s at PWM 255
+    double track = 14.0;             // cm between wheels
+    double turn_efficiency = 1.0;    // fraction of the ideal yaw rate left after wheel scrub
+    double motor_tau = 0.12;         // s
+    double sonar_cone = 0.35;        // rad, beyond this incidence the echo is lost
+    double scripted_distance = -1.0; // cm, overrides ray casting when >= 0
+
+    double temperature = 24.0;
+    double humidity = 45.0;
+
+    double distance_travelled = 0.0;
+    double min_wall_distance = 1e9;
+};
+
+struct MotorSample {
+    uint64_t t_us;
+    int left;
+    int right;
+};
+
+struct SerialLine {
+    uint64_t t_us;
+    std::string text;
+};
+
+struct Stats {
+    uint64_t tx_bytes = 0;
+    uint64_t tx_stalls = 0;          // writes that found the 64-byte TX buffer full
+    uint64_t tx_stall_us = 0;
+    uint64_t pulse_in_us = 0;        // time spent blocked in pulseIn()
+    uint64_t dht_read_us = 0;        // time spent blocked in DHT reads
+    uint64_t io_cycles = 0;          // estimated AVR cycles spent in pin I/O
+};
+
+uint64_t now_us();
+void advance_us(uint64_t us);
+
+// Run fn when the virtual clock reaches t_us (processed inside advance_us).
+void schedule(uint64_t t_us, std::function<void()> fn);
+
+// Pace the virtual clock against the wall clock (needed for --pty).
+void set_realtime(bool realtime);
+
+Pin& pin(int n);
+World& world();
+Stats& stats();
+
+int motor_left_output();
+int motor_right_output();
+const std::vector<MotorSample>& motor_trace();
+
+// Serial: bytes injected here show up in Serial.read() from now on.
+void serial_inject(uint8_t c);
+void serial_inject(const std::string& s);
+void serial_set_baud(unsigned long baud);
+const std::vector<SerialLine>& serial_lines();
+void serial_set_echo(bool echo);
+
+// Serial over a pseudo-terminal; returns the slave path or "" on failure.
+std::string serial_open_pty();
+
+double sonar_distance_cm();
+
+}
@@ -0,0 +1,320 @@
+// Host-side firmware simulator: runs setup()/loop() from microcontroller.cpp
+// on a virtual clock and reports loop timing, command-to-PWM latency and the
+// motor timeline of the rotation/inspection state machines.
+#include "hal.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+void setup();
+void loop();
+
+#define OPERATOR_COMMAND_PERIOD  20     // ms, command_timer interval in operator.cpp
+#define LATENCY_WINDOW           1000   // ms, a probe without a PWM change by then had no effect
+
+
+struct Probe {
+    uint64_t t_us;
+    std::string label;
+};
+
+std::vector<Probe> probes;
+double expected_clearance = -1;     // cm, from "expect clearance"
+
+
+void usage(const char* argv0)
+{
+    std::cerr <<
+        "Usage: " << argv0 << " [options]\n"
+        "  --duration S     simulated seconds to run (0 = forever, default 60)\n"
+        "  --script FILE    timed operator/environment events, see sim/scenarios\n"
+        "  --wall CM        distance to the wall ahead of the robot (default 100)\n"
+        "  --distance CM    fixed sonar reading instead of ray casting the room\n"
+        "  --max-speed V    wheel speed at PWM 255 in cm/s (default 50)\n"
+        "  --turn-efficiency F  fraction of the ideal yaw rate the floor allows (default 1)\n"
+        "  --realtime       pace the virtual clock against the wall clock\n"
+        "  --pty            expose Serial on a pseudo-terminal (implies --realtime)\n"
+        "  --timeline       print the motor output timeline\n"
+        "  --trace FILE     write the motor output timeline as CSV\n"
+        "  --quiet          do not echo firmware Serial output\n";
+}
+
+
+std::string unescape(const std::string& s)
+{
+    std::string out;
+    for (size_t i = 0; i < s.size(); i++) {
+        if (s[i] == '\\' && i + 1 < s.size()) {
+            char c = s[++i];
+            out += (c == 'n') ? '\n' : (c == 'r') ? '\r' : c;
+        } else {
+            out += s[i];
+        }
+    }
+    return out;
+}
+
+
+// Script lines: "<time_ms> <action> [args...]", '#' starts a comment.
+//   send <chars>                 one-shot bytes from the operator
+//   hold <char> <ms> [period]    key held: the byte repeats every period (20 ms)
+//   wall <cm> [speed]            move the wall ahead of the robot, optionally
+//                                approaching at speed cm/s (a walking person)
+//   wallspeed <speed>            change how fast the wall ahead approaches
+//   distance <cm>                fixed sonar reading, -1 returns to ray casting
+//   env <temp> <hum>             DHT11 environment
+//   pose <x> <y> <deg>           teleport the robot
+//   expect clearance <cm>        fail the run if the robot ever came closer
+//                                than cm to a wall (time is ignored)
+bool load_script(const std::string& path)
+{
+    std::ifstream in(path);
+    if (!in.is_open()) {
+        std::cerr << "Cannot open script " << path << std::endl;
+        return false;
+    }
+
+    std::string line;
+    int line_no = 0;
+    while (std::getline(in, line)) {
+        line_no++;
+        line = line.substr(0, line.find('#'));
+
+        std::istringstream ss(line);
+        double t_ms;
+        std::string action;
+        if (!(ss >> t_ms >> action))
+            continue;
+
+        uint64_t t = (uint64_t)(t_ms * 1000.0);
+
+        if (action == "send") {
+            std::string chars;
+            ss >> chars;
+            chars = unescape(chars);
+            probes.push_back({t, "send " + chars});
+            sim::schedule(t, [chars]() { sim::serial_inject(chars); });
+        } else if (action == "hold") {
+            std::string key;
+            double duration = 0, period = OPERATOR_COMMAND_PERIOD;
+            ss >> key >> duration >> period;
+            if (key.empty() || duration <= 0 || period <= 0) {
+                std::cerr << path << ":" << line_no << ": bad hold" << std::endl;
+                return false;
+            }
+            probes.push_back({t, "hold " + key});
+            for (double dt = 0; dt < duration; dt += period) {
+                char c = key[0];
+                sim::schedule(t + (uint64_t)(dt * 1000.0), [c]() { sim::serial_inject((uint8_t)c); });
+            }
+        } else if (action == "wall") {
+            double cm, speed = 0.0;
+            ss >> cm >> speed;
+            sim::schedule(t, [cm, speed]() {
+                sim::world().room_max_x = sim::world().x + cm;
+                sim::world().wall_speed = speed;
+            });
+        } else if (action == "wallspeed") {
+            double speed;
+            ss >> speed;
+            sim::schedule(t, [speed]() { sim::world().wall_speed = speed; });
+        } else if (action == "distance") {
+            double cm;
+            ss >> cm;
+            sim::schedule(t, [cm]() { sim::world().scripted_distance = cm; });
+        } else if (action == "env") {
+            double temp, hum;
+            ss >> temp >> hum;
+            sim::schedule(t, [temp, hum]() {
+                sim::world().temperature = temp;
+                sim::world().humidity = hum;
+            });
+        } else if (action == "pose") {
+            double x, y, deg;
+            ss >> x >> y >> deg;
+            sim::schedule(t, [x, y, deg]() {
+                sim::World& w = sim::world();
+                w.x = x;
+                w.y = y;
+                w.theta = deg * M_PI / 180.0;
+            });
+        } else if (action == "expect") {
+            std::string what;
+            double cm = -1;
+            ss >> what >> cm;
+            if (what != "clearance" || cm < 0) {
+                std::cerr << path << ":" << line_no << ": bad expect" << std::endl;
+                return false;
+            }
+            expected_clearance = cm;
+        } else {
+            std::cerr << path << ":" << line_no << ": unknown action '" << action << "'" << std::endl;
+            return false;
+        }
+    }
+    return true;
+}
+
+
+struct Summary {
+    size_t n = 0;
+    double min = 0, p50 = 0, p99 = 0, max = 0, mean = 0;
+};
+
+
+Summary summarize(std::vector<double> v)
+{
+    Summary s;
+    if (v.empty()) return s;
+
+    std::sort(v.begin(), v.end());
+    s.n = v.size();
+    s.min = v.front();
+    s.max = v.back();
+    s.p50 = v[v.size() / 2];
+    s.p99 = v[std::min(v.size() - 1, (size_t)(v.size() * 0.99))];
+    for (double x : v) s.mean += x;
+    s.mean /= v.size();
+    return s;
+}
+
+
+void print_summary(const char* name, const Summary& s)
+{
+    std::printf("%-26s n=%-7zu min=%-8.2f p50=%-8.2f p99=%-8.2f max=%-8.2f mean=%.2f\n",
+                name, s.n, s.min, s.p50, s.p99, s.max, s.mean);
+}
+
+
+int main(int argc, char* argv[])
+{
+    double duration_s = 60.0;
+    double wall_cm = 100.0;
+    double distance_cm = -1.0;
+    bool realtime = false;
+    bool pty = false;
+    bool timeline = false;
+    bool quiet = false;
+    std::string script_path;
+    std::string trace_path;
+
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        bool has_value = i + 1 < argc;
+
+        if (arg == "--duration" && has_value)       duration_s = std::atof(argv[++i]);
+        else if (arg == "--script" && has_value)    script_path = argv[++i];
+        else if (arg == "--wall" && has_value)      wall_cm = std::atof(argv[++i]);
+        else if (arg == "--distance" && has_value)  distance_cm = std::atof(argv[++i]);
+        else if (arg == "--max-speed" && has_value) sim::world().max_wheel_speed = std::atof(argv[++i]);
+        else if (arg == "--turn-efficiency" && has_value) sim::world().turn_efficiency = std::atof(argv[++i]);
+        else if (arg == "--trace" && has_value)     trace_path = argv[++i];
+        else if (arg == "--realtime")               realtime = true;
+        else if (arg == "--pty")                    pty = realtime = true;
+        else if (arg == "--timeline")               timeline = true;
+        else if (arg == "--quiet")                  quiet = true;
+        else {
+            usage(argv[0]);
+            return arg == "--help" ? 0 : 1;
+        }
+    }
+
+    sim::world().room_max_x = wall_cm;
+    sim::world().scripted_distance = distance_cm;
+    sim::serial_set_echo(!quiet);
+
+    if (!script_path.empty() && !load_script(script_path))
+        return 1;
+
+    if (pty) {
+        std::string path = sim::serial_open_pty();
+        if (path.empty()) {
+            perror("pty");
+            return 1;
+        }
+        std::cout << "Firmware Serial is on " << path << std::endl;
+    }
+    sim::set_realtime(realtime);
+
+    uint64_t end_us = (uint64_t)(duration_s * 1e6);
+    std::vector<double> loop_periods;
+    auto wall_start = std::chrono::steady_clock::now();
+
+    setup();
+    while (duration_s <= 0.0 || sim::now_us() < end_us) {
+        uint64_t start = sim::now_us();
+        loop();
+        loop_periods.push_back((sim::now_us() - start) / 1000.0);
+    }
+
+    double wall_s = std::chrono::duration<double>(std::chrono::steady_clock::now() - wall_start).count();
+    double sim_s = sim::now_us() / 1e6;
+
+    std::printf("\nSimulated %.3f s in %.3f s of wall time (%.0fx real time)\n",
+                sim_s, wall_s, wall_s > 0 ? sim_s / wall_s : 0.0);
+
+    print_summary("loop period [ms]", summarize(loop_periods));
+
+    const sim::Stats& st = sim::stats();
+    std::printf("%-26s pulseIn %.1f%%, DHT %.1f%% of simulated time\n", "blocked in sensors",
+                100.0 * st.pulse_in_us / sim::now_us(), 100.0 * st.dht_read_us / sim::now_us());
+    std::printf("%-26s %.1f estimated AVR cycles per loop\n", "pin I/O",
+                loop_periods.empty() ? 0.0 : (double)st.io_cycles / loop_periods.size());
+    std::printf("%-26s %llu bytes, %llu stalled writes, %.2f ms stalled\n", "serial tx",
+                (unsigned long long)st.tx_bytes, (unsigned long long)st.tx_stalls, st.tx_stall_us / 1000.0);
+
+    const auto& trace = sim::motor_trace();
+    std::vector<double> latencies;
+    for (const Probe& p : probes) {
+        auto it = std::find_if(trace.begin(), trace.end(),
+                               [&](const sim::MotorSample& m) { return m.t_us > p.t_us; });
+        if (it != trace.end() && it->t_us - p.t_us <= LATENCY_WINDOW * 1000ull) {
+            double ms = (it->t_us - p.t_us) / 1000.0;
+            latencies.push_back(ms);
+            std::printf("  %10.3f  %-16s -> PWM (%4d, %4d) after %.2f ms\n",
+                        p.t_us / 1000.0, p.label.c_str(), it->left, it->right, ms);
+        } else {
+            std::printf("  %10.3f  %-16s -> no PWM change\n", p.t_us / 1000.0, p.label.c_str());
+        }
+    }
+    print_summary("command-to-PWM [ms]", summarize(latencies));
+
+    const sim::World& w = sim::world();
+    std::printf("%-26s x=%.1f cm, y=%.1f cm, heading=%.1f deg, travelled %.1f cm, closest wall %.1f cm\n",
+                "robot", w.x, w.y, w.theta * 180.0 / M_PI, w.distance_travelled, w.min_wall_distance);
+
+    if (timeline) {
+        std::printf("\n%12s %12s %6s %6s\n", "start [ms]", "length [ms]", "left", "right");
+        for (size_t i = 0; i < trace.size(); i++) {
+            uint64_t end = (i + 1 < trace.size()) ? trace[i + 1].t_us : sim::now_us();
+            std::printf("%12.3f %12.3f %6d %6d\n", trace[i].t_us / 1000.0,
+                        (end - trace[i].t_us) / 1000.0, trace[i].left, trace[i].right);
+        }
+    }
+
+    if (!trace_path.empty()) {
+        std::ofstream out(trace_path);
+        out << "t_ms,left,right\n";
+        for (const auto& m : trace)
+            out << m.t_us / 1000.0 << "," << m.left << "," << m.right << "\n";
+    }
+
+    if (expected_clearance >= 0) {
+        bool ok = w.min_wall_distance >= expected_clearance;
+        std::printf("%-26s closest wall %.1f cm, at least %.1f cm expected: %s\n", "expect clearance",
+                    w.min_wall_distance, expected_clearance, ok ? "ok" : "FAILED");
+        if (!ok)
+            return 1;
+    }
+
+    return 0;
+}
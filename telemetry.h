@@ -0,0 +1,75 @@
+// Binary telemetry from the Arduino firmware. Every record is a fixed
+// 13-byte frame, so a diagnostic costs ~1.1 ms of UART time at 115200 baud
+// and the message text lives on the host (telemetry_decoder.h) instead of
+// in the ATmega's SRAM.
+//
+//   [0]      TELEMETRY_SYNC
+//   [1]      code (TelemetryCode)
+//   [2..5]   millis() on the Arduino, little-endian
+//   [6..11]  three int16 values, little-endian, meaning depends on the code
+//   [12]     CRC-8 (poly 0x07) over bytes 1..11
+//
+// This header is shared by microcontroller.cpp and the host side; keep it
+// free of the standard library.
+#pragma once
+
+#include <stdint.h>
+
+#define TELEMETRY_SYNC        0xA5
+#define TELEMETRY_FRAME_SIZE  13
+
+
+enum TelemetryCode : uint8_t {
+    TM_BOOT                = 1,
+    TM_ROTATION_STARTED    = 2,
+    TM_CONNECTION_LOST     = 3,
+    TM_INSPECTION_STARTED  = 4,
+    TM_FORWARD_BLOCKED     = 5,
+    TM_OBSTACLE_DETECTED   = 6,   // range [mm], closing speed [mm/s]
+    TM_OBSTACLE_STOP       = 7,
+    TM_OBSTACLE_PRESENT    = 8,   // range [mm]
+    TM_OBSTACLE_CLEARED    = 9,
+    TM_ACTION_INTERRUPTED  = 10,
+    TM_SENSORS             = 11,  // temperature [0.01 C], humidity [0.01 %], distance [cm]
+    TM_TX_OVERFLOW         = 12,  // frames dropped because the TX ring was full
+    TM_POSE                = 13,  // x [mm], y [mm], heading [0.1 deg]
+    TM_CALIBRATION_STARTED = 14,
+    TM_CALIBRATION         = 15,  // wheel speed at PWM 255 [mm/s], turn gain [1/1000]
+    TM_CALIBRATION_FAILED  = 16,  // reason: 1 no wall ahead, 2 implausible drive, 3 timeout
+
+    // From the Raspberry Pi's own detector (onboard_vision.h), not the
+    // firmware; time is the Pi's CLOCK_MONOTONIC in ms. Each detected frame
+    // is one datagram: a TM_VISION_FRAME, then one TM_VISION_OBJECT per box.
+    TM_VISION_FRAME        = 17,  // objects, inference [ms], Pi CPU [%]
+    TM_VISION_OBJECT       = 18,  // class << 8 | score [1/255]; x << 8 | y; w << 8 | h [1/256 of the frame]
+};
+
+
+inline uint8_t telemetry_crc8(const uint8_t* data, uint8_t size)
+{
+    uint8_t crc = 0;
+    for (uint8_t i = 0; i < size; i++) {
+        crc ^= data[i];
+        for (uint8_t bit = 0; bit < 8; bit++)
+            crc = (crc & 0x80) ? (uint8_t)((crc << 1) ^ 0x07) : (uint8_t)(crc << 1);
+    }
+    return crc;
+}
+
+
+inline void telemetry_pack(uint8_t* frame, uint8_t code, uint32_t time,
+                           int16_t v0, int16_t v1, int16_t v2)
+{
+    frame[0] = TELEMETRY_SYNC;
+    frame[1] = code;
+    for (uint8_t i = 0; i < 4; i++)
+        frame[2 + i] = (uint8_t)(time >> (8 * i));
+
+    int16_t values[3] = {v0, v1, v2};
+    for (uint8_t i = 0; i < 3; i++) {
+        frame[6 + 2 * i] = (uint8_t)((uint16_t)values[i] & 0xFF);
+        frame[7 + 2 * i] = (uint8_t)((uint16_t)values[i] >> 8);
+    }
+
+    frame[12] = telemetry_crc8(frame + 1, TELEMETRY_FRAME_SIZE - 2);
+}
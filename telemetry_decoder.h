@@ -0,0 +1,158 @@
+// Host-side decoder for the firmware telemetry stream (see telemetry.h).
+// Frames are resynchronised on TELEMETRY_SYNC and checked by CRC; any bytes
+// that do not form a valid frame are passed through as plain text lines, so
+// output from older text-only firmware still shows up.
+#pragma once
+
+#include "telemetry.h"
+
+#include <cstdio>
+#include <cstddef>
+#include <string>
+#include <vector>
+
+
+struct TelemetryRecord {
+    uint8_t code;
+    uint32_t time_ms;
+    int16_t value[3];
+};
+
+
+class TelemetryDecoder {
+public:
+    // on_record(const TelemetryRecord&) for every frame,
+    // on_text(const std::string&) for every complete plain-text line.
+    template <class RecordFn, class TextFn>
+    void feed(const char* data, size_t size, RecordFn on_record, TextFn on_text)
+    {
+        for (size_t i = 0; i < size; i++)
+            pending.push_back((uint8_t)data[i]);
+
+        size_t pos = 0;
+        while (pos < pending.size()) {
+            uint8_t c = pending[pos];
+
+            if (c == TELEMETRY_SYNC) {
+                if (pending.size() - pos < TELEMETRY_FRAME_SIZE)
+                    break;
+
+                const uint8_t* frame = pending.data() + pos;
+                if (telemetry_crc8(frame + 1, TELEMETRY_FRAME_SIZE - 2) == frame[TELEMETRY_FRAME_SIZE - 1]) {
+                    on_record(unpack(frame));
+                    pos += TELEMETRY_FRAME_SIZE;
+                    continue;
+                }
+            }
+
+            pos++;
+            if (c == '\n') {
+                if (!text.empty()) on_text(text);
+                text.clear();
+            } else if (c != '\r') {
+                text += (char)c;
+            }
+        }
+
+        pending.erase(pending.begin(), pending.begin() + pos);
+    }
+
+    static TelemetryRecord unpack(const uint8_t* frame)
+    {
+        TelemetryRecord r{};
+        r.code = frame[1];
+        for (int i = 0; i < 4; i++)
+            r.time_ms |= (uint32_t)frame[2 + i] << (8 * i);
+        for (int i = 0; i < 3; i++)
+            r.value[i] = (int16_t)(frame[6 + 2 * i] | (frame[7 + 2 * i] << 8));
+        return r;
+    }
+
+private:
+    std::vector<uint8_t> pending;
+    std::string text;
+};
+
+
+// The Pi's own detection records (TM_VISION_*) come as datagrams of whole
+// frames starting with TM_VISION_FRAME, between UART datagrams that may end
+// mid-frame. Decoding them apart keeps such a split frame together.
+inline bool telemetry_vision_datagram(const char* data, size_t size)
+{
+    const uint8_t* frame = (const uint8_t*)data;
+    return size >= TELEMETRY_FRAME_SIZE && size % TELEMETRY_FRAME_SIZE == 0 && frame[0] == TELEMETRY_SYNC &&
+           frame[1] == TM_VISION_FRAME &&
+           telemetry_crc8(frame + 1, TELEMETRY_FRAME_SIZE - 2) == frame[TELEMETRY_FRAME_SIZE - 1];
+}
+
+
+// Renders a record as the log line the firmware used to print.
+inline std::string telemetry_format(const TelemetryRecord& r)
+{
+    char line[128];
+
+    switch (r.code) {
+        case TM_BOOT:               return "Arduino started";
+        case TM_ROTATION_STARTED:   return "Rotation started";
+        case TM_CONNECTION_LOST:    return "Connection lost. Moving backward";
+        case TM_INSPECTION_STARTED: return "Inspection started";
+        case TM_FORWARD_BLOCKED:    return "Forward blocked by obstacle";
+        case TM_OBSTACLE_STOP:      return "Stopping forward motion due to obstacle";
+        case TM_OBSTACLE_CLEARED:   return "Obstacle cleared";
+        case TM_ACTION_INTERRUPTED: return "Action interrupted";
+        case TM_CALIBRATION_STARTED: return "Calibration started";
+
+        case TM_OBSTACLE_DETECTED:
+            std::snprintf(line, sizeof(line), "Obstacle detected! Forward blocked (%.1f cm, closing at %.1f cm/s)",
+                          r.value[0] / 10.0, r.value[1] / 10.0);
+            return line;
+
+        case TM_OBSTACLE_PRESENT:
+            std::snprintf(line, sizeof(line), "Obstacle still present (%.1f cm)", r.value[0] / 10.0);
+            return line;
+
+        case TM_SENSORS:
+            std::snprintf(line, sizeof(line), "Sensors -> Temp: %.2f C, Hum: %.2f %%, Dist: %d cm",
+                          r.value[0] / 100.0, r.value[1] / 100.0, r.value[2]);
+            return line;
+
+        case TM_POSE:
+            std::snprintf(line, sizeof(line), "Pose -> x: %.1f cm, y: %.1f cm, heading: %.1f deg",
+                          r.value[0] / 10.0, r.value[1] / 10.0, r.value[2] / 10.0);
+            return line;
+
+        case TM_CALIBRATION:
+            std::snprintf(line, sizeof(line), "Calibration done: wheel speed %.1f cm/s at full PWM, turn gain %.3f",
+                          r.value[0] / 10.0, r.value[1] / 1000.0);
+            return line;
+
+        case TM_CALIBRATION_FAILED: {
+            const char* reason = r.value[0] == 1 ? "no wall 30..150 cm ahead" :
+                                 r.value[0] == 2 ? "sonar and odometry disagree" :
+                                 r.value[0] == 3 ? "timed out" : "unknown reason";
+            std::snprintf(line, sizeof(line), "Calibration failed: %s", reason);
+            return line;
+        }
+
+        case TM_VISION_FRAME:
+            std::snprintf(line, sizeof(line), "Pi vision -> %d object(s), inference %d ms, CPU %d %%",
+                          r.value[0], r.value[1], r.value[2]);
+            return line;
+
+        case TM_VISION_OBJECT: {
+            uint16_t v0 = (uint16_t)r.value[0], v1 = (uint16_t)r.value[1], v2 = (uint16_t)r.value[2];
+            std::snprintf(line, sizeof(line), "Pi vision -> class %d, score %.2f, box %.2f %.2f %.2f %.2f",
+                          v0 >> 8, (v0 & 0xFF) / 255.0, (v1 >> 8) / 256.0, (v1 & 0xFF) / 256.0,
+                          (v2 >> 8) / 256.0, (v2 & 0xFF) / 256.0);
+            return line;
+        }
+
+        case TM_TX_OVERFLOW:
+            std::snprintf(line, sizeof(line), "Telemetry overflow: %d records dropped", r.value[0]);
+            return line;
+    }
+
+    std::snprintf(line, sizeof(line), "Unknown telemetry code %u (%d, %d, %d)",
+                  r.code, r.value[0], r.value[1], r.value[2]);
+    return line;
+}
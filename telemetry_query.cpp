@@ -0,0 +1,257 @@
+// Time-range queries over telemetry store files (telemetry_*.obts) written
+// by the operator client: raw rows as CSV, or a downsampled profile for
+// plotting where whole blocks are answered from their index headers.
+#include "telemetry_store.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+
+
+void usage(const char* argv0)
+{
+    std::cerr <<
+        "Usage: " << argv0 << " [options] FILE...\n"
+        "  --from TIME      start of the range: \"YYYY-MM-DD HH:MM:SS\", \"YYYY-MM-DD\" or epoch ms\n"
+        "  --to TIME        end of the range (inclusive)\n"
+        "  --buckets N      print N evenly spaced min/mean/max buckets instead of rows\n";
+}
+
+
+bool parse_time(const std::string& text, int64_t& time_ms)
+{
+    char* end = nullptr;
+    long long value = std::strtoll(text.c_str(), &end, 10);
+    if (end && *end == '\0' && text.size() > 10) {
+        time_ms = value;
+        return true;
+    }
+
+    std::tm tm_buf{};
+    const char* rest = strptime(text.c_str(), "%Y-%m-%d %H:%M:%S", &tm_buf);
+    if (!rest) {
+        tm_buf = std::tm{};
+        rest = strptime(text.c_str(), "%Y-%m-%d", &tm_buf);
+    }
+    if (!rest || *rest != '\0')
+        return false;
+
+    tm_buf.tm_isdst = -1;
+    time_ms = (int64_t)std::mktime(&tm_buf) * 1000;
+    return true;
+}
+
+
+std::string format_time(int64_t time_ms)
+{
+    std::time_t t = time_ms / 1000;
+    std::tm tm_buf;
+    localtime_r(&t, &tm_buf);
+
+    char text[40];
+    size_t n = std::strftime(text, sizeof(text), "%Y-%m-%d %H:%M:%S", &tm_buf);
+    std::snprintf(text + n, sizeof(text) - n, ".%03d", (int)(time_ms % 1000));
+    return text;
+}
+
+
+void print_value(int16_t value, double scale)
+{
+    if (value == STORE_NONE)
+        std::printf(",");
+    else
+        std::printf(",%.2f", value * scale);
+}
+
+
+void merge(StoreColumnStats& into, const StoreColumnStats& from)
+{
+    if (from.count == 0) return;
+
+    into.min = std::min(into.min, from.min);
+    into.max = std::max(into.max, from.max);
+    into.sum += from.sum;
+    into.count += from.count;
+}
+
+
+void add(StoreColumnStats& s, int16_t value)
+{
+    if (value == STORE_NONE) return;
+
+    s.min = std::min(s.min, value);
+    s.max = std::max(s.max, value);
+    s.sum += value;
+    s.count++;
+}
+
+
+void print_stats(const StoreColumnStats& s, double scale)
+{
+    if (s.count == 0)
+        std::printf(",,,");
+    else
+        std::printf(",%.2f,%.2f,%.2f", s.min * scale, (double)s.sum / s.count * scale, s.max * scale);
+}
+
+
+struct Bucket {
+    int64_t rows = 0;
+    StoreColumnStats temperature{0, INT16_MAX, INT16_MIN, 0};
+    StoreColumnStats humidity{0, INT16_MAX, INT16_MIN, 0};
+    StoreColumnStats distance{0, INT16_MAX, INT16_MIN, 0};
+};
+
+
+int main(int argc, char* argv[])
+{
+    int64_t from = INT64_MIN;
+    int64_t to = INT64_MAX;
+    int buckets = 0;
+    std::vector<std::string> paths;
+
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        bool has_value = i + 1 < argc;
+
+        if (arg == "--from" && has_value) {
+            if (!parse_time(argv[++i], from)) { std::cerr << "Bad time: " << argv[i] << std::endl; return 1; }
+        } else if (arg == "--to" && has_value) {
+            if (!parse_time(argv[++i], to)) { std::cerr << "Bad time: " << argv[i] << std::endl; return 1; }
+        } else if (arg == "--buckets" && has_value) {
+            buckets = std::atoi(argv[++i]);
+        } else if (arg.size() > 1 && arg[0] == '-') {
+            usage(argv[0]);
+            return arg == "--help" ? 0 : 1;
+        } else {
+            paths.push_back(arg);
+        }
+    }
+
+    if (paths.empty()) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    auto start = std::chrono::steady_clock::now();
+
+    std::vector<std::unique_ptr<TelemetryReader>> readers;
+    for (const std::string& path : paths) {
+        std::unique_ptr<TelemetryReader> reader(new TelemetryReader);
+        if (reader->open(path) && reader->blocks() > 0)
+            readers.push_back(std::move(reader));
+    }
+
+    // Sessions do not overlap, so ordering the files by their first row
+    // keeps the output sorted.
+    std::sort(readers.begin(), readers.end(), [](const std::unique_ptr<TelemetryReader>& a,
+                                                 const std::unique_ptr<TelemetryReader>& b) {
+        return a->block(0).header->first_time < b->block(0).header->first_time;
+    });
+
+    if (readers.empty()) {
+        std::cerr << "No telemetry in the given files" << std::endl;
+        return 1;
+    }
+
+    // Clamp an open range to the data, so buckets span what is there.
+    if (from == INT64_MIN) from = readers.front()->block(0).header->first_time;
+    if (to == INT64_MAX) {
+        const TelemetryReader& last = *readers.back();
+        to = last.block(last.blocks() - 1).header->last_time;
+    }
+    if (to < from) {
+        std::cerr << "Empty time range" << std::endl;
+        return 1;
+    }
+
+    int64_t rows = 0;
+    int64_t blocks_from_index = 0;
+    int64_t blocks_scanned = 0;
+
+    if (buckets <= 0) {
+        std::printf("time,temperature,humidity,distance,command,event\n");
+
+        for (const auto& reader : readers) {
+            for (size_t b = reader->find_block(from); b < reader->blocks(); b++) {
+                StoreBlock block = reader->block(b);
+                if (block.header->first_time > to) break;
+                blocks_scanned++;
+
+                for (uint32_t i = 0; i < block.header->count; i++) {
+                    if (block.time[i] < from) continue;
+                    if (block.time[i] > to) break;
+
+                    std::printf("%s", format_time(block.time[i]).c_str());
+                    print_value(block.temperature[i], 0.01);
+                    print_value(block.humidity[i], 0.01);
+                    print_value(block.distance[i], 0.1);
+                    if (block.command[i]) std::printf(",%c", block.command[i]); else std::printf(",");
+                    if (block.event[i]) std::printf(",%d\n", block.event[i]); else std::printf(",\n");
+                    rows++;
+                }
+            }
+        }
+    } else {
+        std::vector<Bucket> result(buckets);
+        double width = (double)(to - from + 1) / buckets;
+        auto bucket_of = [&](int64_t t) { return std::min(buckets - 1, (int)((t - from) / width)); };
+
+        for (const auto& reader : readers) {
+            for (size_t b = reader->find_block(from); b < reader->blocks(); b++) {
+                StoreBlock block = reader->block(b);
+                const StoreBlockHeader& h = *block.header;
+                if (h.first_time > to) break;
+
+                // A block inside the range and inside one bucket is answered
+                // from its header without touching the columns.
+                if (h.first_time >= from && h.last_time <= to &&
+                    bucket_of(h.first_time) == bucket_of(h.last_time)) {
+                    Bucket& bucket = result[bucket_of(h.first_time)];
+                    bucket.rows += h.count;
+                    merge(bucket.temperature, h.temperature);
+                    merge(bucket.humidity, h.humidity);
+                    merge(bucket.distance, h.distance);
+                    rows += h.count;
+                    blocks_from_index++;
+                    continue;
+                }
+
+                blocks_scanned++;
+                for (uint32_t i = 0; i < h.count; i++) {
+                    if (block.time[i] < from) continue;
+                    if (block.time[i] > to) break;
+
+                    Bucket& bucket = result[bucket_of(block.time[i])];
+                    bucket.rows++;
+                    add(bucket.temperature, block.temperature[i]);
+                    add(bucket.humidity, block.humidity[i]);
+                    add(bucket.distance, block.distance[i]);
+                    rows++;
+                }
+            }
+        }
+
+        std::printf("start,rows,temperature_min,temperature_mean,temperature_max,"
+                    "humidity_min,humidity_mean,humidity_max,distance_min,distance_mean,distance_max\n");
+        for (int i = 0; i < buckets; i++) {
+            std::printf("%s,%lld", format_time(from + (int64_t)(i * width)).c_str(), (long long)result[i].rows);
+            print_stats(result[i].temperature, 0.01);
+            print_stats(result[i].humidity, 0.01);
+            print_stats(result[i].distance, 0.1);
+            std::printf("\n");
+        }
+    }
+
+    double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    std::fprintf(stderr, "%lld rows, %lld blocks scanned, %lld from the index, %.2f ms\n",
+                 (long long)rows, (long long)blocks_scanned, (long long)blocks_from_index, ms);
+    return 0;
+}
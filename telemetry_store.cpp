@@ -0,0 +1,315 @@
+#include "telemetry_store.h"
+
+#include <cstring>
+#include <iostream>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define STORE_MAGIC         0x5354424fu   // "OBTS"
+#define STORE_BLOCK_MAGIC   0x4b4c424fu   // "OBLK"
+#define STORE_VERSION       1
+
+
+struct StoreFileHeader {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t block_bytes;
+    uint32_t block_rows;
+};
+
+
+// Column offsets inside a block; the widest column goes first so every
+// column stays naturally aligned.
+static const size_t TIME_OFFSET        = STORE_BLOCK_HEADER;
+static const size_t TEMPERATURE_OFFSET = TIME_OFFSET + 8 * STORE_BLOCK_ROWS;
+static const size_t HUMIDITY_OFFSET    = TEMPERATURE_OFFSET + 2 * STORE_BLOCK_ROWS;
+static const size_t DISTANCE_OFFSET    = HUMIDITY_OFFSET + 2 * STORE_BLOCK_ROWS;
+static const size_t COMMAND_OFFSET     = DISTANCE_OFFSET + 2 * STORE_BLOCK_ROWS;
+static const size_t EVENT_OFFSET       = COMMAND_OFFSET + STORE_BLOCK_ROWS;
+
+static_assert(EVENT_OFFSET + STORE_BLOCK_ROWS <= STORE_BLOCK_BYTES, "block columns overflow");
+
+
+static StoreBlock block_view(const uint8_t* base)
+{
+    StoreBlock b;
+    b.header      = (const StoreBlockHeader*)base;
+    b.time        = (const int64_t*)(base + TIME_OFFSET);
+    b.temperature = (const int16_t*)(base + TEMPERATURE_OFFSET);
+    b.humidity    = (const int16_t*)(base + HUMIDITY_OFFSET);
+    b.distance    = (const int16_t*)(base + DISTANCE_OFFSET);
+    b.command     = base + COMMAND_OFFSET;
+    b.event       = base + EVENT_OFFSET;
+    return b;
+}
+
+
+static void reset_stats(StoreColumnStats& s)
+{
+    s.count = 0;
+    s.min = INT16_MAX;
+    s.max = INT16_MIN;
+    s.sum = 0;
+}
+
+
+static void add_stat(StoreColumnStats& s, int16_t value)
+{
+    if (value == STORE_NONE) return;
+
+    s.count++;
+    if (value < s.min) s.min = value;
+    if (value > s.max) s.max = value;
+    s.sum += value;
+}
+
+
+static off_t block_offset(size_t index)
+{
+    return STORE_FILE_HEADER + (off_t)index * STORE_BLOCK_BYTES;
+}
+
+
+TelemetryStore::~TelemetryStore()
+{
+    close();
+}
+
+
+bool TelemetryStore::open_write(const std::string& path)
+{
+    close();
+    last_time = INT64_MIN;
+
+    fd = ::open(path.c_str(), O_RDWR | O_CREAT, 0644);
+    if (fd < 0) {
+        std::cerr << "Cannot open telemetry store " << path << std::endl;
+        return false;
+    }
+
+    struct stat st;
+    fstat(fd, &st);
+
+    StoreFileHeader header{};
+    if (st.st_size < STORE_FILE_HEADER) {
+        header = {STORE_MAGIC, STORE_VERSION, STORE_BLOCK_BYTES, STORE_BLOCK_ROWS};
+        if (ftruncate(fd, STORE_FILE_HEADER) != 0 ||
+            pwrite(fd, &header, sizeof(header), 0) != (ssize_t)sizeof(header)) {
+            std::cerr << "Cannot initialise telemetry store " << path << std::endl;
+            close();
+            return false;
+        }
+        st.st_size = STORE_FILE_HEADER;
+    } else if (pread(fd, &header, sizeof(header), 0) != (ssize_t)sizeof(header) ||
+               header.magic != STORE_MAGIC || header.version != STORE_VERSION ||
+               header.block_bytes != STORE_BLOCK_BYTES || header.block_rows != STORE_BLOCK_ROWS) {
+        std::cerr << "Not a telemetry store or incompatible version: " << path << std::endl;
+        close();
+        return false;
+    }
+
+    size_t blocks = (st.st_size - STORE_FILE_HEADER) / STORE_BLOCK_BYTES;
+
+    // The tail block may have been added just before a crash and still be
+    // empty; keep appending after the last row of the block before it.
+    StoreBlockHeader previous{};
+    if (blocks >= 2 &&
+        pread(fd, &previous, sizeof(previous), block_offset(blocks - 2)) == (ssize_t)sizeof(previous) &&
+        previous.magic == STORE_BLOCK_MAGIC && previous.count > 0)
+        last_time = previous.last_time;
+
+    if (!map_block(blocks > 0 ? blocks - 1 : 0)) {
+        close();
+        return false;
+    }
+
+    StoreBlockHeader* h = (StoreBlockHeader*)block;
+    if (h->count == STORE_BLOCK_ROWS && !map_block(block_index + 1)) {
+        close();
+        return false;
+    }
+    return true;
+}
+
+
+void TelemetryStore::close()
+{
+    unmap_block();
+    if (fd >= 0) {
+        fdatasync(fd);
+        ::close(fd);
+        fd = -1;
+    }
+}
+
+
+// Maps block index, growing the file if needed. A block left behind by a
+// crash is repaired: its stats are recomputed from the committed rows.
+bool TelemetryStore::map_block(size_t index)
+{
+    unmap_block();
+
+    struct stat st;
+    fstat(fd, &st);
+    if (st.st_size < block_offset(index + 1) && ftruncate(fd, block_offset(index + 1)) != 0) {
+        std::cerr << "Cannot grow telemetry store" << std::endl;
+        return false;
+    }
+
+    void* p = mmap(nullptr, STORE_BLOCK_BYTES, PROT_READ | PROT_WRITE, MAP_SHARED, fd, block_offset(index));
+    if (p == MAP_FAILED) {
+        std::cerr << "Cannot map telemetry store block" << std::endl;
+        return false;
+    }
+    block = (uint8_t*)p;
+    block_index = index;
+
+    StoreBlockHeader* h = (StoreBlockHeader*)block;
+    if (h->magic != STORE_BLOCK_MAGIC || h->count > STORE_BLOCK_ROWS)
+        h->count = 0;
+
+    StoreBlock view = block_view(block);
+    h->magic = STORE_BLOCK_MAGIC;
+    reset_stats(h->temperature);
+    reset_stats(h->humidity);
+    reset_stats(h->distance);
+    for (uint32_t i = 0; i < h->count; i++) {
+        add_stat(h->temperature, view.temperature[i]);
+        add_stat(h->humidity, view.humidity[i]);
+        add_stat(h->distance, view.distance[i]);
+    }
+
+    if (h->count > 0) {
+        h->first_time = view.time[0];
+        h->last_time = view.time[h->count - 1];
+        last_time = h->last_time;
+    } else {
+        h->first_time = 0;
+        h->last_time = 0;
+    }
+    return true;
+}
+
+
+void TelemetryStore::unmap_block()
+{
+    if (!block) return;
+
+    msync(block, STORE_BLOCK_BYTES, MS_ASYNC);
+    munmap(block, STORE_BLOCK_BYTES);
+    block = nullptr;
+}
+
+
+void TelemetryStore::append(TelemetryRow row)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    if (!block) return;
+
+    StoreBlockHeader* h = (StoreBlockHeader*)block;
+    if (h->count == STORE_BLOCK_ROWS) {
+        if (!map_block(block_index + 1)) return;
+        h = (StoreBlockHeader*)block;
+    }
+
+    if (row.time_ms < last_time) row.time_ms = last_time;
+    last_time = row.time_ms;
+
+    uint32_t i = h->count;
+    ((int64_t*)(block + TIME_OFFSET))[i]        = row.time_ms;
+    ((int16_t*)(block + TEMPERATURE_OFFSET))[i] = row.temperature;
+    ((int16_t*)(block + HUMIDITY_OFFSET))[i]    = row.humidity;
+    ((int16_t*)(block + DISTANCE_OFFSET))[i]    = row.distance;
+    (block + COMMAND_OFFSET)[i]                 = row.command;
+    (block + EVENT_OFFSET)[i]                   = row.event;
+
+    if (i == 0) h->first_time = row.time_ms;
+    h->last_time = row.time_ms;
+    add_stat(h->temperature, row.temperature);
+    add_stat(h->humidity, row.humidity);
+    add_stat(h->distance, row.distance);
+
+    // Commit: the row becomes visible only after all its columns are stored.
+    __atomic_store_n(&h->count, i + 1, __ATOMIC_RELEASE);
+}
+
+
+TelemetryReader::~TelemetryReader()
+{
+    close();
+}
+
+
+bool TelemetryReader::open(const std::string& path)
+{
+    close();
+
+    fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        std::cerr << "Cannot open telemetry store " << path << std::endl;
+        return false;
+    }
+
+    struct stat st;
+    fstat(fd, &st);
+    size = st.st_size;
+
+    StoreFileHeader header{};
+    if (size < STORE_FILE_HEADER ||
+        pread(fd, &header, sizeof(header), 0) != (ssize_t)sizeof(header) ||
+        header.magic != STORE_MAGIC || header.version != STORE_VERSION ||
+        header.block_bytes != STORE_BLOCK_BYTES || header.block_rows != STORE_BLOCK_ROWS) {
+        std::cerr << "Not a telemetry store or incompatible version: " << path << std::endl;
+        close();
+        return false;
+    }
+
+    void* p = mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+    if (p == MAP_FAILED) {
+        std::cerr << "Cannot map telemetry store " << path << std::endl;
+        close();
+        return false;
+    }
+    data = (const uint8_t*)p;
+    madvise(p, size, MADV_RANDOM);
+
+    block_count = (size - STORE_FILE_HEADER) / STORE_BLOCK_BYTES;
+    // An empty tail block carries no time range; leave it out.
+    while (block_count > 0 && block(block_count - 1).header->count == 0)
+        block_count--;
+    return true;
+}
+
+
+void TelemetryReader::close()
+{
+    if (data) munmap((void*)data, size);
+    if (fd >= 0) ::close(fd);
+    data = nullptr;
+    fd = -1;
+    size = 0;
+    block_count = 0;
+}
+
+
+StoreBlock TelemetryReader::block(size_t index) const
+{
+    return block_view(data + block_offset(index));
+}
+
+
+size_t TelemetryReader::find_block(int64_t time_ms) const
+{
+    size_t lo = 0, hi = block_count;
+    while (lo < hi) {
+        size_t mid = (lo + hi) / 2;
+        if (block(mid).header->last_time < time_ms)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo;
+}
@@ -0,0 +1,114 @@
+// Append-only columnar store for telemetry history on the operator side.
+//
+// The file is a 4 KiB header followed by fixed 64 KiB blocks. Each block
+// holds up to STORE_BLOCK_ROWS rows laid out column by column, plus a
+// header with its time range and per-column min/max/sum. The block headers
+// are the sparse time index: a reader maps the file, binary-searches the
+// blocks by time and answers coarse aggregates from the headers alone.
+//
+// Appending writes the row's columns into the mapped tail block and only
+// then bumps the block's row count, so a crash can lose the row being
+// written but never exposes a torn one; open_write() resumes after the last
+// counted row.
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <string>
+
+#define STORE_FILE_HEADER   4096
+#define STORE_BLOCK_BYTES   65536
+#define STORE_BLOCK_HEADER  128
+#define STORE_BLOCK_ROWS    ((STORE_BLOCK_BYTES - STORE_BLOCK_HEADER) / 16)
+
+#define STORE_NONE          INT16_MIN   // column not carried by this row
+
+
+struct TelemetryRow {
+    int64_t time_ms;            // host time the row was recorded, ms since the Unix epoch
+    int16_t temperature;        // 0.01 C
+    int16_t humidity;           // 0.01 %
+    int16_t distance;           // mm
+    uint8_t command;            // operator command byte, 0 if none
+    uint8_t event;              // TelemetryCode of the record, 0 for a command row
+};
+
+
+struct StoreColumnStats {
+    int32_t count;              // rows where the column is not STORE_NONE
+    int16_t min;
+    int16_t max;
+    int64_t sum;
+};
+
+
+struct StoreBlockHeader {
+    uint32_t magic;
+    uint32_t count;             // committed rows, written last
+    int64_t first_time;
+    int64_t last_time;
+    StoreColumnStats temperature;
+    StoreColumnStats humidity;
+    StoreColumnStats distance;
+};
+
+static_assert(sizeof(StoreBlockHeader) <= STORE_BLOCK_HEADER, "block header overflows");
+
+
+// Column views into one mapped block.
+struct StoreBlock {
+    const StoreBlockHeader* header;
+    const int64_t* time;
+    const int16_t* temperature;
+    const int16_t* humidity;
+    const int16_t* distance;
+    const uint8_t* command;
+    const uint8_t* event;
+};
+
+
+class TelemetryStore {
+public:
+    ~TelemetryStore();
+
+    // Creates the file or continues an existing one.
+    bool open_write(const std::string& path);
+    void close();
+
+    // O(1): a few stores into the mapped tail block. Thread-safe. Times
+    // that go backwards (clock adjustments) are clamped to keep the file
+    // sorted.
+    void append(TelemetryRow row);
+
+private:
+    bool map_block(size_t index);
+    void unmap_block();
+
+    std::mutex mutex;
+    int fd = -1;
+    size_t block_index = 0;
+    uint8_t* block = nullptr;
+    int64_t last_time = INT64_MIN;
+};
+
+
+class TelemetryReader {
+public:
+    ~TelemetryReader();
+
+    bool open(const std::string& path);
+    void close();
+
+    size_t blocks() const { return block_count; }
+    StoreBlock block(size_t index) const;
+
+    // First block that may hold rows at or after time_ms.
+    size_t find_block(int64_t time_ms) const;
+
+private:
+    int fd = -1;
+    const uint8_t* data = nullptr;
+    size_t size = 0;
+    size_t block_count = 0;
+};
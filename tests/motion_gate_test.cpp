@@ -0,0 +1,128 @@
+// MotionGate decisions on still, changing and moving scenes, and the
+// contract in motion_gate.h: a skipped frame keeps the previous detections
+// for every consumer, so the safety rules go on firing on a person who
+// stands still in front of the robot.
+#include "detection.h"
+#include "motion_gate.h"
+#include "safety.h"
+
+#include <iostream>
+
+#define FRAME_WIDTH   640
+#define FRAME_HEIGHT  480
+
+
+static int failures = 0;
+
+#define EXPECT(condition) \
+    do { \
+        if (!(condition)) { \
+            std::cerr << __FILE__ << ":" << __LINE__ << ": expected " #condition << std::endl; \
+            failures++; \
+        } \
+    } while (0)
+
+
+// Textured enough that any change shows, and the same on every call.
+static cv::Mat scene(uint64_t seed = 1)
+{
+    cv::Mat frame(FRAME_HEIGHT, FRAME_WIDTH, CV_8UC3);
+    cv::RNG rng(seed);
+    rng.fill(frame, cv::RNG::UNIFORM, 0, 256);
+    return frame;
+}
+
+
+static void still_scene_skips_until_refresh()
+{
+    MotionGate gate;
+    cv::Mat frame = scene();
+    cv::Rect region;
+
+    EXPECT(gate.update(frame, region) == MOTION_FULL);
+    EXPECT(region == cv::Rect(0, 0, FRAME_WIDTH, FRAME_HEIGHT));
+    for (int i = 1; i < MOTION_REFRESH; i++)
+        EXPECT(gate.update(frame, region) == MOTION_SKIP);
+    EXPECT(gate.update(frame, region) == MOTION_FULL);
+
+    gate.reset();
+    EXPECT(gate.update(frame, region) == MOTION_FULL);
+}
+
+
+static void small_change_is_cropped()
+{
+    MotionGate gate;
+    cv::Mat frame = scene();
+    cv::Rect region;
+    gate.update(frame, region);
+
+    cv::Rect changed(520, 40, 40, 40);
+    cv::rectangle(frame, changed, cv::Scalar(255, 255, 255), cv::FILLED);
+    EXPECT(gate.update(frame, region) == MOTION_REGION);
+    EXPECT(region.width == region.height);
+    EXPECT(region.width >= MOTION_CROP_MIN);
+    EXPECT((region & changed) == changed);
+
+    // Taken into the reference: the same frame again is skipped.
+    EXPECT(gate.update(frame, region) == MOTION_SKIP);
+}
+
+
+static void moving_scene_is_inferred_whole()
+{
+    MotionGate gate;
+    cv::Rect region;
+    gate.update(scene(1), region);
+    EXPECT(gate.update(scene(2), region) == MOTION_FULL);
+    EXPECT(region == cv::Rect(0, 0, FRAME_WIDTH, FRAME_HEIGHT));
+}
+
+
+// The operator's detect_frames() with the network replaced by the person
+// it would find: a pass leaves them in detections, a skip leaves
+// detections alone. The default rule has to fire on every frame.
+static void skipped_frames_keep_safety()
+{
+    std::vector<SafetyRule> rules(1);
+    EXPECT(parse_safety_rule(SAFETY_RULE, rules[0]));
+
+    MotionGate gate;
+    cv::Mat frame = scene();
+    Detections detections;
+    std::vector<SafetyBox> boxes;
+    int skipped = 0;
+
+    for (int i = 0; i < 3 * MOTION_REFRESH; i++) {
+        cv::Rect region;
+        if (gate.update(frame, region) == MOTION_SKIP) {
+            skipped++;
+        } else {
+            detections.boxes.assign(1, cv::Rect(200, 200, 240, 280));
+            detections.confidences.assign(1, 0.9f);
+            detections.kept.assign(1, 0);
+        }
+
+        float area = 0;
+        safety_boxes(detections, frame.size(), boxes);
+        EXPECT(check_safety(rules, boxes, area) == 0);
+        EXPECT(area > 0.08f);
+    }
+    EXPECT(skipped > 2 * MOTION_REFRESH);
+}
+
+
+int main()
+{
+    still_scene_skips_until_refresh();
+    small_change_is_cropped();
+    moving_scene_is_inferred_whole();
+    skipped_frames_keep_safety();
+
+    if (failures > 0) {
+        std::cerr << failures << " check(s) failed" << std::endl;
+        return 1;
+    }
+    std::cout << "motion_gate_test: ok" << std::endl;
+    return 0;
+}
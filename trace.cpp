@@ -0,0 +1,127 @@
+#include "trace.h"
+
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <mutex>
+#include <vector>
+
+std::atomic<bool> trace_enabled(false);
+
+// A (ticks, ns) pair taken at startup; with a second one at export time it
+// gives the tick rate over the whole run.
+struct TraceClockPoint {
+    uint64_t ticks;
+    uint64_t ns;
+};
+
+static TraceClockPoint clock_point()
+{
+    TraceClockPoint p;
+    p.ticks = trace_ticks();
+    p.ns = trace_now();
+    return p;
+}
+
+static const TraceClockPoint clock_origin = clock_point();
+
+// Rings live as long as the process: threads come and go rarely, and an
+// exited thread's events still belong in the next export.
+static std::mutex rings_mutex;
+static std::vector<TraceRing*> rings;
+
+
+TraceRing* trace_register_thread()
+{
+    TraceRing* ring = new TraceRing;
+
+    std::lock_guard<std::mutex> lock(rings_mutex);
+    ring->tid = rings.size() + 1;
+    std::snprintf(ring->name, sizeof(ring->name), "thread %u", ring->tid);
+    rings.push_back(ring);
+
+    trace_thread_ring() = ring;
+    return ring;
+}
+
+
+void trace_thread_name(const char* name)
+{
+    TraceRing* ring = trace_thread_ring();
+    if (!ring) ring = trace_register_thread();
+
+    std::lock_guard<std::mutex> lock(rings_mutex);
+    std::snprintf(ring->name, sizeof(ring->name), "%s", name);
+}
+
+
+bool trace_export(const std::string& path, int pid, const char* process_name, int64_t clock_offset)
+{
+    FILE* out = std::fopen(path.c_str(), "w");
+    if (!out) {
+        std::cerr << "Cannot write trace " << path << std::endl;
+        return false;
+    }
+
+    std::lock_guard<std::mutex> lock(rings_mutex);
+
+    // Nanoseconds per tick. The generic timer states its frequency; the
+    // TSC is measured against the monotonic clock since startup.
+#if defined(__aarch64__)
+    uint64_t frequency;
+    asm volatile("mrs %0, cntfrq_el0" : "=r"(frequency));
+    double ns_per_tick = 1e9 / frequency;
+#elif defined(__x86_64__) || defined(__i386__)
+    TraceClockPoint now = clock_point();
+    while (now.ns - clock_origin.ns < 10000000)
+        now = clock_point();
+    double ns_per_tick = (double)(now.ns - clock_origin.ns) / (now.ticks - clock_origin.ticks);
+#else
+    double ns_per_tick = 1.0;
+#endif
+    auto to_ns = [&](uint64_t ticks) {
+        return (int64_t)clock_origin.ns + (int64_t)(((int64_t)(ticks - clock_origin.ticks)) * ns_per_tick);
+    };
+
+    std::fprintf(out, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n");
+    std::fprintf(out, "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":%d,\"tid\":0,\"args\":{\"name\":\"%s\"}}",
+                 pid, process_name);
+
+    size_t written = 0;
+    std::vector<TraceEvent> copy;
+
+    for (TraceRing* ring : rings) {
+        std::fprintf(out, ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%d,\"tid\":%u,\"args\":{\"name\":\"%s\"}}",
+                     pid, ring->tid, ring->name);
+
+        // Copy, then keep only what the writer cannot have overwritten
+        // while we were copying.
+        uint64_t head = ring->head.load(std::memory_order_acquire);
+        uint64_t from = head > TRACE_RING_SIZE ? head - TRACE_RING_SIZE : 0;
+        if (from < ring->exported) from = ring->exported;
+
+        copy.clear();
+        for (uint64_t i = from; i < head; i++)
+            copy.push_back(ring->events[i & (TRACE_RING_SIZE - 1)]);
+
+        uint64_t after = ring->head.load(std::memory_order_acquire);
+        uint64_t valid = after > TRACE_RING_SIZE ? after - TRACE_RING_SIZE : 0;
+
+        for (uint64_t i = from; i < head; i++) {
+            if (i < valid) continue;
+
+            const TraceEvent& e = copy[i - from];
+            double start = (to_ns(e.start) - clock_offset) / 1000.0;
+            std::fprintf(out, ",\n{\"name\":\"%s\",\"ph\":\"X\",\"pid\":%d,\"tid\":%u,\"ts\":%.3f,\"dur\":%.3f}",
+                         e.name, pid, ring->tid, start, e.duration * ns_per_tick / 1000.0);
+            written++;
+        }
+        ring->exported = head;
+    }
+
+    std::fprintf(out, "\n]}\n");
+    std::fclose(out);
+
+    std::cout << "Trace: " << written << " events written to " << path << std::endl;
+    return true;
+}
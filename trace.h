@@ -0,0 +1,128 @@
+// Low-overhead tracing shared by the operator client and the Raspberry Pi
+// server. Each thread records spans into its own ring buffer, so recording
+// takes no lock and never waits; an export writes what the rings hold as
+// Chrome trace JSON, which Perfetto (ui.perfetto.dev) and chrome://tracing
+// open directly.
+//
+// Tracing is switched at runtime with trace_enabled. While it is off a
+// span costs one relaxed load and a branch; while it is on, two reads of
+// the CPU tick counter and four stores, a few nanoseconds. Ticks are
+// converted to CLOCK_MONOTONIC nanoseconds only when exporting.
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+
+#include <time.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+#define TRACE_RING_SIZE  16384   // events kept per thread, power of two; the oldest are overwritten
+
+extern std::atomic<bool> trace_enabled;
+
+
+struct TraceEvent {
+    const char* name;            // string literal, never freed
+    uint64_t start;              // trace_ticks()
+    uint64_t duration;           // ticks
+};
+
+
+// Written only by its thread; the exporter reads it concurrently and drops
+// whatever the writer may have overwritten meanwhile.
+struct TraceRing {
+    uint32_t tid;
+    char name[32];
+    std::atomic<uint64_t> head{0};
+    uint64_t exported = 0;      // events before this index were already written out
+    TraceEvent events[TRACE_RING_SIZE];
+};
+
+
+TraceRing* trace_register_thread();
+
+inline TraceRing*& trace_thread_ring()
+{
+    static thread_local TraceRing* ring = nullptr;
+    return ring;
+}
+
+
+// CLOCK_MONOTONIC in ns: the clock both hosts' traces are aligned on.
+inline uint64_t trace_now()
+{
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+
+// Invariant TSC on the operator's PC, the generic timer on a 64-bit Pi;
+// elsewhere the monotonic clock itself.
+inline uint64_t trace_ticks()
+{
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#elif defined(__aarch64__)
+    uint64_t ticks;
+    asm volatile("mrs %0, cntvct_el0" : "=r"(ticks));
+    return ticks;
+#else
+    return trace_now();
+#endif
+}
+
+
+// Records a finished span; start and end may come from different threads
+// (a frame entering and leaving the encoder).
+inline void trace_record(const char* name, uint64_t start, uint64_t end)
+{
+    TraceRing* ring = trace_thread_ring();
+    if (!ring) ring = trace_register_thread();
+
+    uint64_t head = ring->head.load(std::memory_order_relaxed);
+    TraceEvent& e = ring->events[head & (TRACE_RING_SIZE - 1)];
+    e.name = name;
+    e.start = start;
+    e.duration = end - start;
+    ring->head.store(head + 1, std::memory_order_release);
+}
+
+
+// Names the calling thread in the exported trace.
+void trace_thread_name(const char* name);
+
+// Writes the events recorded since the previous export as Chrome trace
+// JSON. clock_offset (ns) is subtracted from every timestamp, to put a
+// peer's events on the reference host's clock.
+bool trace_export(const std::string& path, int pid, const char* process_name, int64_t clock_offset = 0);
+
+
+class TraceSpan {
+public:
+    explicit TraceSpan(const char* name)
+        : name(name), start(trace_enabled.load(std::memory_order_relaxed) ? trace_ticks() : 0) {}
+
+    ~TraceSpan()
+    {
+        if (start) trace_record(name, start, trace_ticks());
+    }
+
+    TraceSpan(const TraceSpan&) = delete;
+    TraceSpan& operator=(const TraceSpan&) = delete;
+
+private:
+    const char* name;
+    uint64_t start;
+};
+
+
+#define TRACE_CONCAT2(a, b) a##b
+#define TRACE_CONCAT(a, b)  TRACE_CONCAT2(a, b)
+
+// Times the enclosing scope: TRACE_SCOPE("update_frame");
+#define TRACE_SCOPE(name)   TraceSpan TRACE_CONCAT(trace_span_, __LINE__)(name)
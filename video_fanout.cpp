@@ -0,0 +1,256 @@
+#include "video_fanout.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <iostream>
+
+
+std::string video_encoder_pipeline(int bitrate_kbps, int key_interval)
+{
+    std::string key = key_interval > 0 ? "key-int-max=" + std::to_string(key_interval) + " " : "";
+    return "videoconvert ! x264enc name=encoder tune=zerolatency bitrate=" + std::to_string(bitrate_kbps) + " " + key +
+           "speed-preset=ultrafast ! "
+           "rtph264pay config-interval=1 pt=96";
+}
+
+
+std::string video_fanout_pipeline(int bitrate_kbps, int key_interval)
+{
+    return video_encoder_pipeline(bitrate_kbps, key_interval) + " ! "
+           "queue leaky=downstream max-size-buffers=0 max-size-bytes=0 max-size-time=200000000 ! "
+           "multiudpsink name=fanout sync=false async=false buffer-size=" + std::to_string(VIDEO_SEND_BUFFER);
+}
+
+
+bool KeyframeForcer::attach(GstElement* pipeline)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+
+    GstElement* encoder = gst_bin_get_by_name(GST_BIN(pipeline), "encoder");
+    if (!encoder) {
+        std::cerr << "No encoder element in the video pipeline." << std::endl;
+        return false;
+    }
+    pad = gst_element_get_static_pad(encoder, "src");
+    gst_object_unref(encoder);
+    return pad != nullptr;
+}
+
+
+void KeyframeForcer::detach()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    if (pad) {
+        gst_object_unref(pad);
+        pad = nullptr;
+    }
+    pending = false;
+}
+
+
+void KeyframeForcer::request()
+{
+    requests++;
+    std::lock_guard<std::mutex> lock(mutex);
+    auto now = std::chrono::steady_clock::now();
+    if (now - last >= std::chrono::milliseconds(VIDEO_KEYFRAME_GAP))
+        force(now);
+    else
+        pending = true;
+}
+
+
+void KeyframeForcer::poll()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    if (!pending)
+        return;
+    auto now = std::chrono::steady_clock::now();
+    if (now - last >= std::chrono::milliseconds(VIDEO_KEYFRAME_GAP))
+        force(now);
+}
+
+
+// The upstream GstForceKeyUnit event, as gst_video_event_new_upstream_force_key_unit()
+// builds it, without linking gstreamer-video for one function.
+void KeyframeForcer::force(std::chrono::steady_clock::time_point now)
+{
+    pending = false;
+    if (!pad)
+        return;
+
+    GstStructure* structure = gst_structure_new("GstForceKeyUnit", "running-time", G_TYPE_UINT64, GST_CLOCK_TIME_NONE,
+                                                "all-headers", G_TYPE_BOOLEAN, TRUE, "count", G_TYPE_UINT, 0, NULL);
+    if (gst_pad_send_event(pad, gst_event_new_custom(GST_EVENT_CUSTOM_UPSTREAM, structure))) {
+        forced++;
+        last = now;
+    }
+}
+
+
+bool VideoFanout::attach(GstElement* pipeline)
+{
+    keyframes.attach(pipeline);
+
+    std::lock_guard<std::mutex> lock(mutex);
+
+    sink = gst_bin_get_by_name(GST_BIN(pipeline), "fanout");
+    if (!sink) {
+        std::cerr << "No fanout element in the video pipeline." << std::endl;
+        return false;
+    }
+
+    for (const VideoSubscriber& subscriber : list)
+        emit("add", subscriber);
+    return true;
+}
+
+
+void VideoFanout::detach()
+{
+    keyframes.detach();
+    std::lock_guard<std::mutex> lock(mutex);
+    if (sink) {
+        gst_object_unref(sink);
+        sink = nullptr;
+    }
+}
+
+
+VideoSubscriber* VideoFanout::find(const std::string& host, int port)
+{
+    for (VideoSubscriber& subscriber : list)
+        if (subscriber.port == port && subscriber.host == host)
+            return &subscriber;
+    return nullptr;
+}
+
+
+void VideoFanout::emit(const char* signal, const VideoSubscriber& subscriber)
+{
+    if (sink)
+        g_signal_emit_by_name(sink, signal, subscriber.host.c_str(), subscriber.port);
+}
+
+
+void VideoFanout::join(const std::string& host, int port, bool permanent)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    auto now = std::chrono::steady_clock::now();
+
+    if (VideoSubscriber* subscriber = find(host, port)) {
+        subscriber->seen = now;
+        subscriber->permanent |= permanent;
+        return;
+    }
+
+    VideoSubscriber subscriber;
+    subscriber.host = host;
+    subscriber.port = port;
+    subscriber.permanent = permanent;
+    subscriber.joined = now;
+    subscriber.seen = now;
+    list.push_back(subscriber);
+    emit("add", subscriber);
+    keyframes.request();
+
+    std::cout << "Video subscriber joined: " << host << ":" << port << std::endl;
+}
+
+
+void VideoFanout::leave(const std::string& host, int port)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+
+    VideoSubscriber* subscriber = find(host, port);
+    if (!subscriber || subscriber->permanent)
+        return;
+
+    emit("remove", *subscriber);
+    list.erase(list.begin() + (subscriber - list.data()));
+    std::cout << "Video subscriber left: " << host << ":" << port << std::endl;
+}
+
+
+bool VideoFanout::control(const char* message, size_t size, const sockaddr_in& from)
+{
+    char text[64];
+    if (size < 2 || size >= sizeof(text) || message[0] != 'V')
+        return false;
+    std::copy(message, message + size, text);
+    text[size] = '\0';
+
+    char host[INET_ADDRSTRLEN];
+    inet_ntop(AF_INET, &from.sin_addr, host, sizeof(host));
+
+    int port = 0;
+    unsigned long long received = 0, lost = 0;
+    if (text[1] == 'J' && std::sscanf(text + 2, "%d %llu %llu", &port, &received, &lost) >= 1) {
+        if (port <= 0 || port > 65535)
+            return false;
+        join(host, port);
+
+        std::lock_guard<std::mutex> lock(mutex);
+        if (VideoSubscriber* subscriber = find(host, port)) {
+            subscriber->packets_received = received;
+            subscriber->packets_lost = lost;
+        }
+        return true;
+    }
+    if (text[1] == 'L' && std::sscanf(text + 2, "%d", &port) == 1) {
+        leave(host, port);
+        return true;
+    }
+    if (text[1] == 'K' && std::sscanf(text + 2, "%d", &port) == 1) {
+        keyframes.request();
+        return true;
+    }
+    return false;
+}
+
+
+void VideoFanout::expire()
+{
+    keyframes.poll();
+
+    std::lock_guard<std::mutex> lock(mutex);
+    auto now = std::chrono::steady_clock::now();
+    if (now - last_expire < std::chrono::seconds(1))
+        return;
+    last_expire = now;
+
+    for (size_t i = 0; i < list.size();) {
+        if (!list[i].permanent && now - list[i].seen > std::chrono::seconds(VIDEO_LEASE)) {
+            std::cout << "Video subscriber timed out: " << list[i].host << ":" << list[i].port << std::endl;
+            emit("remove", list[i]);
+            list.erase(list.begin() + i);
+        } else {
+            i++;
+        }
+    }
+}
+
+
+std::vector<VideoSubscriber> VideoFanout::subscribers()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+
+    std::vector<VideoSubscriber> copy = list;
+    if (!sink)
+        return copy;
+
+    for (VideoSubscriber& subscriber : copy) {
+        GstStructure* stats = nullptr;
+        g_signal_emit_by_name(sink, "get-stats", subscriber.host.c_str(), subscriber.port, &stats);
+        if (!stats)
+            continue;
+
+        guint64 value = 0;
+        if (gst_structure_get_uint64(stats, "packets-sent", &value))
+            subscriber.packets_sent = value;
+        if (gst_structure_get_uint64(stats, "bytes-sent", &value))
+            subscriber.bytes_sent = value;
+        gst_structure_free(stats);
+    }
+    return copy;
+}
@@ -0,0 +1,114 @@
+// Video fan-out on the Raspberry Pi: the camera is encoded once and the RTP
+// packets go to every subscriber through one multiudpsink. Viewers join and
+// leave over the command port; a join is a lease, renewed with each
+// heartbeat, so a viewer that vanishes without leaving is dropped.
+//
+// A slow or dead subscriber cannot hold the others back: UDP sends do not
+// wait for the receiver, and a leaky queue in front of the sink drops old
+// packets instead of stalling the encoder if the Pi's own socket backs up.
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include <arpa/inet.h>
+#include <gst/gst.h>
+
+#define VIDEO_LEASE        10               // seconds a subscriber stays without renewing its join
+#define VIDEO_SEND_BUFFER  (1024 * 1024)    // bytes of kernel send buffer for the fan-out socket
+#define VIDEO_KEYFRAME_GAP 500              // ms between forced key frames at least
+
+
+struct VideoSubscriber {
+    std::string host;
+    int port = 0;
+    bool permanent = false;                         // never expires (the configured operator)
+    std::chrono::steady_clock::time_point joined;
+    std::chrono::steady_clock::time_point seen;     // last join or renewal
+
+    uint64_t packets_sent = 0;                      // from multiudpsink
+    uint64_t bytes_sent = 0;
+    uint64_t packets_received = 0;                  // as the subscriber last reported
+    uint64_t packets_lost = 0;
+};
+
+
+// Raw frames to RTP H.264 as the operator expects it; the encoder is
+// named "encoder". key_interval caps the frames between key frames
+// (0: x264enc's default of 250, fine at 30 fps but not for a slow stream).
+std::string video_encoder_pipeline(int bitrate_kbps, int key_interval = 0);
+
+// Everything after the decoded camera frames: video_encoder_pipeline() and
+// the fan-out sink named "fanout".
+std::string video_fanout_pipeline(int bitrate_kbps, int key_interval = 0);
+
+
+// Key frames on request, so a viewer that joins or loses packets does not
+// wait out the encoder's key frame interval: the pipeline's "encoder" is
+// sent a force-key-unit event and makes its next frame an IDR frame.
+// Requests less than VIDEO_KEYFRAME_GAP after the last forced key frame are
+// held back and merged into one at the end of the gap, so any number of
+// viewers cost at most 1000 / VIDEO_KEYFRAME_GAP extra key frames a second.
+class KeyframeForcer {
+public:
+    bool attach(GstElement* pipeline);
+    void detach();
+
+    void request();
+
+    // Forces a held-back request once the gap is over; cheap to call often.
+    void poll();
+
+    std::atomic<uint64_t> requests{0};
+    std::atomic<uint64_t> forced{0};
+
+private:
+    void force(std::chrono::steady_clock::time_point now);
+
+    std::mutex mutex;
+    GstPad* pad = nullptr;                          // the encoder's src pad
+    bool pending = false;
+    std::chrono::steady_clock::time_point last;
+};
+
+
+class VideoFanout {
+public:
+    // Takes the pipeline's "fanout" sink and adds the subscribers that
+    // joined before the pipeline existed; the encoder goes to keyframes.
+    bool attach(GstElement* pipeline);
+    void detach();
+
+    void join(const std::string& host, int port, bool permanent = false);
+    void leave(const std::string& host, int port);
+
+    // A control datagram from the command port, host taken from the sender:
+    //   "VJ <port> [<received> <lost>]"  join, or renew and report stats
+    //   "VL <port>"                      leave
+    //   "VK <port>"                      key frame wanted, after loss or on join
+    // A new subscriber gets a key frame without asking. Returns false if
+    // it is not one.
+    bool control(const char* message, size_t size, const sockaddr_in& from);
+
+    // Drops subscribers whose lease ran out and sends held-back key frame
+    // requests; cheap to call often.
+    void expire();
+
+    // A copy with the sink's per-client counters filled in.
+    std::vector<VideoSubscriber> subscribers();
+
+    KeyframeForcer keyframes;
+
+private:
+    VideoSubscriber* find(const std::string& host, int port);
+    void emit(const char* signal, const VideoSubscriber& subscriber);
+
+    std::mutex mutex;
+    GstElement* sink = nullptr;
+    std::vector<VideoSubscriber> list;
+    std::chrono::steady_clock::time_point last_expire;
+};